@@ -11,10 +11,30 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <math.h>
 #include <stdbool.h>
 #include <getopt.h>
 #include "mpt_nn.h"
 #include "mpt_nn_utility.h"
+#include "mpt_nn_numa.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_server.h"
+#include "mpt_nn_distributed.h"
+#include "mpt_nn_conv.h"
+#include "mpt_nn_sparse.h"
+#include "mpt_nn_sweep.h"
+#include "mpt_nn_specialized.h"
+#include "mpt_nn_dataset.h"
+#include "mpt_nn_augment.h"
+#include "mpt_nn_ws.h"
+#include "mpt_nn_pipeline.h"
+#include "mpt_nn_dashboard.h"
+#include "mpt_nn_mixed.h"
+#include "mpt_nn_norm.h"
+#include "mpt_nn_cascade.h"
+#include "mpt_nn_distill.h"
+#include "mpt_nn_export.h"
 
 /**
  * @brief 
@@ -39,14 +59,69 @@ int main(int argc, char *argv[])
 
     double learningRate = 0.01;
     double dropoutRate = 0.0;
+    double pruneSparsity = 0.0;
 
+    const char *bindPolicy = NULL;
+    const char *places = "cores";
+    const char *modelPath = NULL;
+    const char *savePath = NULL;
+    const char *sweepSpec = NULL;
+    const char *cascadePath = NULL;
+    const char *exportPath = NULL;
+
+    struct data_parallel_config dataParallel = {0, DATA_PARALLEL_DEFAULT_BATCH, true, false};
+    struct conv_config conv = {0, 5, 2, DATA_PARALLEL_DEFAULT_BATCH, CONV_DIRECT};
+    struct server_config server = {NULL, SERVER_DEFAULT_MAX_BATCH, SERVER_DEFAULT_LATENCY_US, SERVER_DEFAULT_WORKERS, 5, false, NULL, CASCADE_DEFAULT_MARGIN};
 
     bool nProvided = false;
     bool dProvided = false;
+    bool pruneBlocks = false;
+    bool pruneReport = false;
+    bool useCache = true;
+    bool augment = false;
+    struct augment_config augmentConfig = {0};
+    bool workStealing = false;
+    struct ws_pool pool;
+    struct pipeline_config pipeline = {0, 1};
+    struct mixed_config mixed = {PRECISION_FP64, DATA_PARALLEL_DEFAULT_BATCH, 1};
+    struct norm_config norm = {NORM_NONE, DATA_PARALLEL_DEFAULT_BATCH, 1};
+    struct distill_config distill = {NULL, DISTILL_DEFAULT_TEMPERATURE, DISTILL_DEFAULT_WEIGHT, true};
+
+    // Options without a short form
+    enum
+    {
+        OPT_MAX_BATCH = 256,
+        OPT_LATENCY_BUDGET,
+        OPT_WORKERS,
+        OPT_BATCH,
+        OPT_NO_OVERLAP,
+        OPT_KERNEL,
+        OPT_POOL,
+        OPT_CONV_ALGORITHM,
+        OPT_PRUNE,
+        OPT_PRUNE_BLOCKS,
+        OPT_PRUNE_REPORT,
+        OPT_SWEEP,
+        OPT_DETERMINISTIC,
+        OPT_NO_CACHE,
+        OPT_AUGMENT,
+        OPT_SCHEDULER,
+        OPT_PIPELINE,
+        OPT_PRECISION,
+        OPT_NORM,
+        OPT_CASCADE,
+        OPT_MARGIN,
+        OPT_TEACHER,
+        OPT_TEMPERATURE,
+        OPT_DISTILL_WEIGHT,
+        OPT_EXPORT,
+    };
 
     struct option longopt[] =
         {
             {"help", no_argument, NULL, '?'},
+            {"bind", required_argument, NULL, 'b'},
+            {"conv", required_argument, NULL, 'c'},
             {"defaultParams", no_argument, NULL, 'D'},
             {"epochs", required_argument, NULL, 'e'},
             {"hidden", required_argument, NULL, 'h'},
@@ -55,12 +130,42 @@ int main(int argc, char *argv[])
             {"mode", required_argument, NULL, 'm'},
             {"dropOut", required_argument, NULL, 'd'},
             {"learning", required_argument, NULL, 'l'},
+            {"model", required_argument, NULL, 'M'},
             {"numThreads", required_argument, NULL, 'n'},
+            {"places", required_argument, NULL, 'p'},
+            {"processes", required_argument, NULL, 'P'},
+            {"save", required_argument, NULL, 's'},
+            {"serve", required_argument, NULL, 'S'},
             {"trainsets", required_argument, NULL, 't'},
             {"visualize", no_argument, NULL, 'v'},
+            {"max-batch", required_argument, NULL, OPT_MAX_BATCH},
+            {"latency-budget", required_argument, NULL, OPT_LATENCY_BUDGET},
+            {"workers", required_argument, NULL, OPT_WORKERS},
+            {"batch", required_argument, NULL, OPT_BATCH},
+            {"no-overlap", no_argument, NULL, OPT_NO_OVERLAP},
+            {"kernel", required_argument, NULL, OPT_KERNEL},
+            {"pool", required_argument, NULL, OPT_POOL},
+            {"conv-algorithm", required_argument, NULL, OPT_CONV_ALGORITHM},
+            {"prune", required_argument, NULL, OPT_PRUNE},
+            {"prune-blocks", no_argument, NULL, OPT_PRUNE_BLOCKS},
+            {"prune-report", no_argument, NULL, OPT_PRUNE_REPORT},
+            {"sweep", required_argument, NULL, OPT_SWEEP},
+            {"deterministic", no_argument, NULL, OPT_DETERMINISTIC},
+            {"no-cache", no_argument, NULL, OPT_NO_CACHE},
+            {"augment", required_argument, NULL, OPT_AUGMENT},
+            {"scheduler", required_argument, NULL, OPT_SCHEDULER},
+            {"pipeline", required_argument, NULL, OPT_PIPELINE},
+            {"precision", required_argument, NULL, OPT_PRECISION},
+            {"norm", required_argument, NULL, OPT_NORM},
+            {"cascade", required_argument, NULL, OPT_CASCADE},
+            {"margin", required_argument, NULL, OPT_MARGIN},
+            {"teacher", required_argument, NULL, OPT_TEACHER},
+            {"temperature", required_argument, NULL, OPT_TEMPERATURE},
+            {"distill-weight", required_argument, NULL, OPT_DISTILL_WEIGHT},
+            {"export", required_argument, NULL, OPT_EXPORT},
             {0, 0, 0, 0}};
 
-    const char *optstring = "Dd:e:h:i:l:m:n:o:t:v";
+    const char *optstring = "b:c:Dd:e:h:i:l:M:m:n:o:P:p:S:s:t:v";
 
     opterr = 0;
 
@@ -68,6 +173,12 @@ int main(int argc, char *argv[])
     {
         switch (opt)
         {
+        case 'b':
+            bindPolicy = optarg;
+            break;
+        case 'c':
+            conv.numFilters = atoi(optarg);
+            break;
         case 'D':
             mode = 1;
             numTrainingSets = 10000;
@@ -117,6 +228,162 @@ int main(int argc, char *argv[])
             numThreads = atoi(optarg);
             nProvided = true;
             break;
+        case 'p':
+            places = optarg;
+            break;
+        case 'P':
+            dataParallel.numProcesses = atoi(optarg);
+            break;
+        case 'M':
+            modelPath = optarg;
+            break;
+        case 's':
+            savePath = optarg;
+            break;
+        case 'S':
+            server.address = optarg;
+            break;
+        case OPT_MAX_BATCH:
+            server.maxBatch = atoi(optarg);
+            break;
+        case OPT_LATENCY_BUDGET:
+            server.latencyBudgetUs = atoi(optarg);
+            break;
+        case OPT_WORKERS:
+            server.numWorkers = atoi(optarg);
+            break;
+        case OPT_BATCH:
+            dataParallel.batchSize = atoi(optarg);
+            conv.batchSize = dataParallel.batchSize;
+            break;
+        case OPT_KERNEL:
+            conv.kernelSize = atoi(optarg);
+            break;
+        case OPT_POOL:
+            conv.poolSize = atoi(optarg);
+            break;
+        case OPT_CONV_ALGORITHM:
+            if (strcmp(optarg, "im2col") == 0)
+            {
+                conv.algorithm = CONV_IM2COL;
+            }
+            else if (strcmp(optarg, "direct") == 0)
+            {
+                conv.algorithm = CONV_DIRECT;
+            }
+            else
+            {
+                printf("\033[1;31mUnknown convolution algorithm %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_PRUNE:
+            pruneSparsity = atof(optarg);
+            if (pruneSparsity < 0.0 || pruneSparsity >= 1.0)
+            {
+                printf("\033[1;31mThe pruning sparsity has to be between 0.0 and 1.0.\033[0m\n");
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_PRUNE_BLOCKS:
+            pruneBlocks = true;
+            break;
+        case OPT_PRUNE_REPORT:
+            pruneReport = true;
+            break;
+        case OPT_SWEEP:
+            sweepSpec = optarg;
+            break;
+        case OPT_DETERMINISTIC:
+            set_deterministic(true);
+            break;
+        case OPT_NO_CACHE:
+            useCache = false;
+            break;
+        case OPT_AUGMENT:
+            if (parse_augment(optarg, &augmentConfig) != 0)
+            {
+                printf("\033[1;31mInvalid augmentation %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            augment = true;
+            break;
+        case OPT_SCHEDULER:
+            if (strcmp(optarg, "ws") != 0 && strcmp(optarg, "omp") != 0)
+            {
+                printf("\033[1;31mInvalid scheduler %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            workStealing = strcmp(optarg, "ws") == 0;
+            break;
+        case OPT_PIPELINE:
+            pipeline.microBatch = atoi(optarg);
+            if (pipeline.microBatch <= 0)
+            {
+                printf("\033[1;31mInvalid micro-batch size %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_PRECISION:
+            if (parse_precision(optarg, &mixed.precision) != 0)
+            {
+                printf("\033[1;31mInvalid precision %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_NORM:
+            if (parse_normalization(optarg, &norm.normalization) != 0)
+            {
+                printf("\033[1;31mInvalid normalization %s.\033[0m\n", optarg);
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_CASCADE:
+            cascadePath = optarg;
+            break;
+        case OPT_MARGIN:
+            server.margin = atof(optarg);
+            if (server.margin < 0.0)
+            {
+                printf("\033[1;31mThe cascade margin has to be at least 0.0.\033[0m\n");
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_TEACHER:
+            distill.teacherPath = optarg;
+            break;
+        case OPT_TEMPERATURE:
+            distill.temperature = atof(optarg);
+            if (distill.temperature <= 0.0)
+            {
+                printf("\033[1;31mThe distillation temperature has to be positive.\033[0m\n");
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_DISTILL_WEIGHT:
+            distill.weight = atof(optarg);
+            if (distill.weight < 0.0 || distill.weight > 1.0)
+            {
+                printf("\033[1;31mThe distillation weight has to be between 0.0 and 1.0.\033[0m\n");
+                print_options();
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case OPT_EXPORT:
+            exportPath = optarg;
+            break;
+        case OPT_NO_OVERLAP:
+            dataParallel.overlap = false;
+            break;
         case 'm':
             mode = atoi(optarg);
             counter++;
@@ -140,6 +407,149 @@ int main(int argc, char *argv[])
         }
     }
 
+    // The work-stealing pool has as many workers as OpenMP threads, the calling thread is one of them
+    if (workStealing)
+    {
+        ws_pool_create(&pool, nProvided ? numThreads : omp_get_max_threads());
+        set_scheduler_pool(&pool);
+    }
+
+    // The model file has no normalization layer, only batch norm can be folded into the weights
+    if (norm.normalization == NORM_LAYER && (savePath != NULL || exportPath != NULL))
+    {
+        printf("\033[1;31m--norm layer cannot be saved (-s) or exported (--export), the model format has no normalization layer.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The convolutional network keeps its trained weights in its own arena, the model format only holds the dense layers
+    if (conv.numFilters > 0 && (savePath != NULL || exportPath != NULL))
+    {
+        printf("\033[1;31m-c cannot be saved (-s) or exported (--export), the model format has no convolution layer.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Only the per-sample loop prunes gradually and the data-parallel training prunes once at the end
+    if (pruneSparsity > 0.0 && (pipeline.microBatch > 0 || mixed.precision != PRECISION_FP64 || norm.normalization != NORM_NONE ||
+                                sweepSpec != NULL || conv.numFilters > 0))
+    {
+        printf("\033[1;31m--prune cannot be combined with --pipeline, --precision, --norm, --sweep or -c.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The augmented batches are fed to the per-sample loop of the modes 1 to 3, the other trainings read the images directly
+    if (augment && (dataParallel.numProcesses > 0 || pipeline.microBatch > 0 || mixed.precision != PRECISION_FP64 ||
+                    norm.normalization != NORM_NONE || sweepSpec != NULL || conv.numFilters > 0))
+    {
+        printf("\033[1;31m--augment cannot be combined with -P, --pipeline, --precision, --norm, --sweep or -c.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The dashboard observes the per-sample loop of the modes 1 to 3, the other trainings report their own progress
+    if (visualize && (dataParallel.numProcesses > 0 || pipeline.microBatch > 0 || mixed.precision != PRECISION_FP64 ||
+                      norm.normalization != NORM_NONE || sweepSpec != NULL || conv.numFilters > 0))
+    {
+        printf("\033[1;31m-v cannot be combined with -P, --pipeline, --precision, --norm, --sweep or -c.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The student is trained by the per-sample loop of the modes 1 to 3, the other trainings take one-hot outputs.
+    // The soft targets are computed once on the original images, they do not belong to the augmented variants
+    if (distill.teacherPath != NULL && (dataParallel.numProcesses > 0 || pipeline.microBatch > 0 || mixed.precision != PRECISION_FP64 ||
+                                        norm.normalization != NORM_NONE || sweepSpec != NULL || conv.numFilters > 0 || augment))
+    {
+        printf("\033[1;31m--teacher cannot be combined with -P, --pipeline, --precision, --norm, --sweep, -c or --augment.\033[0m\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Serving a trained model needs none of the training parameters
+    if (server.address != NULL)
+    {
+        struct model model;
+        struct model small;
+        if (modelPath == NULL || server.maxBatch <= 0 || server.latencyBudgetUs < 0 || server.numWorkers <= 0)
+        {
+            printf("\033[1;31m--serve requires a model (-M) and positive --max-batch and --workers.\033[0m\n");
+            print_options();
+            exit(EXIT_FAILURE);
+        }
+        if (load_model(modelPath, &model) != 0)
+        {
+            printf("\033[1;31mCould not load the model %s.\033[0m\n", modelPath);
+            exit(EXIT_FAILURE);
+        }
+        if (cascadePath != NULL)
+        {
+            if (load_model(cascadePath, &small) != 0)
+            {
+                printf("\033[1;31mCould not load the cascade model %s.\033[0m\n", cascadePath);
+                free_model(&model);
+                exit(EXIT_FAILURE);
+            }
+            server.cascade = &small;
+        }
+        server.workStealing = workStealing;
+        int result = run_server(&server, &model);
+        free_model(&model);
+        if (cascadePath != NULL)
+        {
+            free_model(&small);
+        }
+        if (workStealing)
+        {
+            ws_pool_destroy(&pool);
+        }
+        exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // A saved model is exported without training, otherwise the trained model is exported at the end
+    if (exportPath != NULL && modelPath != NULL && cascadePath == NULL)
+    {
+        struct model model;
+        if (load_model(modelPath, &model) != 0)
+        {
+            printf("\033[1;31mCould not load the model %s.\033[0m\n", modelPath);
+            exit(EXIT_FAILURE);
+        }
+        int result = export_model_c(&model, exportPath, EXPORT_DEFAULT_PREFIX);
+        printf(result == 0 ? "Model %s exported to %s\n" : "Error exporting the model %s to %s\n", modelPath, exportPath);
+        free_model(&model);
+        exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Evaluating a cascade of two trained models needs the images, but none of the training parameters
+    if (cascadePath != NULL)
+    {
+        struct model full;
+        struct model small;
+        if (modelPath == NULL)
+        {
+            printf("\033[1;31m--cascade requires the full model (-M).\033[0m\n");
+            print_options();
+            exit(EXIT_FAILURE);
+        }
+        if (load_model(modelPath, &full) != 0 || load_model(cascadePath, &small) != 0)
+        {
+            printf("\033[1;31mCould not load the models %s and %s.\033[0m\n", modelPath, cascadePath);
+            exit(EXIT_FAILURE);
+        }
+
+        struct arena data;
+        arena_create(&data, arena_matrix_bytes(numTrainingSets, full.numInputs) + arena_matrix_bytes(numTrainingSets, full.numOutputs));
+        double **inputs = arena_alloc_matrix(&data, numTrainingSets, full.numInputs);
+        double **outputs = arena_alloc_matrix(&data, numTrainingSets, full.numOutputs);
+        load_mnist(inputs, outputs, numTrainingSets, full.numInputs, full.numOutputs);
+
+        int result = cascade_report(&small, &full, server.margin, inputs, outputs, numTrainingSets, "benchmarks/cascade_results.md");
+        if (result != 0)
+        {
+            printf("\033[1;31mThe models %s and %s do not have the same inputs and outputs.\033[0m\n", cascadePath, modelPath);
+        }
+        arena_destroy(&data);
+        free_model(&small);
+        free_model(&full);
+        exit(result == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     if (!dProvided && counter < 7)
     {
         printf("\033[1;31mMissing arguments. Please select -D for default parameters or set them yourself with the available options.\n");
@@ -180,6 +590,10 @@ int main(int argc, char *argv[])
         {
             printf("* %-25s %-29d *\n", "Number of Threads:", numThreads);
         }
+        if (bindPolicy != NULL)
+        {
+            printf("* %-25s %-12s %-16s *\n", "Thread binding:", bindPolicy, places);
+        }
         printf("***********************************************************\n\033[0m");
     }
 
@@ -188,181 +602,396 @@ int main(int argc, char *argv[])
         omp_set_num_threads(numThreads);
     }
 
-    double *hiddenLayer = malloc(numHiddenNodes * sizeof(double));
-    double *outputLayer = malloc(numOutputs * sizeof(double));
-    double *hiddenLayerBias = malloc(numHiddenNodes * sizeof(double));
-    double *outputLayerBias = malloc(numOutputs * sizeof(double));
-    double **hiddenWeights = malloc(numInputs * sizeof(double *));
-    double **outputWeights = malloc(numHiddenNodes * sizeof(double *));
-    double **training_inputs = malloc(numTrainingSets * sizeof(double *));
-    double **training_outputs = malloc(numTrainingSets * sizeof(double *));
-
-    for (int i = 0; i < numHiddenNodes; i++)
-        hiddenLayer[i] = 0.0;
-    for (int i = 0; i < numOutputs; i++)
-        outputLayer[i] = 0.0;
-    for (int i = 0; i < numHiddenNodes; i++)
-        hiddenLayerBias[i] = 0.0;
-    for (int i = 0; i < numOutputs; i++)
-        outputLayerBias[i] = 0.0;
-
-    for (int i = 0; i < numInputs; i++)
+    if (bindPolicy != NULL)
     {
-        hiddenWeights[i] = malloc(numHiddenNodes * sizeof(double));
-        for (int j = 0; j < numHiddenNodes; j++)
+        struct cpu_topology topology;
+        detect_topology(&topology);
+        if (bind_threads(&topology, bindPolicy, places) != 0)
         {
-            hiddenWeights[i][j] = 0.0;
+            printf("\033[1;31mInvalid thread binding --bind %s --places %s.\033[0m\n", bindPolicy, places);
+            print_options();
+            free_topology(&topology);
+            exit(EXIT_FAILURE);
         }
+        print_topology(&topology);
+        free_topology(&topology);
     }
-    for (int i = 0; i < numHiddenNodes; i++)
+
+    // A valid cache of the preprocessed training data is mapped instead of parsing the IDX files
+    struct dataset_cache cache = {NULL, 0, NULL, NULL};
+    bool cached = useCache && map_dataset_cache(MNIST_CACHE_PATH, MNIST_IMAGE_PATH, MNIST_LABEL_PATH, numTrainingSets,
+                                                numInputs, numOutputs, &cache) == 0;
+
+    // All parameters, errors, activations and training data live in one arena (one allocation, one free)
+    struct arena arena;
+    arena_create(&arena, 3 * arena_vector_bytes(numHiddenNodes, sizeof(double)) +
+                             3 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_matrix_bytes(numInputs, numHiddenNodes) +
+                             arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             (cached ? 2 * arena_vector_bytes(numTrainingSets, sizeof(double *))
+                                     : arena_matrix_bytes(numTrainingSets, numInputs) + arena_matrix_bytes(numTrainingSets, numOutputs)) +
+                             arena_vector_bytes(numInputs, sizeof(int)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)) +
+                             (distill.teacherPath != NULL ? arena_matrix_bytes(numTrainingSets, numOutputs) : 0));
+    printf("Arena: %.1f MiB (%s pages)\n", arena.size / (1024.0 * 1024.0), arena_pages_name(&arena));
+
+    double *hiddenLayer = arena_alloc_vector(&arena, numHiddenNodes);
+    double *outputLayer = arena_alloc_vector(&arena, numOutputs);
+    double *hiddenLayerBias = arena_alloc_vector(&arena, numHiddenNodes);
+    double *outputLayerBias = arena_alloc_vector(&arena, numOutputs);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    int *inputIndex = arena_alloc(&arena, numInputs * sizeof(int));
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double **training_inputs;
+    double **training_outputs;
+    if (cached)
     {
-        outputWeights[i] = malloc(numOutputs * sizeof(double));
-        for (int j = 0; j < numOutputs; j++)
-        {
-            outputWeights[i][j] = 0.0;
-        }
+        training_inputs = arena_alloc_rows(&arena, cache.inputs, numTrainingSets, numInputs);
+        training_outputs = arena_alloc_rows(&arena, cache.outputs, numTrainingSets, numOutputs);
+        printf("Training data mapped from %s\n", MNIST_CACHE_PATH);
     }
-    for (int i = 0; i < numTrainingSets; i++)
+    else
     {
-        training_inputs[i] = malloc(numInputs * sizeof(double));
-        for (int j = 0; j < numInputs; j++)
+        training_inputs = arena_alloc_matrix(&arena, numTrainingSets, numInputs);
+        training_outputs = arena_alloc_matrix(&arena, numTrainingSets, numOutputs);
+        load_mnist(training_inputs, training_outputs, numTrainingSets, numInputs, numOutputs);
+        if (useCache)
         {
-            training_inputs[i][j] = 0.0;
+            if (write_dataset_cache(MNIST_CACHE_PATH, MNIST_IMAGE_PATH, MNIST_LABEL_PATH, training_inputs, training_outputs,
+                                    numTrainingSets, numInputs, numOutputs) == 0)
+            {
+                printf("Training data cached in %s\n", MNIST_CACHE_PATH);
+            }
+            else
+            {
+                printf("Error writing the cache %s\n", MNIST_CACHE_PATH);
+            }
         }
     }
-    for (int i = 0; i < numTrainingSets; i++)
+
+    // A student is trained against a blend of the teacher outputs and the labels, the labels still measure the accuracy
+    double **targets = training_outputs;
+    if (distill.teacherPath != NULL)
     {
-        training_outputs[i] = malloc(numOutputs * sizeof(double));
-        for (int j = 0; j < numOutputs; j++)
+        distill.useCache = useCache;
+        targets = arena_alloc_matrix(&arena, numTrainingSets, numOutputs);
+        if (distill_targets(&distill, training_inputs, training_outputs, numTrainingSets, numInputs, numOutputs, targets) != 0)
         {
-            training_outputs[i][j] = 0.0;
+            printf("\033[1;31mInvalid distillation from the teacher %s.\033[0m\n", distill.teacherPath);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
         }
     }
 
-    load_mnist(training_inputs, training_outputs, numTrainingSets, numInputs, numOutputs);
-
     initialize_weights(hiddenWeights, numInputs, numHiddenNodes);
     initialize_weights(outputWeights, numHiddenNodes, numOutputs);
     initialize_bias(hiddenLayerBias, numHiddenNodes);
     initialize_bias(outputLayerBias, numOutputs);
 
-    for (int epoch = 0; epoch < epochs; epoch++)
+    if (dataParallel.numProcesses > 0)
     {
-        double totalLoss = 0.0;
-        int correctPredictions = 0;
-
-        for (int i = 0; i < numTrainingSets; i++)
+        // Every process trains on its own shard, the gradients are summed with a shared-memory ring all-reduce
+        struct model model = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        dataParallel.pin = bindPolicy != NULL;
+        printf("Data-parallel training: %d processes, mini-batch %d per process, %s\n", dataParallel.numProcesses, dataParallel.batchSize,
+               dataParallel.overlap ? "all-reduce overlapped with the next mini-batch" : "synchronous all-reduce");
+        if (train_data_parallel(&dataParallel, &model, training_inputs, training_outputs, numTrainingSets, epochs, learningRate, dropoutRate) != 0)
+        {
+            printf("\033[1;31mData-parallel training failed.\033[0m\n");
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+        if (pruneSparsity > 0.0)
         {
-            int expectedLabel = 0;
-            for (int j = 1; j < numOutputs; j++)
+            // One-shot pruning of the trained weights, the ranks cannot prune in lockstep between their mini-batches
+            if (pruneBlocks)
             {
-                if (training_outputs[i][j] > training_outputs[i][expectedLabel])
-                {
-                    expectedLabel = j;
-                }
+                prune_weight_blocks(hiddenWeights, numInputs, numHiddenNodes, pruneSparsity);
             }
-
-            if (visualize)
+            else
             {
-                printf("Training on image %d (Epoch %d) - Expected output: %d\n", i + 1, epoch + 1, expectedLabel);
-                visualize_mnist_digit(training_inputs[i], numInputs);
+                prune_weights(hiddenWeights, numInputs, numHiddenNodes, pruneSparsity);
             }
+            printf("Pruned hidden weights: %.2f%% zero\n", 100.0 * weight_sparsity(hiddenWeights, numInputs, numHiddenNodes));
+        }
+    }
+    else if (pipeline.microBatch > 0)
+    {
+        // The hidden and the output layer are trained by two stages on their own groups of threads
+        struct model model = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        pipeline.numThreads = nProvided ? numThreads : omp_get_max_threads();
+        train_pipeline(&pipeline, &model, training_inputs, training_outputs, numTrainingSets, epochs, learningRate, dropoutRate);
+    }
+    else if (mixed.precision != PRECISION_FP64)
+    {
+        // The products run on 16 bit copies of the weights, the updates go to a fp32 master copy
+        struct model model = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        mixed.batchSize = dataParallel.batchSize;
+        mixed.numThreads = nProvided ? numThreads : omp_get_max_threads();
+        if (train_mixed(&mixed, &model, training_inputs, training_outputs, numTrainingSets, epochs, learningRate, dropoutRate) != 0)
+        {
+            printf("\033[1;31mInvalid mixed-precision training (--precision %s --batch %d).\033[0m\n", precision_name(mixed.precision), mixed.batchSize);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (norm.normalization != NORM_NONE)
+    {
+        // The hidden sums are normalized before the sigmoid, batch norm is folded into the weights at the end
+        struct model model = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        norm.batchSize = dataParallel.batchSize;
+        norm.numThreads = nProvided ? numThreads : omp_get_max_threads();
+        if (train_normalized(&norm, &model, training_inputs, training_outputs, numTrainingSets, epochs, learningRate, dropoutRate) != 0)
+        {
+            printf("\033[1;31mInvalid normalized training (--norm %s --batch %d).\033[0m\n", normalization_name(norm.normalization), norm.batchSize);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (sweepSpec != NULL)
+    {
+        // All configurations are trained on the training data loaded above
+        struct sweep_config defaults = {numHiddenNodes, learningRate, dropoutRate};
+        struct sweep_config configs[SWEEP_MAX_CONFIGS];
+        int numConfigs = parse_sweep(sweepSpec, &defaults, configs, SWEEP_MAX_CONFIGS);
+        if (numConfigs <= 0 || train_sweep(configs, numConfigs, mode, training_inputs, training_outputs, numTrainingSets, numInputs,
+                                           numOutputs, epochs, dataParallel.batchSize, "benchmarks/sweep_results.md") != 0)
+        {
+            printf("\033[1;31mInvalid sweep %s (mode %d, --batch %d).\033[0m\n", sweepSpec, mode, dataParallel.batchSize);
+            print_options();
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (conv.numFilters > 0)
+    {
+        // The image is processed by a convolution and a max pooling before the dense layers
+        if (train_conv_network(&conv, training_inputs, training_outputs, numTrainingSets, numInputs, numHiddenNodes, numOutputs,
+                               epochs, learningRate, dropoutRate) != 0)
+        {
+            printf("\033[1;31mInvalid convolutional network for %d inputs (--conv %d --kernel %d --pool %d --batch %d).\033[0m\n",
+                   numInputs, conv.numFilters, conv.kernelSize, conv.poolSize, conv.batchSize);
+            arena_destroy(&arena);
+            exit(EXIT_FAILURE);
+        }
+    }
+    else
+    {
+        // The parallel mode runs on the work-stealing pool with --scheduler ws
+        forward_pass_kernel forwardParallel = workStealing ? forward_pass_ws : forward_pass_parallel;
+        backpropagation_kernel backwardParallel = workStealing ? backpropagation_ws : backpropagation_parallel;
+
+        // The SIMD mode uses the kernels generated for this shape, if there are any
+        forward_pass_kernel forwardSimd = forward_pass_simd;
+        backpropagation_kernel backwardSimd = backpropagation_simd;
+        const struct specialized_kernels *specialized = NULL;
+        if (mode == 3)
+        {
+            specialized = find_specialized_kernels(numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights);
+        }
+        if (specialized != NULL)
+        {
+            forwardSimd = specialized->forward;
+            backwardSimd = specialized->backward;
+            printf("Using kernels specialized for %d-%d-%d\n", numInputs, numHiddenNodes, numOutputs);
+        }
 
-            if (mode == 1)
-            {
-                forward_pass_sequential(training_inputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate);
-            }
-            else if (mode == 2)
-            {
-                forward_pass_parallel(training_inputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate);
-            }
-            else if (mode == 3)
+        // Every epoch trains on new random variants of the images, the next batch is augmented in the background
+        struct augmenter augmenter;
+        double **augmented = NULL;
+        if (augment)
+        {
+            augmentConfig.width = augmentConfig.height = (int)sqrt((double)numInputs);
+            if (augmentConfig.width * augmentConfig.height != numInputs)
             {
-                forward_pass_simd(training_inputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate);
+                printf("\033[1;31m--augment requires square images, %d inputs are not.\033[0m\n", numInputs);
+                arena_destroy(&arena);
+                exit(EXIT_FAILURE);
             }
+            augmenter_create(&augmenter, &augmentConfig, training_inputs, numTrainingSets, epochs,
+                             is_deterministic() ? DETERMINISTIC_SEED : (uint64_t)time(NULL), omp_get_max_threads());
+            printf("Augmentation: shift %g px, rotation %g deg, affine %g, elastic %g px\n", augmentConfig.shift,
+                   augmentConfig.rotate, augmentConfig.affine, augmentConfig.elastic);
+        }
 
-            double loss = 0.0;
-            for (int j = 0; j < numOutputs; j++)
-            {
-                loss += pow(training_outputs[i][j] - outputLayer[j], 2);
-            }
-            totalLoss += loss;
+        struct dashboard dashboard;
+        if (visualize)
+        {
+            dashboard_start(&dashboard, numInputs, numTrainingSets, epochs);
+        }
 
-            int predictedLabel = 0;
-            for (int j = 1; j < numOutputs; j++)
+        for (int epoch = 0; epoch < epochs; epoch++)
+        {
+            double totalLoss = 0.0;
+            int correctPredictions = 0;
+
+            for (int i = 0; i < numTrainingSets; i++)
             {
-                if (outputLayer[j] > outputLayer[predictedLabel])
+                double *sample = training_inputs[i];
+                if (augment)
                 {
-                    predictedLabel = j;
+                    if (i % AUGMENT_BATCH == 0)
+                    {
+                        augmented = augmenter_next(&augmenter, epoch, i);
+                    }
+                    sample = augmented[i % AUGMENT_BATCH];
                 }
-            }
-            int actualLabel = 0;
-            for (int j = 1; j < numOutputs; j++)
-            {
-                if (training_outputs[i][j] > training_outputs[i][actualLabel])
+
+                int numActiveInputs = build_input_index(sample, numInputs, inputIndex);
+
+                if (mode == 1)
                 {
-                    actualLabel = j;
+                    forward_pass_sequential(sample, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate, true, &mask);
+                }
+                else if (mode == 2)
+                {
+                    forwardParallel(sample, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate, true, &mask);
+                }
+                else if (mode == 3)
+                {
+                    forwardSimd(sample, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate, true, &mask);
                 }
-            }
-            if (predictedLabel == actualLabel)
-            {
-                correctPredictions++;
-            }
 
-            if (mode == 1)
-            {
-                backpropagation_sequential(training_inputs[i], training_outputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, learningRate, numInputs, numHiddenNodes, numOutputs, dropoutRate);
+                double loss = 0.0;
+                for (int j = 0; j < numOutputs; j++)
+                {
+                    loss += pow(training_outputs[i][j] - outputLayer[j], 2);
+                }
+                totalLoss += loss;
+
+                int predictedLabel = predict_label(outputLayer, numOutputs);
+                int actualLabel = 0;
+                for (int j = 1; j < numOutputs; j++)
+                {
+                    if (training_outputs[i][j] > training_outputs[i][actualLabel])
+                    {
+                        actualLabel = j;
+                    }
+                }
+                if (predictedLabel == actualLabel)
+                {
+                    correctPredictions++;
+                }
+
+                // The observer thread draws the dashboard, the loop only copies a sample when it asks for one
+                if (visualize && dashboard_wants_sample(&dashboard))
+                {
+                    dashboard_publish(&dashboard, epoch, i, sample, actualLabel, outputLayer, numOutputs, totalLoss / (i + 1), correctPredictions);
+                }
+
+                if (mode == 1)
+                {
+                    backpropagation_sequential(sample, inputIndex, numActiveInputs, targets[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, learningRate, numInputs, numHiddenNodes, numOutputs, &mask);
+                }
+                else if (mode == 2)
+                {
+                    backwardParallel(sample, inputIndex, numActiveInputs, targets[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, learningRate, numInputs, numHiddenNodes, numOutputs, &mask);
+                }
+                else if (mode == 3)
+                {
+                    backwardSimd(sample, inputIndex, numActiveInputs, targets[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, learningRate, numInputs, numHiddenNodes, numOutputs, &mask);
+                }
             }
-            else if (mode == 2)
+
+            double averageLoss = totalLoss / numTrainingSets;
+            double accuracy = (double)correctPredictions / numTrainingSets * 100.0;
+            if (visualize)
             {
-                backpropagation_parallel(training_inputs[i], training_outputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, learningRate, numInputs, numHiddenNodes, numOutputs, dropoutRate);
+                dashboard_publish_epoch(&dashboard, epoch, averageLoss, correctPredictions);
             }
-            else if (mode == 3)
+            printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%d/%d)\n", epoch + 1, epochs, averageLoss, accuracy, correctPredictions, numTrainingSets);
+        
+        	FILE *accuracyFile = fopen("benchmarks/accuracy_results.md", "a");
+    		if (accuracyFile != NULL) {
+        		 const char *modeString;
+       		 switch (mode) {
+           			 case 1: modeString = "sequential"; break;
+           			 case 2: modeString = "parallel"; break;
+            		 case 3: modeString = "SIMD"; break;
+            		 default: modeString = "unknown"; break;
+    		    	       }
+
+        	fprintf(accuracyFile, "Mode: %s | Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%d/%d)\n", modeString, epoch + 1, epochs, averageLoss, accuracy, correctPredictions, numTrainingSets);
+        	fclose(accuracyFile);
+    	}
+    	else {
+        		printf("Error opening file accuracy_results.md\n");
+    	     }
+
+            if (pruneSparsity > 0.0)
             {
-                backpropagation_simd(training_inputs[i], training_outputs[i], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, learningRate, numInputs, numHiddenNodes, numOutputs, dropoutRate);
+                // Gradual pruning: the pruned weights may grow back during the next epoch and are pruned again
+                double sparsity = pruning_schedule(pruneSparsity, epoch + 1, epochs);
+                if (pruneBlocks)
+                {
+                    prune_weight_blocks(hiddenWeights, numInputs, numHiddenNodes, sparsity);
+                }
+                else
+                {
+                    prune_weights(hiddenWeights, numInputs, numHiddenNodes, sparsity);
+                }
+                printf("Pruned hidden weights: %.2f%% zero\n", 100.0 * weight_sparsity(hiddenWeights, numInputs, numHiddenNodes));
             }
         }
 
-        double averageLoss = totalLoss / numTrainingSets;
-        double accuracy = (double)correctPredictions / numTrainingSets * 100.0;
-        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%d/%d)\n", epoch + 1, epochs, averageLoss, accuracy, correctPredictions, numTrainingSets);
-        
-    	FILE *accuracyFile = fopen("benchmarks/accuracy_results.md", "a");
-		if (accuracyFile != NULL) {
-    		 const char *modeString;
-   		 switch (mode) {
-       			 case 1: modeString = "sequential"; break;
-       			 case 2: modeString = "parallel"; break;
-        		 case 3: modeString = "SIMD"; break;
-        		 default: modeString = "unknown"; break;
-		    	       }
-
-    	fprintf(accuracyFile, "Mode: %s | Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%d/%d)\n", modeString, epoch + 1, epochs, averageLoss, accuracy, correctPredictions, numTrainingSets);
-    	fclose(accuracyFile);
-	}
-	else {
-    		printf("Error opening file accuracy_results.md\n");
-	     }
-}
+        if (visualize)
+        {
+            dashboard_stop(&dashboard);
+        }
+        if (augment)
+        {
+            printf("Augmentation: training waited %.2fs for augmented batches\n", augmenter.seconds);
+            augmenter_destroy(&augmenter);
+        }
+    }
+
+    if (pruneReport && conv.numFilters == 0 && sweepSpec == NULL)
+    {
+        struct model trained = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        pruning_report(&trained, training_inputs, training_outputs, numTrainingSets < 10000 ? numTrainingSets : 10000,
+                       "benchmarks/pruning_results.md");
+    }
+
+    if (savePath != NULL && sweepSpec == NULL)
+    {
+        struct model trained = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        if (save_model(savePath, &trained) != 0)
+        {
+            printf("Error saving the model to %s\n", savePath);
+        }
+        else
+        {
+            printf("Model saved to %s\n", savePath);
+        }
+    }
+
+    if (exportPath != NULL && sweepSpec == NULL)
+    {
+        struct model trained = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+        if (export_model_c(&trained, exportPath, EXPORT_DEFAULT_PREFIX) != 0)
+        {
+            printf("Error exporting the model to %s\n", exportPath);
+        }
+        else
+        {
+            printf("Model exported to %s\n", exportPath);
+        }
+    }
+
+    if (workStealing)
+    {
+        printf("Work-stealing scheduler: %d workers, %ld stolen tasks\n", pool.numWorkers, ws_pool_steals(&pool));
+        ws_pool_destroy(&pool);
+    }
 
-    free(hiddenLayer);
-    free(outputLayer);
-    free(hiddenLayerBias);
-    free(outputLayerBias);
-
-    for (int i = 0; i < numInputs; i++)
-        free(hiddenWeights[i]);
-    for (int i = 0; i < numHiddenNodes; i++)
-        free(outputWeights[i]);
-    for (int i = 0; i < numTrainingSets; i++)
-        free(training_inputs[i]);
-    for (int i = 0; i < numTrainingSets; i++)
-        free(training_outputs[i]);
-
-    free(hiddenWeights);
-    free(outputWeights);
-    free(training_inputs);
-    free(training_outputs);
+    arena_destroy(&arena);
+    unmap_dataset_cache(&cache);
 
     return 0;
 }
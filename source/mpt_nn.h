@@ -18,8 +18,13 @@
 #include <omp.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdbool.h>
 #include "mpt_nn.h"
 #include "mpt_nn_utility.h"
+
+struct dropout_mask;
+struct ws_pool;
+
 /**
  * @brief Defines the sigmoid activation function.
  *
@@ -42,12 +47,79 @@ double sigmoid(double x);
  */
 double dSigmoid(double x);
 
+/**
+ * @brief Signature of the forward pass kernels (forward_pass_sequential, forward_pass_parallel, forward_pass_ws, forward_pass_simd).
+ */
+typedef void (*forward_pass_kernel)(double[], const int[], int, double[], double[], double[], double[], double **, double **,
+                                    int, int, int, double, bool, struct dropout_mask *);
+
+/**
+ * @brief Signature of the backpropagation kernels (backpropagation_sequential, backpropagation_parallel, backpropagation_ws, backpropagation_simd).
+ */
+typedef void (*backpropagation_kernel)(double[], const int[], int, double[], double[], double[], double[], double[], double **, double **,
+                                       double[], double[], double, int, int, int, const struct dropout_mask *);
+
+/**
+ * @brief Number of partial sums of the fixed-order reductions of the deterministic mode.
+ */
+#define DETERMINISTIC_LANES 8
+
+/**
+ * @brief Seed of the random number generator in the deterministic mode.
+ */
+#define DETERMINISTIC_SEED 2024u
+
+/**
+ * @brief Enables or disables the deterministic mode.
+ *
+ * In the deterministic mode every dot product of the kernels is summed in DETERMINISTIC_LANES partial sums
+ * with a fixed assignment of the terms to the sums, which are then added in a fixed tree. The order does not depend
+ * on the number of threads or the vector width, so the sequential, parallel and SIMD kernels compute bitwise
+ * identical results. The random number generator is seeded with DETERMINISTIC_SEED instead of the time,
+ * so the initial weights and the dropout masks are the same in every run.
+ * Without it the kernels keep their fastest summation order, which the compiler may change when vectorizing.
+ *
+ * @param enabled true for fixed-order reductions.
+ */
+void set_deterministic(bool enabled);
+
+/**
+ * @brief Returns true if the deterministic mode is enabled.
+ */
+bool is_deterministic(void);
+
+/**
+ * @brief Sets the work-stealing pool of the _ws kernels (see mpt_nn_ws.h).
+ *
+ * Without a pool (NULL, the default) the _ws kernels run all their tasks on the calling thread.
+ *
+ * @param pool Pool of the --scheduler ws option or NULL.
+ */
+void set_scheduler_pool(struct ws_pool *pool);
+
+/**
+ * @brief Builds the list of nonzero inputs of a sample.
+ *
+ * About 80% of the MNIST pixels are exactly zero. The first layer only has to accumulate the weight rows
+ * of the nonzero inputs in the forward pass and only these rows change in the backpropagation,
+ * so the kernels iterate over this compact index list instead of all numInputs inputs.
+ *
+ * @param inputs Input data for the neural network.
+ * @param numInputs Number of input nodes.
+ * @param inputIndex Array of at least numInputs entries receiving the indices of the nonzero inputs.
+ * @return int Number of nonzero inputs.
+ */
+int build_input_index(const double inputs[], int numInputs, int inputIndex[]);
+
 /**
  * @brief Performs a forward pass through the neural network sequentially.
  *
  * Computes the output of the hidden and output layers based on the input data, weights and biases (without parallelisation)
+ * Only the weight rows of the nonzero inputs listed in inputIndex contribute to the hidden layer.
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
  * @param hiddenLayerBias Array containing the biases for the hidden layer.
@@ -58,19 +130,25 @@ double dSigmoid(double x);
  * @param numHiddenNodes Number of hidden layer nodes.
  * @param numOutputs Number of output nodes.
  * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param training true while training: a dropout mask is drawn and the kept neurons are scaled.
+ *                 false for inference: no random numbers are drawn and every neuron is kept unscaled.
+ * @param mask Dropout mask that is filled before the hidden layer is computed. Only the kept neurons are computed.
  */
-void forward_pass_sequential(double inputs[], double hiddenLayer[], double outputLayer[],
+void forward_pass_sequential(double inputs[], const int inputIndex[], int numActiveInputs, double hiddenLayer[], double outputLayer[],
                              double hiddenLayerBias[], double outputLayerBias[],
                              double **hiddenWeights, double **outputWeights,
-                             int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                             int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate, bool training, struct dropout_mask *mask);
 
 /**
  * @brief Performs a forward pass through the neural network using OpenMP for parallelization.
  *
  * Essentially the same as forward_pass_sequential but uses OpenMP for parallelisation.
  * Paralleizes the computation of the activations for hidden and outout layers
+ * in one parallel region: every thread owns a disjoint tile of the active hidden neurons and then of the outputs.
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
  * @param hiddenLayerBias Array containing the biases for the hidden layer.
@@ -81,19 +159,56 @@ void forward_pass_sequential(double inputs[], double hiddenLayer[], double outpu
  * @param numHiddenNodes Number of hidden layer nodes.
  * @param numOutputs Number of output nodes.
  * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param training true while training: a dropout mask is drawn and the kept neurons are scaled.
+ *                 false for inference: no random numbers are drawn and every neuron is kept unscaled.
+ * @param mask Dropout mask that is filled before the hidden layer is computed. Only the kept neurons are computed.
  */
-void forward_pass_parallel(double inputs[], double hiddenLayer[], double outputLayer[],
+void forward_pass_parallel(double inputs[], const int inputIndex[], int numActiveInputs, double hiddenLayer[], double outputLayer[],
                            double hiddenLayerBias[], double outputLayerBias[],
                            double **hiddenWeights, double **outputWeights,
-                           int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                           int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate, bool training, struct dropout_mask *mask);
+
+/**
+ * @brief Performs a forward pass through the neural network with the work-stealing scheduler.
+ *
+ * Computes the same results as forward_pass_parallel, but instead of one static tile per OpenMP thread
+ * the active hidden neurons are split into small tasks (and the outputs into one task per output),
+ * which the workers of the scheduler pool steal from each other. A thread that finishes its part early
+ * takes over the rest of a slower one, also across the layers and samples of other running loops.
+ *
+ * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
+ * @param hiddenLayer Array storing the activations of the hidden layer.
+ * @param outputLayer Array storing activations of the output layer.
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of hidden layer nodes.
+ * @param numOutputs Number of output nodes.
+ * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param training true while training: a dropout mask is drawn and the kept neurons are scaled.
+ *                 false for inference: no random numbers are drawn and every neuron is kept unscaled.
+ * @param mask Dropout mask that is filled before the hidden layer is computed. Only the kept neurons are computed.
+ */
+void forward_pass_ws(double inputs[], const int inputIndex[], int numActiveInputs, double hiddenLayer[], double outputLayer[],
+                     double hiddenLayerBias[], double outputLayerBias[],
+                     double **hiddenWeights, double **outputWeights,
+                     int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate, bool training, struct dropout_mask *mask);
 
 /**
  * @brief Performs a forward pass through the neural network using SIMD and OpenMP.
  *
  * Essentially the same as forward_pass_parallel but with furhter optimization utilizing SIMD(Single Instruction, Multiple Data) via OpenMP.
  * SIMD allows the CPU to perform the same operation on multiple data points
+ * Every thread owns a tile of whole cache lines of the hidden layer (and then of the outputs) and adds the weight rows
+ * of the nonzero inputs to it with contiguous SIMD loops.
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
  * @param hiddenLayerBias Array containing the biases for the hidden layer.
@@ -104,11 +219,63 @@ void forward_pass_parallel(double inputs[], double hiddenLayer[], double outputL
  * @param numHiddenNodes Number of hidden layer nodes.
  * @param numOutputs Number of output nodes.
  * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param training true while training: a dropout mask is drawn and the kept neurons are scaled.
+ *                 false for inference: no random numbers are drawn and every neuron is kept unscaled.
+ * @param mask Dropout mask that is filled before the hidden layer is computed. The hidden tile is summed densely and the
+ *             dropped neurons are set to zero, the output layer only reads the kept neurons.
  */
-void forward_pass_simd(double inputs[], double hiddenLayer[], double outputLayer[],
+void forward_pass_simd(double inputs[], const int inputIndex[], int numActiveInputs, double hiddenLayer[], double outputLayer[],
                        double hiddenLayerBias[], double outputLayerBias[],
                        double **hiddenWeights, double **outputWeights,
-                       int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                       int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate, bool training, struct dropout_mask *mask);
+
+/**
+ * @brief Performs an inference forward pass for a batch of samples.
+ *
+ * Used for serving: no dropout is applied. The kernel is weight-stationary, every weight row is loaded once
+ * per batch and applied to all samples of the batch, so the weights are streamed through the cache once
+ * per batch instead of once per sample. Zero inputs are skipped. Runs on the calling thread, so several
+ * batches can be computed concurrently by a pool of worker threads.
+ *
+ * @param inputs 2D array with the input data of every sample (batchSize x numInputs).
+ * @param batchSize Number of samples in the batch.
+ * @param hiddenLayer 2D array storing the activations of the hidden layer (batchSize x numHiddenNodes).
+ * @param outputLayer 2D array storing the activations of the output layer (batchSize x numOutputs).
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of hidden layer nodes.
+ * @param numOutputs Number of output nodes.
+ */
+void forward_pass_batch(double **inputs, int batchSize, double **hiddenLayer, double **outputLayer,
+                        double hiddenLayerBias[], double outputLayerBias[],
+                        double **hiddenWeights, double **outputWeights,
+                        int numInputs, int numHiddenNodes, int numOutputs);
+
+/**
+ * @brief Performs an inference forward pass for a batch of samples with the work-stealing scheduler.
+ *
+ * Computes the same results as forward_pass_batch. Every sample is a task, which spawns nested tasks
+ * for ranges of the neurons of its layers, so idle workers steal neurons of a sample as well as whole samples.
+ *
+ * @param inputs 2D array with the input data of every sample (batchSize x numInputs).
+ * @param batchSize Number of samples in the batch.
+ * @param hiddenLayer 2D array storing the activations of the hidden layer (batchSize x numHiddenNodes).
+ * @param outputLayer 2D array storing the activations of the output layer (batchSize x numOutputs).
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of hidden layer nodes.
+ * @param numOutputs Number of output nodes.
+ */
+void forward_pass_batch_ws(double **inputs, int batchSize, double **hiddenLayer, double **outputLayer,
+                           double hiddenLayerBias[], double outputLayerBias[],
+                           double **hiddenWeights, double **outputWeights,
+                           int numInputs, int numHiddenNodes, int numOutputs);
 
 /**
  * @brief Performs a backpropagation through the neural network sequentially.
@@ -120,6 +287,8 @@ void forward_pass_simd(double inputs[], double hiddenLayer[], double outputLayer
  *
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param target The target output data for the neural network.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
@@ -127,16 +296,19 @@ void forward_pass_simd(double inputs[], double hiddenLayer[], double outputLayer
  * @param outputLayerBias Array containing the biases for the output layer.
  * @param hiddenWeights 2D array containing the weights between input and hidden layers.
  * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param deltaOutput Workspace array storing the errors of the output layer.
+ * @param deltaHidden Workspace array storing the errors of the hidden layer.
  * @param lr Learning rate used for weight updates.
  * @param numInputs Number of input nodes.
  * @param numHiddenNodes Number of nodes in the hidden layer.
  * @param numOutputs Number of output nodes.
- * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param mask Dropout mask stored by the preceding forward pass. Errors only flow through the kept neurons
+ *             and are scaled like their activations; dropped neurons are skipped.
  */
-void backpropagation_sequential(double inputs[], double target[], double hiddenLayer[], double outputLayer[],
+void backpropagation_sequential(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
                                 double hiddenLayerBias[], double outputLayerBias[],
                                 double **hiddenWeights, double **outputWeights,
-                                double lr, int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                                double deltaOutput[], double deltaHidden[], double lr, int numInputs, int numHiddenNodes, int numOutputs, const struct dropout_mask *mask);
 
 /**
  * @brief Performs a backpropagation through the neural network using OpenMP for parallelization.
@@ -144,8 +316,12 @@ void backpropagation_sequential(double inputs[], double target[], double hiddenL
  * Essentially the same as backpropagation_sequential but now errors for the output layer are calculatet in parallel across multiple threads.
  * Hidden Layer errors are also calculated in parallel.
  * Final adjustments to weights and biases are distributed across multiple threads.
+ * Every thread owns disjoint tiles (outputs, rows of outputWeights of its hidden neurons, rows of hiddenWeights of its inputs),
+ * so no weight is written by two threads and no atomics are needed.
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param target The target output data for the neural network.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
@@ -153,16 +329,49 @@ void backpropagation_sequential(double inputs[], double target[], double hiddenL
  * @param outputLayerBias Array containing the biases for the output layer.
  * @param hiddenWeights 2D array containing the weights between input and hidden layers.
  * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param deltaOutput Workspace array storing the errors of the output layer.
+ * @param deltaHidden Workspace array storing the errors of the hidden layer.
  * @param lr Learning rate used for weight updates.
  * @param numInputs Number of input nodes.
  * @param numHiddenNodes Number of nodes in the hidden layer.
  * @param numOutputs Number of output nodes.
- * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param mask Dropout mask stored by the preceding forward pass. Errors only flow through the kept neurons
+ *             and are scaled like their activations; dropped neurons are skipped.
  */
-void backpropagation_parallel(double inputs[], double target[], double hiddenLayer[], double outputLayer[],
+void backpropagation_parallel(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
                               double hiddenLayerBias[], double outputLayerBias[],
                               double **hiddenWeights, double **outputWeights,
-                              double lr, int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                              double deltaOutput[], double deltaHidden[], double lr, int numInputs, int numHiddenNodes, int numOutputs, const struct dropout_mask *mask);
+
+/**
+ * @brief Performs a backpropagation through the neural network with the work-stealing scheduler.
+ *
+ * Computes the same results as backpropagation_parallel. The outputs, the active hidden neurons and the
+ * rows of hiddenWeights of the nonzero inputs are split into small tasks that are stolen between the workers
+ * of the scheduler pool.
+ *
+ * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
+ * @param target The target output data for the neural network.
+ * @param hiddenLayer Array storing the activations of the hidden layer.
+ * @param outputLayer Array storing activations of the output layer.
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param deltaOutput Workspace array storing the errors of the output layer.
+ * @param deltaHidden Workspace array storing the errors of the hidden layer.
+ * @param lr Learning rate used for weight updates.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of nodes in the hidden layer.
+ * @param numOutputs Number of output nodes.
+ * @param mask Dropout mask stored by the preceding forward pass.
+ */
+void backpropagation_ws(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
+                        double hiddenLayerBias[], double outputLayerBias[],
+                        double **hiddenWeights, double **outputWeights,
+                        double deltaOutput[], double deltaHidden[], double lr, int numInputs, int numHiddenNodes, int numOutputs, const struct dropout_mask *mask);
 
 /**
  * @brief Performs a backward pass (backpropagation) through the neural network using SIMD and OpenMP.
@@ -171,9 +380,12 @@ void backpropagation_parallel(double inputs[], double target[], double hiddenLay
  * Output layer errors are calculated in parallel across multiple threads and optimized usind SIMD.
  * Hidden layer errors are calculated in parallel across multiple threads and ptimized usind SIMD.
  * Weights and biases are updated in parrallel across multiple threads and optimized using SIMD.
+ * The errors of dropped neurons are set to zero, so the rows of hiddenWeights are updated with contiguous SIMD loops.
  *
  *
  * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
  * @param target The target output data for the neural network.
  * @param hiddenLayer Array storing the activations of the hidden layer.
  * @param outputLayer Array storing activations of the output layer.
@@ -181,15 +393,88 @@ void backpropagation_parallel(double inputs[], double target[], double hiddenLay
  * @param outputLayerBias Array containing the biases for the output layer.
  * @param hiddenWeights 2D array containing the weights between input and hidden layers.
  * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param deltaOutput Workspace array storing the errors of the output layer.
+ * @param deltaHidden Workspace array storing the errors of the hidden layer.
  * @param lr Learning rate used for weight updates.
  * @param numInputs Number of input nodes.
  * @param numHiddenNodes Number of nodes in the hidden layer.
  * @param numOutputs Number of output nodes.
- * @param dropout_rate Dropout rate for random neuron dropouts.
+ * @param mask Dropout mask stored by the preceding forward pass. Errors only flow through the kept neurons
+ *             and are scaled like their activations; dropped neurons are skipped.
  */
-void backpropagation_simd(double inputs[], double target[], double hiddenLayer[], double outputLayer[],
+void backpropagation_simd(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
                           double hiddenLayerBias[], double outputLayerBias[],
                           double **hiddenWeights, double **outputWeights,
-                          double lr, int numInputs, int numHiddenNodes, int numOutputs, double dropout_rate);
+                          double deltaOutput[], double deltaHidden[], double lr, int numInputs, int numHiddenNodes, int numOutputs, const struct dropout_mask *mask);
+
+/**
+ * @brief Number of doubles in a flat gradient vector of the network.
+ *
+ * Layout: hidden weights (numInputs x numHiddenNodes, row-major), hidden biases,
+ * output weights (numHiddenNodes x numOutputs, row-major), output biases.
+ */
+#define GRADIENT_SIZE(numInputs, numHiddenNodes, numOutputs) \
+    ((size_t)(numInputs) * (numHiddenNodes) + (numHiddenNodes) + (size_t)(numHiddenNodes) * (numOutputs) + (numOutputs))
+
+/**
+ * @brief Adds the gradient of one sample to a flat gradient vector.
+ *
+ * Computes the same errors as backpropagation_sequential but leaves the weights untouched:
+ * the update that backpropagation_sequential would apply (without the learning rate) is added to gradients.
+ * Used by the data-parallel training, where the gradients of a mini-batch are summed over all
+ * processes before they are applied with apply_gradients.
+ *
+ * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
+ * @param target The target output data for the neural network.
+ * @param hiddenLayer Array storing the activations of the hidden layer.
+ * @param outputLayer Array storing activations of the output layer.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param deltaOutput Workspace array storing the errors of the output layer.
+ * @param deltaHidden Workspace array storing the errors of the hidden layer.
+ * @param gradients Flat gradient vector (see GRADIENT_SIZE) the gradient is added to.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of nodes in the hidden layer.
+ * @param numOutputs Number of output nodes.
+ * @param mask Dropout mask stored by the preceding forward pass.
+ */
+void accumulate_gradients(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
+                          double **outputWeights, double deltaOutput[], double deltaHidden[], double gradients[],
+                          int numInputs, int numHiddenNodes, int numOutputs, const struct dropout_mask *mask);
+
+/**
+ * @brief Applies a flat gradient vector to the weights and biases.
+ *
+ * Every parameter is updated with parameter += scale * gradient.
+ *
+ * @param gradients Flat gradient vector (see GRADIENT_SIZE).
+ * @param scale Factor the gradients are multiplied with (learning rate / number of processes).
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of nodes in the hidden layer.
+ * @param numOutputs Number of output nodes.
+ */
+void apply_gradients(const double gradients[], double scale, double hiddenLayerBias[], double outputLayerBias[],
+                     double **hiddenWeights, double **outputWeights, int numInputs, int numHiddenNodes, int numOutputs);
+
+/**
+ * @brief Propagates the errors of the hidden layer back to the inputs of the network.
+ *
+ * Computes inputError[j] = sum over the kept hidden neurons i of deltaHidden[i] * hiddenWeights[j][i].
+ * Needed when the inputs are produced by preceding layers (e.g. the convolutional layers in mpt_nn_conv.h).
+ * Has to be called before the hidden weights are updated.
+ *
+ * @param deltaHidden Errors of the hidden layer (see accumulate_gradients).
+ * @param hiddenWeights 2D array containing the weights between input and hidden layers.
+ * @param mask Dropout mask of the sample, only the kept neurons contribute.
+ * @param numInputs Number of input nodes.
+ * @param inputError Array receiving the error of every input.
+ */
+void backpropagate_input_error(const double deltaHidden[], double **hiddenWeights, const struct dropout_mask *mask,
+                               int numInputs, double inputError[]);
 
 #endif // MPT_NN_H
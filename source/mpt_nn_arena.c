@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "mpt_nn_arena.h"
+
+/**
+ * @brief Rounds a size up to a multiple of an alignment.
+ *
+ * @param size Size in bytes.
+ * @param alignment Alignment (power of two).
+ * @return size_t The rounded size.
+ */
+static size_t align_up(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * @brief Returns the number of doubles between the starts of two rows of a matrix.
+ *
+ * @param cols Number of columns.
+ * @return size_t Row stride padded to ARENA_ALIGNMENT.
+ */
+static size_t row_stride(int cols)
+{
+    return ARENA_ROW_STRIDE((size_t)cols);
+}
+
+size_t arena_vector_bytes(size_t count, size_t elemSize)
+{
+    return align_up(count * elemSize, ARENA_ALIGNMENT);
+}
+
+size_t arena_matrix_bytes(int rows, int cols)
+{
+    return arena_vector_bytes(rows, sizeof(double *)) + (size_t)rows * row_stride(cols) * sizeof(double);
+}
+
+void arena_create(struct arena *arena, size_t size)
+{
+    void *base = MAP_FAILED;
+
+    arena->used = 0;
+    arena->size = align_up(size > 0 ? size : ARENA_ALIGNMENT, ARENA_HUGE_PAGE_SIZE);
+    arena->pages = ARENA_PAGES_DEFAULT;
+
+#ifdef MAP_HUGETLB
+    if (size >= ARENA_HUGE_PAGE_SIZE)
+    {
+        base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            arena->pages = ARENA_PAGES_HUGETLB;
+        }
+    }
+#endif
+
+    if (base == MAP_FAILED)
+    {
+        base = mmap(NULL, arena->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            fprintf(stderr, "Failed to allocate %zu bytes for the arena\n", arena->size);
+            exit(EXIT_FAILURE);
+        }
+#ifdef MADV_HUGEPAGE
+        if (size >= ARENA_HUGE_PAGE_SIZE && madvise(base, arena->size, MADV_HUGEPAGE) == 0)
+        {
+            arena->pages = ARENA_PAGES_TRANSPARENT;
+        }
+#endif
+    }
+
+    arena->base = base;
+}
+
+void *arena_alloc(struct arena *arena, size_t bytes)
+{
+    size_t offset = align_up(arena->used, ARENA_ALIGNMENT);
+
+    if (offset + bytes > arena->size)
+    {
+        fprintf(stderr, "Arena exhausted: %zu of %zu bytes used, %zu requested\n", arena->used, arena->size, bytes);
+        exit(EXIT_FAILURE);
+    }
+    arena->used = offset + bytes;
+    return arena->base + offset;
+}
+
+double *arena_alloc_vector(struct arena *arena, int size)
+{
+    double *vector = arena_alloc(arena, (size_t)size * sizeof(double));
+
+    for (int i = 0; i < size; i++)
+    {
+        vector[i] = 0.0;
+    }
+    return vector;
+}
+
+double **arena_alloc_matrix(struct arena *arena, int rows, int cols)
+{
+    size_t stride = row_stride(cols);
+    double **matrix = arena_alloc(arena, (size_t)rows * sizeof(double *));
+    double *data = arena_alloc(arena, (size_t)rows * stride * sizeof(double));
+
+    for (int i = 0; i < rows; i++)
+    {
+        matrix[i] = data + (size_t)i * stride;
+        for (size_t j = 0; j < stride; j++)
+        {
+            matrix[i][j] = 0.0;
+        }
+    }
+    return matrix;
+}
+
+double **arena_alloc_rows(struct arena *arena, double *data, int rows, int cols)
+{
+    size_t stride = row_stride(cols);
+    double **matrix = arena_alloc(arena, (size_t)rows * sizeof(double *));
+
+    for (int i = 0; i < rows; i++)
+    {
+        matrix[i] = data + (size_t)i * stride;
+    }
+    return matrix;
+}
+
+void arena_destroy(struct arena *arena)
+{
+    if (arena->base != NULL)
+    {
+        munmap(arena->base, arena->size);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+const char *arena_pages_name(const struct arena *arena)
+{
+    switch (arena->pages)
+    {
+    case ARENA_PAGES_HUGETLB:
+        return "hugetlb";
+    case ARENA_PAGES_TRANSPARENT:
+        return "thp";
+    default:
+        return "default";
+    }
+}
@@ -0,0 +1,153 @@
+/**
+ * @file mpt_nn_arena.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the arena allocator that owns all buffers of the mpt_nn.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for a simple bump allocator.
+ * All parameters, gradients, activations and training data of the mpt_nn are carved
+ * out of one mapping that is backed by huge pages where the system provides them.
+ * Setting up the network takes a single allocation and tearing it down a single free.
+ */
+#ifndef MPT_NN_ARENA_H
+#define MPT_NN_ARENA_H
+
+#include <stddef.h>
+
+/**
+ * @brief Alignment of every allocation in the arena (one cache line).
+ */
+#define ARENA_ALIGNMENT 64
+
+/**
+ * @brief Number of doubles between the starts of two rows of a matrix allocated with arena_alloc_matrix.
+ *
+ * Rows are padded to ARENA_ALIGNMENT. Compile-time constant for constant column counts.
+ */
+#define ARENA_ROW_STRIDE(cols) (((cols) * sizeof(double) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT / sizeof(double))
+
+/**
+ * @brief Size of the huge pages requested for large arenas.
+ */
+#define ARENA_HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+/**
+ * @brief Kind of pages backing an arena.
+ */
+enum arena_pages
+{
+    ARENA_PAGES_DEFAULT,       /**< Regular pages. */
+    ARENA_PAGES_TRANSPARENT,   /**< Regular mapping advised for transparent huge pages. */
+    ARENA_PAGES_HUGETLB        /**< Explicit huge pages (MAP_HUGETLB). */
+};
+
+/**
+ * @brief A bump allocator over one anonymous mapping.
+ */
+struct arena
+{
+    char *base;             /**< Start of the mapping. */
+    size_t size;            /**< Size of the mapping in bytes. */
+    size_t used;            /**< Bytes handed out so far. */
+    enum arena_pages pages; /**< Kind of pages backing the mapping. */
+};
+
+/**
+ * @brief Returns the number of bytes an arena needs for a vector.
+ *
+ * @param count Number of elements.
+ * @param elemSize Size of one element in bytes.
+ * @return size_t Bytes including the alignment padding.
+ */
+size_t arena_vector_bytes(size_t count, size_t elemSize);
+
+/**
+ * @brief Returns the number of bytes an arena needs for a matrix of doubles.
+ *
+ * Includes the row pointers and the padding that aligns every row to ARENA_ALIGNMENT.
+ *
+ * @param rows Number of rows.
+ * @param cols Number of columns.
+ * @return size_t Bytes including the alignment padding.
+ */
+size_t arena_matrix_bytes(int rows, int cols);
+
+/**
+ * @brief Creates an arena with the given capacity.
+ *
+ * Arenas of at least ARENA_HUGE_PAGE_SIZE first try explicit huge pages (MAP_HUGETLB)
+ * and fall back to a regular mapping advised for transparent huge pages (MADV_HUGEPAGE).
+ * The pages are not touched, so they are placed on the NUMA node of the thread that first writes them.
+ * Exits the program if no memory is available.
+ *
+ * @param arena Arena to initialize.
+ * @param size Capacity in bytes.
+ */
+void arena_create(struct arena *arena, size_t size);
+
+/**
+ * @brief Allocates memory from the arena.
+ *
+ * The memory is aligned to ARENA_ALIGNMENT and is not initialized.
+ * Exits the program if the capacity of the arena is exceeded.
+ *
+ * @param arena Arena to allocate from.
+ * @param bytes Number of bytes.
+ * @return void* Pointer to the allocated memory.
+ */
+void *arena_alloc(struct arena *arena, size_t bytes);
+
+/**
+ * @brief Allocates a zero-initialized vector of doubles from the arena.
+ *
+ * @param arena Arena to allocate from.
+ * @param size Number of elements.
+ * @return double* Pointer to the vector.
+ */
+double *arena_alloc_vector(struct arena *arena, int size);
+
+/**
+ * @brief Allocates a zero-initialized matrix of doubles from the arena.
+ *
+ * The rows are stored contiguously, every row starts on a cache line and the row pointers point into the block.
+ *
+ * @param arena Arena to allocate from.
+ * @param rows Number of rows.
+ * @param cols Number of columns.
+ * @return double** Pointer to the row pointers of the matrix.
+ */
+double **arena_alloc_matrix(struct arena *arena, int rows, int cols);
+
+/**
+ * @brief Allocates the row pointers of a matrix whose rows are already stored elsewhere.
+ *
+ * The rows have to be stored contiguously with the stride ARENA_ROW_STRIDE(cols), like the rows of arena_alloc_matrix.
+ * Needs arena_vector_bytes(rows, sizeof(double *)) bytes of the arena.
+ *
+ * @param arena Arena to allocate the row pointers from.
+ * @param data First row of the matrix.
+ * @param rows Number of rows.
+ * @param cols Number of columns.
+ * @return double** Pointer to the row pointers of the matrix.
+ */
+double **arena_alloc_rows(struct arena *arena, double *data, int rows, int cols);
+
+/**
+ * @brief Releases the arena and every buffer allocated from it.
+ *
+ * @param arena Arena to destroy.
+ */
+void arena_destroy(struct arena *arena);
+
+/**
+ * @brief Returns a readable name for the pages backing an arena.
+ *
+ * @param arena Arena.
+ * @return const char* "hugetlb", "thp" or "default".
+ */
+const char *arena_pages_name(const struct arena *arena);
+
+#endif // MPT_NN_ARENA_H
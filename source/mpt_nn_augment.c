@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+#include "mpt_nn_augment.h"
+#include "mpt_nn_numa.h"
+
+int parse_augment(const char *spec, struct augment_config *config)
+{
+    struct augment_config parsed = *config;
+    const char *p = spec;
+
+    parsed.shift = parsed.rotate = parsed.affine = parsed.elastic = 0.0;
+    while (*p != '\0')
+    {
+        char *end;
+        if (p[1] != '=')
+        {
+            return -1;
+        }
+        double value = strtod(p + 2, &end);
+        if (end == p + 2 || (*end != ',' && *end != '\0') || value < 0.0)
+        {
+            return -1;
+        }
+        switch (*p)
+        {
+        case 's':
+            parsed.shift = value;
+            break;
+        case 'r':
+            parsed.rotate = value;
+            break;
+        case 'a':
+            parsed.affine = value;
+            break;
+        case 'e':
+            parsed.elastic = value;
+            break;
+        default:
+            return -1;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    *config = parsed;
+    return 0;
+}
+
+/**
+ * @brief Returns the next number of a splitmix64 generator.
+ */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @brief Returns a uniformly distributed number in [-limit, limit].
+ */
+static double uniform(uint64_t *state, double limit)
+{
+    return ((next_random(state) >> 11) * (1.0 / 9007199254740992.0) * 2.0 - 1.0) * limit;
+}
+
+/**
+ * @brief Clamps an index to [0, size - 1].
+ */
+static inline int clamp_index(int i, int size)
+{
+    return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+/**
+ * @brief Hat function of the linear interpolation: 1 at 0, falling to 0 at -1 and 1 (vectorizes unlike fmax).
+ */
+static inline double hat(double t)
+{
+    double w = 1.0 - fabs(t);
+    return w > 0.0 ? w : 0.0;
+}
+
+void augment_image(const struct augment_config *config, const double *src, double *dst, uint64_t seed)
+{
+    int width = config->width, height = config->height;
+    double cx = (width - 1) / 2.0, cy = (height - 1) / 2.0;
+    double gridX[AUGMENT_GRID * AUGMENT_GRID], gridY[AUGMENT_GRID * AUGMENT_GRID];
+    uint64_t state = seed;
+
+    // Inverse mapping around the center: rotation, scaling and shear, then the shift
+    double angle = uniform(&state, config->rotate) * M_PI / 180.0;
+    double scaleX = 1.0 + uniform(&state, config->affine), scaleY = 1.0 + uniform(&state, config->affine);
+    double shear = uniform(&state, config->affine);
+    double m00 = cos(angle) * scaleX, m01 = -sin(angle) * scaleY + shear;
+    double m10 = sin(angle) * scaleX, m11 = cos(angle) * scaleY;
+    double dx = uniform(&state, config->shift), dy = uniform(&state, config->shift);
+
+    // The elastic distortion is a smooth displacement field, interpolated between random control points
+    for (int g = 0; g < AUGMENT_GRID * AUGMENT_GRID; g++)
+    {
+        gridX[g] = uniform(&state, config->elastic);
+        gridY[g] = uniform(&state, config->elastic);
+    }
+    double toGridX = (AUGMENT_GRID - 1) / (double)(width > 1 ? width - 1 : 1);
+    double toGridY = (AUGMENT_GRID - 1) / (double)(height > 1 ? height - 1 : 1);
+
+    for (int y = 0; y < height; y++)
+    {
+        double v = y - cy;
+        double gy = y * toGridY;
+        double rowX[AUGMENT_GRID], rowY[AUGMENT_GRID];
+
+        // Displacements of the control points interpolated to this row
+        for (int gx = 0; gx < AUGMENT_GRID; gx++)
+        {
+            rowX[gx] = rowY[gx] = 0.0;
+            for (int g = 0; g < AUGMENT_GRID; g++)
+            {
+                double w = hat(gy - g);
+                rowX[gx] += w * gridX[g * AUGMENT_GRID + gx];
+                rowY[gx] += w * gridY[g * AUGMENT_GRID + gx];
+            }
+        }
+
+#pragma omp simd
+        for (int x = 0; x < width; x++)
+        {
+            double u = x - cx;
+            double gx = x * toGridX;
+
+            // Linear interpolation between the control points as a sum of hat functions (no gather)
+            double ex = 0.0, ey = 0.0;
+            for (int g = 0; g < AUGMENT_GRID; g++)
+            {
+                double w = hat(gx - g);
+                ex += w * rowX[g];
+                ey += w * rowY[g];
+            }
+
+            double sx = cx + m00 * u + m01 * v + dx + ex;
+            double sy = cy + m10 * u + m11 * v + dy + ey;
+
+            // Bilinear sampling, neighbors outside of the image get the weight 0 and a clamped index
+            double fx = floor(sx), fy = floor(sy);
+            int x0 = (int)fx, y0 = (int)fy;
+            double ax = sx - fx, ay = sy - fy;
+            double wx0 = (x0 >= 0 && x0 < width) ? 1.0 - ax : 0.0;
+            double wx1 = (x0 + 1 >= 0 && x0 + 1 < width) ? ax : 0.0;
+            double wy0 = (y0 >= 0 && y0 < height) ? 1.0 - ay : 0.0;
+            double wy1 = (y0 + 1 >= 0 && y0 + 1 < height) ? ay : 0.0;
+            int cx0 = clamp_index(x0, width), cx1 = clamp_index(x0 + 1, width);
+            const double *row0 = src + clamp_index(y0, height) * width;
+            const double *row1 = src + clamp_index(y0 + 1, height) * width;
+
+            dst[y * width + x] = wy0 * (wx0 * row0[cx0] + wx1 * row0[cx1]) + wy1 * (wx0 * row1[cx0] + wx1 * row1[cx1]);
+        }
+    }
+}
+
+void augment_batch(const struct augment_config *config, double **inputs, int first, int count, double **outputs,
+                   uint64_t seed, int epoch, int numThreads)
+{
+#pragma omp parallel for schedule(static) num_threads(numThreads)
+    for (int b = 0; b < count; b++)
+    {
+        uint64_t state = seed ^ ((uint64_t)epoch << 32 ^ (uint64_t)(first + b));
+        augment_image(config, inputs[first + b], outputs[b], next_random(&state));
+    }
+}
+
+/**
+ * @brief Returns the number of images of the batch starting at first.
+ */
+static int batch_size(const struct augmenter *augmenter, int first)
+{
+    return augmenter->numTrainingSets - first < AUGMENT_BATCH ? augmenter->numTrainingSets - first : AUGMENT_BATCH;
+}
+
+/**
+ * @brief Main function of the background thread: augments the handed batch into the buffer that is not trained.
+ *
+ * @param arg The augmenter.
+ * @return void* Always NULL.
+ */
+static void *augmenter_main(void *arg)
+{
+    struct augmenter *augmenter = arg;
+
+    pthread_mutex_lock(&augmenter->lock);
+    while (!augmenter->stop)
+    {
+        if (!augmenter->pending || augmenter->done)
+        {
+            pthread_cond_wait(&augmenter->cond, &augmenter->lock);
+            continue;
+        }
+        int epoch = augmenter->jobEpoch, first = augmenter->jobFirst;
+        double **buffer = augmenter->buffers[1 - augmenter->current];
+        pthread_mutex_unlock(&augmenter->lock);
+
+        augment_batch(&augmenter->config, augmenter->inputs, first, batch_size(augmenter, first), buffer,
+                      augmenter->seed, epoch, augmenter->numThreads);
+
+        pthread_mutex_lock(&augmenter->lock);
+        augmenter->done = true;
+        pthread_cond_broadcast(&augmenter->cond);
+    }
+    pthread_mutex_unlock(&augmenter->lock);
+    return NULL;
+}
+
+void augmenter_create(struct augmenter *augmenter, const struct augment_config *config, double **inputs,
+                      int numTrainingSets, int epochs, uint64_t seed, int numThreads)
+{
+    int numInputs = config->width * config->height;
+
+    augmenter->config = *config;
+    augmenter->inputs = inputs;
+    augmenter->numTrainingSets = numTrainingSets;
+    augmenter->epochs = epochs;
+    augmenter->numThreads = numThreads;
+    augmenter->seed = seed;
+    arena_create(&augmenter->arena, 2 * arena_matrix_bytes(AUGMENT_BATCH, numInputs));
+    augmenter->buffers[0] = arena_alloc_matrix(&augmenter->arena, AUGMENT_BATCH, numInputs);
+    augmenter->buffers[1] = arena_alloc_matrix(&augmenter->arena, AUGMENT_BATCH, numInputs);
+    augmenter->current = 1;
+    augmenter->pending = false;
+    augmenter->done = false;
+    augmenter->stop = false;
+    augmenter->seconds = 0.0;
+    pthread_mutex_init(&augmenter->lock, NULL);
+    pthread_cond_init(&augmenter->cond, NULL);
+    create_thread(&augmenter->thread, augmenter_main, augmenter);
+}
+
+double **augmenter_next(struct augmenter *augmenter, int epoch, int first)
+{
+    double start = omp_get_wtime();
+
+    pthread_mutex_lock(&augmenter->lock);
+    while (augmenter->pending && !augmenter->done)
+    {
+        pthread_cond_wait(&augmenter->cond, &augmenter->lock);
+    }
+    bool prepared = augmenter->pending && augmenter->jobEpoch == epoch && augmenter->jobFirst == first;
+    augmenter->pending = false;
+    augmenter->current = 1 - augmenter->current;
+    pthread_mutex_unlock(&augmenter->lock);
+
+    if (!prepared)
+    {
+        augment_batch(&augmenter->config, augmenter->inputs, first, batch_size(augmenter, first),
+                      augmenter->buffers[augmenter->current], augmenter->seed, epoch, augmenter->numThreads);
+    }
+    augmenter->seconds += omp_get_wtime() - start;
+
+    // The following batch is prepared while this one is trained
+    int nextEpoch = epoch, nextFirst = first + AUGMENT_BATCH;
+    if (nextFirst >= augmenter->numTrainingSets)
+    {
+        nextEpoch++;
+        nextFirst = 0;
+    }
+    if (nextEpoch < augmenter->epochs)
+    {
+        pthread_mutex_lock(&augmenter->lock);
+        augmenter->jobEpoch = nextEpoch;
+        augmenter->jobFirst = nextFirst;
+        augmenter->pending = true;
+        augmenter->done = false;
+        pthread_cond_broadcast(&augmenter->cond);
+        pthread_mutex_unlock(&augmenter->lock);
+    }
+    return augmenter->buffers[augmenter->current];
+}
+
+void augmenter_destroy(struct augmenter *augmenter)
+{
+    pthread_mutex_lock(&augmenter->lock);
+    augmenter->stop = true;
+    pthread_cond_broadcast(&augmenter->cond);
+    pthread_mutex_unlock(&augmenter->lock);
+    pthread_join(augmenter->thread, NULL);
+    pthread_cond_destroy(&augmenter->cond);
+    pthread_mutex_destroy(&augmenter->lock);
+    arena_destroy(&augmenter->arena);
+}
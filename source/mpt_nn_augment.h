@@ -0,0 +1,149 @@
+/**
+ * @file mpt_nn_augment.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the on-the-fly data augmentation of the training images.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Every epoch sees a new random variant of every training image: a sub-pixel shift, a small rotation,
+ * a small scaling and shear (affine warp) and an elastic distortion. All transformations are combined into
+ * one mapping from the output pixel to a position in the source image, which is read with bilinear sampling.
+ * The pixels of a row are computed in one vectorized loop.
+ * The images are augmented in batches by an OpenMP team. A background thread augments the next batch
+ * while the current one is trained, so the augmentation overlaps with the training.
+ */
+#ifndef MPT_NN_AUGMENT_H
+#define MPT_NN_AUGMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "mpt_nn_arena.h"
+
+/**
+ * @brief Images per augmented batch.
+ */
+#define AUGMENT_BATCH 256
+
+/**
+ * @brief Control points per side of the displacement field of the elastic distortion.
+ */
+#define AUGMENT_GRID 4
+
+/**
+ * @brief Strength of the transformations, 0 disables a transformation.
+ */
+struct augment_config
+{
+    double shift;   /**< Maximum shift in pixels. */
+    double rotate;  /**< Maximum rotation in degrees. */
+    double affine;  /**< Maximum relative scaling and shear. */
+    double elastic; /**< Maximum displacement of the elastic distortion in pixels. */
+    int width;      /**< Width of the images. */
+    int height;     /**< Height of the images. */
+};
+
+/**
+ * @brief Parses the strength of the transformations.
+ *
+ * The specification is a ',' separated list of s=<shift>, r=<rotation>, a=<affine> and e=<elastic>,
+ * e.g. "s=2,r=10,a=0.1,e=1.5". Transformations that are not given are disabled.
+ *
+ * @param spec Specification as described above.
+ * @param config Receives the strengths, width and height are not changed.
+ * @return int 0 on success, -1 if the specification is invalid.
+ */
+int parse_augment(const char *spec, struct augment_config *config);
+
+/**
+ * @brief Writes a random variant of an image.
+ *
+ * The transformation only depends on the seed, so an image is augmented identically by every thread.
+ * Pixels that are mapped outside of the source image are 0.
+ *
+ * @param config Strength of the transformations and size of the image.
+ * @param src Source image (width * height pixels, row by row).
+ * @param dst Augmented image.
+ * @param seed Seed of the random transformation.
+ */
+void augment_image(const struct augment_config *config, const double *src, double *dst, uint64_t seed);
+
+/**
+ * @brief Augments consecutive training images in parallel.
+ *
+ * The seed of an image is derived from the seed, the epoch and the index of the image.
+ *
+ * @param config Strength of the transformations and size of the images.
+ * @param inputs Training images.
+ * @param first Index of the first image.
+ * @param count Number of images.
+ * @param outputs Receives the augmented images.
+ * @param seed Seed of the training run.
+ * @param epoch Epoch the images are augmented for.
+ * @param numThreads Size of the OpenMP team.
+ */
+void augment_batch(const struct augment_config *config, double **inputs, int first, int count, double **outputs,
+                   uint64_t seed, int epoch, int numThreads);
+
+/**
+ * @brief Augments the training images batch by batch, the next batch is prepared by a background thread.
+ */
+struct augmenter
+{
+    struct augment_config config;
+    double **inputs;      /**< Training images. */
+    int numTrainingSets;  /**< Number of training images. */
+    int epochs;           /**< Number of epochs, the batch after the last one is not prepared. */
+    int numThreads;       /**< Size of the OpenMP team of the background thread. */
+    uint64_t seed;        /**< Seed of the training run. */
+    struct arena arena;   /**< Holds the two buffers. */
+    double **buffers[2];  /**< Augmented batches, one is trained while the other is prepared. */
+    int current;          /**< Buffer returned by the last augmenter_next. */
+    pthread_t thread;     /**< Background thread. */
+    pthread_mutex_t lock; /**< Protects the fields below. */
+    pthread_cond_t cond;  /**< Signals a new job or a finished job. */
+    bool pending;         /**< A job has been handed to the background thread. */
+    bool done;            /**< The background thread has finished the job. */
+    bool stop;            /**< Ends the background thread. */
+    int jobEpoch;         /**< Epoch of the job. */
+    int jobFirst;         /**< First image of the job. */
+    double seconds;       /**< Total time the training waited for augmented batches. */
+};
+
+/**
+ * @brief Creates an augmenter and starts its background thread.
+ *
+ * @param augmenter Augmenter to initialize.
+ * @param config Strength of the transformations and size of the images (width * height inputs).
+ * @param inputs Training images.
+ * @param numTrainingSets Number of training images.
+ * @param epochs Number of epochs.
+ * @param seed Seed of the training run.
+ * @param numThreads Size of the OpenMP team that augments a batch.
+ */
+void augmenter_create(struct augmenter *augmenter, const struct augment_config *config, double **inputs,
+                      int numTrainingSets, int epochs, uint64_t seed, int numThreads);
+
+/**
+ * @brief Returns the augmented images first .. first + AUGMENT_BATCH - 1 of an epoch.
+ *
+ * Waits for the background thread if it is still augmenting them (or augments them if they were not prepared)
+ * and hands the following batch to the background thread. The returned rows are valid until the next call.
+ *
+ * @param augmenter Augmenter.
+ * @param epoch Epoch.
+ * @param first Index of the first image, a multiple of AUGMENT_BATCH.
+ * @return double** Augmented images (row b is image first + b).
+ */
+double **augmenter_next(struct augmenter *augmenter, int epoch, int first);
+
+/**
+ * @brief Stops the background thread and releases the buffers.
+ *
+ * @param augmenter Augmenter.
+ */
+void augmenter_destroy(struct augmenter *augmenter);
+
+#endif // MPT_NN_AUGMENT_H
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_cascade.h"
+
+double top1_margin(const double outputLayer[], int numOutputs)
+{
+    double first = outputLayer[0] > outputLayer[1] ? outputLayer[0] : outputLayer[1];
+    double second = outputLayer[0] > outputLayer[1] ? outputLayer[1] : outputLayer[0];
+
+    for (int i = 2; i < numOutputs; i++)
+    {
+        if (outputLayer[i] > first)
+        {
+            second = first;
+            first = outputLayer[i];
+        }
+        else if (outputLayer[i] > second)
+        {
+            second = outputLayer[i];
+        }
+    }
+    return first - second;
+}
+
+int cascade_create(struct cascade *cascade, const struct model *small, const struct model *full, double margin, int maxBatch)
+{
+    if (small->numInputs != full->numInputs || small->numOutputs != full->numOutputs || small->numOutputs < 2 || maxBatch <= 0)
+    {
+        return -1;
+    }
+
+    int O = full->numOutputs;
+    cascade->small = small;
+    cascade->full = full;
+    cascade->margin = margin;
+    cascade->maxBatch = maxBatch;
+    arena_create(&cascade->arena, arena_matrix_bytes(maxBatch, small->numHiddenNodes) + arena_matrix_bytes(maxBatch, full->numHiddenNodes) +
+                                      2 * arena_matrix_bytes(maxBatch, O) + arena_vector_bytes(maxBatch, sizeof(double *)) +
+                                      arena_vector_bytes(maxBatch, sizeof(int)));
+    cascade->hiddenSmall = arena_alloc_matrix(&cascade->arena, maxBatch, small->numHiddenNodes);
+    cascade->outputSmall = arena_alloc_matrix(&cascade->arena, maxBatch, O);
+    cascade->hiddenFull = arena_alloc_matrix(&cascade->arena, maxBatch, full->numHiddenNodes);
+    cascade->outputFull = arena_alloc_matrix(&cascade->arena, maxBatch, O);
+    cascade->forwarded = arena_alloc(&cascade->arena, maxBatch * sizeof(double *));
+    cascade->forwardedIndex = arena_alloc(&cascade->arena, maxBatch * sizeof(int));
+    return 0;
+}
+
+int cascade_classify(struct cascade *cascade, double **inputs, int batchSize, int labels[])
+{
+    const struct model *small = cascade->small;
+    const struct model *full = cascade->full;
+    int numForwarded = 0;
+
+    forward_pass_batch(inputs, batchSize, cascade->hiddenSmall, cascade->outputSmall, small->hiddenLayerBias, small->outputLayerBias,
+                       small->hiddenWeights, small->outputWeights, small->numInputs, small->numHiddenNodes, small->numOutputs);
+
+    // The confident images are answered by the small model, the others are collected for the full model
+    for (int b = 0; b < batchSize; b++)
+    {
+        if (top1_margin(cascade->outputSmall[b], small->numOutputs) >= cascade->margin)
+        {
+            labels[b] = predict_label(cascade->outputSmall[b], small->numOutputs);
+        }
+        else
+        {
+            cascade->forwarded[numForwarded] = inputs[b];
+            cascade->forwardedIndex[numForwarded++] = b;
+        }
+    }
+
+    if (numForwarded > 0)
+    {
+        forward_pass_batch(cascade->forwarded, numForwarded, cascade->hiddenFull, cascade->outputFull, full->hiddenLayerBias,
+                           full->outputLayerBias, full->hiddenWeights, full->outputWeights, full->numInputs, full->numHiddenNodes,
+                           full->numOutputs);
+        for (int f = 0; f < numForwarded; f++)
+        {
+            labels[cascade->forwardedIndex[f]] = predict_label(cascade->outputFull[f], full->numOutputs);
+        }
+    }
+    return numForwarded;
+}
+
+void cascade_destroy(struct cascade *cascade)
+{
+    arena_destroy(&cascade->arena);
+}
+
+/**
+ * @brief Classifies a data set with one model in batches of CASCADE_BATCH images.
+ *
+ * @param labels Receives the predicted label of every sample.
+ * @param margins Receives the top-1 margin of every sample, may be NULL.
+ * @return double Time of the forward passes in seconds.
+ */
+static double classify_all(const struct model *model, double **inputs, int numSets, double **hiddenLayer, double **outputLayer,
+                           int labels[], double margins[])
+{
+    double start = omp_get_wtime();
+
+    for (int s = 0; s < numSets; s += CASCADE_BATCH)
+    {
+        int batchSize = numSets - s < CASCADE_BATCH ? numSets - s : CASCADE_BATCH;
+        forward_pass_batch(inputs + s, batchSize, hiddenLayer, outputLayer, model->hiddenLayerBias, model->outputLayerBias,
+                           model->hiddenWeights, model->outputWeights, model->numInputs, model->numHiddenNodes, model->numOutputs);
+        for (int b = 0; b < batchSize; b++)
+        {
+            labels[s + b] = predict_label(outputLayer[b], model->numOutputs);
+            if (margins != NULL)
+            {
+                margins[s + b] = top1_margin(outputLayer[b], model->numOutputs);
+            }
+        }
+    }
+    return omp_get_wtime() - start;
+}
+
+int cascade_report(const struct model *small, const struct model *full, double margin,
+                   double **inputs, double **outputs, int numSets, const char *path)
+{
+    const double margins[] = {0.05, 0.1, 0.2, 0.3, 0.5, 0.7, 0.9};
+    int numMargins = sizeof(margins) / sizeof(margins[0]);
+    struct cascade cascade;
+    struct arena arena;
+    char line[256];
+
+    if (numSets <= 0 || cascade_create(&cascade, small, full, margin, CASCADE_BATCH) != 0)
+    {
+        return -1;
+    }
+
+    arena_create(&arena, 4 * arena_vector_bytes(numSets, sizeof(int)) + arena_vector_bytes(numSets, sizeof(double)));
+    int *actual = arena_alloc(&arena, numSets * sizeof(int));
+    int *smallLabels = arena_alloc(&arena, numSets * sizeof(int));
+    int *fullLabels = arena_alloc(&arena, numSets * sizeof(int));
+    int *cascadeLabels = arena_alloc(&arena, numSets * sizeof(int));
+    double *smallMargins = arena_alloc(&arena, numSets * sizeof(double));
+
+    for (int s = 0; s < numSets; s++)
+    {
+        actual[s] = predict_label(outputs[s], full->numOutputs);
+    }
+
+    // Warm-up, so the first timing does not include the first touch of the inputs
+    classify_all(small, inputs, numSets, cascade.hiddenSmall, cascade.outputSmall, smallLabels, smallMargins);
+    double smallSeconds = classify_all(small, inputs, numSets, cascade.hiddenSmall, cascade.outputSmall, smallLabels, smallMargins);
+    double fullSeconds = classify_all(full, inputs, numSets, cascade.hiddenFull, cascade.outputFull, fullLabels, NULL);
+
+    int numForwarded = 0;
+    double start = omp_get_wtime();
+    for (int s = 0; s < numSets; s += CASCADE_BATCH)
+    {
+        int batchSize = numSets - s < CASCADE_BATCH ? numSets - s : CASCADE_BATCH;
+        numForwarded += cascade_classify(&cascade, inputs + s, batchSize, cascadeLabels + s);
+    }
+    double cascadeSeconds = omp_get_wtime() - start;
+
+    int smallCorrect = 0, fullCorrect = 0, cascadeCorrect = 0;
+    for (int s = 0; s < numSets; s++)
+    {
+        smallCorrect += smallLabels[s] == actual[s];
+        fullCorrect += fullLabels[s] == actual[s];
+        cascadeCorrect += cascadeLabels[s] == actual[s];
+    }
+
+    FILE *file = path != NULL ? fopen(path, "w") : NULL;
+    if (path != NULL && file == NULL)
+    {
+        printf("Error opening file %s\n", path);
+    }
+
+    snprintf(line, sizeof(line), "Cascade %d-%d-%d -> %d-%d-%d, margin %.2f, %d samples\n\n", small->numInputs, small->numHiddenNodes,
+             small->numOutputs, full->numInputs, full->numHiddenNodes, full->numOutputs, margin, numSets);
+    const char *header = "| Model   | Accuracy | Time [us/image] | Speedup |\n"
+                         "|---------|---------:|----------------:|--------:|\n";
+    printf("%s%s", line, header);
+    if (file != NULL)
+    {
+        fprintf(file, "%s%s", line, header);
+    }
+
+    const char *names[] = {"small", "full", "cascade"};
+    int correct[] = {smallCorrect, fullCorrect, cascadeCorrect};
+    double seconds[] = {smallSeconds, fullSeconds, cascadeSeconds};
+    for (int m = 0; m < 3; m++)
+    {
+        snprintf(line, sizeof(line), "| %-7s | %7.2f%% | %15.2f | %6.2fx |\n", names[m], 100.0 * correct[m] / numSets,
+                 seconds[m] * 1e6 / numSets, fullSeconds / seconds[m]);
+        printf("%s", line);
+        if (file != NULL)
+        {
+            fprintf(file, "%s", line);
+        }
+    }
+
+    snprintf(line, sizeof(line), "\nHit rate: %.2f%% answered by the small model - Accuracy delta to the full model: %+.2f points\n\n",
+             100.0 * (numSets - numForwarded) / numSets, 100.0 * (cascadeCorrect - fullCorrect) / numSets);
+    printf("%s", line);
+    if (file != NULL)
+    {
+        fprintf(file, "%s", line);
+    }
+
+    // Other margins are estimated from the outputs of both models: the small model for every image, the full one for the forwarded
+    header = "| Margin | Hit rate | Accuracy | Accuracy delta | Estimated time [us/image] |\n"
+             "|-------:|---------:|---------:|---------------:|--------------------------:|\n";
+    printf("%s", header);
+    if (file != NULL)
+    {
+        fprintf(file, "%s", header);
+    }
+    for (int m = 0; m < numMargins; m++)
+    {
+        int hits = 0, correctAt = 0;
+        for (int s = 0; s < numSets; s++)
+        {
+            bool hit = smallMargins[s] >= margins[m];
+            hits += hit;
+            correctAt += (hit ? smallLabels[s] : fullLabels[s]) == actual[s];
+        }
+        double estimated = (smallSeconds + fullSeconds * (numSets - hits) / numSets) * 1e6 / numSets;
+        snprintf(line, sizeof(line), "| %6.2f | %7.2f%% | %7.2f%% | %+14.2f | %25.2f |\n", margins[m], 100.0 * hits / numSets,
+                 100.0 * correctAt / numSets, 100.0 * (correctAt - fullCorrect) / numSets, estimated);
+        printf("%s", line);
+        if (file != NULL)
+        {
+            fprintf(file, "%s", line);
+        }
+    }
+
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    arena_destroy(&arena);
+    cascade_destroy(&cascade);
+    return 0;
+}
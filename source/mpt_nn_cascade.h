@@ -0,0 +1,109 @@
+/**
+ * @file mpt_nn_cascade.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the confidence-gated inference cascade.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * A cascade classifies every image with a small model first (e.g. 16 hidden nodes). Only the images whose top-1
+ * margin (largest minus second largest output) is below a threshold are forwarded to the full model, so the easy
+ * images pay for the small model only. Both models have to have the same inputs and outputs.
+ */
+#ifndef MPT_NN_CASCADE_H
+#define MPT_NN_CASCADE_H
+
+#include "mpt_nn_arena.h"
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Default margin below which an image is forwarded to the full model.
+ */
+#define CASCADE_DEFAULT_MARGIN 0.5
+
+/**
+ * @brief Images per batch of the forward passes of cascade_report.
+ */
+#define CASCADE_BATCH 32
+
+/**
+ * @brief A small and a full model with the buffers to classify batches of up to maxBatch images.
+ */
+struct cascade
+{
+    const struct model *small; /**< Model that classifies every image. */
+    const struct model *full;  /**< Model that classifies the images with a small margin. */
+    double margin;             /**< Images with a smaller top-1 margin of the small model are forwarded. */
+    int maxBatch;              /**< Maximum number of images per batch. */
+    double **hiddenSmall;      /**< Hidden activations of the small model (maxBatch x small hidden nodes). */
+    double **outputSmall;      /**< Outputs of the small model (maxBatch x numOutputs). */
+    double **hiddenFull;       /**< Hidden activations of the full model (maxBatch x full hidden nodes). */
+    double **outputFull;       /**< Outputs of the full model (maxBatch x numOutputs). */
+    double **forwarded;        /**< Inputs of the forwarded images. */
+    int *forwardedIndex;       /**< Position of every forwarded image in the batch. */
+    struct arena arena;        /**< Arena owning the buffers. */
+};
+
+/**
+ * @brief Returns the top-1 margin of the outputs, the largest minus the second largest output.
+ *
+ * @param outputLayer Activations of the output layer.
+ * @param numOutputs Number of output nodes, at least 2.
+ * @return double Margin between the predicted label and the runner-up.
+ */
+double top1_margin(const double outputLayer[], int numOutputs);
+
+/**
+ * @brief Creates a cascade of two models.
+ *
+ * @param cascade Cascade to create. Has to be released with cascade_destroy.
+ * @param small Model that classifies every image.
+ * @param full Model that classifies the images with a small margin.
+ * @param margin Images with a smaller top-1 margin of the small model are forwarded to the full model.
+ * @param maxBatch Maximum number of images per batch.
+ * @return 0 on success, -1 if the models have different inputs or outputs.
+ */
+int cascade_create(struct cascade *cascade, const struct model *small, const struct model *full, double margin, int maxBatch);
+
+/**
+ * @brief Classifies a batch of images with the cascade.
+ *
+ * The small model computes the whole batch with forward_pass_batch, the forwarded images are computed by the full
+ * model in a second, smaller batch. Runs on the calling thread.
+ *
+ * @param cascade Cascade.
+ * @param inputs 2D array with the input data of every image (batchSize x numInputs).
+ * @param batchSize Number of images, at most maxBatch.
+ * @param labels Receives the predicted label of every image.
+ * @return int Number of images forwarded to the full model.
+ */
+int cascade_classify(struct cascade *cascade, double **inputs, int batchSize, int labels[]);
+
+/**
+ * @brief Releases the buffers of a cascade.
+ *
+ * @param cascade Cascade to release.
+ */
+void cascade_destroy(struct cascade *cascade);
+
+/**
+ * @brief Compares a cascade with its two models on a data set.
+ *
+ * Prints and writes to path the accuracy and the time per image of the small model, the full model and the cascade,
+ * the hit rate (images answered by the small model) and the accuracy difference to the full model. A table of
+ * other margins, estimated from the outputs of both models, helps to choose the margin.
+ *
+ * @param small Model that classifies every image.
+ * @param full Model that classifies the images with a small margin.
+ * @param margin Images with a smaller top-1 margin of the small model are forwarded to the full model.
+ * @param inputs 2D array of inputs.
+ * @param outputs 2D array of one-hot outputs.
+ * @param numSets Number of samples.
+ * @param path Markdown file for the report, NULL to only print it.
+ * @return 0 on success, -1 if the models have different inputs or outputs.
+ */
+int cascade_report(const struct model *small, const struct model *full, double margin,
+                   double **inputs, double **outputs, int numSets, const char *path);
+
+#endif // MPT_NN_CASCADE_H
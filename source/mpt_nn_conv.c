@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "mpt_nn.h"
+#include "mpt_nn_conv.h"
+
+size_t conv_layer_bytes(int inChannels, int outChannels, int kernelSize)
+{
+    size_t numWeights = (size_t)outChannels * inChannels * kernelSize * kernelSize;
+    return 2 * arena_vector_bytes(numWeights, sizeof(double)) + 2 * arena_vector_bytes(outChannels, sizeof(double));
+}
+
+void conv_layer_init(struct conv_layer *layer, struct arena *arena, int inChannels, int inHeight, int inWidth,
+                     int outChannels, int kernelSize)
+{
+    int fanIn = inChannels * kernelSize * kernelSize;
+    size_t numWeights = (size_t)outChannels * fanIn;
+    double limit = sqrt(6.0 / fanIn);
+
+    layer->inChannels = inChannels;
+    layer->inHeight = inHeight;
+    layer->inWidth = inWidth;
+    layer->outChannels = outChannels;
+    layer->kernelSize = kernelSize;
+    layer->outHeight = CONV_OUTPUT_SIZE(inHeight, kernelSize);
+    layer->outWidth = CONV_OUTPUT_SIZE(inWidth, kernelSize);
+    layer->weights = arena_alloc_vector(arena, numWeights);
+    layer->bias = arena_alloc_vector(arena, outChannels);
+    layer->gradWeights = arena_alloc_vector(arena, numWeights);
+    layer->gradBias = arena_alloc_vector(arena, outChannels);
+
+    for (size_t i = 0; i < numWeights; i++)
+    {
+        layer->weights[i] = (2.0 * rand() / RAND_MAX - 1.0) * limit;
+    }
+}
+
+void pool_layer_init(struct pool_layer *layer, int channels, int inHeight, int inWidth, int poolSize)
+{
+    layer->channels = channels;
+    layer->inHeight = inHeight;
+    layer->inWidth = inWidth;
+    layer->poolSize = poolSize;
+    layer->outHeight = inHeight / poolSize;
+    layer->outWidth = inWidth / poolSize;
+}
+
+size_t conv2d_workspace_size(const struct conv_layer *layer, int numThreads)
+{
+    size_t columns = (size_t)layer->inChannels * layer->kernelSize * layer->kernelSize * layer->outHeight * layer->outWidth;
+    return columns * (numThreads > 2 ? numThreads : 2);
+}
+
+/**
+ * @brief Unfolds the patches of one input channel into the rows of the im2col matrix.
+ *
+ * Row (c * kernelSize + ky) * kernelSize + kx holds input[c][oy + ky][ox + kx] for every output position (oy, ox).
+ *
+ * @param layer Convolution layer.
+ * @param input Input of one sample.
+ * @param c Input channel to unfold.
+ * @param columns im2col matrix.
+ */
+static void im2col_channel(const struct conv_layer *layer, const double *input, int c, double *columns)
+{
+    int K = layer->kernelSize, OH = layer->outHeight, OW = layer->outWidth;
+    const double *plane = input + (size_t)c * layer->inHeight * layer->inWidth;
+
+    for (int ky = 0; ky < K; ky++)
+    {
+        for (int kx = 0; kx < K; kx++)
+        {
+            double *row = columns + ((size_t)(c * K + ky) * K + kx) * OH * OW;
+            for (int oy = 0; oy < OH; oy++)
+            {
+                memcpy(row + oy * OW, plane + (oy + ky) * layer->inWidth + kx, OW * sizeof(double));
+            }
+        }
+    }
+}
+
+void conv2d_forward_im2col(const struct conv_layer *layer, double *const inputs[], int batchSize, double outputs[], double workspace[])
+{
+    int CKK = layer->inChannels * layer->kernelSize * layer->kernelSize;
+    int P = layer->outHeight * layer->outWidth;
+
+#pragma omp parallel
+    {
+        double *columns = workspace + (size_t)omp_get_thread_num() * CKK * P;
+
+#pragma omp for schedule(static)
+        for (int b = 0; b < batchSize; b++)
+        {
+            for (int c = 0; c < layer->inChannels; c++)
+            {
+                im2col_channel(layer, inputs[b], c, columns);
+            }
+
+            // GEMM: outputs[co][p] = bias[co] + sum over k of weights[co][k] * columns[k][p]
+            for (int co = 0; co < layer->outChannels; co++)
+            {
+                double *out = outputs + ((size_t)b * layer->outChannels + co) * P;
+                const double *w = layer->weights + (size_t)co * CKK;
+                for (int p = 0; p < P; p++)
+                {
+                    out[p] = layer->bias[co];
+                }
+                for (int k = 0; k < CKK; k++)
+                {
+                    const double *row = columns + (size_t)k * P;
+                    double weight = w[k];
+#pragma omp simd
+                    for (int p = 0; p < P; p++)
+                    {
+                        out[p] += weight * row[p];
+                    }
+                }
+#pragma omp simd
+                for (int p = 0; p < P; p++)
+                {
+                    out[p] = out[p] > 0.0 ? out[p] : 0.0;
+                }
+            }
+        }
+    }
+}
+
+void conv2d_forward_direct(const struct conv_layer *layer, double *const inputs[], int batchSize, double outputs[])
+{
+    int K = layer->kernelSize, OH = layer->outHeight, OW = layer->outWidth;
+    int H = layer->inHeight, W = layer->inWidth;
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int co = 0; co < layer->outChannels; co++)
+        {
+            const double *w = layer->weights + (size_t)co * layer->inChannels * K * K;
+            double *out = outputs + ((size_t)b * layer->outChannels + co) * OH * OW;
+
+            for (int oy = 0; oy < OH; oy++)
+            {
+                for (int ox = 0; ox < OW; ox += CONV_BLOCK_WIDTH)
+                {
+                    int width = OW - ox < CONV_BLOCK_WIDTH ? OW - ox : CONV_BLOCK_WIDTH;
+                    double acc[CONV_BLOCK_WIDTH];
+
+                    for (int v = 0; v < CONV_BLOCK_WIDTH; v++)
+                    {
+                        acc[v] = layer->bias[co];
+                    }
+                    for (int c = 0; c < layer->inChannels; c++)
+                    {
+                        for (int ky = 0; ky < K; ky++)
+                        {
+                            const double *in = inputs[b] + ((size_t)c * H + oy + ky) * W + ox;
+                            const double *wRow = w + (c * K + ky) * K;
+                            for (int kx = 0; kx < K; kx++)
+                            {
+                                double weight = wRow[kx];
+                                if (width == CONV_BLOCK_WIDTH)
+                                {
+#pragma omp simd
+                                    for (int v = 0; v < CONV_BLOCK_WIDTH; v++)
+                                    {
+                                        acc[v] += weight * in[kx + v];
+                                    }
+                                }
+                                else
+                                {
+                                    for (int v = 0; v < width; v++)
+                                    {
+                                        acc[v] += weight * in[kx + v];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                    for (int v = 0; v < width; v++)
+                    {
+                        out[oy * OW + ox + v] = acc[v] > 0.0 ? acc[v] : 0.0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Multiplies the output errors with the derivative of the ReLU.
+ */
+static void relu_backward(const struct conv_layer *layer, int batchSize, const double outputs[], double outputError[])
+{
+    size_t size = (size_t)batchSize * layer->outChannels * layer->outHeight * layer->outWidth;
+
+#pragma omp parallel for simd schedule(static)
+    for (size_t i = 0; i < size; i++)
+    {
+        outputError[i] = outputs[i] > 0.0 ? outputError[i] : 0.0;
+    }
+}
+
+void conv2d_backward_im2col(const struct conv_layer *layer, double *const inputs[], int batchSize, const double outputs[],
+                            double outputError[], double inputError[], double workspace[])
+{
+    int K = layer->kernelSize, H = layer->inHeight, W = layer->inWidth;
+    int OW = layer->outWidth;
+    int CKK = layer->inChannels * K * K;
+    int P = layer->outHeight * OW;
+    double *columns = workspace;
+    double *columnError = workspace + (size_t)CKK * P;
+
+    relu_backward(layer, batchSize, outputs, outputError);
+
+    for (int b = 0; b < batchSize; b++)
+    {
+        const double *error = outputError + (size_t)b * layer->outChannels * P;
+
+#pragma omp parallel for schedule(static)
+        for (int c = 0; c < layer->inChannels; c++)
+        {
+            im2col_channel(layer, inputs[b], c, columns);
+        }
+
+        // gradWeights[co][k] += sum over p of error[co][p] * columns[k][p]
+#pragma omp parallel for schedule(static)
+        for (int co = 0; co < layer->outChannels; co++)
+        {
+            const double *e = error + (size_t)co * P;
+            double biasSum = 0.0;
+#pragma omp simd reduction(+ : biasSum)
+            for (int p = 0; p < P; p++)
+            {
+                biasSum += e[p];
+            }
+            layer->gradBias[co] += biasSum;
+            for (int k = 0; k < CKK; k++)
+            {
+                const double *row = columns + (size_t)k * P;
+                double sum = 0.0;
+#pragma omp simd reduction(+ : sum)
+                for (int p = 0; p < P; p++)
+                {
+                    sum += e[p] * row[p];
+                }
+                layer->gradWeights[(size_t)co * CKK + k] += sum;
+            }
+        }
+
+        if (inputError == NULL)
+        {
+            continue;
+        }
+
+        // columnError[k][p] = sum over co of weights[co][k] * error[co][p]
+#pragma omp parallel for schedule(static)
+        for (int k = 0; k < CKK; k++)
+        {
+            double *row = columnError + (size_t)k * P;
+            memset(row, 0, P * sizeof(double));
+            for (int co = 0; co < layer->outChannels; co++)
+            {
+                double weight = layer->weights[(size_t)co * CKK + k];
+                const double *e = error + (size_t)co * P;
+#pragma omp simd
+                for (int p = 0; p < P; p++)
+                {
+                    row[p] += weight * e[p];
+                }
+            }
+        }
+
+        // col2im: the rows of a channel only touch the errors of that channel
+#pragma omp parallel for schedule(static)
+        for (int c = 0; c < layer->inChannels; c++)
+        {
+            double *plane = inputError + ((size_t)b * layer->inChannels + c) * H * W;
+            memset(plane, 0, (size_t)H * W * sizeof(double));
+            for (int ky = 0; ky < K; ky++)
+            {
+                for (int kx = 0; kx < K; kx++)
+                {
+                    const double *row = columnError + ((size_t)(c * K + ky) * K + kx) * P;
+                    for (int oy = 0; oy < layer->outHeight; oy++)
+                    {
+                        double *in = plane + (oy + ky) * W + kx;
+#pragma omp simd
+                        for (int ox = 0; ox < OW; ox++)
+                        {
+                            in[ox] += row[oy * OW + ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void conv2d_backward_direct(const struct conv_layer *layer, double *const inputs[], int batchSize, const double outputs[],
+                            double outputError[], double inputError[])
+{
+    int K = layer->kernelSize, H = layer->inHeight, W = layer->inWidth;
+    int OH = layer->outHeight, OW = layer->outWidth;
+    int CKK = layer->inChannels * K * K;
+
+    relu_backward(layer, batchSize, outputs, outputError);
+
+    // Every filter is owned by one thread, so its gradients are summed over the batch without races
+#pragma omp parallel for schedule(static)
+    for (int co = 0; co < layer->outChannels; co++)
+    {
+        double *gradW = layer->gradWeights + (size_t)co * CKK;
+        for (int b = 0; b < batchSize; b++)
+        {
+            const double *e = outputError + ((size_t)b * layer->outChannels + co) * OH * OW;
+            double biasSum = 0.0;
+#pragma omp simd reduction(+ : biasSum)
+            for (int p = 0; p < OH * OW; p++)
+            {
+                biasSum += e[p];
+            }
+            layer->gradBias[co] += biasSum;
+
+            for (int c = 0; c < layer->inChannels; c++)
+            {
+                for (int ky = 0; ky < K; ky++)
+                {
+                    for (int kx = 0; kx < K; kx++)
+                    {
+                        double sum = 0.0;
+                        for (int oy = 0; oy < OH; oy++)
+                        {
+                            const double *in = inputs[b] + ((size_t)c * H + oy + ky) * W + kx;
+                            const double *eRow = e + oy * OW;
+#pragma omp simd reduction(+ : sum)
+                            for (int ox = 0; ox < OW; ox++)
+                            {
+                                sum += eRow[ox] * in[ox];
+                            }
+                        }
+                        gradW[(c * K + ky) * K + kx] += sum;
+                    }
+                }
+            }
+        }
+    }
+
+    if (inputError == NULL)
+    {
+        return;
+    }
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int c = 0; c < layer->inChannels; c++)
+        {
+            double *plane = inputError + ((size_t)b * layer->inChannels + c) * H * W;
+            memset(plane, 0, (size_t)H * W * sizeof(double));
+            for (int co = 0; co < layer->outChannels; co++)
+            {
+                const double *e = outputError + ((size_t)b * layer->outChannels + co) * OH * OW;
+                const double *w = layer->weights + (size_t)co * CKK + c * K * K;
+                for (int ky = 0; ky < K; ky++)
+                {
+                    for (int kx = 0; kx < K; kx++)
+                    {
+                        double weight = w[ky * K + kx];
+                        for (int oy = 0; oy < OH; oy++)
+                        {
+                            double *in = plane + (oy + ky) * W + kx;
+                            const double *eRow = e + oy * OW;
+#pragma omp simd
+                            for (int ox = 0; ox < OW; ox++)
+                            {
+                                in[ox] += weight * eRow[ox];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void conv_apply_gradients(struct conv_layer *layer, double scale)
+{
+    size_t numWeights = (size_t)layer->outChannels * layer->inChannels * layer->kernelSize * layer->kernelSize;
+
+#pragma omp simd
+    for (size_t i = 0; i < numWeights; i++)
+    {
+        layer->weights[i] += scale * layer->gradWeights[i];
+        layer->gradWeights[i] = 0.0;
+    }
+    for (int co = 0; co < layer->outChannels; co++)
+    {
+        layer->bias[co] += scale * layer->gradBias[co];
+        layer->gradBias[co] = 0.0;
+    }
+}
+
+void maxpool_forward(const struct pool_layer *layer, const double inputs[], int batchSize, double outputs[], int argmax[])
+{
+    int S = layer->poolSize, W = layer->inWidth;
+    size_t inPlane = (size_t)layer->inHeight * W, outPlane = (size_t)layer->outHeight * layer->outWidth;
+
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int c = 0; c < layer->channels; c++)
+        {
+            const double *in = inputs + ((size_t)b * layer->channels + c) * inPlane;
+            size_t outOffset = ((size_t)b * layer->channels + c) * outPlane;
+
+            for (int py = 0; py < layer->outHeight; py++)
+            {
+                for (int px = 0; px < layer->outWidth; px++)
+                {
+                    double best = -DBL_MAX;
+                    int bestIndex = 0;
+                    for (int dy = 0; dy < S; dy++)
+                    {
+                        for (int dx = 0; dx < S; dx++)
+                        {
+                            int index = (py * S + dy) * W + px * S + dx;
+                            if (in[index] > best)
+                            {
+                                best = in[index];
+                                bestIndex = index;
+                            }
+                        }
+                    }
+                    outputs[outOffset + py * layer->outWidth + px] = best;
+                    argmax[outOffset + py * layer->outWidth + px] = c * inPlane + bestIndex;
+                }
+            }
+        }
+    }
+}
+
+void maxpool_backward(const struct pool_layer *layer, const double outputError[], const int argmax[], int batchSize, double inputError[])
+{
+    size_t inPlane = (size_t)layer->inHeight * layer->inWidth, outPlane = (size_t)layer->outHeight * layer->outWidth;
+
+    // The maximum of a window lies in the channel of the window, so every (sample, channel) is independent
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int c = 0; c < layer->channels; c++)
+        {
+            double *in = inputError + (size_t)b * layer->channels * inPlane;
+            size_t outOffset = ((size_t)b * layer->channels + c) * outPlane;
+
+            memset(in + c * inPlane, 0, inPlane * sizeof(double));
+            for (size_t p = 0; p < outPlane; p++)
+            {
+                in[argmax[outOffset + p]] += outputError[outOffset + p];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Buffers of one thread for the dense layers of the convolutional network.
+ */
+struct dense_workspace
+{
+    double *gradients;
+    double *hiddenLayer;
+    double *outputLayer;
+    double *deltaHidden;
+    double *deltaOutput;
+    int *inputIndex;
+    struct dropout_mask mask;
+};
+
+int train_conv_network(const struct conv_config *config, double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                       int numInputs, int numHiddenNodes, int numOutputs, int epochs, double learningRate, double dropoutRate)
+{
+    int side = (int)sqrt((double)numInputs);
+    int batchSize = config->batchSize;
+    int numThreads = omp_get_max_threads();
+
+    if (side * side != numInputs || config->numFilters <= 0 || config->kernelSize <= 0 || config->kernelSize > side ||
+        config->poolSize <= 0 || CONV_OUTPUT_SIZE(side, config->kernelSize) < config->poolSize || batchSize <= 0)
+    {
+        return -1;
+    }
+
+    int convOutputs = config->numFilters * CONV_OUTPUT_SIZE(side, config->kernelSize) * CONV_OUTPUT_SIZE(side, config->kernelSize);
+    int poolSide = CONV_OUTPUT_SIZE(side, config->kernelSize) / config->poolSize;
+    int numFeatures = config->numFilters * poolSide * poolSide;
+    size_t gradientSize = GRADIENT_SIZE(numFeatures, numHiddenNodes, numOutputs);
+    size_t workspaceSize = (size_t)config->kernelSize * config->kernelSize * convOutputs / config->numFilters * (numThreads > 2 ? numThreads : 2);
+
+    struct arena arena;
+    arena_create(&arena, conv_layer_bytes(1, config->numFilters, config->kernelSize) +
+                             arena_vector_bytes(workspaceSize, sizeof(double)) +
+                             2 * arena_vector_bytes((size_t)batchSize * convOutputs, sizeof(double)) +
+                             2 * arena_vector_bytes((size_t)batchSize * numFeatures, sizeof(double)) +
+                             arena_vector_bytes((size_t)batchSize * numFeatures, sizeof(int)) +
+                             arena_matrix_bytes(numFeatures, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(double)) + arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_vector_bytes(numThreads, sizeof(struct dense_workspace)) +
+                             numThreads * (arena_vector_bytes(gradientSize, sizeof(double)) +
+                                           2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) +
+                                           2 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                                           arena_vector_bytes(numFeatures, sizeof(int)) +
+                                           arena_vector_bytes(numHiddenNodes, sizeof(int)) +
+                                           arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t))));
+
+    struct conv_layer conv;
+    struct pool_layer pool;
+    conv_layer_init(&conv, &arena, 1, side, side, config->numFilters, config->kernelSize);
+    pool_layer_init(&pool, config->numFilters, conv.outHeight, conv.outWidth, config->poolSize);
+
+    double *workspace = arena_alloc_vector(&arena, workspaceSize);
+    double *convOutput = arena_alloc_vector(&arena, (size_t)batchSize * convOutputs);
+    double *convError = arena_alloc_vector(&arena, (size_t)batchSize * convOutputs);
+    double *features = arena_alloc_vector(&arena, (size_t)batchSize * numFeatures);
+    double *featureError = arena_alloc_vector(&arena, (size_t)batchSize * numFeatures);
+    int *argmax = arena_alloc(&arena, (size_t)batchSize * numFeatures * sizeof(int));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numFeatures, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double *hiddenLayerBias = arena_alloc_vector(&arena, numHiddenNodes);
+    double *outputLayerBias = arena_alloc_vector(&arena, numOutputs);
+    struct dense_workspace *work = arena_alloc(&arena, numThreads * sizeof(struct dense_workspace));
+
+    // The dense weights are rescaled to a variance of 1 / numFeatures so the sigmoids of the hidden layer do not saturate
+    initialize_weights(hiddenWeights, numFeatures, numHiddenNodes);
+    initialize_weights(outputWeights, numHiddenNodes, numOutputs);
+    initialize_bias(hiddenLayerBias, numHiddenNodes);
+    initialize_bias(outputLayerBias, numOutputs);
+    for (int j = 0; j < numFeatures; j++)
+    {
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            hiddenWeights[j][i] *= 2.0 * sqrt(3.0 / numFeatures);
+        }
+    }
+
+    for (int t = 0; t < numThreads; t++)
+    {
+        work[t].gradients = arena_alloc_vector(&arena, gradientSize);
+        work[t].hiddenLayer = arena_alloc_vector(&arena, numHiddenNodes);
+        work[t].deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
+        work[t].outputLayer = arena_alloc_vector(&arena, numOutputs);
+        work[t].deltaOutput = arena_alloc_vector(&arena, numOutputs);
+        work[t].inputIndex = arena_alloc(&arena, numFeatures * sizeof(int));
+        work[t].mask = (struct dropout_mask){arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                             arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+    }
+
+    size_t convParameters = (size_t)config->numFilters * (config->kernelSize * config->kernelSize + 1);
+    size_t denseParameters = GRADIENT_SIZE(numFeatures, numHiddenNodes, numOutputs);
+    printf("Conv network: 1x%dx%d -> conv %dx%dx%d (%s) -> max pool %dx%d -> %d features -> %d hidden -> %d outputs\n",
+           side, side, config->numFilters, conv.outHeight, conv.outWidth, config->algorithm == CONV_IM2COL ? "im2col + GEMM" : "direct",
+           config->poolSize, config->poolSize, numFeatures, numHiddenNodes, numOutputs);
+    printf("Parameters: %zu (conv %zu, dense %zu), MLP with the same hidden layer: %zu\n", convParameters + denseParameters,
+           convParameters, denseParameters, GRADIENT_SIZE(numInputs, numHiddenNodes, numOutputs));
+
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+        double totalLoss = 0.0;
+        int correctPredictions = 0;
+        double start = omp_get_wtime();
+
+        for (int first = 0; first < numTrainingSets; first += batchSize)
+        {
+            int size = numTrainingSets - first < batchSize ? numTrainingSets - first : batchSize;
+            double *const *inputs = trainingInputs + first;
+
+            if (config->algorithm == CONV_IM2COL)
+            {
+                conv2d_forward_im2col(&conv, inputs, size, convOutput, workspace);
+            }
+            else
+            {
+                conv2d_forward_direct(&conv, inputs, size, convOutput);
+            }
+            maxpool_forward(&pool, convOutput, size, features, argmax);
+
+#pragma omp parallel reduction(+ : totalLoss, correctPredictions)
+            {
+                struct dense_workspace *w = &work[omp_get_thread_num()];
+                int teamSize = omp_get_num_threads();
+
+                memset(w->gradients, 0, gradientSize * sizeof(double));
+#pragma omp for schedule(static)
+                for (int b = 0; b < size; b++)
+                {
+                    double *feature = features + (size_t)b * numFeatures;
+                    double *target = trainingOutputs[first + b];
+                    int numActiveInputs = build_input_index(feature, numFeatures, w->inputIndex);
+
+                    forward_pass_sequential(feature, w->inputIndex, numActiveInputs, w->hiddenLayer, w->outputLayer, hiddenLayerBias, outputLayerBias,
+                                            hiddenWeights, outputWeights, numFeatures, numHiddenNodes, numOutputs, dropoutRate, true, &w->mask);
+                    for (int j = 0; j < numOutputs; j++)
+                    {
+                        totalLoss += pow(target[j] - w->outputLayer[j], 2);
+                    }
+                    correctPredictions += predict_label(w->outputLayer, numOutputs) == predict_label(target, numOutputs);
+                    accumulate_gradients(feature, w->inputIndex, numActiveInputs, target, w->hiddenLayer, w->outputLayer, outputWeights,
+                                         w->deltaOutput, w->deltaHidden, w->gradients, numFeatures, numHiddenNodes, numOutputs, &w->mask);
+                    backpropagate_input_error(w->deltaHidden, hiddenWeights, &w->mask, numFeatures, featureError + (size_t)b * numFeatures);
+                }
+
+                // The gradients of all threads are summed into the buffer of thread 0
+#pragma omp for schedule(static)
+                for (size_t g = 0; g < gradientSize; g++)
+                {
+                    for (int t = 1; t < teamSize; t++)
+                    {
+                        work[0].gradients[g] += work[t].gradients[g];
+                    }
+                }
+            }
+
+            maxpool_backward(&pool, featureError, argmax, size, convError);
+            if (config->algorithm == CONV_IM2COL)
+            {
+                conv2d_backward_im2col(&conv, inputs, size, convOutput, convError, NULL, workspace);
+            }
+            else
+            {
+                conv2d_backward_direct(&conv, inputs, size, convOutput, convError, NULL);
+            }
+
+            apply_gradients(work[0].gradients, learningRate, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights,
+                            numFeatures, numHiddenNodes, numOutputs);
+            conv_apply_gradients(&conv, learningRate);
+        }
+
+        double averageLoss = totalLoss / numTrainingSets;
+        double accuracy = (double)correctPredictions / numTrainingSets * 100.0;
+        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%d/%d) - %.2fs\n", epoch + 1, epochs, averageLoss, accuracy,
+               correctPredictions, numTrainingSets, omp_get_wtime() - start);
+    }
+
+    arena_destroy(&arena);
+    return 0;
+}
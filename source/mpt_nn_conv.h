@@ -0,0 +1,232 @@
+/**
+ * @file mpt_nn_conv.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the convolutional layers of the mpt_nn.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for Conv2D and MaxPool layers working on mini-batches.
+ * Tensors are stored as flat arrays in channel, row, column order per sample ([C][H][W]),
+ * a batch is an array of pointers to its samples.
+ * The convolution is implemented twice: as im2col followed by a matrix multiplication (GEMM)
+ * and as a direct, register-blocked SIMD convolution. Both produce the same results and are
+ * parallelized with OpenMP over the samples of the batch and over the channels.
+ */
+#ifndef MPT_NN_CONV_H
+#define MPT_NN_CONV_H
+
+#include <stddef.h>
+#include "mpt_nn_arena.h"
+
+/**
+ * @brief Number of outputs of a valid convolution (stride 1, no padding) per dimension.
+ */
+#define CONV_OUTPUT_SIZE(inputSize, kernelSize) ((inputSize) - (kernelSize) + 1)
+
+/**
+ * @brief Number of neighbouring output columns the direct convolution keeps in registers.
+ */
+#define CONV_BLOCK_WIDTH 8
+
+/**
+ * @brief Implementation used for the convolutions.
+ */
+enum conv_algorithm
+{
+    CONV_IM2COL, /**< Unfold the input patches into a matrix and multiply it with the filters. */
+    CONV_DIRECT  /**< Slide the filters over the input, several outputs at once in registers. */
+};
+
+/**
+ * @brief A 2D convolution with stride 1, no padding and a fused ReLU activation.
+ */
+struct conv_layer
+{
+    int inChannels;      /**< Channels of the input. */
+    int inHeight;        /**< Rows of the input. */
+    int inWidth;         /**< Columns of the input. */
+    int outChannels;     /**< Number of filters (channels of the output). */
+    int kernelSize;      /**< Rows and columns of every filter. */
+    int outHeight;       /**< Rows of the output. */
+    int outWidth;        /**< Columns of the output. */
+    double *weights;     /**< Filters, outChannels x (inChannels x kernelSize x kernelSize). */
+    double *bias;        /**< Bias of every filter. */
+    double *gradWeights; /**< Accumulated gradients of the filters (same layout as weights). */
+    double *gradBias;    /**< Accumulated gradients of the biases. */
+};
+
+/**
+ * @brief A 2D max pooling with a square window and a stride equal to the window size.
+ */
+struct pool_layer
+{
+    int channels;  /**< Channels of the input and the output. */
+    int inHeight;  /**< Rows of the input. */
+    int inWidth;   /**< Columns of the input. */
+    int poolSize;  /**< Rows and columns of a window. */
+    int outHeight; /**< Rows of the output. */
+    int outWidth;  /**< Columns of the output. */
+};
+
+/**
+ * @brief Configuration of the convolutional network (conv -> max pool -> dense hidden layer -> output layer).
+ */
+struct conv_config
+{
+    int numFilters;                /**< Filters of the convolution, 0 disables the convolutional network. */
+    int kernelSize;                /**< Rows and columns of the filters. */
+    int poolSize;                  /**< Window of the max pooling. */
+    int batchSize;                 /**< Samples per mini-batch. */
+    enum conv_algorithm algorithm; /**< Implementation of the convolutions. */
+};
+
+/**
+ * @brief Returns the bytes needed in an arena for a convolution layer.
+ */
+size_t conv_layer_bytes(int inChannels, int outChannels, int kernelSize);
+
+/**
+ * @brief Initializes a convolution layer with He-uniform random filters and zero biases.
+ *
+ * @param layer Layer to initialize.
+ * @param arena Arena the weights and gradients are allocated from.
+ * @param inChannels Channels of the input.
+ * @param inHeight Rows of the input.
+ * @param inWidth Columns of the input.
+ * @param outChannels Number of filters.
+ * @param kernelSize Rows and columns of every filter.
+ */
+void conv_layer_init(struct conv_layer *layer, struct arena *arena, int inChannels, int inHeight, int inWidth,
+                     int outChannels, int kernelSize);
+
+/**
+ * @brief Initializes a max pooling layer. Rows and columns that do not fill a window are dropped.
+ */
+void pool_layer_init(struct pool_layer *layer, int channels, int inHeight, int inWidth, int poolSize);
+
+/**
+ * @brief Returns the number of doubles of workspace the im2col path needs.
+ *
+ * @param layer Convolution layer.
+ * @param numThreads Number of OpenMP threads that run the convolution.
+ * @return size_t Doubles of workspace (one unfolded input per thread, at least two).
+ */
+size_t conv2d_workspace_size(const struct conv_layer *layer, int numThreads);
+
+/**
+ * @brief Computes the convolution and ReLU of a batch by im2col and GEMM.
+ *
+ * Every sample is unfolded into a (inChannels x kernelSize x kernelSize) x (outHeight x outWidth) matrix
+ * that is multiplied with the filter matrix. Parallelized over the samples of the batch.
+ *
+ * @param layer Convolution layer.
+ * @param inputs Pointers to the inputs of the samples ([inChannels][inHeight][inWidth] each).
+ * @param batchSize Number of samples.
+ * @param outputs Outputs of the batch ([batchSize][outChannels][outHeight][outWidth]).
+ * @param workspace Workspace of conv2d_workspace_size doubles.
+ */
+void conv2d_forward_im2col(const struct conv_layer *layer, double *const inputs[], int batchSize, double outputs[], double workspace[]);
+
+/**
+ * @brief Computes the convolution and ReLU of a batch directly.
+ *
+ * CONV_BLOCK_WIDTH neighbouring outputs of a row are accumulated in registers while the filter
+ * is applied, every input value loaded is used for the whole block. Parallelized over samples and filters.
+ *
+ * @param layer Convolution layer.
+ * @param inputs Pointers to the inputs of the samples ([inChannels][inHeight][inWidth] each).
+ * @param batchSize Number of samples.
+ * @param outputs Outputs of the batch ([batchSize][outChannels][outHeight][outWidth]).
+ */
+void conv2d_forward_direct(const struct conv_layer *layer, double *const inputs[], int batchSize, double outputs[]);
+
+/**
+ * @brief Backward pass of the convolution by im2col and GEMM.
+ *
+ * The output errors are multiplied with the ReLU derivative (in place), then the gradients of the filters and
+ * biases are added to gradWeights and gradBias. The samples are processed one after another, the filter
+ * gradients are parallelized over the filters and the input errors over the input channels.
+ *
+ * @param layer Convolution layer.
+ * @param inputs Pointers to the inputs of the samples.
+ * @param batchSize Number of samples.
+ * @param outputs Outputs of the forward pass.
+ * @param outputError Errors of the outputs, multiplied with the ReLU derivative in place.
+ * @param inputError Receives the errors of the inputs ([batchSize][inChannels][inHeight][inWidth]), NULL if not needed.
+ * @param workspace Workspace of conv2d_workspace_size doubles.
+ */
+void conv2d_backward_im2col(const struct conv_layer *layer, double *const inputs[], int batchSize, const double outputs[],
+                            double outputError[], double inputError[], double workspace[]);
+
+/**
+ * @brief Backward pass of the convolution computed directly.
+ *
+ * Same results as conv2d_backward_im2col. The filter gradients are parallelized over the filters,
+ * the input errors over samples and input channels.
+ *
+ * @param layer Convolution layer.
+ * @param inputs Pointers to the inputs of the samples.
+ * @param batchSize Number of samples.
+ * @param outputs Outputs of the forward pass.
+ * @param outputError Errors of the outputs, multiplied with the ReLU derivative in place.
+ * @param inputError Receives the errors of the inputs, NULL if not needed.
+ */
+void conv2d_backward_direct(const struct conv_layer *layer, double *const inputs[], int batchSize, const double outputs[],
+                            double outputError[], double inputError[]);
+
+/**
+ * @brief Applies the accumulated gradients of a convolution layer and resets them to zero.
+ *
+ * @param layer Convolution layer.
+ * @param scale Factor the gradients are multiplied with (the learning rate).
+ */
+void conv_apply_gradients(struct conv_layer *layer, double scale);
+
+/**
+ * @brief Max pooling of a batch. Parallelized over samples and channels.
+ *
+ * @param layer Pooling layer.
+ * @param inputs Inputs of the batch ([batchSize][channels][inHeight][inWidth]).
+ * @param batchSize Number of samples.
+ * @param outputs Outputs of the batch ([batchSize][channels][outHeight][outWidth]).
+ * @param argmax Receives the input index (within the sample) of the maximum of every window.
+ */
+void maxpool_forward(const struct pool_layer *layer, const double inputs[], int batchSize, double outputs[], int argmax[]);
+
+/**
+ * @brief Backward pass of the max pooling: every output error is routed to the maximum of its window.
+ *
+ * @param layer Pooling layer.
+ * @param outputError Errors of the outputs.
+ * @param argmax Indices stored by maxpool_forward.
+ * @param batchSize Number of samples.
+ * @param inputError Receives the errors of the inputs (all other inputs get 0).
+ */
+void maxpool_backward(const struct pool_layer *layer, const double outputError[], const int argmax[], int batchSize, double inputError[]);
+
+/**
+ * @brief Trains a convolutional network: conv (ReLU) -> max pool -> dense hidden layer (sigmoid) -> output layer (sigmoid).
+ *
+ * The images are square (numInputs has to be a square number). Every mini-batch is propagated through
+ * all layers at once, the dense layers are parallelized over the samples of the batch.
+ * All gradients of a mini-batch are summed and applied with the learning rate.
+ * Prints the number of parameters and the loss and accuracy of every epoch.
+ *
+ * @param config Configuration of the convolutional layers.
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param numInputs Pixels per image.
+ * @param numHiddenNodes Nodes of the dense hidden layer.
+ * @param numOutputs Number of output nodes.
+ * @param epochs Number of epochs.
+ * @param learningRate Learning rate per sample.
+ * @param dropoutRate Dropout rate of the dense hidden layer.
+ * @return 0 on success, -1 if the configuration is invalid.
+ */
+int train_conv_network(const struct conv_config *config, double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                       int numInputs, int numHiddenNodes, int numOutputs, int epochs, double learningRate, double dropoutRate);
+
+#endif // MPT_NN_CONV_H
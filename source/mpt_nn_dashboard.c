@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "mpt_nn_utility.h"
+#include "mpt_nn_dashboard.h"
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Width of the progress bar in characters.
+ */
+#define DASHBOARD_BAR_WIDTH 40
+
+/**
+ * @brief State of the observer thread, only used by the observer.
+ */
+struct observer
+{
+    unsigned long seen;                     /**< Snapshots read so far. */
+    bool hasSample;                         /**< latest holds a sample. */
+    struct dashboard_sample latest;         /**< Last snapshot with an image. */
+    int numEpochs;                          /**< Finished epochs in the history. */
+    double epochLoss[DASHBOARD_MAX_EPOCHS]; /**< Average loss of the finished epochs. */
+    int epochCorrect[DASHBOARD_MAX_EPOCHS]; /**< Correct predictions of the finished epochs. */
+    long progress;                          /**< Samples trained according to the last snapshot. */
+    long lastProgress;                      /**< Samples trained when the throughput was last measured. */
+    double lastTime;                        /**< Time the throughput was last measured. */
+    double rate;                            /**< Samples per second. */
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Writes a snapshot into the next entry of the ring (single writer: the training loop).
+ */
+static void publish(struct dashboard *dashboard, const struct dashboard_sample *sample, int numPixels)
+{
+    unsigned long n = atomic_load_explicit(&dashboard->published, memory_order_relaxed);
+    struct dashboard_entry *entry = &dashboard->ring[n % DASHBOARD_RING_SIZE];
+
+    atomic_store_explicit(&entry->sequence, 2 * n + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&entry->sample, sample, offsetof(struct dashboard_sample, pixels) + numPixels * sizeof(double));
+    atomic_store_explicit(&entry->sequence, 2 * n + 2, memory_order_release);
+    atomic_store_explicit(&dashboard->published, n + 1, memory_order_release);
+}
+
+void dashboard_publish(struct dashboard *dashboard, int epoch, int index, const double *image, int expected,
+                       const double outputLayer[], int numOutputs, double loss, int correct)
+{
+    struct dashboard_sample sample;
+    int numPixels = dashboard->numInputs <= DASHBOARD_MAX_PIXELS ? dashboard->numInputs : 0;
+
+    atomic_store_explicit(&dashboard->requested, false, memory_order_relaxed);
+    sample.epoch = epoch;
+    sample.index = index;
+    sample.expected = expected;
+    sample.predicted = predict_label(outputLayer, numOutputs);
+    sample.confidence = outputLayer[sample.predicted];
+    sample.loss = loss;
+    sample.correct = correct;
+    sample.epochDone = false;
+    memcpy(sample.pixels, image, numPixels * sizeof(double));
+    publish(dashboard, &sample, numPixels);
+}
+
+void dashboard_publish_epoch(struct dashboard *dashboard, int epoch, double loss, int correct)
+{
+    struct dashboard_sample sample = {epoch, dashboard->numTrainingSets - 1, 0, 0, 0.0, loss, correct, true};
+    publish(dashboard, &sample, 0);
+}
+
+/**
+ * @brief Copies the snapshots published since the last call (entries overwritten in the meantime are skipped).
+ */
+static void collect(struct dashboard *dashboard, struct observer *observer)
+{
+    unsigned long published = atomic_load_explicit(&dashboard->published, memory_order_acquire);
+
+    if (published - observer->seen > DASHBOARD_RING_SIZE)
+    {
+        observer->seen = published - DASHBOARD_RING_SIZE;
+    }
+    for (; observer->seen < published; observer->seen++)
+    {
+        struct dashboard_entry *entry = &dashboard->ring[observer->seen % DASHBOARD_RING_SIZE];
+        struct dashboard_sample sample;
+        unsigned long sequence = atomic_load_explicit(&entry->sequence, memory_order_acquire);
+
+        if (sequence != 2 * observer->seen + 2)
+        {
+            continue;
+        }
+        memcpy(&sample, &entry->sample, sizeof(sample));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&entry->sequence, memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+
+        if (sample.epochDone)
+        {
+            if (observer->numEpochs < DASHBOARD_MAX_EPOCHS)
+            {
+                observer->epochLoss[observer->numEpochs] = sample.loss;
+                observer->epochCorrect[observer->numEpochs] = sample.correct;
+                observer->numEpochs++;
+            }
+        }
+        else
+        {
+            observer->latest = sample;
+            observer->hasSample = true;
+        }
+        observer->progress = (long)sample.epoch * dashboard->numTrainingSets + sample.index + 1;
+    }
+}
+
+/**
+ * @brief Redraws the whole dashboard.
+ */
+static void draw(const struct dashboard *dashboard, struct observer *observer)
+{
+    const struct dashboard_sample *latest = &observer->latest;
+    long total = (long)dashboard->epochs * dashboard->numTrainingSets;
+    double time = now_seconds();
+    int filled = total > 0 ? (int)(DASHBOARD_BAR_WIDTH * observer->progress / total) : 0;
+
+    // The throughput is only measured over intervals in which new snapshots arrived
+    if (observer->progress > observer->lastProgress && time > observer->lastTime)
+    {
+        observer->rate = (observer->progress - observer->lastProgress) / (time - observer->lastTime);
+        observer->lastProgress = observer->progress;
+        observer->lastTime = time;
+    }
+
+    printf("\033[H\033[2J");
+    printf("mpt_nn training - epoch %d/%d [", observer->hasSample ? latest->epoch + 1 : 1, dashboard->epochs);
+    for (int c = 0; c < DASHBOARD_BAR_WIDTH; c++)
+    {
+        putchar(c < filled ? '#' : '.');
+    }
+    printf("] %5.1f%% - %.0f samples/s\n", total > 0 ? 100.0 * observer->progress / total : 0.0, observer->rate);
+
+    if (observer->hasSample)
+    {
+        printf("Epoch so far: loss %.6f - accuracy %.2f%% (%d/%d)\n", latest->loss, 100.0 * latest->correct / (latest->index + 1),
+               latest->correct, latest->index + 1);
+        printf("Sample %d: expected %d - predicted %d (%.3f) %s\n", latest->index + 1, latest->expected, latest->predicted,
+               latest->confidence, latest->expected == latest->predicted ? "correct" : "wrong");
+        if (dashboard->numInputs <= DASHBOARD_MAX_PIXELS)
+        {
+            visualize_mnist_digit((double *)latest->pixels, dashboard->numInputs);
+        }
+    }
+
+    for (int e = 0; e < observer->numEpochs; e++)
+    {
+        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%%\n", e + 1, dashboard->epochs, observer->epochLoss[e],
+               100.0 * observer->epochCorrect[e] / dashboard->numTrainingSets);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Main function of the observer thread: requests a snapshot, sleeps, redraws.
+ *
+ * @param arg The dashboard.
+ * @return void* Always NULL.
+ */
+static void *observer_main(void *arg)
+{
+    struct dashboard *dashboard = arg;
+    struct observer observer = {0};
+
+    observer.lastTime = now_seconds();
+    pthread_mutex_lock(&dashboard->lock);
+    while (!atomic_load(&dashboard->stop))
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += DASHBOARD_REFRESH_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+
+        atomic_store_explicit(&dashboard->requested, true, memory_order_relaxed);
+        pthread_cond_timedwait(&dashboard->wake, &dashboard->lock, &deadline);
+        collect(dashboard, &observer);
+        draw(dashboard, &observer);
+    }
+    pthread_mutex_unlock(&dashboard->lock);
+    collect(dashboard, &observer);
+    draw(dashboard, &observer);
+    return NULL;
+}
+
+void dashboard_start(struct dashboard *dashboard, int numInputs, int numTrainingSets, int epochs)
+{
+    for (int e = 0; e < DASHBOARD_RING_SIZE; e++)
+    {
+        atomic_init(&dashboard->ring[e].sequence, 0);
+    }
+    atomic_init(&dashboard->published, 0);
+    atomic_init(&dashboard->requested, false);
+    atomic_init(&dashboard->stop, false);
+    pthread_mutex_init(&dashboard->lock, NULL);
+    pthread_cond_init(&dashboard->wake, NULL);
+    dashboard->numInputs = numInputs;
+    dashboard->numTrainingSets = numTrainingSets;
+    dashboard->epochs = epochs;
+    create_thread(&dashboard->thread, observer_main, dashboard);
+}
+
+void dashboard_stop(struct dashboard *dashboard)
+{
+    pthread_mutex_lock(&dashboard->lock);
+    atomic_store(&dashboard->stop, true);
+    pthread_cond_signal(&dashboard->wake);
+    pthread_mutex_unlock(&dashboard->lock);
+    pthread_join(dashboard->thread, NULL);
+    pthread_cond_destroy(&dashboard->wake);
+    pthread_mutex_destroy(&dashboard->lock);
+}
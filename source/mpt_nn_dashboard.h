@@ -0,0 +1,142 @@
+/**
+ * @file mpt_nn_dashboard.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the live training dashboard (-v).
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The visualization runs on an observer thread that redraws a terminal dashboard every DASHBOARD_REFRESH_MS.
+ * Before a redraw the observer raises a flag, the training loop tests it with one relaxed load per sample and
+ * only then copies the current image, prediction and running metrics into a lock-free ring buffer.
+ * The training loop never waits for the observer and never prints, so -v costs a load and a branch per sample
+ * and a copy of one image per refresh.
+ */
+#ifndef MPT_NN_DASHBOARD_H
+#define MPT_NN_DASHBOARD_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+/**
+ * @brief Time between two redraws of the dashboard in milliseconds.
+ */
+#define DASHBOARD_REFRESH_MS 100
+
+/**
+ * @brief Entries of the ring buffer between the training loop and the observer.
+ */
+#define DASHBOARD_RING_SIZE 8
+
+/**
+ * @brief Largest image shown on the dashboard.
+ */
+#define DASHBOARD_MAX_PIXELS 1024
+
+/**
+ * @brief Epochs kept in the history of the dashboard.
+ */
+#define DASHBOARD_MAX_EPOCHS 64
+
+/**
+ * @brief A snapshot of the training published to the observer.
+ */
+struct dashboard_sample
+{
+    int epoch;         /**< Epoch (from 0). */
+    int index;         /**< Index of the sample in the epoch. */
+    int expected;      /**< Label of the sample. */
+    int predicted;     /**< Predicted label. */
+    double confidence; /**< Output of the predicted label. */
+    double loss;       /**< Average loss of the epoch so far. */
+    int correct;       /**< Correct predictions of the epoch so far. */
+    bool epochDone;    /**< The snapshot is the summary of a finished epoch (no image). */
+    double pixels[DASHBOARD_MAX_PIXELS]; /**< The image of the sample. */
+};
+
+/**
+ * @brief An entry of the ring buffer, guarded by a sequence number (seqlock).
+ *
+ * The sequence number is odd while the training loop writes the entry. The observer copies an entry
+ * and discards the copy if the sequence number changed in the meantime.
+ */
+struct dashboard_entry
+{
+    atomic_ulong sequence;          /**< 2 * (publication number + 1) when complete, odd while written. */
+    struct dashboard_sample sample; /**< The snapshot. */
+};
+
+/**
+ * @brief The dashboard and its observer thread.
+ */
+struct dashboard
+{
+    struct dashboard_entry ring[DASHBOARD_RING_SIZE]; /**< Last published snapshots. */
+    atomic_ulong published;                           /**< Number of published snapshots. */
+    atomic_bool requested;                            /**< The observer waits for a new snapshot. */
+    atomic_bool stop;                                 /**< Ends the observer thread. */
+    pthread_t thread;                                 /**< Observer thread. */
+    pthread_mutex_t lock;                             /**< Only used by the observer and dashboard_stop. */
+    pthread_cond_t wake;                              /**< Wakes the observer early when it is stopped. */
+    int numInputs;                                    /**< Pixels per image. */
+    int numTrainingSets;                              /**< Samples per epoch. */
+    int epochs;                                       /**< Number of epochs. */
+};
+
+/**
+ * @brief Starts the observer thread.
+ *
+ * @param dashboard Dashboard to initialize.
+ * @param numInputs Pixels per image, images with more than DASHBOARD_MAX_PIXELS pixels are not shown.
+ * @param numTrainingSets Samples per epoch.
+ * @param epochs Number of epochs.
+ */
+void dashboard_start(struct dashboard *dashboard, int numInputs, int numTrainingSets, int epochs);
+
+/**
+ * @brief Returns true if the observer waits for a new snapshot. Called by the training loop for every sample.
+ *
+ * @param dashboard Dashboard.
+ * @return true if dashboard_publish should be called.
+ */
+static inline bool dashboard_wants_sample(struct dashboard *dashboard)
+{
+    return atomic_load_explicit(&dashboard->requested, memory_order_relaxed);
+}
+
+/**
+ * @brief Publishes a snapshot of the training, never waits for the observer.
+ *
+ * @param dashboard Dashboard.
+ * @param epoch Epoch (from 0).
+ * @param index Index of the sample in the epoch.
+ * @param image The image of the sample.
+ * @param expected Label of the sample.
+ * @param outputLayer Outputs of the network for the sample.
+ * @param numOutputs Number of outputs.
+ * @param loss Average loss of the epoch so far.
+ * @param correct Correct predictions of the epoch so far.
+ */
+void dashboard_publish(struct dashboard *dashboard, int epoch, int index, const double *image, int expected,
+                       const double outputLayer[], int numOutputs, double loss, int correct);
+
+/**
+ * @brief Publishes the summary of a finished epoch for the history of the dashboard.
+ *
+ * @param dashboard Dashboard.
+ * @param epoch Epoch (from 0).
+ * @param loss Average loss of the epoch.
+ * @param correct Correct predictions of the epoch.
+ */
+void dashboard_publish_epoch(struct dashboard *dashboard, int epoch, double loss, int correct);
+
+/**
+ * @brief Draws the last state and stops the observer thread.
+ *
+ * @param dashboard Dashboard.
+ */
+void dashboard_stop(struct dashboard *dashboard);
+
+#endif // MPT_NN_DASHBOARD_H
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mpt_nn_arena.h"
+#include "mpt_nn_dataset.h"
+
+static const char cacheMagic[8] = "MPTNNDS";
+
+/**
+ * @brief Adds bytes to a 64-bit FNV-1a hash.
+ *
+ * @param hash Hash so far.
+ * @param data Bytes to add.
+ * @param size Number of bytes.
+ * @return uint64_t The new hash.
+ */
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+int file_key(const char *const paths[], int numPaths, uint64_t *key)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (int f = 0; f < numPaths; f++)
+    {
+        struct stat st;
+        if (stat(paths[f], &st) != 0)
+        {
+            return -1;
+        }
+        int64_t fields[3] = {(int64_t)st.st_size, (int64_t)st.st_mtim.tv_sec, (int64_t)st.st_mtim.tv_nsec};
+        hash = fnv1a(hash, fields, sizeof(fields));
+    }
+    *key = hash;
+    return 0;
+}
+
+/**
+ * @brief Hashes the size and modification time of the source files.
+ *
+ * @param key Receives the key.
+ * @return 0 on success, -1 if a file does not exist.
+ */
+static int source_key(const char *imagePath, const char *labelPath, uint64_t *key)
+{
+    const char *paths[2] = {imagePath, labelPath};
+    return file_key(paths, 2, key);
+}
+
+/**
+ * @brief Returns the checksum of a header (all fields before headerChecksum).
+ */
+static uint64_t header_checksum(const struct dataset_cache_header *header)
+{
+    return fnv1a(0xcbf29ce484222325ULL, header, offsetof(struct dataset_cache_header, headerChecksum));
+}
+
+/**
+ * @brief Returns the size of a cache file with numSets samples.
+ */
+static size_t cache_size(int numSets, int numInputs, int numOutputs)
+{
+    return DATASET_CACHE_DATA_OFFSET + (size_t)numSets * (ARENA_ROW_STRIDE((size_t)numInputs) + ARENA_ROW_STRIDE((size_t)numOutputs)) * sizeof(double);
+}
+
+int map_dataset_cache(const char *path, const char *imagePath, const char *labelPath,
+                      int numSets, int numInputs, int numOutputs, struct dataset_cache *cache)
+{
+    struct dataset_cache_header header;
+    uint64_t key;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (source_key(imagePath, labelPath, &key) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != DATASET_CACHE_VERSION ||
+        header.headerChecksum != header_checksum(&header) || header.sourceKey != key || header.numSets < numSets ||
+        header.numInputs != numInputs || header.numOutputs != numOutputs ||
+        header.inputStride != ARENA_ROW_STRIDE((size_t)numInputs) || header.outputStride != ARENA_ROW_STRIDE((size_t)numOutputs))
+    {
+        close(fd);
+        return -1;
+    }
+
+    struct stat st;
+    size_t size = cache_size(header.numSets, numInputs, numOutputs);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != size)
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    cache->map = map;
+    cache->size = size;
+    cache->inputs = (double *)((char *)map + DATASET_CACHE_DATA_OFFSET);
+    cache->outputs = cache->inputs + (size_t)header.numSets * header.inputStride;
+    return 0;
+}
+
+int write_dataset_cache(const char *path, const char *imagePath, const char *labelPath, double **inputs, double **outputs,
+                        int numSets, int numInputs, int numOutputs)
+{
+    char page[DATASET_CACHE_DATA_OFFSET] = {0};
+    struct dataset_cache_header *header = (struct dataset_cache_header *)page;
+    char tmpPath[4096];
+
+    memcpy(header->magic, cacheMagic, sizeof(cacheMagic));
+    header->version = DATASET_CACHE_VERSION;
+    header->numSets = numSets;
+    header->numInputs = numInputs;
+    header->numOutputs = numOutputs;
+    header->inputStride = ARENA_ROW_STRIDE((size_t)numInputs);
+    header->outputStride = ARENA_ROW_STRIDE((size_t)numOutputs);
+    if (source_key(imagePath, labelPath, &header->sourceKey) != 0)
+    {
+        return -1;
+    }
+    header->headerChecksum = header_checksum(header);
+
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmpPath))
+    {
+        return -1;
+    }
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    // The rows of arena matrices are contiguous, so every matrix is written as one block including the padding
+    size_t inputCount = (size_t)numSets * header->inputStride;
+    size_t outputCount = (size_t)numSets * header->outputStride;
+    bool ok = fwrite(page, sizeof(page), 1, file) == 1 &&
+              (numSets == 0 || (fwrite(inputs[0], sizeof(double), inputCount, file) == inputCount &&
+                                fwrite(outputs[0], sizeof(double), outputCount, file) == outputCount));
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath, path) != 0)
+    {
+        remove(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+void unmap_dataset_cache(struct dataset_cache *cache)
+{
+    if (cache->map != NULL)
+    {
+        munmap(cache->map, cache->size);
+    }
+    cache->map = NULL;
+    cache->size = 0;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file mpt_nn_dataset.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the preprocessed binary cache of the training data.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * load_mnist parses the IDX files byte by byte, normalizes the pixels and expands the labels to one-hot vectors.
+ * The result is written once to a cache file next to the dataset, in exactly the layout the kernels read:
+ * doubles, one row per sample, every row padded to ARENA_ROW_STRIDE and the data starting on a page.
+ * Later runs map the cache file directly, so all preprocessing is skipped and the pages come from the page cache.
+ * The header stores the shape and a key of the source files (size and modification time), a changed
+ * dataset or a smaller cache invalidates it and it is rebuilt.
+ */
+#ifndef MPT_NN_DATASET_H
+#define MPT_NN_DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief MNIST training images (IDX format).
+ */
+#define MNIST_IMAGE_PATH "data/train-images.idx3-ubyte"
+
+/**
+ * @brief MNIST training labels (IDX format).
+ */
+#define MNIST_LABEL_PATH "data/train-labels.idx1-ubyte"
+
+/**
+ * @brief Cache of the preprocessed training data.
+ */
+#define MNIST_CACHE_PATH "data/train.mpt_nn_cache"
+
+/**
+ * @brief Version of the cache layout, caches of other versions are rebuilt.
+ */
+#define DATASET_CACHE_VERSION 1
+
+/**
+ * @brief Offset of the data in the cache file, the header is padded to a page.
+ */
+#define DATASET_CACHE_DATA_OFFSET 4096
+
+/**
+ * @brief Header at the start of a cache file.
+ */
+struct dataset_cache_header
+{
+    char magic[8];           /**< "MPTNNDS" and a terminating zero. */
+    uint32_t version;        /**< DATASET_CACHE_VERSION. */
+    int32_t numSets;         /**< Number of samples in the cache. */
+    int32_t numInputs;       /**< Inputs per sample. */
+    int32_t numOutputs;      /**< Outputs per sample (one-hot). */
+    uint64_t inputStride;    /**< Doubles between two input rows. */
+    uint64_t outputStride;   /**< Doubles between two output rows. */
+    uint64_t sourceKey;      /**< Hash of the size and modification time of the source files (file_key), not of their contents. */
+    uint64_t headerChecksum; /**< Hash of all fields above, detects a damaged header only. */
+};
+
+/**
+ * @brief A mapped cache file.
+ */
+struct dataset_cache
+{
+    void *map;       /**< Start of the mapping. */
+    size_t size;     /**< Size of the mapping in bytes. */
+    double *inputs;  /**< First input row, the rows have the stride ARENA_ROW_STRIDE(numInputs). */
+    double *outputs; /**< First output row, the rows have the stride ARENA_ROW_STRIDE(numOutputs). */
+};
+
+/**
+ * @brief Hashes the size and modification time of files, the key of the sources of a cache.
+ *
+ * The contents are not read: a file rewritten with the same size and modification time keeps its key.
+ *
+ * @param paths Files to hash.
+ * @param numPaths Number of files.
+ * @param key Receives the key.
+ * @return 0 on success, -1 if a file does not exist.
+ */
+int file_key(const char *const paths[], int numPaths, uint64_t *key);
+
+/**
+ * @brief Maps a cache file if it is valid for the source files and holds at least the requested samples.
+ *
+ * The mapping is private, so writes to the data do not reach the file. The pages are populated up front.
+ * Use arena_alloc_rows to get the row pointers of the inputs and outputs.
+ *
+ * @param path Cache file.
+ * @param imagePath Image file the cache was built from.
+ * @param labelPath Label file the cache was built from.
+ * @param numSets Number of samples needed.
+ * @param numInputs Inputs per sample.
+ * @param numOutputs Outputs per sample.
+ * @param cache Receives the mapping.
+ * @return 0 on success, -1 if the cache is missing, invalid or stale.
+ */
+int map_dataset_cache(const char *path, const char *imagePath, const char *labelPath,
+                      int numSets, int numInputs, int numOutputs, struct dataset_cache *cache);
+
+/**
+ * @brief Writes the preprocessed training data to a cache file.
+ *
+ * The matrices have to be arena matrices (contiguous rows with the stride ARENA_ROW_STRIDE).
+ * The file is written to a temporary file first and renamed, so a cancelled run never leaves a partial cache.
+ *
+ * @param path Cache file.
+ * @param imagePath Image file the data was loaded from.
+ * @param labelPath Label file the data was loaded from.
+ * @param inputs Inputs of the samples.
+ * @param outputs One-hot outputs of the samples.
+ * @param numSets Number of samples.
+ * @param numInputs Inputs per sample.
+ * @param numOutputs Outputs per sample.
+ * @return 0 on success, -1 on an error.
+ */
+int write_dataset_cache(const char *path, const char *imagePath, const char *labelPath, double **inputs, double **outputs,
+                        int numSets, int numInputs, int numOutputs);
+
+/**
+ * @brief Unmaps a cache file.
+ *
+ * @param cache Mapping of map_dataset_cache.
+ */
+void unmap_dataset_cache(struct dataset_cache *cache);
+
+#endif // MPT_NN_DATASET_H
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_dataset.h"
+#include "mpt_nn_distill.h"
+
+static const char cacheMagic[8] = "MPTNNTL";
+
+void compute_logits(const struct model *model, double **inputs, int numSets, float *logits)
+{
+    int H = model->numHiddenNodes, O = model->numOutputs;
+
+#pragma omp parallel
+    {
+        struct arena arena;
+        arena_create(&arena, arena_matrix_bytes(DISTILL_BATCH, H) + arena_matrix_bytes(DISTILL_BATCH, O));
+        double **hiddenLayer = arena_alloc_matrix(&arena, DISTILL_BATCH, H);
+        double **outputLayer = arena_alloc_matrix(&arena, DISTILL_BATCH, O);
+
+#pragma omp for schedule(dynamic)
+        for (int s = 0; s < numSets; s += DISTILL_BATCH)
+        {
+            int batchSize = numSets - s < DISTILL_BATCH ? numSets - s : DISTILL_BATCH;
+            forward_pass_batch(inputs + s, batchSize, hiddenLayer, outputLayer, model->hiddenLayerBias, model->outputLayerBias,
+                               model->hiddenWeights, model->outputWeights, model->numInputs, H, O);
+
+            // The outputs are saturated sigmoids, the logits are summed again from the hidden activations
+            for (int b = 0; b < batchSize; b++)
+            {
+                float *logit = logits + (size_t)(s + b) * O;
+                for (int i = 0; i < O; i++)
+                {
+                    double sum = model->outputLayerBias[i];
+                    for (int j = 0; j < H; j++)
+                    {
+                        sum += hiddenLayer[b][j] * model->outputWeights[j][i];
+                    }
+                    logit[i] = (float)sum;
+                }
+            }
+        }
+        arena_destroy(&arena);
+    }
+}
+
+/**
+ * @brief Reads the logits of the first numSets samples from a cache that is valid for the key.
+ *
+ * @return 0 on success, -1 if the cache is missing, invalid or stale.
+ */
+static int read_logit_cache(const char *path, uint64_t key, int numSets, int numOutputs, float *logits)
+{
+    struct distill_cache_header header;
+    struct stat st;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 &&
+              header.version == DISTILL_CACHE_VERSION && header.sourceKey == key && header.numSets >= numSets &&
+              header.numOutputs == numOutputs && fstat(fileno(file), &st) == 0 &&
+              (size_t)st.st_size == sizeof(header) + (size_t)header.numSets * numOutputs * sizeof(float) &&
+              fread(logits, sizeof(float), (size_t)numSets * numOutputs, file) == (size_t)numSets * numOutputs;
+    fclose(file);
+    return ok ? 0 : -1;
+}
+
+/**
+ * @brief Writes the logits to a cache, through a temporary file that is renamed.
+ *
+ * @return 0 on success, -1 on an error.
+ */
+static int write_logit_cache(const char *path, uint64_t key, int numSets, int numOutputs, const float *logits)
+{
+    struct distill_cache_header header;
+    char tmpPath[4096];
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = DISTILL_CACHE_VERSION;
+    header.numSets = numSets;
+    header.numOutputs = numOutputs;
+    header.sourceKey = key;
+
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(tmpPath))
+    {
+        return -1;
+    }
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(logits, sizeof(float), (size_t)numSets * numOutputs, file) == (size_t)numSets * numOutputs;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmpPath, path) != 0)
+    {
+        remove(tmpPath);
+        return -1;
+    }
+    return 0;
+}
+
+int distill_targets(const struct distill_config *config, double **inputs, double **outputs, int numSets,
+                    int numInputs, int numOutputs, double **targets)
+{
+    struct model teacher;
+    struct arena arena;
+    char cachePath[4096];
+    uint64_t key = 0;
+
+    if (config->temperature <= 0.0 || config->weight < 0.0 || config->weight > 1.0 || numSets <= 0)
+    {
+        return -1;
+    }
+    if (load_model(config->teacherPath, &teacher) != 0)
+    {
+        printf("Could not load the teacher %s\n", config->teacherPath);
+        return -1;
+    }
+    if (teacher.numInputs != numInputs || teacher.numOutputs != numOutputs)
+    {
+        printf("The teacher %s has %d inputs and %d outputs instead of %d and %d\n", config->teacherPath, teacher.numInputs,
+               teacher.numOutputs, numInputs, numOutputs);
+        free_model(&teacher);
+        return -1;
+    }
+
+    arena_create(&arena, arena_vector_bytes((size_t)numSets * numOutputs, sizeof(float)));
+    float *logits = arena_alloc(&arena, (size_t)numSets * numOutputs * sizeof(float));
+    const char *sources[3] = {config->teacherPath, MNIST_IMAGE_PATH, MNIST_LABEL_PATH};
+    bool useCache = config->useCache && file_key(sources, 3, &key) == 0 &&
+                    snprintf(cachePath, sizeof(cachePath), "%s%s", config->teacherPath, DISTILL_CACHE_SUFFIX) < (int)sizeof(cachePath);
+
+    if (useCache && read_logit_cache(cachePath, key, numSets, numOutputs, logits) == 0)
+    {
+        printf("Teacher %d-%d-%d: logits read from %s\n", teacher.numInputs, teacher.numHiddenNodes, teacher.numOutputs, cachePath);
+    }
+    else
+    {
+        double start = omp_get_wtime();
+        compute_logits(&teacher, inputs, numSets, logits);
+        printf("Teacher %d-%d-%d: logits of %d samples computed in %.2fs with %d threads\n", teacher.numInputs, teacher.numHiddenNodes,
+               teacher.numOutputs, numSets, omp_get_wtime() - start, omp_get_max_threads());
+        if (useCache)
+        {
+            if (write_logit_cache(cachePath, key, numSets, numOutputs, logits) == 0)
+            {
+                printf("Teacher logits cached in %s\n", cachePath);
+            }
+            else
+            {
+                printf("Error writing the cache %s\n", cachePath);
+            }
+        }
+    }
+
+    int correct = 0;
+    double logitLayer[numOutputs];
+    for (int s = 0; s < numSets; s++)
+    {
+        const float *logit = logits + (size_t)s * numOutputs;
+        for (int i = 0; i < numOutputs; i++)
+        {
+            logitLayer[i] = logit[i];
+            targets[s][i] = config->weight * sigmoid(logit[i] / config->temperature) + (1.0 - config->weight) * outputs[s][i];
+        }
+        correct += predict_label(logitLayer, numOutputs) == predict_label(outputs[s], numOutputs);
+    }
+    printf("Teacher accuracy: %.2f%% (%d/%d) - Targets: %.2f x sigmoid(logit / %.2f) + %.2f x label\n", 100.0 * correct / numSets,
+           correct, numSets, config->weight, config->temperature, 1.0 - config->weight);
+
+    arena_destroy(&arena);
+    free_model(&teacher);
+    return 0;
+}
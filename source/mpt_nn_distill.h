@@ -0,0 +1,102 @@
+/**
+ * @file mpt_nn_distill.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for training a small student network against the outputs of a trained teacher model.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The teacher classifies all training images once in a batched forward pass over all threads. Its logits (the sums
+ * of the output layer before the sigmoid) are stored as floats in a cache file next to the teacher model, later runs
+ * with the same teacher and dataset read the file instead of running the teacher. The student is trained with the
+ * usual squared error against a blend of the softened teacher outputs, sigmoid(logit / temperature), and the
+ * one-hot labels.
+ */
+#ifndef MPT_NN_DISTILL_H
+#define MPT_NN_DISTILL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Default temperature the teacher logits are divided by.
+ */
+#define DISTILL_DEFAULT_TEMPERATURE 2.0
+
+/**
+ * @brief Default weight of the teacher outputs in the targets, the labels get the rest.
+ */
+#define DISTILL_DEFAULT_WEIGHT 0.5
+
+/**
+ * @brief Images per batch of the teacher forward pass.
+ */
+#define DISTILL_BATCH 64
+
+/**
+ * @brief Version of the logit cache layout, caches of other versions are rebuilt.
+ */
+#define DISTILL_CACHE_VERSION 1
+
+/**
+ * @brief Appended to the path of the teacher model to get the path of its logit cache.
+ */
+#define DISTILL_CACHE_SUFFIX ".logits"
+
+/**
+ * @brief Header at the start of a logit cache, followed by numSets x numOutputs floats.
+ */
+struct distill_cache_header
+{
+    char magic[8];      /**< "MPTNNTL" and a terminating zero. */
+    uint32_t version;   /**< DISTILL_CACHE_VERSION. */
+    int32_t numSets;    /**< Number of samples in the cache. */
+    int32_t numOutputs; /**< Logits per sample. */
+    uint64_t sourceKey; /**< Key of the teacher model, the image and the label file (file_key). */
+};
+
+/**
+ * @brief Configuration of the distillation.
+ */
+struct distill_config
+{
+    const char *teacherPath; /**< Model file of the teacher. */
+    double temperature;      /**< The teacher logits are divided by the temperature before the sigmoid. */
+    double weight;           /**< Weight of the teacher outputs in the targets (0.0 - 1.0), the labels get 1 - weight. */
+    bool useCache;           /**< Reads and writes the logit cache next to the teacher model. */
+};
+
+/**
+ * @brief Computes the logits of a model for a data set.
+ *
+ * The samples are classified in batches of DISTILL_BATCH images with forward_pass_batch, the batches are
+ * distributed over the OpenMP threads.
+ *
+ * @param model Model.
+ * @param inputs 2D array of inputs.
+ * @param numSets Number of samples.
+ * @param logits Receives numSets x numOutputs logits (sums of the output layer before the sigmoid).
+ */
+void compute_logits(const struct model *model, double **inputs, int numSets, float *logits);
+
+/**
+ * @brief Computes the distillation targets of the training data.
+ *
+ * Loads the teacher, takes its logits from the cache or computes them (and writes the cache), prints the accuracy
+ * of the teacher and fills targets[s][j] = weight * sigmoid(logit / temperature) + (1 - weight) * outputs[s][j].
+ *
+ * @param config Configuration of the distillation.
+ * @param inputs 2D array of training inputs.
+ * @param outputs 2D array of one-hot training outputs.
+ * @param numSets Number of training samples.
+ * @param numInputs Number of input nodes.
+ * @param numOutputs Number of output nodes.
+ * @param targets Receives the targets (numSets x numOutputs).
+ * @return 0 on success, -1 if the teacher cannot be loaded, has another shape or the configuration is invalid.
+ */
+int distill_targets(const struct distill_config *config, double **inputs, double **outputs, int numSets,
+                    int numInputs, int numOutputs, double **targets);
+
+#endif // MPT_NN_DISTILL_H
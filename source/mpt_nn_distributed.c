@@ -0,0 +1,588 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_distributed.h"
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Synchronization counters of one process, each on its own cache line.
+ */
+struct ring_rank
+{
+    _Atomic long posted;   /**< Chunks written into the inbox of this process by its left neighbour. */
+    char padding1[ARENA_ALIGNMENT - sizeof(long)];
+    _Atomic long consumed; /**< Chunks this process has taken out of its inbox. */
+    char padding2[ARENA_ALIGNMENT - sizeof(long)];
+};
+
+/**
+ * @brief State shared by all processes of a ring.
+ */
+struct ring_shared
+{
+    _Atomic int aborted; /**< Set as soon as one process failed, all others stop waiting. */
+    char padding[ARENA_ALIGNMENT - sizeof(int)];
+    struct ring_rank ranks[];
+};
+
+/**
+ * @brief Number of busy-wait iterations before a waiting process starts to yield its CPU.
+ */
+#define RING_SPIN_COUNT 256
+
+int ring_create(struct ring *ring, int numProcesses, size_t count)
+{
+    size_t header = sizeof(struct ring_shared) + numProcesses * sizeof(struct ring_rank);
+
+    memset(ring, 0, sizeof(*ring));
+    ring->numProcesses = numProcesses;
+    ring->count = count;
+    ring->chunkCapacity = (count + numProcesses - 1) / numProcesses;
+    ring->sharedBytes = header + numProcesses * arena_vector_bytes(ring->chunkCapacity, sizeof(double));
+
+    void *memory = mmap(NULL, ring->sharedBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        return -1;
+    }
+    ring->shared = memory;
+    ring->slots = (double *)((char *)memory + header);
+    ring->children = calloc(numProcesses, sizeof(pid_t));
+    if (ring->children == NULL)
+    {
+        munmap(memory, ring->sharedBytes);
+        return -1;
+    }
+    return 0;
+}
+
+int ring_fork(struct ring *ring)
+{
+    pid_t parent = getpid();
+
+    fflush(stdout);
+    fflush(stderr);
+    // The ranks start with the mask of the process, not with the place of the calling thread (pin_process narrows it)
+    process_affinity_begin();
+    for (int r = 1; r < ring->numProcesses; r++)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            process_affinity_end();
+            atomic_store(&ring->shared->aborted, 1);
+            return -1;
+        }
+        if (pid == 0)
+        {
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() != parent)
+            {
+                _exit(EXIT_FAILURE);
+            }
+            ring->rank = r;
+            return r;
+        }
+        ring->children[r] = pid;
+    }
+    process_affinity_end();
+    return 0;
+}
+
+/**
+ * @brief Checks whether a process of the ring failed.
+ *
+ * Rank 0 reaps children that exited and marks the ring as aborted if one of them failed.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @return int 1 if the ring was aborted.
+ */
+static int ring_failed(struct ring *ring)
+{
+    if (ring->rank == 0)
+    {
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+        {
+            for (int r = 1; r < ring->numProcesses; r++)
+            {
+                if (ring->children[r] == pid)
+                {
+                    ring->children[r] = 0;
+                }
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                atomic_store(&ring->shared->aborted, 1);
+            }
+        }
+    }
+    return atomic_load_explicit(&ring->shared->aborted, memory_order_relaxed);
+}
+
+/**
+ * @brief Waits until a counter of the shared state reaches a value.
+ *
+ * Spins briefly, then yields the CPU so more processes than cores still make progress.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @param counter Counter to wait for.
+ * @param value Value the counter has to reach.
+ * @return 0 once the counter reached the value, -1 if the ring was aborted.
+ */
+static int ring_wait(struct ring *ring, _Atomic long *counter, long value)
+{
+    for (unsigned spins = 0; atomic_load_explicit(counter, memory_order_acquire) < value; spins++)
+    {
+        if (spins < RING_SPIN_COUNT)
+        {
+            continue;
+        }
+        if (spins % 1024 == 0 && ring_failed(ring))
+        {
+            return -1;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+/**
+ * @brief Sends a chunk to the right neighbour.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @param data Chunk to send.
+ * @param count Number of doubles in the chunk.
+ * @return 0 on success, -1 if the ring was aborted.
+ */
+static int ring_send(struct ring *ring, const double *data, size_t count)
+{
+    int right = (ring->rank + 1) % ring->numProcesses;
+    struct ring_rank *target = &ring->shared->ranks[right];
+    double *slot = (double *)((char *)ring->slots + right * arena_vector_bytes(ring->chunkCapacity, sizeof(double)));
+
+    // The previous chunk has to be taken out of the inbox before it is overwritten
+    if (ring_wait(ring, &target->consumed, ring->sequence) != 0)
+    {
+        return -1;
+    }
+    memcpy(slot, data, count * sizeof(double));
+    ring->sequence++;
+    atomic_store_explicit(&target->posted, ring->sequence, memory_order_release);
+    return 0;
+}
+
+/**
+ * @brief Receives a chunk from the left neighbour.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @param data Chunk that receives the data.
+ * @param count Number of doubles in the chunk.
+ * @param accumulate Add the received chunk to data instead of overwriting it.
+ * @return 0 on success, -1 if the ring was aborted.
+ */
+static int ring_recv(struct ring *ring, double *data, size_t count, bool accumulate)
+{
+    struct ring_rank *self = &ring->shared->ranks[ring->rank];
+    const double *slot = (const double *)((char *)ring->slots + ring->rank * arena_vector_bytes(ring->chunkCapacity, sizeof(double)));
+
+    // Every process sends exactly as many chunks as it receives, so the own sequence is the expected one
+    if (ring_wait(ring, &self->posted, ring->sequence) != 0)
+    {
+        return -1;
+    }
+    if (accumulate)
+    {
+#pragma omp simd
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i] += slot[i];
+        }
+    }
+    else
+    {
+        memcpy(data, slot, count * sizeof(double));
+    }
+    atomic_store_explicit(&self->consumed, ring->sequence, memory_order_release);
+    return 0;
+}
+
+int ring_allreduce(struct ring *ring, double data[], size_t count)
+{
+    int n = ring->numProcesses;
+
+    if (n == 1)
+    {
+        return 0;
+    }
+
+    // Chunk c covers [c * count / n, (c + 1) * count / n)
+    for (int step = 0; step < 2 * (n - 1); step++)
+    {
+        bool reduce = step < n - 1;
+        int s = reduce ? step : step - (n - 1);
+        int sendChunk = ((reduce ? ring->rank - s : ring->rank + 1 - s) % n + n) % n;
+        int recvChunk = ((reduce ? ring->rank - s - 1 : ring->rank - s) % n + n) % n;
+        size_t sendBegin = sendChunk * count / n, sendEnd = (sendChunk + 1) * count / n;
+        size_t recvBegin = recvChunk * count / n, recvEnd = (recvChunk + 1) * count / n;
+
+        if (ring_send(ring, data + sendBegin, sendEnd - sendBegin) != 0 ||
+            ring_recv(ring, data + recvBegin, recvEnd - recvBegin, reduce) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ring_join(struct ring *ring, int status)
+{
+    if (ring->rank != 0)
+    {
+        if (status != 0)
+        {
+            atomic_store(&ring->shared->aborted, 1);
+        }
+        fflush(stdout);
+        _exit(status == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int failed = status != 0;
+    if (failed)
+    {
+        atomic_store(&ring->shared->aborted, 1);
+    }
+    for (int r = 1; r < ring->numProcesses; r++)
+    {
+        int childStatus;
+        if (ring->children[r] > 0 && waitpid(ring->children[r], &childStatus, 0) == ring->children[r])
+        {
+            failed |= !WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0;
+        }
+    }
+    failed |= atomic_load(&ring->shared->aborted);
+
+    munmap(ring->shared, ring->sharedBytes);
+    free(ring->children);
+    memset(ring, 0, sizeof(*ring));
+    return failed ? -1 : 0;
+}
+
+/**
+ * @brief Background thread running the all-reduce of one mini-batch while the next one is computed.
+ */
+struct comm_thread
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct ring *ring;
+    double *job;    /**< Gradients to reduce, NULL if idle. */
+    size_t count;   /**< Doubles in job. */
+    bool done;      /**< Set when the job has been reduced. */
+    bool stop;      /**< Ends the thread. */
+    int result;     /**< Result of the last ring_allreduce. */
+    double seconds; /**< Total time spent in ring_allreduce. */
+};
+
+/**
+ * @brief Returns the current time of the monotonic clock in seconds.
+ */
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Main function of the communication thread.
+ *
+ * @param arg The comm_thread.
+ * @return void* Always NULL.
+ */
+static void *comm_main(void *arg)
+{
+    struct comm_thread *comm = arg;
+
+    pthread_mutex_lock(&comm->lock);
+    while (!comm->stop)
+    {
+        if (comm->job == NULL || comm->done)
+        {
+            pthread_cond_wait(&comm->cond, &comm->lock);
+            continue;
+        }
+        double *job = comm->job;
+        size_t count = comm->count;
+        pthread_mutex_unlock(&comm->lock);
+
+        double start = now_seconds();
+        int result = ring_allreduce(comm->ring, job, count);
+        double seconds = now_seconds() - start;
+
+        pthread_mutex_lock(&comm->lock);
+        comm->result = result;
+        comm->seconds += seconds;
+        comm->done = true;
+        pthread_cond_broadcast(&comm->cond);
+    }
+    pthread_mutex_unlock(&comm->lock);
+    return NULL;
+}
+
+/**
+ * @brief Hands a gradient vector to the communication thread.
+ */
+static void comm_start(struct comm_thread *comm, double *job, size_t count)
+{
+    pthread_mutex_lock(&comm->lock);
+    comm->job = job;
+    comm->count = count;
+    comm->done = false;
+    pthread_cond_broadcast(&comm->cond);
+    pthread_mutex_unlock(&comm->lock);
+}
+
+/**
+ * @brief Waits until the communication thread has reduced its job.
+ *
+ * @return int Result of the ring_allreduce.
+ */
+static int comm_wait(struct comm_thread *comm)
+{
+    pthread_mutex_lock(&comm->lock);
+    while (!comm->done)
+    {
+        pthread_cond_wait(&comm->cond, &comm->lock);
+    }
+    comm->job = NULL;
+    int result = comm->result;
+    pthread_mutex_unlock(&comm->lock);
+    return result;
+}
+
+/**
+ * @brief Pins the calling process to the rank-th CPU of the process mask from before --bind (see process_cpu).
+ */
+static void pin_process(int rank)
+{
+    cpu_set_t target;
+    int cpu = process_cpu(rank);
+
+    if (cpu < 0)
+    {
+        return;
+    }
+    CPU_ZERO(&target);
+    CPU_SET(cpu, &target);
+    sched_setaffinity(0, sizeof(target), &target);
+}
+
+/**
+ * @brief Returns the time the communication thread has spent in ring_allreduce.
+ */
+static double comm_seconds(struct comm_thread *comm)
+{
+    pthread_mutex_lock(&comm->lock);
+    double seconds = comm->seconds;
+    pthread_mutex_unlock(&comm->lock);
+    return seconds;
+}
+
+/**
+ * @brief Training loop of one process of the ring.
+ *
+ * @return int 0 on success, -1 if the ring was aborted.
+ */
+static int train_shard(const struct data_parallel_config *config, struct ring *ring, struct model *model,
+                       double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                       int epochs, double learningRate, double dropoutRate)
+{
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes, numOutputs = model->numOutputs;
+    size_t gradientSize = GRADIENT_SIZE(numInputs, numHiddenNodes, numOutputs);
+    // The first numTrainingSets % numProcesses processes get one sample more, all run as many mini-batches as the largest shard
+    int remainder = numTrainingSets % config->numProcesses;
+    int shardSize = numTrainingSets / config->numProcesses + (ring->rank < remainder);
+    int first = ring->rank * (numTrainingSets / config->numProcesses) + (ring->rank < remainder ? ring->rank : remainder);
+    int largestShard = numTrainingSets / config->numProcesses + (remainder > 0);
+    int numBatches = (largestShard + config->batchSize - 1) / config->batchSize;
+    double scale = learningRate / config->numProcesses;
+    int result = 0;
+
+    // The workspace is allocated after forking, so every process first touches its own copy
+    struct arena arena;
+    arena_create(&arena, 2 * arena_vector_bytes(gradientSize, sizeof(double)) +
+                             3 * arena_vector_bytes(numHiddenNodes, sizeof(double)) +
+                             2 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_vector_bytes(numInputs, sizeof(int)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)));
+    double *gradients[2] = {arena_alloc_vector(&arena, gradientSize), arena_alloc_vector(&arena, gradientSize)};
+    double *hiddenLayer = arena_alloc_vector(&arena, numHiddenNodes);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
+    double *outputLayer = arena_alloc_vector(&arena, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    int *inputIndex = arena_alloc(&arena, numInputs * sizeof(int));
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+
+    struct comm_thread comm = {.ring = ring};
+    pthread_mutex_init(&comm.lock, NULL);
+    pthread_cond_init(&comm.cond, NULL);
+    if (config->overlap)
+    {
+        pthread_create(&comm.thread, NULL, comm_main, &comm);
+    }
+
+    for (int epoch = 0; epoch < epochs && result == 0; epoch++)
+    {
+        double loss = 0.0, computeSeconds = 0.0, waitSeconds = 0.0;
+        double commSeconds = comm_seconds(&comm);
+        long correct = 0;
+        double *pending = NULL;
+        double epochStart = now_seconds();
+
+        for (int batch = 0; batch < numBatches && result == 0; batch++)
+        {
+            double *current = gradients[batch % 2];
+            int begin = first + batch * config->batchSize;
+            int end = begin + config->batchSize < first + shardSize ? begin + config->batchSize : first + shardSize;
+            double start = now_seconds();
+
+            memset(current, 0, gradientSize * sizeof(double));
+            for (int i = begin; i < end; i++)
+            {
+                int numActiveInputs = build_input_index(trainingInputs[i], numInputs, inputIndex);
+                forward_pass_sequential(trainingInputs[i], inputIndex, numActiveInputs, hiddenLayer, outputLayer, model->hiddenLayerBias, model->outputLayerBias,
+                                        model->hiddenWeights, model->outputWeights, numInputs, numHiddenNodes, numOutputs, dropoutRate, true, &mask);
+                for (int j = 0; j < numOutputs; j++)
+                {
+                    loss += pow(trainingOutputs[i][j] - outputLayer[j], 2);
+                }
+                correct += predict_label(outputLayer, numOutputs) == predict_label(trainingOutputs[i], numOutputs);
+                accumulate_gradients(trainingInputs[i], inputIndex, numActiveInputs, trainingOutputs[i], hiddenLayer, outputLayer,
+                                     model->outputWeights, deltaOutput, deltaHidden, current, numInputs, numHiddenNodes, numOutputs, &mask);
+            }
+            computeSeconds += now_seconds() - start;
+
+            start = now_seconds();
+            if (!config->overlap)
+            {
+                double reduceStart = now_seconds();
+                result = ring_allreduce(ring, current, gradientSize);
+                double reduceSeconds = now_seconds() - reduceStart;
+                pthread_mutex_lock(&comm.lock);
+                comm.seconds += reduceSeconds;
+                pthread_mutex_unlock(&comm.lock);
+                pending = current;
+            }
+            else if (pending != NULL)
+            {
+                result = comm_wait(&comm);
+            }
+            if (pending != NULL && result == 0)
+            {
+                apply_gradients(pending, scale, model->hiddenLayerBias, model->outputLayerBias,
+                                model->hiddenWeights, model->outputWeights, numInputs, numHiddenNodes, numOutputs);
+            }
+            waitSeconds += now_seconds() - start;
+
+            pending = NULL;
+            if (config->overlap && result == 0)
+            {
+                comm_start(&comm, current, gradientSize);
+                pending = current;
+            }
+        }
+
+        if (pending != NULL)
+        {
+            double start = now_seconds();
+            int last = comm_wait(&comm);
+            result = result == 0 ? last : result;
+            if (result == 0)
+            {
+                apply_gradients(pending, scale, model->hiddenLayerBias, model->outputLayerBias,
+                                model->hiddenWeights, model->outputWeights, numInputs, numHiddenNodes, numOutputs);
+            }
+            waitSeconds += now_seconds() - start;
+        }
+        if (result != 0)
+        {
+            break;
+        }
+
+        // Loss, accuracy and timings of all processes are summed with the same ring
+        double stats[6] = {loss, (double)correct, (double)(shardSize), computeSeconds, waitSeconds, comm_seconds(&comm) - commSeconds};
+        result = ring_allreduce(ring, stats, 6);
+        double seconds = now_seconds() - epochStart;
+        if (result == 0 && ring->rank == 0)
+        {
+            int n = config->numProcesses;
+            printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%.0f/%.0f) - %.0f samples/s - Per process: compute %.3fs, all-reduce %.3fs, waiting %.3fs (%.1f%%)\n",
+                   epoch + 1, epochs, stats[0] / stats[2], 100.0 * stats[1] / stats[2], stats[1], stats[2], stats[2] / seconds,
+                   stats[3] / n, stats[5] / n, stats[4] / n, 100.0 * stats[4] / n / seconds);
+        }
+    }
+
+    if (config->overlap)
+    {
+        pthread_mutex_lock(&comm.lock);
+        comm.stop = true;
+        pthread_cond_broadcast(&comm.cond);
+        pthread_mutex_unlock(&comm.lock);
+        pthread_join(comm.thread, NULL);
+    }
+    pthread_cond_destroy(&comm.cond);
+    pthread_mutex_destroy(&comm.lock);
+    arena_destroy(&arena);
+    return result;
+}
+
+int train_data_parallel(const struct data_parallel_config *config, struct model *model,
+                        double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                        int epochs, double learningRate, double dropoutRate)
+{
+    struct ring ring;
+
+    if (config->numProcesses <= 0 || config->batchSize <= 0 || numTrainingSets < config->numProcesses)
+    {
+        return -1;
+    }
+    if (ring_create(&ring, config->numProcesses, GRADIENT_SIZE(model->numInputs, model->numHiddenNodes, model->numOutputs)) != 0)
+    {
+        perror("Error creating the shared memory of the ring");
+        return -1;
+    }
+
+    int rank = ring_fork(&ring);
+    if (rank < 0)
+    {
+        perror("Error forking the worker processes");
+        return ring_join(&ring, -1);
+    }
+
+    // Every process draws different dropout masks
+    srand((unsigned int)rand() + rank);
+    if (config->pin)
+    {
+        pin_process(rank);
+    }
+
+    int result = train_shard(config, &ring, model, trainingInputs, trainingOutputs, numTrainingSets, epochs, learningRate, dropoutRate);
+    return ring_join(&ring, result);
+}
@@ -0,0 +1,132 @@
+/**
+ * @file mpt_nn_distributed.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the multi-process data-parallel training.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for training the mpt_nn with several worker processes on one host.
+ * Every process trains on its own shard of the training data. The gradients of every mini-batch are summed
+ * over all processes with a ring all-reduce through shared memory, so all processes apply the same update
+ * and keep identical weights. The ring only uses ring_send/ring_recv between neighbours, the shared-memory
+ * channel can be replaced by sockets to span several hosts.
+ */
+#ifndef MPT_NN_DISTRIBUTED_H
+#define MPT_NN_DISTRIBUTED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Default number of samples per process in one mini-batch.
+ */
+#define DATA_PARALLEL_DEFAULT_BATCH 32
+
+/**
+ * @brief A ring of processes connected through shared memory.
+ */
+struct ring
+{
+    int numProcesses;           /**< Number of processes in the ring. */
+    int rank;                   /**< Position of the calling process in the ring (0 is the parent). */
+    size_t count;               /**< Maximum number of doubles per all-reduce. */
+    size_t chunkCapacity;       /**< Doubles per inbox slot. */
+    long sequence;              /**< Number of chunks sent by this process so far. */
+    struct ring_shared *shared; /**< Shared synchronization state of all processes. */
+    size_t sharedBytes;         /**< Size of the shared mapping. */
+    double *slots;              /**< One inbox slot per process, written by its left neighbour. */
+    pid_t *children;            /**< Process ids of the ranks 1..numProcesses-1 (only valid in rank 0). */
+};
+
+/**
+ * @brief Configuration of the data-parallel training.
+ */
+struct data_parallel_config
+{
+    int numProcesses; /**< Number of worker processes (including the calling process). */
+    int batchSize;    /**< Samples per process in one mini-batch. */
+    bool overlap;     /**< Overlap the all-reduce of a mini-batch with the computation of the next one. */
+    bool pin;         /**< Pin process r to the r-th CPU of the affinity mask the process had before --bind. */
+};
+
+/**
+ * @brief Creates the shared memory of a ring. Has to be called before ring_fork.
+ *
+ * @param ring Ring to initialize.
+ * @param numProcesses Number of processes in the ring.
+ * @param count Maximum number of doubles reduced by one ring_allreduce.
+ * @return 0 on success, -1 if the shared memory could not be created.
+ */
+int ring_create(struct ring *ring, int numProcesses, size_t count);
+
+/**
+ * @brief Forks the ranks 1..numProcesses-1 of the ring.
+ *
+ * Children are killed if the parent dies. stdout is flushed before forking.
+ *
+ * @param ring Ring created with ring_create.
+ * @return int Rank of the calling process (0 in the parent), -1 if forking failed.
+ */
+int ring_fork(struct ring *ring);
+
+/**
+ * @brief Sums a vector over all processes of the ring (ring all-reduce).
+ *
+ * The vector is split into one chunk per process. In numProcesses - 1 reduce-scatter steps every process
+ * adds the chunk received from its left neighbour and forwards it, afterwards every process owns one fully
+ * reduced chunk. In numProcesses - 1 allgather steps the reduced chunks are passed around the ring.
+ * Every process sends and receives 2 * (numProcesses - 1) / numProcesses of the vector, independent of the ring size.
+ * All processes have to call ring_allreduce in the same order with the same count.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @param data Vector that is replaced by the sum over all processes.
+ * @param count Number of doubles in data (at most the count passed to ring_create).
+ * @return 0 on success, -1 if another process of the ring failed.
+ */
+int ring_allreduce(struct ring *ring, double data[], size_t count);
+
+/**
+ * @brief Ends the participation of the calling process in the ring.
+ *
+ * Child processes exit with the given status and never return.
+ * The parent waits for all children and releases the shared memory.
+ *
+ * @param ring Ring the calling process belongs to.
+ * @param status 0 if the calling process succeeded.
+ * @return 0 if all processes succeeded, -1 otherwise.
+ */
+int ring_join(struct ring *ring, int status);
+
+/**
+ * @brief Trains a model with several processes on shards of the training data.
+ *
+ * The training data is split into numProcesses shards, the first numTrainingSets % numProcesses shards have one
+ * sample more. Every process computes the gradients of batchSize samples of its shard, then the gradients are
+ * summed with ring_allreduce and every process applies learningRate / numProcesses times the sum. With one process
+ * and a batch size of 1 this is the per-sample SGD of the sequential mode.
+ *
+ * With overlap the all-reduce of mini-batch k runs on a communication thread while mini-batch k + 1 is computed,
+ * its update is applied afterwards (the gradients are one mini-batch stale).
+ *
+ * Prints the loss, accuracy, throughput and the share of time spent waiting for the all-reduce of every epoch.
+ * Returns in the calling process only, with the trained weights in model.
+ *
+ * @param config Configuration of the data-parallel training.
+ * @param model Initialized weights and biases, replaced by the trained ones.
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param epochs Number of epochs.
+ * @param learningRate Learning rate per sample.
+ * @param dropoutRate Dropout rate of the hidden layer.
+ * @return 0 on success, -1 if a process failed.
+ */
+int train_data_parallel(const struct data_parallel_config *config, struct model *model,
+                        double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                        int epochs, double learningRate, double dropoutRate);
+
+#endif // MPT_NN_DISTRIBUTED_H
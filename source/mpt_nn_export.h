@@ -0,0 +1,40 @@
+/**
+ * @file mpt_nn_export.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the ahead-of-time export of a trained model into a standalone C source file.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The generated file needs only the C library and libm: the weights and biases are compiled in as 64-byte aligned
+ * static const arrays (hexadecimal floating-point literals, so every weight is reproduced exactly), the rows are padded
+ * to whole vectors with zeros. The forward function has the shape as compile-time constants, no allocation and no
+ * dispatch, and computes the same sums in the same order as forward_pass_batch: the rows of the zero pixels are skipped,
+ * which is faster on images that are mostly zero than a dense loop over all inputs. With MPT_NN_AOT_MAIN defined the
+ * file also contains a main function that classifies raw images (numInputs bytes each) from stdin.
+ */
+#ifndef MPT_NN_EXPORT_H
+#define MPT_NN_EXPORT_H
+
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Prefix of the functions and constants of the generated file.
+ */
+#define EXPORT_DEFAULT_PREFIX "mpt_nn_aot"
+
+/**
+ * @brief Writes a model as a standalone C source file.
+ *
+ * The file defines <prefix>_forward(const double input[], double output[]), which computes the outputs of an image
+ * with pixels in [0, 1], and <prefix>_classify(const unsigned char pixels[]), which returns the label of raw pixels.
+ *
+ * @param model Model to export.
+ * @param path C source file to write.
+ * @param prefix Prefix of the generated functions and constants, a valid C identifier.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int export_model_c(const struct model *model, const char *path, const char *prefix);
+
+#endif // MPT_NN_EXPORT_H
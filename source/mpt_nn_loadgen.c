@@ -0,0 +1,336 @@
+/**
+ * @file mpt_nn_loadgen.c
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Load generator for the mpt_nn inference server.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Opens several connections to a running server (see mpt_nn_server.h), keeps a fixed number of
+ * images in flight on every connection and reports the throughput, the latency percentiles
+ * measured by the client and the accuracy of the replies.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "mpt_nn_server.h"
+
+/**
+ * @brief Images used by the load generator.
+ */
+struct image_set
+{
+    unsigned char *pixels; /**< numImages x numInputs pixels. */
+    unsigned char *labels; /**< Label of every image, NULL for random images. */
+    int numImages;
+    int numInputs;
+};
+
+/**
+ * @brief State of one client connection.
+ */
+struct client
+{
+    const char *address;
+    const struct image_set *images;
+    int numRequests;      /**< Images sent on this connection. */
+    int depth;            /**< Images in flight on this connection. */
+    int offset;           /**< First image of this connection. */
+    double *latencies;    /**< Latency of every request in microseconds. */
+    int correct;          /**< Replies matching the label. */
+    int failed;           /**< Set if the connection broke. */
+};
+
+/**
+ * @brief Returns the difference of two points in time in microseconds.
+ */
+static double elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * @brief Compares two doubles for qsort.
+ */
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Loads MNIST images and labels, or generates random images if the files are missing.
+ *
+ * @param images Image set to fill.
+ * @param numImages Number of images.
+ * @param numInputs Pixels per image.
+ */
+static void load_images(struct image_set *images, int numImages, int numInputs)
+{
+    FILE *imageFile = fopen("data/train-images.idx3-ubyte", "rb");
+    FILE *labelFile = fopen("data/train-labels.idx1-ubyte", "rb");
+
+    images->numImages = numImages;
+    images->numInputs = numInputs;
+    images->pixels = malloc((size_t)numImages * numInputs);
+    images->labels = malloc(numImages);
+    if (!images->pixels || !images->labels)
+    {
+        fprintf(stderr, "Failed to allocate memory for the images\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (imageFile != NULL && labelFile != NULL && fseek(imageFile, 16, SEEK_SET) == 0 && fseek(labelFile, 8, SEEK_SET) == 0 &&
+        fread(images->pixels, numInputs, numImages, imageFile) == (size_t)numImages &&
+        fread(images->labels, 1, numImages, labelFile) == (size_t)numImages)
+    {
+        printf("Using %d MNIST images\n", numImages);
+    }
+    else
+    {
+        printf("MNIST files not found, using %d random images\n", numImages);
+        srand(1);
+        for (size_t i = 0; i < (size_t)numImages * numInputs; i++)
+        {
+            images->pixels[i] = rand() % 5 == 0 ? rand() % 256 : 0;
+        }
+        free(images->labels);
+        images->labels = NULL;
+    }
+
+    if (imageFile != NULL)
+    {
+        fclose(imageFile);
+    }
+    if (labelFile != NULL)
+    {
+        fclose(labelFile);
+    }
+}
+
+/**
+ * @brief Client thread: sends the images of one connection and receives the replies.
+ *
+ * @param arg Client state.
+ * @return void* Always NULL.
+ */
+static void *client_main(void *arg)
+{
+    struct client *client = arg;
+    const struct image_set *images = client->images;
+    struct sockaddr_storage addr;
+    socklen_t len;
+    struct timespec *sendTimes = malloc(client->numRequests * sizeof(struct timespec));
+    int sent = 0, received = 0;
+
+    if (sendTimes == NULL || server_address(client->address, &addr, &len) != 0)
+    {
+        client->failed = 1;
+        free(sendTimes);
+        return NULL;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, len) != 0)
+    {
+        perror("Error connecting to the server");
+        client->failed = 1;
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        free(sendTimes);
+        return NULL;
+    }
+
+    while (received < client->numRequests && !client->failed)
+    {
+        while (sent < client->numRequests && sent - received < client->depth)
+        {
+            int image = (client->offset + sent) % images->numImages;
+            const unsigned char *pixels = images->pixels + (size_t)image * images->numInputs;
+            size_t done = 0;
+
+            clock_gettime(CLOCK_MONOTONIC, &sendTimes[sent]);
+            while (done < (size_t)images->numInputs)
+            {
+                ssize_t n = send(fd, pixels + done, images->numInputs - done, MSG_NOSIGNAL);
+                if (n <= 0 && errno != EINTR)
+                {
+                    client->failed = 1;
+                    break;
+                }
+                done += n > 0 ? n : 0;
+            }
+            sent++;
+        }
+
+        struct server_reply reply;
+        size_t got = 0;
+        while (got < sizeof(reply) && !client->failed)
+        {
+            ssize_t n = recv(fd, (char *)&reply + got, sizeof(reply) - got, 0);
+            if (n <= 0 && errno != EINTR)
+            {
+                client->failed = 1;
+                break;
+            }
+            got += n > 0 ? n : 0;
+        }
+        if (client->failed || reply.id >= (uint32_t)sent)
+        {
+            client->failed = 1;
+            break;
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        client->latencies[received++] = elapsed_us(&sendTimes[reply.id], &now);
+        if (images->labels != NULL && reply.label == images->labels[(client->offset + reply.id) % images->numImages])
+        {
+            client->correct++;
+        }
+    }
+
+    close(fd);
+    free(sendTimes);
+    return NULL;
+}
+
+/**
+ * @brief Prints the available command line options of the load generator.
+ */
+static void print_loadgen_options(void)
+{
+    printf("Usage: mpt_nn_loadgen -a <address> [options]\n");
+    printf("  -a, --address     <address>            Server address [unix:/path][/path][tcp:port][port]\n");
+    printf("  -c, --connections <numConnections>     Number of concurrent connections (default 8)\n");
+    printf("  -d, --depth       <depth>              Images in flight per connection (default 4)\n");
+    printf("  -i, --inputs      <numInputs>          Pixels per image (default 784)\n");
+    printf("  -r, --requests    <numRequests>        Images sent per connection (default 10000)\n");
+    printf("  -?, --help                             Display this help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *address = NULL;
+    int numConnections = 8;
+    int depth = 4;
+    int numInputs = 784;
+    int numRequests = 10000;
+    int opt;
+
+    struct option longopt[] =
+        {
+            {"help", no_argument, NULL, '?'},
+            {"address", required_argument, NULL, 'a'},
+            {"connections", required_argument, NULL, 'c'},
+            {"depth", required_argument, NULL, 'd'},
+            {"inputs", required_argument, NULL, 'i'},
+            {"requests", required_argument, NULL, 'r'},
+            {0, 0, 0, 0}};
+
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, "a:c:d:i:r:", longopt, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'a':
+            address = optarg;
+            break;
+        case 'c':
+            numConnections = atoi(optarg);
+            break;
+        case 'd':
+            depth = atoi(optarg);
+            break;
+        case 'i':
+            numInputs = atoi(optarg);
+            break;
+        case 'r':
+            numRequests = atoi(optarg);
+            break;
+        default:
+            print_loadgen_options();
+            exit(opt == '?' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (address == NULL || numConnections <= 0 || depth <= 0 || numInputs <= 0 || numRequests <= 0)
+    {
+        print_loadgen_options();
+        exit(EXIT_FAILURE);
+    }
+
+    struct image_set images;
+    load_images(&images, 60000, numInputs);
+
+    struct client *clients = calloc(numConnections, sizeof(struct client));
+    pthread_t *threads = malloc(numConnections * sizeof(pthread_t));
+    double *latencies = malloc((size_t)numConnections * numRequests * sizeof(double));
+    if (!clients || !threads || !latencies)
+    {
+        fprintf(stderr, "Failed to allocate memory for the clients\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int c = 0; c < numConnections; c++)
+    {
+        clients[c] = (struct client){address, &images, numRequests, depth, c * numRequests,
+                                     latencies + (size_t)c * numRequests, 0, 0};
+        pthread_create(&threads[c], NULL, client_main, &clients[c]);
+    }
+
+    long total = 0, correct = 0;
+    int failed = 0;
+    for (int c = 0; c < numConnections; c++)
+    {
+        pthread_join(threads[c], NULL);
+        correct += clients[c].correct;
+        failed += clients[c].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // The latencies of every connection are compacted to the front for the percentiles
+    for (int c = 0; c < numConnections; c++)
+    {
+        if (!clients[c].failed)
+        {
+            memmove(latencies + total, clients[c].latencies, numRequests * sizeof(double));
+            total += numRequests;
+        }
+    }
+
+    double seconds = elapsed_us(&start, &end) / 1e6;
+    printf("Connections: %d (failed %d) - Depth: %d - Requests: %ld in %.3fs (%.1f/s)\n",
+           numConnections, failed, depth, total, seconds, total / seconds);
+    if (total > 0)
+    {
+        qsort(latencies, total, sizeof(double), compare_double);
+        printf("Latency p50: %.0fus p90: %.0fus p99: %.0fus max: %.0fus\n",
+               latencies[(long)(0.50 * (total - 1))], latencies[(long)(0.90 * (total - 1))],
+               latencies[(long)(0.99 * (total - 1))], latencies[total - 1]);
+    }
+    if (images.labels != NULL && total > 0)
+    {
+        printf("Accuracy: %.2f%% (%ld/%ld)\n", 100.0 * correct / total, correct, total);
+    }
+
+    free(latencies);
+    free(threads);
+    free(clients);
+    free(images.pixels);
+    free(images.labels);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
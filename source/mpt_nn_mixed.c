@@ -0,0 +1,862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h>
+#include <immintrin.h>
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_mixed.h"
+
+/**
+ * @brief Rounds n up to a multiple of m.
+ */
+#define MIXED_PAD(n, m) (((n) + (m) - 1) / (m) * (m))
+
+/**
+ * @brief Master weights in fp32 and their 16 bit copies in pairs of rows.
+ */
+struct mixed_weights
+{
+    enum precision precision;
+    int numInputs;
+    int numHiddenNodes;
+    int numOutputs;
+    int inputPairs;        /**< Pairs of inputs: numInputs / 2 rounded up. */
+    int hiddenColumns;     /**< numHiddenNodes padded to MIXED_LANES (even). */
+    int outputColumns;     /**< numOutputs padded to MIXED_LANES (even). */
+    float *hiddenWeights;  /**< Master weights between input and hidden layer (numInputs x numHiddenNodes). */
+    float *outputWeights;  /**< Master weights between hidden and output layer (numHiddenNodes x numOutputs). */
+    float *hiddenBias;     /**< Master biases of the hidden layer (hiddenColumns, padding 0). */
+    float *outputBias;     /**< Master biases of the output layer (outputColumns, padding 0). */
+    uint32_t *hiddenLow;   /**< 16 bit hidden weights in pairs of rows [inputPairs][hiddenColumns]. */
+    uint32_t *outputLow;   /**< 16 bit output weights in pairs of rows [hiddenColumns / 2][outputColumns]. */
+    uint32_t *outputLowT;  /**< 16 bit transposed output weights [outputColumns / 2][hiddenColumns] for the errors of the hidden layer. */
+};
+
+/**
+ * @brief Buffers of the samples of a mini-batch.
+ */
+struct mixed_batch
+{
+    uint32_t **inputs;     /**< 16 bit inputs in pairs (inputPairs per sample), rows of the rounded training data. */
+    int **inputIndex;      /**< Pairs with a nonzero input. */
+    int *numInputPairs;    /**< Number of pairs with a nonzero input. */
+    uint32_t **hidden;     /**< 16 bit hidden activations in pairs (hiddenColumns / 2 per sample), 0 for dropped neurons. */
+    int **hiddenIndex;     /**< Pairs with a nonzero hidden activation. */
+    int *numHiddenPairs;   /**< Number of pairs with a nonzero hidden activation. */
+    float **keep;          /**< Dropout factor of every hidden neuron: the dropout scale or 0. */
+    float **sums;          /**< fp32 sums of the hidden layer, then the (16 bit rounded) errors of the hidden layer. */
+    float **outputs;       /**< Output activations (outputColumns per sample). */
+    uint32_t **deltaOutput; /**< Scaled 16 bit errors of the outputs in pairs (outputColumns / 2 per sample). */
+    float **outputErrors;  /**< The 16 bit errors of the outputs converted back to fp32 for the updates. */
+    unsigned char *touched; /**< 1 for every pair of input rows updated by the mini-batch (inputPairs). */
+    double *sampleLoss;    /**< Loss of every sample. */
+    int *sampleCorrect;    /**< 1 for every correctly predicted sample. */
+    int *overflow;         /**< 1 for every sample with an error beyond the 16 bit range. */
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int parse_precision(const char *name, enum precision *precision)
+{
+    if (strcmp(name, "fp64") == 0)
+    {
+        *precision = PRECISION_FP64;
+    }
+    else if (strcmp(name, "bf16") == 0)
+    {
+        *precision = PRECISION_BF16;
+    }
+    else if (strcmp(name, "fp16") == 0)
+    {
+        *precision = PRECISION_FP16;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+const char *precision_name(enum precision precision)
+{
+    switch (precision)
+    {
+    case PRECISION_BF16:
+        return "bf16";
+    case PRECISION_FP16:
+        return "fp16";
+    default:
+        return "fp64";
+    }
+}
+
+uint16_t float_to_bf16(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t rounded = (bits + 0x7fffu + ((bits >> 16) & 1u)) >> 16;
+    uint32_t nan = (bits >> 16) | 0x0040u;
+
+    // Quiet NaN, rounding could turn the payload into infinity (a select, so that loops stay vectorizable)
+    return (uint16_t)((bits & 0x7fffffffu) > 0x7f800000u ? nan : rounded);
+}
+
+float bf16_to_float(uint16_t bits)
+{
+    uint32_t wide = (uint32_t)bits << 16;
+    float value;
+    memcpy(&value, &wide, sizeof(value));
+    return value;
+}
+
+uint16_t float_to_fp16(float value)
+{
+    // Converted by F16C / AVX512-FP16 if the CPU has it, by libgcc otherwise
+    _Float16 half = (_Float16)value;
+    uint16_t bits;
+    memcpy(&bits, &half, sizeof(bits));
+    return bits;
+}
+
+float fp16_to_float(uint16_t bits)
+{
+    _Float16 half;
+    memcpy(&half, &bits, sizeof(half));
+    return (float)half;
+}
+
+bool mixed_uses_hardware(enum precision precision)
+{
+#ifdef __AVX512BF16__
+    return precision == PRECISION_BF16;
+#else
+    (void)precision;
+    return false;
+#endif
+}
+
+static inline __attribute__((always_inline)) uint16_t to_low(enum precision precision, float value)
+{
+    return precision == PRECISION_BF16 ? float_to_bf16(value) : float_to_fp16(value);
+}
+
+static inline __attribute__((always_inline)) float to_float(enum precision precision, uint16_t bits)
+{
+    return precision == PRECISION_BF16 ? bf16_to_float(bits) : fp16_to_float(bits);
+}
+
+static inline __attribute__((always_inline)) uint32_t to_pair(enum precision precision, float first, float second)
+{
+    return to_low(precision, first) | (uint32_t)to_low(precision, second) << 16;
+}
+
+/**
+ * @brief The sigmoid of mpt_nn.c in fp32, the sums are fp32 anyway.
+ */
+static inline float sigmoid_float(float x)
+{
+    return 1.0f / (1.0f + expf(-x));
+}
+
+/**
+ * @brief Software version of pair_products, the format is a constant after inlining.
+ */
+static inline __attribute__((always_inline)) void pair_products_soft(enum precision precision, const uint32_t *pairs, const int *index, int numActive,
+                                                                     const uint32_t *weights, int columns, float *sums)
+{
+    for (int c = 0; c < columns; c += MIXED_LANES)
+    {
+        float acc[MIXED_LANES];
+        for (int l = 0; l < MIXED_LANES; l++)
+        {
+            acc[l] = sums[c + l];
+        }
+        for (int k = 0; k < numActive; k++)
+        {
+            int p = index[k];
+            float a0 = to_float(precision, pairs[p] & 0xffffu);
+            float a1 = to_float(precision, pairs[p] >> 16);
+            const uint32_t *w = weights + (size_t)p * columns + c;
+#pragma omp simd
+            for (int l = 0; l < MIXED_LANES; l++)
+            {
+                acc[l] += a0 * to_float(precision, w[l] & 0xffffu) + a1 * to_float(precision, w[l] >> 16);
+            }
+        }
+        for (int l = 0; l < MIXED_LANES; l++)
+        {
+            sums[c + l] = acc[l];
+        }
+    }
+}
+
+/**
+ * @brief Adds the products of the active pairs of a 16 bit vector and the row pairs of a 16 bit matrix to fp32 sums:
+ *        sums[c] += a[2p] * w[2p][c] + a[2p + 1] * w[2p + 1][c] for every active pair p.
+ *
+ * @param precision Number format of the vector and the matrix.
+ * @param pairs Vector in pairs (element 2p in the low, 2p + 1 in the high half).
+ * @param index Active pairs.
+ * @param numActive Number of active pairs.
+ * @param weights Matrix in pairs of rows ([pairs][columns], row 2p in the low, 2p + 1 in the high half).
+ * @param columns Columns of the matrix (multiple of MIXED_LANES).
+ * @param sums fp32 sums (columns).
+ */
+static void pair_products(enum precision precision, const uint32_t *pairs, const int *index, int numActive,
+                          const uint32_t *weights, int columns, float *sums)
+{
+#ifdef __AVX512BF16__
+    if (precision == PRECISION_BF16)
+    {
+        for (int c = 0; c < columns; c += MIXED_LANES)
+        {
+            // Two sums hide the latency of vdpbf16ps
+            __m512 acc0 = _mm512_loadu_ps(sums + c);
+            __m512 acc1 = _mm512_setzero_ps();
+            int k = 0;
+            for (; k + 1 < numActive; k += 2)
+            {
+                __m512i a0 = _mm512_set1_epi32((int)pairs[index[k]]);
+                __m512i a1 = _mm512_set1_epi32((int)pairs[index[k + 1]]);
+                __m512i w0 = _mm512_loadu_si512(weights + (size_t)index[k] * columns + c);
+                __m512i w1 = _mm512_loadu_si512(weights + (size_t)index[k + 1] * columns + c);
+                acc0 = _mm512_dpbf16_ps(acc0, (__m512bh)a0, (__m512bh)w0);
+                acc1 = _mm512_dpbf16_ps(acc1, (__m512bh)a1, (__m512bh)w1);
+            }
+            if (k < numActive)
+            {
+                __m512i a0 = _mm512_set1_epi32((int)pairs[index[k]]);
+                __m512i w0 = _mm512_loadu_si512(weights + (size_t)index[k] * columns + c);
+                acc0 = _mm512_dpbf16_ps(acc0, (__m512bh)a0, (__m512bh)w0);
+            }
+            _mm512_storeu_ps(sums + c, _mm512_add_ps(acc0, acc1));
+        }
+        return;
+    }
+#endif
+#ifdef __AVX512F__
+    if (precision == PRECISION_FP16)
+    {
+        // Both halves are converted with vcvtph2ps, the products are fp32 FMAs
+        for (int c = 0; c < columns; c += MIXED_LANES)
+        {
+            __m512 acc = _mm512_loadu_ps(sums + c);
+            for (int k = 0; k < numActive; k++)
+            {
+                uint32_t pair = pairs[index[k]];
+                __m512i w = _mm512_loadu_si512(weights + (size_t)index[k] * columns + c);
+                __m512 w0 = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(w));
+                __m512 w1 = _mm512_cvtph_ps(_mm512_cvtepi32_epi16(_mm512_srli_epi32(w, 16)));
+                acc = _mm512_fmadd_ps(_mm512_set1_ps(fp16_to_float(pair & 0xffffu)), w0, acc);
+                acc = _mm512_fmadd_ps(_mm512_set1_ps(fp16_to_float(pair >> 16)), w1, acc);
+            }
+            _mm512_storeu_ps(sums + c, acc);
+        }
+        return;
+    }
+#endif
+    if (precision == PRECISION_BF16)
+    {
+        pair_products_soft(PRECISION_BF16, pairs, index, numActive, weights, columns, sums);
+    }
+    else
+    {
+        pair_products_soft(PRECISION_FP16, pairs, index, numActive, weights, columns, sums);
+    }
+}
+
+/**
+ * @brief Rounds the master rows 2p and 2p + 1 of the hidden weights to the 16 bit copy.
+ */
+static void round_hidden_pair(struct mixed_weights *w, int p)
+{
+    enum precision precision = w->precision;
+    uint32_t *dst = w->hiddenLow + (size_t)p * w->hiddenColumns;
+    const float *first = w->hiddenWeights + (size_t)(2 * p) * w->numHiddenNodes;
+    const float *second = 2 * p + 1 < w->numInputs ? first + w->numHiddenNodes : NULL;
+
+    int i = 0;
+
+    if (second == NULL)
+    {
+        for (; i < w->numHiddenNodes; i++)
+        {
+            dst[i] = to_low(precision, first[i]);
+        }
+        return;
+    }
+#ifdef __AVX512F__
+    if (precision == PRECISION_FP16)
+    {
+        for (; i + MIXED_LANES <= w->numHiddenNodes; i += MIXED_LANES)
+        {
+            __m512i low = _mm512_cvtepu16_epi32(_mm512_cvtps_ph(_mm512_loadu_ps(first + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+            __m512i high = _mm512_cvtepu16_epi32(_mm512_cvtps_ph(_mm512_loadu_ps(second + i), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+            _mm512_storeu_si512(dst + i, _mm512_or_si512(low, _mm512_slli_epi32(high, 16)));
+        }
+    }
+#endif
+#pragma omp simd
+    for (int j = i; j < w->numHiddenNodes; j++)
+    {
+        dst[j] = to_pair(precision, first[j], second[j]);
+    }
+}
+
+/**
+ * @brief Rounds the master output weights to both 16 bit copies.
+ */
+static void round_output_weights(struct mixed_weights *w)
+{
+    enum precision precision = w->precision;
+    int numHiddenNodes = w->numHiddenNodes, numOutputs = w->numOutputs;
+
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        const float *row = w->outputWeights + (size_t)i * numOutputs;
+        for (int o = 0; o < numOutputs; o++)
+        {
+            uint32_t low = to_low(precision, row[o]);
+            uint32_t *pair = &w->outputLow[(size_t)(i / 2) * w->outputColumns + o];
+            uint32_t *pairT = &w->outputLowT[(size_t)(o / 2) * w->hiddenColumns + i];
+            *pair = i % 2 == 0 ? (*pair & 0xffff0000u) | low : (*pair & 0xffffu) | low << 16;
+            *pairT = o % 2 == 0 ? (*pairT & 0xffff0000u) | low : (*pairT & 0xffffu) | low << 16;
+        }
+    }
+}
+
+/**
+ * @brief Rounds the inputs of a sample to 16 bit pairs.
+ */
+static void round_inputs(enum precision precision, const double *input, int numInputs, uint32_t *inputs)
+{
+    for (int p = 0; p < (numInputs + 1) / 2; p++)
+    {
+        double second = 2 * p + 1 < numInputs ? input[2 * p + 1] : 0.0;
+        inputs[p] = to_pair(precision, (float)input[2 * p], (float)second);
+    }
+}
+
+/**
+ * @brief Forward pass of a sample with the 16 bit weights.
+ *
+ * @param inputs 16 bit inputs in pairs.
+ * @param keep Dropout factors of the hidden neurons, NULL keeps all neurons unscaled.
+ */
+static void forward_sample(const struct mixed_weights *w, const uint32_t *inputs, const float *keep, int *inputIndex,
+                           int *numInputPairs, float *sums, uint32_t *hidden, int *hiddenIndex, int *numHiddenPairs, float *outputs)
+{
+    enum precision precision = w->precision;
+    int numActive = 0;
+
+    for (int p = 0; p < w->inputPairs; p++)
+    {
+        if (inputs[p] != 0)
+        {
+            inputIndex[numActive++] = p;
+        }
+    }
+    *numInputPairs = numActive;
+
+    memcpy(sums, w->hiddenBias, w->hiddenColumns * sizeof(float));
+    pair_products(precision, inputs, inputIndex, numActive, w->hiddenLow, w->hiddenColumns, sums);
+    for (int i = 0; i < w->hiddenColumns; i++)
+    {
+        float factor = i >= w->numHiddenNodes ? 0.0f : keep != NULL ? keep[i] : 1.0f;
+        sums[i] = factor != 0.0f ? sigmoid_float(sums[i]) * factor : 0.0f;
+    }
+
+    numActive = 0;
+    for (int p = 0; p < w->hiddenColumns / 2; p++)
+    {
+        hidden[p] = to_pair(precision, sums[2 * p], sums[2 * p + 1]);
+        if (hidden[p] != 0)
+        {
+            hiddenIndex[numActive++] = p;
+        }
+    }
+    *numHiddenPairs = numActive;
+
+    memcpy(outputs, w->outputBias, w->outputColumns * sizeof(float));
+    pair_products(precision, hidden, hiddenIndex, numActive, w->outputLow, w->outputColumns, outputs);
+    for (int o = 0; o < w->numOutputs; o++)
+    {
+        outputs[o] = sigmoid_float(outputs[o]);
+    }
+}
+
+/**
+ * @brief Returns the index of the largest of the first n values.
+ */
+static int argmax_float(const float *values, int n)
+{
+    int best = 0;
+    for (int o = 1; o < n; o++)
+    {
+        if (values[o] > values[best])
+        {
+            best = o;
+        }
+    }
+    return best;
+}
+
+/**
+ * @brief Forward pass, loss and scaled errors of sample b of a mini-batch.
+ */
+static void train_sample(const struct mixed_weights *w, struct mixed_batch *batch, int b, const double *target,
+                         const int *outputIndex, float lossScale)
+{
+    enum precision precision = w->precision;
+    float *outputs = batch->outputs[b];
+    float *sums = batch->sums[b];
+    float *delta = batch->outputErrors[b]; // Overwritten pair by pair by the rounded errors below
+    double loss = 0.0;
+    int overflow = 0;
+
+    forward_sample(w, batch->inputs[b], batch->keep[b], batch->inputIndex[b], &batch->numInputPairs[b], sums,
+                   batch->hidden[b], batch->hiddenIndex[b], &batch->numHiddenPairs[b], outputs);
+
+    for (int o = 0; o < w->outputColumns; o++)
+    {
+        delta[o] = 0.0f;
+        if (o < w->numOutputs)
+        {
+            float error = (float)target[o] - outputs[o];
+            loss += (double)error * error;
+            delta[o] = error * outputs[o] * (1.0f - outputs[o]) * lossScale;
+        }
+    }
+    for (int p = 0; p < w->outputColumns / 2; p++)
+    {
+        uint32_t pair = to_pair(precision, delta[2 * p], delta[2 * p + 1]);
+        overflow |= !isfinite(to_float(precision, pair & 0xffffu)) || !isfinite(to_float(precision, pair >> 16));
+        batch->deltaOutput[b][p] = pair;
+        batch->outputErrors[b][2 * p] = to_float(precision, pair & 0xffffu);
+        batch->outputErrors[b][2 * p + 1] = to_float(precision, pair >> 16);
+    }
+    batch->sampleLoss[b] = loss;
+    batch->sampleCorrect[b] = argmax_float(outputs, w->numOutputs) == predict_label(target, w->numOutputs);
+
+    // Errors of the hidden layer, rounded to 16 bit like the other operands of the products
+    for (int i = 0; i < w->hiddenColumns; i++)
+    {
+        sums[i] = 0.0f;
+    }
+    pair_products(precision, batch->deltaOutput[b], outputIndex, w->outputColumns / 2, w->outputLowT, w->hiddenColumns, sums);
+    for (int i = 0; i < w->hiddenColumns; i++)
+    {
+        float keep = batch->keep[b][i];
+        float error = 0.0f;
+        if (keep != 0.0f)
+        {
+            uint32_t pair = batch->hidden[b][i / 2];
+            float h = to_float(precision, i % 2 == 0 ? pair & 0xffffu : pair >> 16) / keep;
+            error = to_float(precision, to_low(precision, sums[i] * keep * h * (1.0f - h)));
+            overflow |= !isfinite(error);
+        }
+        sums[i] = error;
+    }
+    batch->overflow[b] = overflow;
+}
+
+/**
+ * @brief Computes the range [begin, end) of n items owned by the calling thread.
+ */
+static void owned_range(int n, int *begin, int *end)
+{
+    int numThreads = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+
+    *begin = (int)((long)n * thread / numThreads);
+    *end = (int)((long)n * (thread + 1) / numThreads);
+}
+
+/**
+ * @brief Applies the summed gradient of a mini-batch to the master weights and rounds them to the 16 bit copies.
+ */
+static void apply_batch(struct mixed_weights *w, struct mixed_batch *batch, int count, float step, int numThreads)
+{
+    enum precision precision = w->precision;
+    int numHiddenNodes = w->numHiddenNodes, numOutputs = w->numOutputs;
+
+#pragma omp parallel num_threads(numThreads)
+    {
+        // Every thread owns pairs of input rows, so the rows and their 16 bit copies are written by one thread only.
+        // Only the nonzero inputs listed by the forward pass are visited, in sample order.
+        int begin, end;
+        owned_range(w->inputPairs, &begin, &end);
+        for (int b = 0; b < count; b++)
+        {
+            const float *delta = batch->sums[b];
+            for (int k = 0; k < batch->numInputPairs[b]; k++)
+            {
+                int p = batch->inputIndex[b][k];
+                if (p < begin || p >= end)
+                {
+                    continue;
+                }
+                uint32_t pair = batch->inputs[b][p];
+                for (int r = 0; r < 2; r++)
+                {
+                    float x = to_float(precision, r == 0 ? pair & 0xffffu : pair >> 16);
+                    if (x == 0.0f)
+                    {
+                        continue;
+                    }
+                    float a = step * x;
+                    float *row = w->hiddenWeights + (size_t)(2 * p + r) * numHiddenNodes;
+#pragma omp simd
+                    for (int i = 0; i < numHiddenNodes; i++)
+                    {
+                        row[i] += a * delta[i];
+                    }
+                }
+                batch->touched[p] = 1;
+            }
+        }
+        for (int p = begin; p < end; p++)
+        {
+            if (batch->touched[p])
+            {
+                round_hidden_pair(w, p);
+                batch->touched[p] = 0;
+            }
+        }
+
+#pragma omp for schedule(static)
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            float *row = w->outputWeights + (size_t)i * numOutputs;
+            for (int b = 0; b < count; b++)
+            {
+                uint32_t pair = batch->hidden[b][i / 2];
+                float a = step * to_float(precision, i % 2 == 0 ? pair & 0xffffu : pair >> 16);
+                const float *delta = batch->outputErrors[b];
+                if (a == 0.0f)
+                {
+                    continue;
+                }
+#pragma omp simd
+                for (int o = 0; o < numOutputs; o++)
+                {
+                    row[o] += a * delta[o];
+                }
+            }
+        }
+
+#pragma omp single
+        {
+            round_output_weights(w);
+            for (int b = 0; b < count; b++)
+            {
+                for (int i = 0; i < numHiddenNodes; i++)
+                {
+                    w->hiddenBias[i] += step * batch->sums[b][i];
+                }
+                for (int o = 0; o < numOutputs; o++)
+                {
+                    w->outputBias[o] += step * batch->outputErrors[b][o];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Accuracy of the fp64 forward pass with the weights of a model (no dropout).
+ *
+ * @param hiddenWork One row of numHiddenNodes doubles per thread.
+ * @param outputWork One row of numOutputs doubles per thread.
+ */
+static double accuracy_fp64(const struct model *model, double **hiddenWork, double **outputWork, double **inputs, double **outputs,
+                            int numTrainingSets, int numThreads)
+{
+    long correct = 0;
+
+#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+ : correct)
+    for (int s = 0; s < numTrainingSets; s++)
+    {
+        double *hidden = hiddenWork[omp_get_thread_num()];
+        double *output = outputWork[omp_get_thread_num()];
+
+        memcpy(hidden, model->hiddenLayerBias, model->numHiddenNodes * sizeof(double));
+        for (int j = 0; j < model->numInputs; j++)
+        {
+            double x = inputs[s][j];
+            if (x != 0.0)
+            {
+                for (int i = 0; i < model->numHiddenNodes; i++)
+                {
+                    hidden[i] += x * model->hiddenWeights[j][i];
+                }
+            }
+        }
+        for (int o = 0; o < model->numOutputs; o++)
+        {
+            output[o] = model->outputLayerBias[o];
+        }
+        for (int i = 0; i < model->numHiddenNodes; i++)
+        {
+            double h = sigmoid(hidden[i]);
+            for (int o = 0; o < model->numOutputs; o++)
+            {
+                output[o] += h * model->outputWeights[i][o];
+            }
+        }
+        correct += predict_label(output, model->numOutputs) == predict_label(outputs[s], model->numOutputs);
+    }
+    return 100.0 * correct / numTrainingSets;
+}
+
+int train_mixed(const struct mixed_config *config, struct model *model,
+                double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                int epochs, double learningRate, double dropoutRate)
+{
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes, numOutputs = model->numOutputs;
+    int batchSize = config->batchSize;
+    int numThreads = config->numThreads;
+    struct mixed_weights w;
+    struct mixed_batch batch;
+
+    if ((config->precision != PRECISION_BF16 && config->precision != PRECISION_FP16) || batchSize <= 0 || numThreads <= 0 ||
+        numTrainingSets <= 0)
+    {
+        return -1;
+    }
+
+    w.precision = config->precision;
+    w.numInputs = numInputs;
+    w.numHiddenNodes = numHiddenNodes;
+    w.numOutputs = numOutputs;
+    w.inputPairs = (numInputs + 1) / 2;
+    w.hiddenColumns = MIXED_PAD(numHiddenNodes, MIXED_LANES);
+    w.outputColumns = MIXED_PAD(numOutputs, MIXED_LANES);
+
+    size_t weightBytes = arena_vector_bytes((size_t)numInputs * numHiddenNodes, sizeof(float)) +
+                         arena_vector_bytes((size_t)numHiddenNodes * numOutputs, sizeof(float)) +
+                         arena_vector_bytes(w.hiddenColumns, sizeof(float)) + arena_vector_bytes(w.outputColumns, sizeof(float)) +
+                         arena_vector_bytes((size_t)w.inputPairs * w.hiddenColumns, sizeof(uint32_t)) +
+                         2 * arena_vector_bytes((size_t)w.hiddenColumns / 2 * w.outputColumns, sizeof(uint32_t));
+    size_t sampleBytes = arena_vector_bytes(w.inputPairs, sizeof(int)) +
+                         arena_vector_bytes(w.hiddenColumns / 2, sizeof(uint32_t)) + arena_vector_bytes(w.hiddenColumns / 2, sizeof(int)) +
+                         2 * arena_vector_bytes(w.hiddenColumns, sizeof(float)) + arena_vector_bytes(w.outputColumns, sizeof(float)) +
+                         arena_vector_bytes(w.outputColumns / 2, sizeof(uint32_t)) + arena_vector_bytes(w.outputColumns, sizeof(float));
+    struct arena arena;
+    arena_create(&arena, weightBytes + arena_vector_bytes((size_t)numTrainingSets * w.inputPairs, sizeof(uint32_t)) + (size_t)batchSize * sampleBytes + 9 * arena_vector_bytes(batchSize, sizeof(void *)) + arena_vector_bytes(w.inputPairs, 1) +
+                             4 * arena_vector_bytes(batchSize, sizeof(int)) + arena_vector_bytes(batchSize, sizeof(double)) +
+                             arena_vector_bytes(w.outputColumns / 2, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)) +
+                             arena_matrix_bytes(numThreads, numHiddenNodes) + arena_matrix_bytes(numThreads, numOutputs));
+
+    w.hiddenWeights = arena_alloc(&arena, (size_t)numInputs * numHiddenNodes * sizeof(float));
+    w.outputWeights = arena_alloc(&arena, (size_t)numHiddenNodes * numOutputs * sizeof(float));
+    w.hiddenBias = arena_alloc(&arena, w.hiddenColumns * sizeof(float));
+    w.outputBias = arena_alloc(&arena, w.outputColumns * sizeof(float));
+    w.hiddenLow = arena_alloc(&arena, (size_t)w.inputPairs * w.hiddenColumns * sizeof(uint32_t));
+    w.outputLow = arena_alloc(&arena, (size_t)w.hiddenColumns / 2 * w.outputColumns * sizeof(uint32_t));
+    w.outputLowT = arena_alloc(&arena, (size_t)w.outputColumns / 2 * w.hiddenColumns * sizeof(uint32_t));
+
+    // The padding of the biases and the 16 bit copies stays 0
+    memset(w.hiddenBias, 0, w.hiddenColumns * sizeof(float));
+    memset(w.outputBias, 0, w.outputColumns * sizeof(float));
+    memset(w.hiddenLow, 0, (size_t)w.inputPairs * w.hiddenColumns * sizeof(uint32_t));
+    memset(w.outputLow, 0, (size_t)w.hiddenColumns / 2 * w.outputColumns * sizeof(uint32_t));
+    memset(w.outputLowT, 0, (size_t)w.outputColumns / 2 * w.hiddenColumns * sizeof(uint32_t));
+    for (int j = 0; j < numInputs; j++)
+    {
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            w.hiddenWeights[(size_t)j * numHiddenNodes + i] = (float)model->hiddenWeights[j][i];
+        }
+    }
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        w.hiddenBias[i] = (float)model->hiddenLayerBias[i];
+        for (int o = 0; o < numOutputs; o++)
+        {
+            w.outputWeights[(size_t)i * numOutputs + o] = (float)model->outputWeights[i][o];
+        }
+    }
+    for (int o = 0; o < numOutputs; o++)
+    {
+        w.outputBias[o] = (float)model->outputLayerBias[o];
+    }
+    for (int p = 0; p < w.inputPairs; p++)
+    {
+        round_hidden_pair(&w, p);
+    }
+    round_output_weights(&w);
+
+    // The training data is rounded once and read in 16 bit in every epoch
+    uint32_t *inputs = arena_alloc(&arena, (size_t)numTrainingSets * w.inputPairs * sizeof(uint32_t));
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+    for (int s = 0; s < numTrainingSets; s++)
+    {
+        round_inputs(w.precision, trainingInputs[s], numInputs, inputs + (size_t)s * w.inputPairs);
+    }
+
+    batch.inputs = arena_alloc(&arena, batchSize * sizeof(uint32_t *));
+    batch.inputIndex = arena_alloc(&arena, batchSize * sizeof(int *));
+    batch.hidden = arena_alloc(&arena, batchSize * sizeof(uint32_t *));
+    batch.hiddenIndex = arena_alloc(&arena, batchSize * sizeof(int *));
+    batch.keep = arena_alloc(&arena, batchSize * sizeof(float *));
+    batch.sums = arena_alloc(&arena, batchSize * sizeof(float *));
+    batch.outputs = arena_alloc(&arena, batchSize * sizeof(float *));
+    batch.deltaOutput = arena_alloc(&arena, batchSize * sizeof(uint32_t *));
+    batch.outputErrors = arena_alloc(&arena, batchSize * sizeof(float *));
+    for (int b = 0; b < batchSize; b++)
+    {
+        batch.inputIndex[b] = arena_alloc(&arena, w.inputPairs * sizeof(int));
+        batch.hidden[b] = arena_alloc(&arena, w.hiddenColumns / 2 * sizeof(uint32_t));
+        batch.hiddenIndex[b] = arena_alloc(&arena, w.hiddenColumns / 2 * sizeof(int));
+        batch.keep[b] = arena_alloc(&arena, w.hiddenColumns * sizeof(float));
+        batch.sums[b] = arena_alloc(&arena, w.hiddenColumns * sizeof(float));
+        batch.outputs[b] = arena_alloc(&arena, w.outputColumns * sizeof(float));
+        batch.deltaOutput[b] = arena_alloc(&arena, w.outputColumns / 2 * sizeof(uint32_t));
+        batch.outputErrors[b] = arena_alloc(&arena, w.outputColumns * sizeof(float));
+    }
+    batch.numInputPairs = arena_alloc(&arena, batchSize * sizeof(int));
+    batch.numHiddenPairs = arena_alloc(&arena, batchSize * sizeof(int));
+    batch.sampleLoss = arena_alloc_vector(&arena, batchSize);
+    batch.sampleCorrect = arena_alloc(&arena, batchSize * sizeof(int));
+    batch.overflow = arena_alloc(&arena, batchSize * sizeof(int));
+    batch.touched = arena_alloc(&arena, w.inputPairs);
+    memset(batch.touched, 0, w.inputPairs);
+    int *outputIndex = arena_alloc(&arena, w.outputColumns / 2 * sizeof(int));
+    for (int p = 0; p < w.outputColumns / 2; p++)
+    {
+        outputIndex[p] = p;
+    }
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+    double **hiddenWork = arena_alloc_matrix(&arena, numThreads, numHiddenNodes);
+    double **outputWork = arena_alloc_matrix(&arena, numThreads, numOutputs);
+
+    printf("Mixed precision: %s weights and activations, fp32 master copy and sums, %s, mini-batch %d, %d threads\n",
+           precision_name(w.precision), mixed_uses_hardware(w.precision) ? "AVX512-BF16 vdpbf16ps" : "software conversion", batchSize, numThreads);
+    printf("Weights read by the products per sample: %.1f KiB (fp64: %.1f KiB)\n",
+           ((double)numInputs * numHiddenNodes + 2.0 * numHiddenNodes * numOutputs) * sizeof(uint16_t) / 1024.0,
+           ((double)numInputs * numHiddenNodes + 2.0 * numHiddenNodes * numOutputs) * sizeof(double) / 1024.0);
+
+    float lossScale = w.precision == PRECISION_FP16 ? MIXED_INITIAL_LOSS_SCALE : 1.0f;
+    int goodBatches = 0;
+    double lowAccuracy = 0.0;
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+        double epochStart = now_seconds();
+        double loss = 0.0;
+        long correct = 0;
+        int skipped = 0;
+
+        for (int first = 0; first < numTrainingSets; first += batchSize)
+        {
+            int count = numTrainingSets - first < batchSize ? numTrainingSets - first : batchSize;
+
+            // The masks are drawn by this thread only, so the random numbers are drawn in a fixed order
+            for (int b = 0; b < count; b++)
+            {
+                if (dropoutRate > 0.0)
+                {
+                    draw_dropout_mask(&mask, numHiddenNodes, dropoutRate);
+                }
+                else
+                {
+                    keep_all_neurons(&mask, numHiddenNodes);
+                }
+                for (int i = 0; i < w.hiddenColumns; i++)
+                {
+                    batch.keep[b][i] = i < numHiddenNodes && (mask.bits[i / 64] >> (i % 64)) & 1 ? (float)mask.scale : 0.0f;
+                }
+            }
+
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+            for (int b = 0; b < count; b++)
+            {
+                batch.inputs[b] = inputs + (size_t)(first + b) * w.inputPairs;
+                train_sample(&w, &batch, b, trainingOutputs[first + b], outputIndex, lossScale);
+            }
+
+            int overflow = 0;
+            for (int b = 0; b < count; b++)
+            {
+                loss += batch.sampleLoss[b];
+                correct += batch.sampleCorrect[b];
+                overflow |= batch.overflow[b];
+            }
+
+            // Dynamic loss scaling: an overflow skips the mini-batch and halves the scale
+            if (overflow)
+            {
+                lossScale = lossScale > 1.0f ? lossScale / 2.0f : 1.0f;
+                goodBatches = 0;
+                skipped++;
+                continue;
+            }
+            apply_batch(&w, &batch, count, (float)learningRate / lossScale, numThreads);
+            if (w.precision == PRECISION_FP16 && ++goodBatches == MIXED_SCALE_WINDOW)
+            {
+                lossScale *= 2.0f;
+                goodBatches = 0;
+            }
+        }
+
+        double seconds = now_seconds() - epochStart;
+        lowAccuracy = 100.0 * correct / numTrainingSets;
+        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%ld/%d) - %.0f samples/s - loss scale %.0f, %d skipped mini-batches\n",
+               epoch + 1, epochs, loss / numTrainingSets, lowAccuracy, correct, numTrainingSets, numTrainingSets / seconds, lossScale, skipped);
+    }
+
+    // The 16 bit forward pass without dropout, compared to fp64 with the master weights
+    long correct = 0;
+    for (int first = 0; first < numTrainingSets; first += batchSize)
+    {
+        int count = numTrainingSets - first < batchSize ? numTrainingSets - first : batchSize;
+#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+ : correct)
+        for (int b = 0; b < count; b++)
+        {
+            forward_sample(&w, inputs + (size_t)(first + b) * w.inputPairs, NULL, batch.inputIndex[b], &batch.numInputPairs[b], batch.sums[b],
+                           batch.hidden[b], batch.hiddenIndex[b], &batch.numHiddenPairs[b], batch.outputs[b]);
+            correct += argmax_float(batch.outputs[b], numOutputs) == predict_label(trainingOutputs[first + b], numOutputs);
+        }
+    }
+    lowAccuracy = 100.0 * correct / numTrainingSets;
+
+    for (int j = 0; j < numInputs; j++)
+    {
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            model->hiddenWeights[j][i] = w.hiddenWeights[(size_t)j * numHiddenNodes + i];
+        }
+    }
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        model->hiddenLayerBias[i] = w.hiddenBias[i];
+        for (int o = 0; o < numOutputs; o++)
+        {
+            model->outputWeights[i][o] = w.outputWeights[(size_t)i * numOutputs + o];
+        }
+    }
+    for (int o = 0; o < numOutputs; o++)
+    {
+        model->outputLayerBias[o] = w.outputBias[o];
+    }
+
+    double masterAccuracy = accuracy_fp64(model, hiddenWork, outputWork, trainingInputs, trainingOutputs, numTrainingSets, numThreads);
+    double difference = fabs(lowAccuracy - masterAccuracy);
+    printf("Accuracy: %s %.2f%%, fp64 with the master weights %.2f%%, difference %.2f points (%s the tolerance of %.2f)\n",
+           precision_name(w.precision), lowAccuracy, masterAccuracy, difference,
+           difference <= MIXED_ACCURACY_TOLERANCE ? "within" : "beyond", MIXED_ACCURACY_TOLERANCE);
+
+    arena_destroy(&arena);
+    return 0;
+}
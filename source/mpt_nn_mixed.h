@@ -0,0 +1,147 @@
+/**
+ * @file mpt_nn_mixed.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the mixed-precision training (bf16/fp16 with a fp32 master copy).
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The model is trained on mini-batches. The master copy of the weights and biases is kept in fp32 and receives
+ * the updates; after every update the touched rows are rounded to a 16 bit copy (bf16 or fp16) that the forward
+ * and the backward products read. The inputs, the hidden activations and the errors are stored in 16 bit as well,
+ * only the sums are accumulated in fp32. The 16 bit matrices are stored in pairs of rows ([rows / 2][columns][2]),
+ * the layout of the AVX512-BF16 instruction vdpbf16ps, which multiplies and adds two rows per instruction.
+ * Without AVX512-BF16 (and for fp16) the same layout is converted to fp32 in software.
+ * Compared to the doubles of mpt_nn.c the products read a quarter of the bytes.
+ *
+ * The errors of the outputs are multiplied with a loss scale before they are rounded, so that small gradients
+ * do not underflow in fp16. The scale is halved and the mini-batch is skipped when an error overflows, and doubled
+ * after MIXED_SCALE_WINDOW mini-batches without overflow. bf16 has the exponent range of fp32 and keeps a scale of 1.
+ */
+#ifndef MPT_NN_MIXED_H
+#define MPT_NN_MIXED_H
+
+#include <stdint.h>
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Columns of a 16 bit matrix processed at once (one AVX-512 register of fp32 sums), the columns are padded to a multiple.
+ */
+#define MIXED_LANES 16
+
+/**
+ * @brief Initial loss scale of fp16.
+ */
+#define MIXED_INITIAL_LOSS_SCALE 1024.0f
+
+/**
+ * @brief Mini-batches without overflow before the loss scale is doubled.
+ */
+#define MIXED_SCALE_WINDOW 200
+
+/**
+ * @brief Largest difference of the accuracy to the fp64 evaluation of the master weights in percentage points
+ *        that is reported as within tolerance.
+ */
+#define MIXED_ACCURACY_TOLERANCE 1.0
+
+/**
+ * @brief Number format of the weights and activations.
+ */
+enum precision
+{
+    PRECISION_FP64, /**< The doubles of mpt_nn.c, no mixed precision. */
+    PRECISION_BF16, /**< bfloat16: 8 exponent bits, 7 mantissa bits. */
+    PRECISION_FP16  /**< IEEE half precision: 5 exponent bits, 10 mantissa bits. */
+};
+
+/**
+ * @brief Configuration of the mixed-precision training.
+ */
+struct mixed_config
+{
+    enum precision precision; /**< PRECISION_BF16 or PRECISION_FP16. */
+    int batchSize;            /**< Samples per mini-batch. */
+    int numThreads;           /**< Number of OpenMP threads. */
+};
+
+/**
+ * @brief Parses a number format.
+ *
+ * @param name "fp64", "bf16" or "fp16".
+ * @param precision Receives the format.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_precision(const char *name, enum precision *precision);
+
+/**
+ * @brief Returns the name of a number format, e.g. "bf16".
+ *
+ * @param precision Number format.
+ * @return const char* Name of the format.
+ */
+const char *precision_name(enum precision precision);
+
+/**
+ * @brief Rounds a float to the nearest bf16 (ties to even), NaN stays NaN.
+ *
+ * @param value Value.
+ * @return uint16_t Bits of the bf16.
+ */
+uint16_t float_to_bf16(float value);
+
+/**
+ * @brief Converts a bf16 to a float (exact).
+ *
+ * @param bits Bits of the bf16.
+ * @return float Value.
+ */
+float bf16_to_float(uint16_t bits);
+
+/**
+ * @brief Rounds a float to the nearest fp16 (ties to even), values beyond 65504 become infinite.
+ *
+ * @param value Value.
+ * @return uint16_t Bits of the fp16.
+ */
+uint16_t float_to_fp16(float value);
+
+/**
+ * @brief Converts a fp16 to a float (exact).
+ *
+ * @param bits Bits of the fp16.
+ * @return float Value.
+ */
+float fp16_to_float(uint16_t bits);
+
+/**
+ * @brief Returns true if the 16 bit products use AVX512-BF16 (vdpbf16ps), false if they convert in software.
+ *
+ * @param precision Number format.
+ * @return true if the hardware instruction is used.
+ */
+bool mixed_uses_hardware(enum precision precision);
+
+/**
+ * @brief Trains a model in mixed precision.
+ *
+ * The weights are updated after every mini-batch with learningRate times the summed gradient of its samples.
+ * Prints the loss, accuracy, throughput and loss scale of every epoch. At the end the master weights are written
+ * to the model and the accuracy of the 16 bit forward pass is compared to a fp64 forward pass with the master weights.
+ *
+ * @param config Configuration of the training.
+ * @param model Initialized weights and biases, replaced by the trained master weights.
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param epochs Number of epochs.
+ * @param learningRate Learning rate per sample.
+ * @param dropoutRate Dropout rate of the hidden layer.
+ * @return 0 on success, -1 if the configuration is invalid.
+ */
+int train_mixed(const struct mixed_config *config, struct model *model,
+                double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                int epochs, double learningRate, double dropoutRate);
+
+#endif // MPT_NN_MIXED_H
@@ -0,0 +1,680 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_norm.h"
+
+/**
+ * @brief Weights of the network and the parameters and statistics of the normalization.
+ */
+struct norm_state
+{
+    enum normalization normalization;
+    int numInputs;
+    int numHiddenNodes;
+    int numOutputs;
+    double **hiddenWeights;   /**< Weights between input and hidden layer (of the model). */
+    double **outputWeights;   /**< Weights between hidden and output layer (of the model). */
+    double *hiddenBias;       /**< Biases of the hidden layer (of the model). */
+    double *outputBias;       /**< Biases of the output layer (of the model). */
+    double *gamma;            /**< Scale of every hidden node after the normalization. */
+    double *beta;             /**< Shift of every hidden node after the normalization. */
+    double *runningMean;      /**< Batch norm: mean of every hidden node for the inference. */
+    double *runningVariance;  /**< Batch norm: variance of every hidden node for the inference. */
+    double *mean;             /**< Batch norm: mean of every hidden node over the mini-batch. */
+    double *invStd;           /**< Batch norm: 1 / standard deviation of every hidden node over the mini-batch. */
+    double *errorSum;         /**< Batch norm: sum of the scaled errors of every hidden node over the mini-batch. */
+    double *errorDot;         /**< Batch norm: sum of the scaled errors times the normalized sums. */
+};
+
+/**
+ * @brief Buffers of the samples of a mini-batch.
+ */
+struct norm_batch
+{
+    double **inputs;        /**< Rows of the training data. */
+    int **inputIndex;       /**< Indices of the nonzero inputs. */
+    int *numActiveInputs;   /**< Number of nonzero inputs. */
+    double **normalized;    /**< Normalized sums of the hidden layer (the raw sums during the forward pass). */
+    double **activation;    /**< Sigmoid of the scaled and shifted normalized sums, before the dropout. */
+    double **keep;          /**< Dropout factor of every hidden node: the dropout scale or 0. */
+    double **errors;        /**< Errors of the hidden layer after the normalization (of gamma * x + beta). */
+    double **deltaHidden;   /**< Errors of the sums of the hidden layer. */
+    double **outputs;       /**< Output activations. */
+    double **deltaOutput;   /**< Errors of the outputs. */
+    double *invStd;         /**< Layer norm: 1 / standard deviation of the sums of every sample. */
+    double *sampleLoss;     /**< Loss of every sample. */
+    int *sampleCorrect;     /**< 1 for every correctly predicted sample. */
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int parse_normalization(const char *name, enum normalization *normalization)
+{
+    if (strcmp(name, "none") == 0)
+    {
+        *normalization = NORM_NONE;
+    }
+    else if (strcmp(name, "layer") == 0)
+    {
+        *normalization = NORM_LAYER;
+    }
+    else if (strcmp(name, "batch") == 0)
+    {
+        *normalization = NORM_BATCH;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+const char *normalization_name(enum normalization normalization)
+{
+    switch (normalization)
+    {
+    case NORM_LAYER:
+        return "layer";
+    case NORM_BATCH:
+        return "batch";
+    default:
+        return "none";
+    }
+}
+
+/**
+ * @brief Sigmoid that can be inlined into the vectorized loops.
+ */
+static inline double sigmoid_inline(double x)
+{
+    return 1.0 / (1.0 + exp(-x));
+}
+
+/**
+ * @brief Computes the hidden nodes [begin, end) owned by the calling thread, whole blocks of NORM_LANES nodes.
+ */
+static void owned_columns(int numHiddenNodes, int *begin, int *end)
+{
+    int numBlocks = (numHiddenNodes + NORM_LANES - 1) / NORM_LANES;
+    int numThreads = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+
+    *begin = (int)((long)numBlocks * thread / numThreads) * NORM_LANES;
+    *end = (int)((long)numBlocks * (thread + 1) / numThreads) * NORM_LANES;
+    *begin = *begin < numHiddenNodes ? *begin : numHiddenNodes;
+    *end = *end < numHiddenNodes ? *end : numHiddenNodes;
+}
+
+/**
+ * @brief Sums the products of all nonzero inputs but the last into sums[begin, end).
+ *
+ * The last input and the bias are added by the caller in the loop that also accumulates the statistics.
+ *
+ * @return int The last nonzero input, -1 if there is none.
+ */
+static int hidden_products(const struct norm_state *s, const double *input, const int *index, int numActive,
+                           int begin, int end, double *sums)
+{
+    for (int i = begin; i < end; i++)
+    {
+        sums[i] = 0.0;
+    }
+    for (int k = 0; k < numActive - 1; k++)
+    {
+        double x = input[index[k]];
+        const double *row = s->hiddenWeights[index[k]];
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            sums[i] += x * row[i];
+        }
+    }
+    return numActive > 0 ? index[numActive - 1] : -1;
+}
+
+/**
+ * @brief Forward pass of the hidden layer of one sample with layer norm.
+ *
+ * @param s Weights and normalization.
+ * @param input Inputs of the sample.
+ * @param index Indices of the nonzero inputs.
+ * @param numActive Number of nonzero inputs.
+ * @param normalized Receives the normalized sums.
+ * @param activation Receives the sigmoid of the scaled and shifted normalized sums.
+ * @return double 1 / standard deviation of the sums.
+ */
+static double layer_norm_forward(const struct norm_state *s, const double *input, const int *index, int numActive,
+                                 double *normalized, double *activation)
+{
+    int numHiddenNodes = s->numHiddenNodes;
+    int last = hidden_products(s, input, index, numActive, 0, numHiddenNodes, normalized);
+    double x = last >= 0 ? input[last] : 0.0;
+    const double *row = s->hiddenWeights[last >= 0 ? last : 0];
+    double sum = 0.0, squares = 0.0;
+
+    // Epilogue of the products: last input, bias, mean and variance in one pass
+#pragma omp simd reduction(+ : sum, squares)
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        double v = normalized[i] + x * row[i] + s->hiddenBias[i];
+        normalized[i] = v;
+        sum += v;
+        squares += v * v;
+    }
+    double mean = sum / numHiddenNodes;
+    double variance = fmax(squares / numHiddenNodes - mean * mean, 0.0);
+    double invStd = 1.0 / sqrt(variance + NORM_EPSILON);
+
+#pragma omp simd
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        double z = (normalized[i] - mean) * invStd;
+        normalized[i] = z;
+        activation[i] = sigmoid_inline(s->gamma[i] * z + s->beta[i]);
+    }
+    return invStd;
+}
+
+/**
+ * @brief Forward pass of the hidden nodes [begin, end) of a mini-batch with batch norm.
+ *
+ * The statistics of a hidden node only depend on its own column, so the owner of the column needs no other thread.
+ */
+static void batch_norm_forward(struct norm_state *s, struct norm_batch *batch, int count, int begin, int end)
+{
+    double *sum = s->mean, *squares = s->invStd;
+
+    for (int i = begin; i < end; i++)
+    {
+        sum[i] = 0.0;
+        squares[i] = 0.0;
+    }
+    for (int b = 0; b < count; b++)
+    {
+        const double *input = batch->inputs[b];
+        double *sums = batch->normalized[b];
+        int last = hidden_products(s, input, batch->inputIndex[b], batch->numActiveInputs[b], begin, end, sums);
+        double x = last >= 0 ? input[last] : 0.0;
+        const double *row = s->hiddenWeights[last >= 0 ? last : 0];
+
+        // Epilogue of the products: last input, bias and the column sums of the statistics
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            double v = sums[i] + x * row[i] + s->hiddenBias[i];
+            sums[i] = v;
+            sum[i] += v;
+            squares[i] += v * v;
+        }
+    }
+
+    for (int i = begin; i < end; i++)
+    {
+        double mean = sum[i] / count;
+        double variance = fmax(squares[i] / count - mean * mean, 0.0);
+        s->mean[i] = mean;
+        s->invStd[i] = 1.0 / sqrt(variance + NORM_EPSILON);
+        s->runningMean[i] += NORM_MOMENTUM * (mean - s->runningMean[i]);
+        s->runningVariance[i] += NORM_MOMENTUM * (variance - s->runningVariance[i]);
+    }
+
+    for (int b = 0; b < count; b++)
+    {
+        double *normalized = batch->normalized[b], *activation = batch->activation[b];
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            double z = (normalized[i] - s->mean[i]) * s->invStd[i];
+            normalized[i] = z;
+            activation[i] = sigmoid_inline(s->gamma[i] * z + s->beta[i]);
+        }
+    }
+}
+
+/**
+ * @brief Computes the outputs of one sample from the activations of the hidden layer.
+ *
+ * @param keep Dropout factors of the hidden nodes, NULL for the inference.
+ */
+static void output_forward(const struct norm_state *s, const double *activation, const double *keep, double *outputs)
+{
+    for (int o = 0; o < s->numOutputs; o++)
+    {
+        outputs[o] = s->outputBias[o];
+    }
+    for (int i = 0; i < s->numHiddenNodes; i++)
+    {
+        double h = keep != NULL ? activation[i] * keep[i] : activation[i];
+        if (h == 0.0)
+        {
+            continue;
+        }
+        for (int o = 0; o < s->numOutputs; o++)
+        {
+            outputs[o] += h * s->outputWeights[i][o];
+        }
+    }
+    for (int o = 0; o < s->numOutputs; o++)
+    {
+        outputs[o] = sigmoid_inline(outputs[o]);
+    }
+}
+
+/**
+ * @brief Outputs, loss and errors of the outputs of sample b.
+ */
+static void output_errors(const struct norm_state *s, struct norm_batch *batch, int b, const double *target)
+{
+    double *outputs = batch->outputs[b];
+    double loss = 0.0;
+
+    output_forward(s, batch->activation[b], batch->keep[b], outputs);
+    for (int o = 0; o < s->numOutputs; o++)
+    {
+        double error = target[o] - outputs[o];
+        loss += error * error;
+        batch->deltaOutput[b][o] = error * outputs[o] * (1.0 - outputs[o]);
+    }
+    batch->sampleLoss[b] = loss;
+    batch->sampleCorrect[b] = predict_label(outputs, s->numOutputs) == predict_label(target, s->numOutputs);
+}
+
+/**
+ * @brief Error of hidden node i of sample b after the normalization: through the output weights, the dropout and the sigmoid.
+ */
+static inline double hidden_error(const struct norm_state *s, const struct norm_batch *batch, int b, int i)
+{
+    double error = 0.0;
+    for (int o = 0; o < s->numOutputs; o++)
+    {
+        error += s->outputWeights[i][o] * batch->deltaOutput[b][o];
+    }
+    double a = batch->activation[b][i];
+    return error * batch->keep[b][i] * a * (1.0 - a);
+}
+
+/**
+ * @brief Backward pass of the hidden layer of sample b with layer norm.
+ *
+ * The errors of the sigmoid and the two sums over the hidden nodes are computed in one loop, the errors of the sums in a second.
+ */
+static void layer_norm_backward(const struct norm_state *s, struct norm_batch *batch, int b)
+{
+    int numHiddenNodes = s->numHiddenNodes;
+    double *errors = batch->errors[b], *delta = batch->deltaHidden[b];
+    const double *normalized = batch->normalized[b];
+    double sum = 0.0, dot = 0.0;
+
+#pragma omp simd reduction(+ : sum, dot)
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        double error = hidden_error(s, batch, b, i);
+        double scaled = error * s->gamma[i];
+        errors[i] = error;
+        sum += scaled;
+        dot += scaled * normalized[i];
+    }
+
+    double meanError = sum / numHiddenNodes, meanDot = dot / numHiddenNodes, invStd = batch->invStd[b];
+#pragma omp simd
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        delta[i] = invStd * (errors[i] * s->gamma[i] - meanError - normalized[i] * meanDot);
+    }
+}
+
+/**
+ * @brief Backward pass of the hidden nodes [begin, end) of a mini-batch with batch norm.
+ */
+static void batch_norm_backward(struct norm_state *s, struct norm_batch *batch, int count, int begin, int end)
+{
+    double *sum = s->errorSum, *dot = s->errorDot;
+
+    for (int i = begin; i < end; i++)
+    {
+        sum[i] = 0.0;
+        dot[i] = 0.0;
+    }
+    for (int b = 0; b < count; b++)
+    {
+        double *errors = batch->errors[b];
+        const double *normalized = batch->normalized[b];
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            double error = hidden_error(s, batch, b, i);
+            double scaled = error * s->gamma[i];
+            errors[i] = error;
+            sum[i] += scaled;
+            dot[i] += scaled * normalized[i];
+        }
+    }
+
+    for (int b = 0; b < count; b++)
+    {
+        const double *errors = batch->errors[b], *normalized = batch->normalized[b];
+        double *delta = batch->deltaHidden[b];
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            delta[i] = s->invStd[i] * (errors[i] * s->gamma[i] - sum[i] / count - normalized[i] * dot[i] / count);
+        }
+    }
+}
+
+/**
+ * @brief Applies the summed gradient of a mini-batch to the parameters of the hidden nodes [begin, end).
+ *
+ * The columns of the hidden weights and the rows of the output weights of these nodes are only written by the
+ * calling thread, the samples are visited in order.
+ */
+static void update_columns(struct norm_state *s, const struct norm_batch *batch, int count, int begin, int end, double step)
+{
+    for (int b = 0; b < count; b++)
+    {
+        const double *input = batch->inputs[b], *errors = batch->errors[b], *normalized = batch->normalized[b];
+        const double *delta = batch->deltaHidden[b];
+
+        for (int i = begin; i < end; i++)
+        {
+            s->gamma[i] += step * errors[i] * normalized[i];
+            s->beta[i] += step * errors[i];
+            s->hiddenBias[i] += step * delta[i];
+        }
+        for (int k = 0; k < batch->numActiveInputs[b]; k++)
+        {
+            double a = step * input[batch->inputIndex[b][k]];
+            double *row = s->hiddenWeights[batch->inputIndex[b][k]];
+#pragma omp simd
+            for (int i = begin; i < end; i++)
+            {
+                row[i] += a * delta[i];
+            }
+        }
+        for (int i = begin; i < end; i++)
+        {
+            double a = step * batch->activation[b][i] * batch->keep[b][i];
+            if (a == 0.0)
+            {
+                continue;
+            }
+            for (int o = 0; o < s->numOutputs; o++)
+            {
+                s->outputWeights[i][o] += a * batch->deltaOutput[b][o];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Forward pass, backward pass and update of a mini-batch.
+ */
+static void train_batch(struct norm_state *s, struct norm_batch *batch, double **targets, int count, double step, int numThreads)
+{
+    int numInputs = s->numInputs;
+
+    if (s->normalization == NORM_LAYER)
+    {
+#pragma omp parallel for num_threads(numThreads) schedule(static)
+        for (int b = 0; b < count; b++)
+        {
+            batch->numActiveInputs[b] = build_input_index(batch->inputs[b], numInputs, batch->inputIndex[b]);
+            batch->invStd[b] = layer_norm_forward(s, batch->inputs[b], batch->inputIndex[b], batch->numActiveInputs[b],
+                                                  batch->normalized[b], batch->activation[b]);
+            output_errors(s, batch, b, targets[b]);
+        }
+    }
+    else
+    {
+#pragma omp parallel num_threads(numThreads)
+        {
+            int begin, end;
+#pragma omp for schedule(static)
+            for (int b = 0; b < count; b++)
+            {
+                batch->numActiveInputs[b] = build_input_index(batch->inputs[b], numInputs, batch->inputIndex[b]);
+            }
+            owned_columns(s->numHiddenNodes, &begin, &end);
+            batch_norm_forward(s, batch, count, begin, end);
+#pragma omp barrier
+#pragma omp for schedule(static)
+            for (int b = 0; b < count; b++)
+            {
+                output_errors(s, batch, b, targets[b]);
+            }
+        }
+    }
+
+#pragma omp parallel num_threads(numThreads)
+    {
+        int begin, end;
+        owned_columns(s->numHiddenNodes, &begin, &end);
+        if (s->normalization == NORM_LAYER)
+        {
+#pragma omp for schedule(static)
+            for (int b = 0; b < count; b++)
+            {
+                layer_norm_backward(s, batch, b);
+            }
+        }
+        else
+        {
+            batch_norm_backward(s, batch, count, begin, end);
+        }
+        update_columns(s, batch, count, begin, end, step);
+    }
+
+    for (int b = 0; b < count; b++)
+    {
+        for (int o = 0; o < s->numOutputs; o++)
+        {
+            s->outputBias[o] += step * batch->deltaOutput[b][o];
+        }
+    }
+}
+
+/**
+ * @brief Accuracy of the inference forward pass (no dropout, batch norm with the running statistics).
+ *
+ * @param work Workspace with one row of inputIndex, normalized, activation and outputs per thread.
+ */
+static double inference_accuracy(const struct norm_state *s, const struct norm_batch *work, double **inputs, double **targets,
+                                 int numTrainingSets, int numThreads)
+{
+    int numHiddenNodes = s->numHiddenNodes;
+    long correct = 0;
+
+#pragma omp parallel for num_threads(numThreads) schedule(static) reduction(+ : correct)
+    for (int n = 0; n < numTrainingSets; n++)
+    {
+        int thread = omp_get_thread_num();
+        double *normalized = work->normalized[thread];
+        double *activation = work->activation[thread];
+        double *outputs = work->outputs[thread];
+        int *index = work->inputIndex[thread];
+        int numActive = build_input_index(inputs[n], s->numInputs, index);
+
+        if (s->normalization == NORM_LAYER)
+        {
+            layer_norm_forward(s, inputs[n], index, numActive, normalized, activation);
+        }
+        else
+        {
+            int last = hidden_products(s, inputs[n], index, numActive, 0, numHiddenNodes, normalized);
+            double x = last >= 0 ? inputs[n][last] : 0.0;
+            const double *row = s->hiddenWeights[last >= 0 ? last : 0];
+            for (int i = 0; i < numHiddenNodes; i++)
+            {
+                double z = (normalized[i] + x * row[i] + s->hiddenBias[i] - s->runningMean[i]) / sqrt(s->runningVariance[i] + NORM_EPSILON);
+                activation[i] = sigmoid_inline(s->gamma[i] * z + s->beta[i]);
+            }
+        }
+        output_forward(s, activation, NULL, outputs);
+        correct += predict_label(outputs, s->numOutputs) == predict_label(targets[n], s->numOutputs);
+    }
+    return 100.0 * correct / numTrainingSets;
+}
+
+int train_normalized(const struct norm_config *config, struct model *model,
+                     double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                     int epochs, double learningRate, double dropoutRate)
+{
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes, numOutputs = model->numOutputs;
+    int batchSize = config->batchSize;
+    int numThreads = config->numThreads;
+    struct norm_state s;
+    struct norm_batch batch;
+
+    if ((config->normalization != NORM_LAYER && config->normalization != NORM_BATCH) || batchSize <= 0 ||
+        (config->normalization == NORM_BATCH && batchSize < 2) || numThreads <= 0 || numTrainingSets <= 0)
+    {
+        return -1;
+    }
+
+    struct arena arena;
+    arena_create(&arena, 8 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 9 * arena_vector_bytes(batchSize, sizeof(void *)) +
+                             (size_t)batchSize * arena_vector_bytes(numInputs, sizeof(int)) +
+                             5 * arena_matrix_bytes(batchSize, numHiddenNodes) + 2 * arena_matrix_bytes(batchSize, numOutputs) +
+                             2 * arena_vector_bytes(batchSize, sizeof(double)) + 2 * arena_vector_bytes(batchSize, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)) + arena_vector_bytes(numThreads, sizeof(void *)) +
+                             (size_t)numThreads * arena_vector_bytes(numInputs, sizeof(int)) +
+                             2 * arena_matrix_bytes(numThreads, numHiddenNodes) + arena_matrix_bytes(numThreads, numOutputs));
+
+    s.normalization = config->normalization;
+    s.numInputs = numInputs;
+    s.numHiddenNodes = numHiddenNodes;
+    s.numOutputs = numOutputs;
+    s.hiddenWeights = model->hiddenWeights;
+    s.outputWeights = model->outputWeights;
+    s.hiddenBias = model->hiddenLayerBias;
+    s.outputBias = model->outputLayerBias;
+    s.gamma = arena_alloc_vector(&arena, numHiddenNodes);
+    s.beta = arena_alloc_vector(&arena, numHiddenNodes);
+    s.runningMean = arena_alloc_vector(&arena, numHiddenNodes);
+    s.runningVariance = arena_alloc_vector(&arena, numHiddenNodes);
+    s.mean = arena_alloc_vector(&arena, numHiddenNodes);
+    s.invStd = arena_alloc_vector(&arena, numHiddenNodes);
+    s.errorSum = arena_alloc_vector(&arena, numHiddenNodes);
+    s.errorDot = arena_alloc_vector(&arena, numHiddenNodes);
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        s.gamma[i] = 1.0;
+        s.beta[i] = 0.0;
+        s.runningMean[i] = 0.0;
+        s.runningVariance[i] = 1.0;
+    }
+
+    batch.inputs = arena_alloc(&arena, batchSize * sizeof(double *));
+    batch.inputIndex = arena_alloc(&arena, batchSize * sizeof(int *));
+    for (int b = 0; b < batchSize; b++)
+    {
+        batch.inputIndex[b] = arena_alloc(&arena, numInputs * sizeof(int));
+    }
+    batch.numActiveInputs = arena_alloc(&arena, batchSize * sizeof(int));
+    batch.normalized = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    batch.activation = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    batch.keep = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    batch.errors = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    batch.deltaHidden = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    batch.outputs = arena_alloc_matrix(&arena, batchSize, numOutputs);
+    batch.deltaOutput = arena_alloc_matrix(&arena, batchSize, numOutputs);
+    batch.invStd = arena_alloc_vector(&arena, batchSize);
+    batch.sampleLoss = arena_alloc_vector(&arena, batchSize);
+    batch.sampleCorrect = arena_alloc(&arena, batchSize * sizeof(int));
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+
+    // Workspace of the inference pass, one row per thread
+    struct norm_batch work = {0};
+    work.inputIndex = arena_alloc(&arena, numThreads * sizeof(int *));
+    for (int t = 0; t < numThreads; t++)
+    {
+        work.inputIndex[t] = arena_alloc(&arena, numInputs * sizeof(int));
+    }
+    work.normalized = arena_alloc_matrix(&arena, numThreads, numHiddenNodes);
+    work.activation = arena_alloc_matrix(&arena, numThreads, numHiddenNodes);
+    work.outputs = arena_alloc_matrix(&arena, numThreads, numOutputs);
+
+    printf("Normalization: %s norm before the hidden sigmoid, mini-batch %d, %d threads\n",
+           normalization_name(s.normalization), batchSize, numThreads);
+
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+        double epochStart = now_seconds();
+        double loss = 0.0;
+        long correct = 0;
+
+        for (int first = 0; first < numTrainingSets; first += batchSize)
+        {
+            int count = numTrainingSets - first < batchSize ? numTrainingSets - first : batchSize;
+
+            // A last mini-batch of one sample has no batch statistics, it is skipped
+            if (s.normalization == NORM_BATCH && count < 2)
+            {
+                continue;
+            }
+
+            // The masks are drawn by this thread only, so the random numbers are drawn in a fixed order
+            for (int b = 0; b < count; b++)
+            {
+                if (dropoutRate > 0.0)
+                {
+                    draw_dropout_mask(&mask, numHiddenNodes, dropoutRate);
+                }
+                else
+                {
+                    keep_all_neurons(&mask, numHiddenNodes);
+                }
+                for (int i = 0; i < numHiddenNodes; i++)
+                {
+                    batch.keep[b][i] = (mask.bits[i / 64] >> (i % 64)) & 1 ? mask.scale : 0.0;
+                }
+                batch.inputs[b] = trainingInputs[first + b];
+            }
+
+            train_batch(&s, &batch, trainingOutputs + first, count, learningRate, numThreads);
+            for (int b = 0; b < count; b++)
+            {
+                loss += batch.sampleLoss[b];
+                correct += batch.sampleCorrect[b];
+            }
+        }
+
+        double seconds = now_seconds() - epochStart;
+        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%ld/%d) - %.0f samples/s\n",
+               epoch + 1, epochs, loss / numTrainingSets, 100.0 * correct / numTrainingSets, correct, numTrainingSets,
+               numTrainingSets / seconds);
+    }
+
+    printf("Accuracy of the inference (%s): %.2f%%\n", s.normalization == NORM_BATCH ? "running statistics" : "no dropout",
+           inference_accuracy(&s, &work, trainingInputs, trainingOutputs, numTrainingSets, numThreads));
+
+    // Batch norm with fixed statistics is an affine map of the sums, it becomes part of the hidden weights and biases
+    if (s.normalization == NORM_BATCH)
+    {
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            double scale = s.gamma[i] / sqrt(s.runningVariance[i] + NORM_EPSILON);
+            for (int j = 0; j < numInputs; j++)
+            {
+                model->hiddenWeights[j][i] *= scale;
+            }
+            model->hiddenLayerBias[i] = (model->hiddenLayerBias[i] - s.runningMean[i]) * scale + s.beta[i];
+        }
+        printf("Batch norm folded into the hidden weights and biases\n");
+    }
+
+    arena_destroy(&arena);
+    return 0;
+}
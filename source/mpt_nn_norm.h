@@ -0,0 +1,100 @@
+/**
+ * @file mpt_nn_norm.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the training with a normalized hidden layer (layer norm or batch norm).
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The sums of the hidden layer are normalized before the sigmoid: layer norm uses mean and variance of the hidden
+ * nodes of every sample, batch norm those of every hidden node over the mini-batch. A learned scale (gamma) and shift
+ * (beta) per hidden node follow. The mean and the variance are accumulated in the same vectorized loop that adds the
+ * last nonzero input and the bias to the sums, and normalization, scale, shift, sigmoid and dropout are applied in one
+ * loop. The backward pass likewise computes the errors of the sigmoid together with the two sums of the normalization
+ * and derives the errors of the sums in a second loop.
+ *
+ * Batch norm is computed by threads that own blocks of hidden nodes: the statistics, the backward pass and the weight
+ * updates of a block need no reduction between threads. Layer norm is computed by threads that own samples.
+ * After the training the running statistics of batch norm are folded into the hidden weights and biases, so the model
+ * can be saved and served without normalization. Layer norm depends on every sample and cannot be folded.
+ */
+#ifndef MPT_NN_NORM_H
+#define MPT_NN_NORM_H
+
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Hidden nodes per block of the batch norm threads (one AVX-512 register of doubles).
+ */
+#define NORM_LANES 8
+
+/**
+ * @brief Added to the variance before the square root.
+ */
+#define NORM_EPSILON 1e-5
+
+/**
+ * @brief Weight of a mini-batch in the running mean and variance of batch norm.
+ */
+#define NORM_MOMENTUM 0.1
+
+/**
+ * @brief Normalization of the hidden layer.
+ */
+enum normalization
+{
+    NORM_NONE,  /**< The sigmoid is applied to the sums. */
+    NORM_LAYER, /**< Mean and variance over the hidden nodes of a sample. */
+    NORM_BATCH  /**< Mean and variance of a hidden node over the mini-batch. */
+};
+
+/**
+ * @brief Configuration of the training with normalization.
+ */
+struct norm_config
+{
+    enum normalization normalization; /**< NORM_LAYER or NORM_BATCH. */
+    int batchSize;                    /**< Samples per mini-batch, at least 2 for batch norm. */
+    int numThreads;                   /**< Number of OpenMP threads. */
+};
+
+/**
+ * @brief Parses a normalization.
+ *
+ * @param name "none", "layer" or "batch".
+ * @param normalization Receives the normalization.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_normalization(const char *name, enum normalization *normalization);
+
+/**
+ * @brief Returns the name of a normalization, e.g. "layer".
+ *
+ * @param normalization Normalization.
+ * @return const char* Name of the normalization.
+ */
+const char *normalization_name(enum normalization normalization);
+
+/**
+ * @brief Trains a model with a normalized hidden layer.
+ *
+ * The weights are updated after every mini-batch with learningRate times the summed gradient of its samples.
+ * Prints the loss, accuracy and throughput of every epoch and the accuracy of the inference forward pass at the end
+ * (batch norm with the running statistics). The results do not depend on the number of threads.
+ *
+ * @param config Configuration of the training.
+ * @param model Initialized weights and biases, replaced by the trained ones (batch norm folded in).
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param epochs Number of epochs.
+ * @param learningRate Learning rate per sample.
+ * @param dropoutRate Dropout rate of the hidden layer.
+ * @return 0 on success, -1 if the configuration is invalid.
+ */
+int train_normalized(const struct norm_config *config, struct model *model,
+                     double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                     int epochs, double learningRate, double dropoutRate);
+
+#endif // MPT_NN_NORM_H
@@ -0,0 +1,434 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <omp.h>
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Affinity mask of the process before bind_threads narrowed the threads to places.
+ */
+static cpu_set_t processMask;
+
+/**
+ * @brief Set once processMask holds the mask.
+ */
+static int processMaskSaved = 0;
+
+/**
+ * @brief Mask of the calling thread between process_affinity_begin and process_affinity_end.
+ */
+static __thread cpu_set_t threadMask;
+
+/**
+ * @brief Set while threadMask holds the mask of the calling thread.
+ */
+static __thread int threadMaskSaved = 0;
+
+/**
+ * @brief Reads a single integer from a sysfs file.
+ *
+ * @param path Path of the file.
+ * @param fallback Value returned if the file cannot be read.
+ * @return int The value of the file or the fallback.
+ */
+static int read_sysfs_int(const char *path, int fallback)
+{
+    FILE *file = fopen(path, "r");
+    int value = fallback;
+
+    if (file == NULL)
+    {
+        return fallback;
+    }
+    if (fscanf(file, "%d", &value) != 1)
+    {
+        value = fallback;
+    }
+    fclose(file);
+    return value;
+}
+
+/**
+ * @brief Parses a CPU list like "0,2,4-7" into a CPU set.
+ *
+ * @param list CPU list.
+ * @param set Set that receives the CPUs.
+ * @return 0 on success, -1 if the list is malformed.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *set)
+{
+    const char *p = list;
+
+    CPU_ZERO(set);
+    while (*p != '\0' && *p != '\n')
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p || first < 0)
+        {
+            return -1;
+        }
+        p = end;
+        if (*p == '-')
+        {
+            p++;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first)
+            {
+                return -1;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+        {
+            CPU_SET(cpu, set);
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0' && *p != '\n')
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Counts the distinct values of an array.
+ *
+ * @param values Array of values.
+ * @param size Number of values.
+ * @return int Number of distinct values.
+ */
+static int count_distinct(const int *values, int size)
+{
+    int distinct = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        int seen = 0;
+        for (int j = 0; j < i && !seen; j++)
+        {
+            seen = values[j] == values[i];
+        }
+        distinct += !seen;
+    }
+    return distinct;
+}
+
+void detect_topology(struct cpu_topology *topo)
+{
+    cpu_set_t allowed;
+    char path[128];
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        CPU_ZERO(&allowed);
+        CPU_SET(0, &allowed);
+    }
+
+    topo->numCpus = CPU_COUNT(&allowed);
+    topo->cpus = malloc(topo->numCpus * sizeof(int));
+    topo->node = malloc(topo->numCpus * sizeof(int));
+    topo->socket = malloc(topo->numCpus * sizeof(int));
+    topo->core = malloc(topo->numCpus * sizeof(int));
+    if (!topo->cpus || !topo->node || !topo->socket || !topo->core)
+    {
+        fprintf(stderr, "Failed to allocate memory for the topology\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int n = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && n < topo->numCpus; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+        topo->cpus[n] = cpu;
+        topo->node[n] = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+        topo->socket[n] = read_sysfs_int(path, 0);
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        topo->core[n] = read_sysfs_int(path, cpu);
+        n++;
+    }
+
+    for (int node = 0; node < 1024; node++)
+    {
+        char list[4096];
+        cpu_set_t nodeCpus;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == NULL)
+        {
+            continue;
+        }
+        if (fgets(list, sizeof(list), file) != NULL && parse_cpu_list(list, &nodeCpus) == 0)
+        {
+            for (int i = 0; i < topo->numCpus; i++)
+            {
+                if (CPU_ISSET(topo->cpus[i], &nodeCpus))
+                {
+                    topo->node[i] = node;
+                }
+            }
+        }
+        fclose(file);
+    }
+
+    topo->numNodes = count_distinct(topo->node, topo->numCpus);
+    topo->numSockets = count_distinct(topo->socket, topo->numCpus);
+}
+
+void free_topology(struct cpu_topology *topo)
+{
+    free(topo->cpus);
+    free(topo->node);
+    free(topo->socket);
+    free(topo->core);
+    memset(topo, 0, sizeof(*topo));
+}
+
+/**
+ * @brief Builds the list of places for a place definition.
+ *
+ * @param topo Topology of the machine.
+ * @param places Place definition (threads, cores, sockets, numa or a CPU list).
+ * @param sets Array of at least numCpus sets receiving the places.
+ * @return int Number of places, -1 if the definition is invalid.
+ */
+static int build_places(const struct cpu_topology *topo, const char *places, cpu_set_t *sets)
+{
+    int numPlaces = 0;
+    const int *key = NULL;
+
+    if (strcmp(places, "threads") == 0)
+    {
+        for (int i = 0; i < topo->numCpus; i++)
+        {
+            CPU_ZERO(&sets[i]);
+            CPU_SET(topo->cpus[i], &sets[i]);
+        }
+        return topo->numCpus;
+    }
+
+    if (strcmp(places, "sockets") == 0)
+    {
+        key = topo->socket;
+    }
+    else if (strcmp(places, "numa") == 0)
+    {
+        key = topo->node;
+    }
+
+    if (key != NULL || strcmp(places, "cores") == 0)
+    {
+        int placeOf[topo->numCpus];
+        for (int i = 0; i < topo->numCpus; i++)
+        {
+            placeOf[i] = -1;
+            for (int j = 0; j < i && placeOf[i] < 0; j++)
+            {
+                int same = key != NULL ? key[j] == key[i]
+                                       : topo->socket[j] == topo->socket[i] && topo->core[j] == topo->core[i];
+                if (same)
+                {
+                    placeOf[i] = placeOf[j];
+                }
+            }
+            if (placeOf[i] < 0)
+            {
+                placeOf[i] = numPlaces;
+                CPU_ZERO(&sets[numPlaces]);
+                numPlaces++;
+            }
+            CPU_SET(topo->cpus[i], &sets[placeOf[i]]);
+        }
+        return numPlaces;
+    }
+
+    cpu_set_t listed;
+    if (parse_cpu_list(places, &listed) != 0)
+    {
+        return -1;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE && numPlaces < topo->numCpus; cpu++)
+    {
+        if (CPU_ISSET(cpu, &listed))
+        {
+            CPU_ZERO(&sets[numPlaces]);
+            CPU_SET(cpu, &sets[numPlaces]);
+            numPlaces++;
+        }
+    }
+    return numPlaces > 0 ? numPlaces : -1;
+}
+
+int bind_threads(const struct cpu_topology *topo, const char *bind, const char *places)
+{
+    if (strcmp(bind, "none") == 0 || strcmp(bind, "false") == 0)
+    {
+        return 0;
+    }
+    if (strcmp(bind, "close") != 0 && strcmp(bind, "spread") != 0 && strcmp(bind, "master") != 0)
+    {
+        return -1;
+    }
+
+    cpu_set_t *sets = malloc(topo->numCpus * sizeof(cpu_set_t));
+    if (!sets)
+    {
+        fprintf(stderr, "Failed to allocate memory for the thread places\n");
+        exit(EXIT_FAILURE);
+    }
+
+    int numPlaces = build_places(topo, places, sets);
+    if (numPlaces < 0)
+    {
+        free(sets);
+        return -1;
+    }
+
+    if (!processMaskSaved)
+    {
+        if (sched_getaffinity(0, sizeof(processMask), &processMask) != 0)
+        {
+            free(sets);
+            return -1;
+        }
+        processMaskSaved = 1;
+    }
+
+    int failed = 0;
+#pragma omp parallel reduction(+ : failed)
+    {
+        int thread = omp_get_thread_num();
+        int numThreads = omp_get_num_threads();
+        int place = 0;
+
+        if (strcmp(bind, "close") == 0)
+        {
+            place = thread % numPlaces;
+        }
+        else if (strcmp(bind, "spread") == 0)
+        {
+            place = numThreads <= numPlaces ? (int)((long)thread * numPlaces / numThreads) : thread % numPlaces;
+        }
+        failed += sched_setaffinity(0, sizeof(cpu_set_t), &sets[place]) != 0;
+    }
+
+    free(sets);
+    return failed ? -1 : 0;
+}
+
+void process_affinity_begin(void)
+{
+    if (processMaskSaved && !threadMaskSaved && sched_getaffinity(0, sizeof(threadMask), &threadMask) == 0)
+    {
+        threadMaskSaved = sched_setaffinity(0, sizeof(processMask), &processMask) == 0;
+    }
+}
+
+void process_affinity_end(void)
+{
+    if (threadMaskSaved)
+    {
+        sched_setaffinity(0, sizeof(threadMask), &threadMask);
+        threadMaskSaved = 0;
+    }
+}
+
+int create_thread(pthread_t *thread, void *(*start)(void *), void *arg)
+{
+    process_affinity_begin();
+    int result = pthread_create(thread, NULL, start, arg);
+    process_affinity_end();
+    return result;
+}
+
+int process_cpu(int index)
+{
+    cpu_set_t allowed;
+
+    if (processMaskSaved)
+    {
+        allowed = processMask;
+    }
+    else if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+        return -1;
+    }
+    if (CPU_COUNT(&allowed) == 0)
+    {
+        return -1;
+    }
+
+    index %= CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+void print_topology(const struct cpu_topology *topo)
+{
+    int numThreads = omp_get_max_threads();
+    int threadCpu[numThreads];
+
+    printf("Topology: %d CPUs, %d socket(s), %d NUMA node(s)\n", topo->numCpus, topo->numSockets, topo->numNodes);
+    for (int i = 0; i < topo->numCpus; i++)
+    {
+        int first = 1;
+        for (int j = 0; j < i && first; j++)
+        {
+            first = topo->node[j] != topo->node[i];
+        }
+        if (!first)
+        {
+            continue;
+        }
+        printf("  Node %d:", topo->node[i]);
+        for (int j = i; j < topo->numCpus; j++)
+        {
+            if (topo->node[j] == topo->node[i])
+            {
+                printf(" %d", topo->cpus[j]);
+            }
+        }
+        printf("\n");
+    }
+
+    for (int t = 0; t < numThreads; t++)
+    {
+        threadCpu[t] = -1;
+    }
+#pragma omp parallel
+    {
+        threadCpu[omp_get_thread_num()] = sched_getcpu();
+    }
+
+    for (int t = 0; t < numThreads; t++)
+    {
+        int node = -1;
+        for (int i = 0; i < topo->numCpus; i++)
+        {
+            if (topo->cpus[i] == threadCpu[t])
+            {
+                node = topo->node[i];
+            }
+        }
+        printf("  Thread %d -> CPU %d (node %d)\n", t, threadCpu[t], node);
+    }
+}
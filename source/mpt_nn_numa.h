@@ -0,0 +1,112 @@
+/**
+ * @file mpt_nn_numa.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the NUMA topology and thread binding helpers.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for detecting the CPU/NUMA topology of the machine
+ * and pinning the OpenMP threads to places (cores, sockets, NUMA nodes).
+ */
+#ifndef MPT_NN_NUMA_H
+#define MPT_NN_NUMA_H
+
+#include <pthread.h>
+
+/**
+ * @brief Describes the CPUs the process may run on.
+ *
+ * Every array has numCpus entries and is indexed in the same order as cpus.
+ */
+struct cpu_topology
+{
+    int numCpus;    /**< Number of CPUs in the affinity mask of the process. */
+    int numNodes;   /**< Number of NUMA nodes that contain at least one of the CPUs. */
+    int numSockets; /**< Number of sockets (physical packages) that contain at least one of the CPUs. */
+    int *cpus;      /**< Operating system ids of the CPUs. */
+    int *node;      /**< NUMA node of every CPU. */
+    int *socket;    /**< Socket of every CPU. */
+    int *core;      /**< Core id of every CPU (unique within its socket). */
+};
+
+/**
+ * @brief Detects the CPU and NUMA topology from sysfs.
+ *
+ * Only the CPUs in the affinity mask of the process are taken into account.
+ * Missing sysfs entries (e.g. kernels without NUMA support) are treated as a single node and socket.
+ *
+ * @param topo Topology structure that is filled. Has to be released with free_topology.
+ */
+void detect_topology(struct cpu_topology *topo);
+
+/**
+ * @brief Releases the memory held by a topology structure.
+ *
+ * @param topo Topology filled by detect_topology.
+ */
+void free_topology(struct cpu_topology *topo);
+
+/**
+ * @brief Pins the threads of the OpenMP team to places.
+ *
+ * Places are built from the topology:
+ * threads (one place per hardware thread), cores (per physical core), sockets, numa (per node)
+ * or an explicit list of CPU ids like "0,2,4-7" (one place per listed CPU).
+ * The bind policy decides how threads are mapped onto the places:
+ * close (thread t on place t), spread (threads distributed evenly over all places),
+ * master (every thread on the first place) or none (no binding).
+ *
+ * The calling thread is thread 0 of the team and stays bound to its place. The affinity mask of the process from
+ * before the binding is saved: threads and processes created later inside process_affinity_begin/end (or with
+ * create_thread) get the whole mask instead of the place of the calling thread.
+ *
+ * @param topo Topology of the machine.
+ * @param bind Bind policy (close, spread, master, none).
+ * @param places Place definition (threads, cores, sockets, numa or a CPU list).
+ * @return 0 on success, -1 if the policy or places are invalid.
+ */
+int bind_threads(const struct cpu_topology *topo, const char *bind, const char *places);
+
+/**
+ * @brief Gives the calling thread the affinity mask the process had before bind_threads.
+ *
+ * Threads created and processes forked until process_affinity_end inherit the whole mask instead of the place
+ * of the calling thread. Does nothing if bind_threads has not bound any threads.
+ */
+void process_affinity_begin(void);
+
+/**
+ * @brief Restores the affinity mask the calling thread had before process_affinity_begin.
+ */
+void process_affinity_end(void);
+
+/**
+ * @brief Creates a thread with the affinity mask the process had before bind_threads.
+ *
+ * @param thread Receives the id of the new thread.
+ * @param start Function run by the thread.
+ * @param arg Argument of the function.
+ * @return int 0 on success, an error number of pthread_create otherwise.
+ */
+int create_thread(pthread_t *thread, void *(*start)(void *), void *arg);
+
+/**
+ * @brief Returns a CPU of the affinity mask the process had before bind_threads.
+ *
+ * Used to pin processes and threads that must not inherit the place of the calling thread.
+ *
+ * @param index Index of the CPU in the mask, wraps around the number of CPUs.
+ * @return int Operating system id of the CPU, -1 if the mask cannot be read.
+ */
+int process_cpu(int index);
+
+/**
+ * @brief Prints the detected topology and the CPU every OpenMP thread currently runs on.
+ *
+ * @param topo Topology of the machine.
+ */
+void print_topology(const struct cpu_topology *topo);
+
+#endif // MPT_NN_NUMA_H
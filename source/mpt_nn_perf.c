@@ -0,0 +1,640 @@
+/**
+ * @file mpt_nn_perf.c
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Performance-regression suite (make perf-check).
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Measures a fixed set of scenarios: the forward and backward kernels of every mode for several shapes and thread
+ * counts (in this process, on random sparse images) and complete training runs of mpt_nn (as child processes).
+ * Every scenario is repeated and all measurements are written to a JSON file. Given a baseline file of an earlier run,
+ * the mean log-times are compared with Welch's t-test: a scenario is reported as slower if the whole 95% confidence
+ * interval of the ratio of the geometric means lies above 1 + threshold. Any slower scenario or a missing baseline file makes the exit status 1.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_dataset.h"
+#include "mpt_nn_specialized.h"
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Largest number of repetitions of a scenario.
+ */
+#define PERF_MAX_REPETITIONS 100
+
+/**
+ * @brief Length of a scenario name.
+ */
+#define PERF_NAME_LENGTH 64
+
+/**
+ * @brief Images passed through the kernels per measurement.
+ */
+#define PERF_KERNEL_SAMPLES 256
+
+/**
+ * @brief Unmeasured repetitions before the measurements of a scenario.
+ */
+#define PERF_WARMUP 2
+
+/**
+ * @brief Two-sided confidence level of the comparison.
+ */
+#define PERF_CONFIDENCE 0.95
+
+/**
+ * @brief Kernels of a mode.
+ */
+enum perf_mode
+{
+    PERF_SEQUENTIAL,
+    PERF_PARALLEL,
+    PERF_SIMD
+};
+
+/**
+ * @brief Measurements of one scenario.
+ */
+struct scenario
+{
+    char name[PERF_NAME_LENGTH];           /**< e.g. kernel/simd/784-128-10/t4. */
+    const char *unit;                      /**< Unit of the measurements. */
+    double samples[PERF_MAX_REPETITIONS];  /**< One measurement per repetition. */
+    int numSamples;                        /**< Number of measurements. */
+};
+
+/**
+ * @brief Result of the comparison of a scenario with its baseline.
+ */
+struct comparison
+{
+    double ratio; /**< Ratio of the geometric means (current / baseline). */
+    double low;   /**< Lower bound of the confidence interval of the ratio. */
+    double high;  /**< Upper bound of the confidence interval of the ratio. */
+    int verdict;  /**< 1 slower, -1 faster, 0 no significant change beyond the threshold. */
+};
+
+/**
+ * @brief Shapes (inputs, hidden, outputs) of the kernel scenarios: a specialized shape and an uneven one.
+ */
+static const int kernelShapes[][3] = {{784, 128, 10}, {784, 37, 10}};
+
+/**
+ * @brief Arguments of the end-to-end scenarios, the thread count is appended to the multi-threaded ones.
+ */
+static const struct
+{
+    const char *name;  /**< Mode of the run. */
+    const char *shape; /**< Shape of the network, part of the scenario name. */
+    const char *args;  /**< Arguments of mpt_nn. */
+    bool threaded;     /**< -n with all threads is appended. */
+} commandScenarios[] = {
+    {"sequential", "784-128-10", "-m1 -t10000 -i784 -h128 -o10 -e1 -l0.01 -d0.1", false},
+    {"parallel", "784-128-10", "-m2 -t10000 -i784 -h128 -o10 -e1 -l0.01 -d0.1", true},
+    {"simd", "784-128-10", "-m3 -t10000 -i784 -h128 -o10 -e1 -l0.01 -d0.1", true},
+    {"ws", "784-37-10", "-m2 -t10000 -i784 -h37 -o10 -e1 -l0.01 -d0.2 --scheduler ws", true},
+    {"pipeline", "784-128-10", "-m1 -t10000 -i784 -h128 -o10 -e1 -l0.01 -d0.1 --pipeline 16", true},
+    {"bf16", "784-128-10", "-m1 -t10000 -i784 -h128 -o10 -e1 -l0.01 -d0.1 --precision bf16", true},
+};
+
+static const char *modeNames[] = {"sequential", "parallel", "simd"};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/**
+ * @brief Measures the forward and backward kernels of a mode in microseconds per image.
+ *
+ * @param s Scenario receiving the measurements, its name has to be set.
+ * @param mode Kernels to measure.
+ * @param shape Inputs, hidden nodes and outputs.
+ * @param numThreads Number of OpenMP threads.
+ * @param repetitions Number of measurements.
+ */
+static void measure_kernels(struct scenario *s, enum perf_mode mode, const int shape[3], int numThreads, int repetitions)
+{
+    int numInputs = shape[0], numHiddenNodes = shape[1], numOutputs = shape[2];
+    struct arena arena;
+
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_matrix_bytes(PERF_KERNEL_SAMPLES, numInputs) + arena_matrix_bytes(PERF_KERNEL_SAMPLES, numOutputs) +
+                             arena_vector_bytes(PERF_KERNEL_SAMPLES * numInputs, sizeof(int)) +
+                             arena_vector_bytes(PERF_KERNEL_SAMPLES, sizeof(int)) +
+                             4 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 4 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double **inputs = arena_alloc_matrix(&arena, PERF_KERNEL_SAMPLES, numInputs);
+    double **targets = arena_alloc_matrix(&arena, PERF_KERNEL_SAMPLES, numOutputs);
+    int *inputIndex = arena_alloc(&arena, PERF_KERNEL_SAMPLES * numInputs * sizeof(int));
+    int *numActiveInputs = arena_alloc(&arena, PERF_KERNEL_SAMPLES * sizeof(int));
+    double *hiddenLayer = arena_alloc_vector(&arena, numHiddenNodes);
+    double *hiddenLayerBias = arena_alloc_vector(&arena, numHiddenNodes);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
+    double *outputLayer = arena_alloc_vector(&arena, numOutputs);
+    double *outputLayerBias = arena_alloc_vector(&arena, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+
+    // Random images with about a fifth of the pixels set, like the MNIST digits
+    srand(1);
+    initialize_weights(hiddenWeights, numInputs, numHiddenNodes);
+    initialize_weights(outputWeights, numHiddenNodes, numOutputs);
+    initialize_bias(hiddenLayerBias, numHiddenNodes);
+    initialize_bias(outputLayerBias, numOutputs);
+    for (int n = 0; n < PERF_KERNEL_SAMPLES; n++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[n][j] = rand() % 5 == 0 ? (rand() % 256) / 255.0 : 0.0;
+        }
+        for (int k = 0; k < numOutputs; k++)
+        {
+            targets[n][k] = k == n % numOutputs ? 1.0 : 0.0;
+        }
+        numActiveInputs[n] = build_input_index(inputs[n], numInputs, inputIndex + n * numInputs);
+    }
+
+    forward_pass_kernel forward = mode == PERF_SEQUENTIAL ? forward_pass_sequential
+                                  : mode == PERF_PARALLEL ? forward_pass_parallel
+                                                          : forward_pass_simd;
+    backpropagation_kernel backward = mode == PERF_SEQUENTIAL ? backpropagation_sequential
+                                      : mode == PERF_PARALLEL ? backpropagation_parallel
+                                                              : backpropagation_simd;
+    const struct specialized_kernels *specialized = NULL;
+    if (mode == PERF_SIMD)
+    {
+        specialized = find_specialized_kernels(numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights);
+    }
+    if (specialized != NULL)
+    {
+        forward = specialized->forward;
+        backward = specialized->backward;
+    }
+
+    omp_set_num_threads(numThreads);
+    s->unit = "us/image";
+    s->numSamples = repetitions;
+    for (int r = -PERF_WARMUP; r < repetitions; r++)
+    {
+        double start = now_us();
+        for (int n = 0; n < PERF_KERNEL_SAMPLES; n++)
+        {
+            forward(inputs[n], inputIndex + n * numInputs, numActiveInputs[n], hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias,
+                    hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.1, true, &mask);
+            backward(inputs[n], inputIndex + n * numInputs, numActiveInputs[n], targets[n], hiddenLayer, outputLayer, hiddenLayerBias,
+                     outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, 0.001, numInputs, numHiddenNodes,
+                     numOutputs, &mask);
+        }
+        if (r >= 0)
+        {
+            s->samples[r] = (now_us() - start) / PERF_KERNEL_SAMPLES;
+        }
+    }
+
+    arena_destroy(&arena);
+}
+
+/**
+ * @brief Measures a training run of mpt_nn in milliseconds, the output of the run is discarded.
+ *
+ * @param s Scenario receiving the measurements, its name has to be set.
+ * @param executable Path of mpt_nn.
+ * @param args Arguments separated by spaces.
+ * @param repetitions Number of measurements.
+ * @return 0 on success, -1 if a run failed.
+ */
+static int measure_command(struct scenario *s, const char *executable, const char *args, int repetitions)
+{
+    char buffer[256];
+    char *argv[32];
+    int argc = 0;
+
+    snprintf(buffer, sizeof(buffer), "%s", args);
+    argv[argc++] = (char *)executable;
+    for (char *token = strtok(buffer, " "); token != NULL && argc < 31; token = strtok(NULL, " "))
+    {
+        argv[argc++] = token;
+    }
+    argv[argc] = NULL;
+
+    s->unit = "ms";
+    s->numSamples = repetitions;
+    for (int r = -1; r < repetitions; r++)
+    {
+        double start = now_us();
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            int null = open("/dev/null", O_WRONLY);
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            execv(executable, argv);
+            _exit(127);
+        }
+
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "Run of %s %s failed\n", executable, args);
+            s->numSamples = 0;
+            return -1;
+        }
+        if (r >= 0)
+        {
+            s->samples[r] = (now_us() - start) / 1e3;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the 1 - (1 - PERF_CONFIDENCE) / 2 quantile of Student's t-distribution.
+ *
+ * Uses the Cornish-Fisher expansion around the normal quantile, which is accurate to three digits from 3 degrees of freedom.
+ *
+ * @param df Degrees of freedom.
+ * @return double The quantile.
+ */
+static double t_quantile(double df)
+{
+    const double z = 1.959963984540054; // Normal quantile of 0.975, matches PERF_CONFIDENCE
+    double z3 = z * z * z, z5 = z3 * z * z, z7 = z5 * z * z, z9 = z7 * z * z;
+
+    if (df < 1.0)
+    {
+        df = 1.0;
+    }
+    return z + (z3 + z) / (4 * df) + (5 * z5 + 16 * z3 + 3 * z) / (96 * df * df) +
+           (3 * z7 + 19 * z5 + 17 * z3 - 15 * z) / (384 * df * df * df) +
+           (79 * z9 + 776 * z7 + 1482 * z5 - 1920 * z3 - 945 * z) / (92160 * df * df * df * df);
+}
+
+/**
+ * @brief Computes mean and variance of the logarithms of the measurements.
+ */
+static void log_moments(const double *samples, int n, double *mean, double *variance)
+{
+    double sum = 0.0, squares = 0.0;
+
+    for (int i = 0; i < n; i++)
+    {
+        sum += log(samples[i]);
+    }
+    *mean = sum / n;
+    for (int i = 0; i < n; i++)
+    {
+        double d = log(samples[i]) - *mean;
+        squares += d * d;
+    }
+    *variance = n > 1 ? squares / (n - 1) : 0.0;
+}
+
+/**
+ * @brief Compares the measurements of a scenario with its baseline (Welch's t-test on the log-times).
+ *
+ * @param baseline Baseline measurements.
+ * @param current Current measurements.
+ * @param threshold Relative change below which a significant difference is not reported, e.g. 0.05.
+ * @param result Receives ratio, confidence interval and verdict.
+ */
+static void compare_scenario(const struct scenario *baseline, const struct scenario *current, double threshold, struct comparison *result)
+{
+    double meanBase, varBase, meanCur, varCur;
+
+    log_moments(baseline->samples, baseline->numSamples, &meanBase, &varBase);
+    log_moments(current->samples, current->numSamples, &meanCur, &varCur);
+
+    double a = varBase / baseline->numSamples, b = varCur / current->numSamples;
+    double stderror = sqrt(a + b);
+    double df = 1.0;
+    if (a + b > 0.0)
+    {
+        // Welch-Satterthwaite approximation, a scenario with a single measurement counts as infinite variance
+        double denominator = (baseline->numSamples > 1 ? a * a / (baseline->numSamples - 1) : 0.0) +
+                             (current->numSamples > 1 ? b * b / (current->numSamples - 1) : 0.0);
+        df = denominator > 0.0 ? (a + b) * (a + b) / denominator : 1.0;
+    }
+
+    double difference = meanCur - meanBase, margin = t_quantile(df) * stderror;
+    result->ratio = exp(difference);
+    result->low = exp(difference - margin);
+    result->high = exp(difference + margin);
+    result->verdict = result->low > 1.0 + threshold ? 1 : result->high < 1.0 - threshold ? -1 : 0;
+}
+
+/**
+ * @brief Writes the measurements of all scenarios as JSON.
+ *
+ * @return 0 on success, -1 if the file could not be written.
+ */
+static int write_results(const char *path, const struct scenario *scenarios, int numScenarios, int numThreads)
+{
+    FILE *file = fopen(path, "w");
+    char host[256] = "unknown";
+
+    if (file == NULL)
+    {
+        perror("Error writing the results");
+        return -1;
+    }
+    gethostname(host, sizeof(host) - 1);
+
+    fprintf(file, "{\n  \"host\": \"%s\",\n  \"threads\": %d,\n  \"confidence\": %.2f,\n  \"scenarios\": [\n", host, numThreads, PERF_CONFIDENCE);
+    for (int s = 0; s < numScenarios; s++)
+    {
+        fprintf(file, "    {\"name\": \"%s\", \"unit\": \"%s\", \"samples\": [", scenarios[s].name, scenarios[s].unit);
+        for (int i = 0; i < scenarios[s].numSamples; i++)
+        {
+            fprintf(file, "%s%.3f", i > 0 ? ", " : "", scenarios[s].samples[i]);
+        }
+        fprintf(file, "]}%s\n", s + 1 < numScenarios ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/**
+ * @brief Reads the scenarios of a file written by write_results.
+ *
+ * Only the "name" and "samples" members of the scenarios are read, other members and the formatting are ignored.
+ *
+ * @param path Path of the JSON file.
+ * @param scenarios Receives up to maxScenarios scenarios (unit is NULL).
+ * @param maxScenarios Capacity of scenarios.
+ * @return int Number of scenarios read, -1 if the file could not be read.
+ */
+static int read_results(const char *path, struct scenario *scenarios, int maxScenarios)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *text = malloc(size + 1);
+    if (text == NULL || fread(text, 1, size, file) != (size_t)size)
+    {
+        free(text);
+        fclose(file);
+        return -1;
+    }
+    text[size] = '\0';
+    fclose(file);
+
+    int numScenarios = 0;
+    for (char *p = strstr(text, "\"name\""); p != NULL && numScenarios < maxScenarios; p = strstr(p, "\"name\""))
+    {
+        struct scenario *s = &scenarios[numScenarios];
+        char *start = strchr(p + 6, '"'), *end = start != NULL ? strchr(start + 1, '"') : NULL;
+        char *samples = end != NULL ? strstr(end, "\"samples\"") : NULL;
+        char *list = samples != NULL ? strchr(samples, '[') : NULL;
+        if (list == NULL || end - start - 1 >= PERF_NAME_LENGTH)
+        {
+            break;
+        }
+
+        memcpy(s->name, start + 1, end - start - 1);
+        s->name[end - start - 1] = '\0';
+        s->unit = NULL;
+        s->numSamples = 0;
+        p = list + 1;
+        while (s->numSamples < PERF_MAX_REPETITIONS)
+        {
+            char *next;
+            double value = strtod(p, &next);
+            if (next == p)
+            {
+                break;
+            }
+            s->samples[s->numSamples++] = value;
+            p = next + strspn(next, " ,\n\t\r");
+        }
+        numScenarios++;
+    }
+    free(text);
+    return numScenarios;
+}
+
+/**
+ * @brief Returns the arithmetic mean of the measurements.
+ */
+static double mean(const struct scenario *s)
+{
+    double sum = 0.0;
+    for (int i = 0; i < s->numSamples; i++)
+    {
+        sum += s->samples[i];
+    }
+    return s->numSamples > 0 ? sum / s->numSamples : 0.0;
+}
+
+/**
+ * @brief Prints the available command line options of the performance suite.
+ */
+static void print_perf_options(void)
+{
+    printf("Usage: mpt_nn_perf [options]\n");
+    printf("  -b, --baseline    <file>               Compare with the measurements of an earlier run\n");
+    printf("  -w, --write       <file>               Write the measurements as JSON\n");
+    printf("  -r, --repetitions <n>                  Measurements per kernel scenario (default 20)\n");
+    printf("  -R, --runs        <n>                  Measurements per end-to-end scenario (default 5)\n");
+    printf("  -T, --threshold   <percent>            Smallest slowdown that fails the check (default 5)\n");
+    printf("  -f, --filter      <text>               Only run scenarios whose name contains the text\n");
+    printf("  -x, --executable  <path>               mpt_nn for the end-to-end scenarios (default out/mpt_nn)\n");
+    printf("  -?, --help                             Display this help and exit\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *baselinePath = NULL;
+    const char *resultPath = NULL;
+    const char *filter = "";
+    const char *executable = "out/mpt_nn";
+    int repetitions = 20;
+    int runs = 5;
+    double threshold = 5.0;
+    int opt;
+
+    struct option longopt[] =
+        {
+            {"help", no_argument, NULL, '?'},
+            {"baseline", required_argument, NULL, 'b'},
+            {"write", required_argument, NULL, 'w'},
+            {"repetitions", required_argument, NULL, 'r'},
+            {"runs", required_argument, NULL, 'R'},
+            {"threshold", required_argument, NULL, 'T'},
+            {"filter", required_argument, NULL, 'f'},
+            {"executable", required_argument, NULL, 'x'},
+            {0, 0, 0, 0}};
+
+    opterr = 0;
+    while ((opt = getopt_long(argc, argv, "b:w:r:R:T:f:x:", longopt, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            baselinePath = optarg;
+            break;
+        case 'w':
+            resultPath = optarg;
+            break;
+        case 'r':
+            repetitions = atoi(optarg);
+            break;
+        case 'R':
+            runs = atoi(optarg);
+            break;
+        case 'T':
+            threshold = atof(optarg);
+            break;
+        case 'f':
+            filter = optarg;
+            break;
+        case 'x':
+            executable = optarg;
+            break;
+        default:
+            print_perf_options();
+            exit(opt == '?' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (repetitions < 2 || repetitions > PERF_MAX_REPETITIONS || runs < 2 || runs > PERF_MAX_REPETITIONS || threshold < 0.0)
+    {
+        print_perf_options();
+        exit(EXIT_FAILURE);
+    }
+
+    int maxThreads = omp_get_max_threads();
+    int threadCounts[2] = {1, maxThreads};
+    int numThreadCounts = maxThreads > 1 ? 2 : 1;
+    int maxScenarios = 3 * 2 * (int)(sizeof(kernelShapes) / sizeof(kernelShapes[0])) +
+                       (int)(sizeof(commandScenarios) / sizeof(commandScenarios[0]));
+    struct scenario *scenarios = calloc(maxScenarios, sizeof(struct scenario));
+    struct scenario *baseline = calloc(maxScenarios * 2, sizeof(struct scenario));
+    int numScenarios = 0, failed = 0;
+    if (!scenarios || !baseline)
+    {
+        fprintf(stderr, "Failed to allocate memory for the scenarios\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A check without a baseline could never fail, so a missing baseline is an error before anything is measured
+    int numBaseline = baselinePath != NULL ? read_results(baselinePath, baseline, maxScenarios * 2) : -1;
+    if (baselinePath != NULL && numBaseline < 0)
+    {
+        fprintf(stderr, "No baseline %s, create it with make perf-baseline first\n", baselinePath);
+        free(baseline);
+        free(scenarios);
+        exit(EXIT_FAILURE);
+    }
+
+    // Kernel scenarios: every mode, shape and thread count (the sequential kernels only with one thread)
+    for (int mode = PERF_SEQUENTIAL; mode <= PERF_SIMD; mode++)
+    {
+        for (size_t shape = 0; shape < sizeof(kernelShapes) / sizeof(kernelShapes[0]); shape++)
+        {
+            for (int t = 0; t < (mode == PERF_SEQUENTIAL ? 1 : numThreadCounts); t++)
+            {
+                struct scenario *s = &scenarios[numScenarios];
+                snprintf(s->name, sizeof(s->name), "kernel/%s/%d-%d-%d/t%d", modeNames[mode], kernelShapes[shape][0],
+                         kernelShapes[shape][1], kernelShapes[shape][2], threadCounts[t]);
+                if (strstr(s->name, filter) != NULL)
+                {
+                    measure_kernels(s, mode, kernelShapes[shape], threadCounts[t], repetitions);
+                    printf("%-40s %10.2f %s\n", s->name, mean(s), s->unit);
+                    numScenarios++;
+                }
+            }
+        }
+    }
+
+    // End-to-end scenarios need the MNIST files
+    if (access(MNIST_IMAGE_PATH, R_OK) != 0 || access(MNIST_LABEL_PATH, R_OK) != 0)
+    {
+        printf("MNIST files not found, skipping the end-to-end scenarios\n");
+    }
+    else
+    {
+        for (size_t c = 0; c < sizeof(commandScenarios) / sizeof(commandScenarios[0]); c++)
+        {
+            struct scenario *s = &scenarios[numScenarios];
+            int numThreads = commandScenarios[c].threaded ? maxThreads : 1;
+            char args[256];
+
+            snprintf(s->name, sizeof(s->name), "e2e/%s/%s/t%d", commandScenarios[c].name, commandScenarios[c].shape, numThreads);
+            if (strstr(s->name, filter) == NULL)
+            {
+                continue;
+            }
+            snprintf(args, sizeof(args), commandScenarios[c].threaded ? "%s -n%d" : "%s", commandScenarios[c].args, numThreads);
+            if (measure_command(s, executable, args, runs) != 0)
+            {
+                failed = 1;
+                continue;
+            }
+            printf("%-40s %10.2f %s\n", s->name, mean(s), s->unit);
+            numScenarios++;
+        }
+    }
+
+    if (resultPath != NULL && write_results(resultPath, scenarios, numScenarios, maxThreads) == 0)
+    {
+        printf("Measurements written to %s\n", resultPath);
+    }
+
+    int slower = 0;
+    if (baselinePath != NULL)
+    {
+        printf("\n%-40s %12s %12s %8s %19s  %s\n", "Scenario", "Baseline", "Current", "Change",
+               "95% CI", "Verdict");
+        for (int s = 0; s < numScenarios; s++)
+        {
+            const struct scenario *base = NULL;
+            for (int b = 0; b < numBaseline && base == NULL; b++)
+            {
+                base = strcmp(baseline[b].name, scenarios[s].name) == 0 && baseline[b].numSamples > 0 ? &baseline[b] : NULL;
+            }
+            if (base == NULL)
+            {
+                printf("%-40s %12s %12.2f %8s %19s  new\n", scenarios[s].name, "-", mean(&scenarios[s]), "-", "-");
+                continue;
+            }
+
+            struct comparison result;
+            compare_scenario(base, &scenarios[s], threshold / 100.0, &result);
+            printf("%-40s %12.2f %12.2f %+7.1f%% [%+6.1f%%, %+6.1f%%]  %s\n", scenarios[s].name, mean(base), mean(&scenarios[s]),
+                   100.0 * (result.ratio - 1.0), 100.0 * (result.low - 1.0), 100.0 * (result.high - 1.0),
+                   result.verdict > 0 ? "\033[1;31mslower\033[0m" : result.verdict < 0 ? "faster" : "unchanged");
+            slower += result.verdict > 0;
+        }
+        printf("%d of %d scenarios significantly slower (threshold %.1f%%)\n", slower, numScenarios, threshold);
+    }
+
+    free(baseline);
+    free(scenarios);
+    return slower > 0 || failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
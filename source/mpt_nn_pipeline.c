@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include "mpt_nn.h"
+#include "mpt_nn_pipeline.h"
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Hidden neurons per granule of the column tiles of stage 1 (one cache line of doubles).
+ */
+#define PIPELINE_TILE_GRANULE 8
+
+/**
+ * @brief Item that stops the thread of stage 2.
+ */
+#define PIPELINE_STOP -1
+
+void spsc_init(struct spsc_queue *queue)
+{
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+}
+
+bool spsc_push(struct spsc_queue *queue, int item)
+{
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+    if (tail - head == SPSC_QUEUE_CAPACITY)
+    {
+        return false;
+    }
+    queue->items[tail % SPSC_QUEUE_CAPACITY] = item;
+    atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool spsc_pop(struct spsc_queue *queue, int *item)
+{
+    unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+    if (head == tail)
+    {
+        return false;
+    }
+    *item = queue->items[head % SPSC_QUEUE_CAPACITY];
+    atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+    return true;
+}
+
+/**
+ * @brief A micro-batch in flight and the buffers it is handed between the stages with.
+ */
+struct pipeline_slot
+{
+    int first;            /**< Index of the first sample. */
+    int count;            /**< Number of samples. */
+    double **hidden;      /**< Hidden activations (count x numHiddenNodes), 0 for dropped neurons. */
+    double **keep;        /**< Dropout factor of every hidden neuron: the dropout scale or 0. */
+    double **deltaHidden; /**< Errors of the hidden layer, written by stage 2. */
+    int *inputIndex;      /**< Nonzero inputs of every sample (numInputs entries per sample). */
+    int *numActive;       /**< Number of nonzero inputs of every sample. */
+};
+
+/**
+ * @brief State of the pipeline shared by both stages.
+ */
+struct pipeline
+{
+    struct model *model;
+    double **trainingInputs;
+    double **trainingOutputs;
+    double learningRate;
+    double dropoutScale;  /**< Factor of the kept hidden neurons. */
+    int stageThreads[2];  /**< Threads of stage 1 and stage 2. */
+    struct pipeline_slot slots[PIPELINE_DEPTH];
+    struct spsc_queue forward;  /**< Slots handed from stage 1 to stage 2. */
+    struct spsc_queue backward; /**< Slots handed back from stage 2 to stage 1. */
+    double **outputs;     /**< Output activations of a micro-batch, only used by stage 2. */
+    double **deltaOutput; /**< Errors of the outputs of a micro-batch, only used by stage 2. */
+    double *sampleLoss;   /**< Loss of every sample of a micro-batch, only used by stage 2. */
+    int *sampleCorrect;   /**< 1 for every correctly predicted sample of a micro-batch, only used by stage 2. */
+    double loss;          /**< Loss of the epoch, written by stage 2. */
+    long correct;         /**< Correct predictions of the epoch, written by stage 2. */
+    double busy[2];       /**< Seconds both stages spent computing in the epoch. */
+};
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Takes the next slot of a queue, waits until there is one.
+ */
+static int wait_pop(struct spsc_queue *queue)
+{
+    int item;
+    while (!spsc_pop(queue, &item))
+    {
+        sched_yield();
+    }
+    return item;
+}
+
+/**
+ * @brief Appends a slot to a queue, waits until there is room.
+ */
+static void wait_push(struct spsc_queue *queue, int item)
+{
+    while (!spsc_push(queue, item))
+    {
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Computes the column tile [begin, end) of the hidden neurons owned by the calling thread of stage 1.
+ *
+ * The same thread owns the same tile in the forward and the backward pass.
+ */
+static void stage_tile(int n, int *begin, int *end)
+{
+    int numThreads = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+    int numGranules = (n + PIPELINE_TILE_GRANULE - 1) / PIPELINE_TILE_GRANULE;
+    int first = numGranules * thread / numThreads * PIPELINE_TILE_GRANULE;
+    int last = numGranules * (thread + 1) / numThreads * PIPELINE_TILE_GRANULE;
+
+    *begin = first < n ? first : n;
+    *end = last < n ? last : n;
+}
+
+/**
+ * @brief Stage 1, forward pass of a micro-batch: dropout masks, nonzero inputs and hidden activations.
+ */
+static void stage1_forward(struct pipeline *pipeline, struct pipeline_slot *slot, double dropoutRate, struct dropout_mask *mask)
+{
+    struct model *model = pipeline->model;
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes;
+
+    // The masks are drawn by this thread only, so the random numbers are drawn in a fixed order
+    for (int b = 0; b < slot->count; b++)
+    {
+        if (dropoutRate > 0.0)
+        {
+            draw_dropout_mask(mask, numHiddenNodes, dropoutRate);
+        }
+        else
+        {
+            keep_all_neurons(mask, numHiddenNodes);
+        }
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            slot->keep[b][i] = (mask->bits[i / 64] >> (i % 64)) & 1 ? mask->scale : 0.0;
+        }
+    }
+
+#pragma omp parallel num_threads(pipeline->stageThreads[0])
+    {
+#pragma omp for schedule(static)
+        for (int b = 0; b < slot->count; b++)
+        {
+            slot->numActive[b] = build_input_index(pipeline->trainingInputs[slot->first + b], numInputs, slot->inputIndex + (size_t)b * numInputs);
+        }
+
+        int begin, end;
+        stage_tile(numHiddenNodes, &begin, &end);
+        for (int b = 0; b < slot->count; b++)
+        {
+            const double *input = pipeline->trainingInputs[slot->first + b];
+            const int *index = slot->inputIndex + (size_t)b * numInputs;
+            double *hidden = slot->hidden[b];
+
+            for (int i = begin; i < end; i++)
+            {
+                hidden[i] = model->hiddenLayerBias[i];
+            }
+            for (int k = 0; k < slot->numActive[b]; k++)
+            {
+                int j = index[k];
+                double x = input[j];
+                const double *row = model->hiddenWeights[j];
+#pragma omp simd
+                for (int i = begin; i < end; i++)
+                {
+                    hidden[i] += x * row[i];
+                }
+            }
+            for (int i = begin; i < end; i++)
+            {
+                hidden[i] = sigmoid(hidden[i]) * slot->keep[b][i];
+            }
+        }
+    }
+}
+
+/**
+ * @brief Stage 1, backward pass of a micro-batch: update of the input weights and hidden biases.
+ */
+static void stage1_backward(struct pipeline *pipeline, const struct pipeline_slot *slot)
+{
+    struct model *model = pipeline->model;
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes;
+    double lr = pipeline->learningRate;
+
+#pragma omp parallel num_threads(pipeline->stageThreads[0])
+    {
+        int begin, end;
+        stage_tile(numHiddenNodes, &begin, &end);
+
+        for (int i = begin; i < end; i++)
+        {
+            double sum = 0.0;
+            for (int b = 0; b < slot->count; b++)
+            {
+                sum += slot->deltaHidden[b][i];
+            }
+            model->hiddenLayerBias[i] += sum * lr;
+        }
+        for (int b = 0; b < slot->count; b++)
+        {
+            const double *input = pipeline->trainingInputs[slot->first + b];
+            const int *index = slot->inputIndex + (size_t)b * numInputs;
+            const double *delta = slot->deltaHidden[b];
+
+            for (int k = 0; k < slot->numActive[b]; k++)
+            {
+                int j = index[k];
+                double x = input[j] * lr;
+                double *row = model->hiddenWeights[j];
+#pragma omp simd
+                for (int i = begin; i < end; i++)
+                {
+                    row[i] += x * delta[i];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Stage 2: outputs, errors and update of the output layer, errors of the hidden layer for stage 1.
+ */
+static void stage2_compute(struct pipeline *pipeline, struct pipeline_slot *slot)
+{
+    struct model *model = pipeline->model;
+    int numHiddenNodes = model->numHiddenNodes, numOutputs = model->numOutputs;
+    double lr = pipeline->learningRate;
+
+#pragma omp parallel num_threads(pipeline->stageThreads[1])
+    {
+#pragma omp for schedule(static)
+        for (int b = 0; b < slot->count; b++)
+        {
+            const double *target = pipeline->trainingOutputs[slot->first + b];
+            const double *hidden = slot->hidden[b];
+            double *output = pipeline->outputs[b];
+            double *delta = pipeline->deltaOutput[b];
+            double loss = 0.0;
+
+            for (int o = 0; o < numOutputs; o++)
+            {
+                output[o] = model->outputLayerBias[o];
+            }
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                double x = hidden[j];
+                const double *row = model->outputWeights[j];
+#pragma omp simd
+                for (int o = 0; o < numOutputs; o++)
+                {
+                    output[o] += x * row[o];
+                }
+            }
+            for (int o = 0; o < numOutputs; o++)
+            {
+                output[o] = sigmoid(output[o]);
+                loss += pow(target[o] - output[o], 2);
+                delta[o] = (target[o] - output[o]) * dSigmoid(output[o]);
+            }
+            pipeline->sampleLoss[b] = loss;
+            pipeline->sampleCorrect[b] = predict_label(output, numOutputs) == predict_label(target, numOutputs);
+
+            // The errors of the hidden layer use the output weights before this micro-batch updates them
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                double error = 0.0;
+                if (slot->keep[b][j] != 0.0)
+                {
+                    for (int o = 0; o < numOutputs; o++)
+                    {
+                        error += delta[o] * model->outputWeights[j][o];
+                    }
+                    error *= slot->keep[b][j] * dSigmoid(hidden[j] / pipeline->dropoutScale);
+                }
+                slot->deltaHidden[b][j] = error;
+            }
+        }
+
+#pragma omp for schedule(static)
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            double *row = model->outputWeights[j];
+            for (int b = 0; b < slot->count; b++)
+            {
+                double x = slot->hidden[b][j] * lr;
+                const double *delta = pipeline->deltaOutput[b];
+#pragma omp simd
+                for (int o = 0; o < numOutputs; o++)
+                {
+                    row[o] += x * delta[o];
+                }
+            }
+        }
+
+#pragma omp single
+        for (int b = 0; b < slot->count; b++)
+        {
+            for (int o = 0; o < numOutputs; o++)
+            {
+                model->outputLayerBias[o] += pipeline->deltaOutput[b][o] * lr;
+            }
+        }
+    }
+
+    // Summed in sample order, so the reported loss does not depend on the threads of the stage
+    for (int b = 0; b < slot->count; b++)
+    {
+        pipeline->loss += pipeline->sampleLoss[b];
+        pipeline->correct += pipeline->sampleCorrect[b];
+    }
+}
+
+/**
+ * @brief Main function of the thread of stage 2.
+ *
+ * @param arg The pipeline.
+ * @return void* Always NULL.
+ */
+static void *stage2_main(void *arg)
+{
+    struct pipeline *pipeline = arg;
+
+    for (;;)
+    {
+        int s = wait_pop(&pipeline->forward);
+        if (s == PIPELINE_STOP)
+        {
+            break;
+        }
+        double start = now_seconds();
+        stage2_compute(pipeline, &pipeline->slots[s]);
+        pipeline->busy[1] += now_seconds() - start;
+        wait_push(&pipeline->backward, s);
+    }
+    return NULL;
+}
+
+int train_pipeline(const struct pipeline_config *config, struct model *model,
+                   double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                   int epochs, double learningRate, double dropoutRate)
+{
+    int numInputs = model->numInputs, numHiddenNodes = model->numHiddenNodes, numOutputs = model->numOutputs;
+    int microBatch = config->microBatch;
+    struct pipeline pipeline;
+    pthread_t stage2;
+
+    if (microBatch <= 0 || config->numThreads <= 0 || numTrainingSets <= 0)
+    {
+        return -1;
+    }
+
+    // The threads are split in proportion to the weights of the stages, every stage gets at least one
+    double share = (double)numHiddenNodes * numOutputs / ((double)numInputs * numHiddenNodes + (double)numHiddenNodes * numOutputs);
+    pipeline.stageThreads[1] = (int)(config->numThreads * share + 0.5) > 0 ? (int)(config->numThreads * share + 0.5) : 1;
+    pipeline.stageThreads[0] = config->numThreads - pipeline.stageThreads[1] > 0 ? config->numThreads - pipeline.stageThreads[1] : 1;
+    printf("Pipeline: micro-batch %d, stage 1 (hidden layer, %.1f KiB weights) %d threads, stage 2 (output layer, %.1f KiB weights) %d threads\n",
+           microBatch, numInputs * (double)numHiddenNodes * sizeof(double) / 1024.0, pipeline.stageThreads[0],
+           numHiddenNodes * (double)numOutputs * sizeof(double) / 1024.0, pipeline.stageThreads[1]);
+
+    pipeline.model = model;
+    pipeline.trainingInputs = trainingInputs;
+    pipeline.trainingOutputs = trainingOutputs;
+    pipeline.learningRate = learningRate;
+    pipeline.dropoutScale = 1.0 / (1.0 - dropoutRate);
+
+    struct arena arena;
+    arena_create(&arena, PIPELINE_DEPTH * (3 * arena_matrix_bytes(microBatch, numHiddenNodes) +
+                                           arena_vector_bytes((size_t)microBatch * numInputs, sizeof(int)) +
+                                           arena_vector_bytes(microBatch, sizeof(int))) +
+                             2 * arena_matrix_bytes(microBatch, numOutputs) +
+                             arena_vector_bytes(microBatch, sizeof(double)) + arena_vector_bytes(microBatch, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(numHiddenNodes), sizeof(uint64_t)) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(int)));
+    for (int s = 0; s < PIPELINE_DEPTH; s++)
+    {
+        struct pipeline_slot *slot = &pipeline.slots[s];
+        slot->hidden = arena_alloc_matrix(&arena, microBatch, numHiddenNodes);
+        slot->keep = arena_alloc_matrix(&arena, microBatch, numHiddenNodes);
+        slot->deltaHidden = arena_alloc_matrix(&arena, microBatch, numHiddenNodes);
+        slot->inputIndex = arena_alloc(&arena, (size_t)microBatch * numInputs * sizeof(int));
+        slot->numActive = arena_alloc(&arena, microBatch * sizeof(int));
+    }
+    pipeline.outputs = arena_alloc_matrix(&arena, microBatch, numOutputs);
+    pipeline.deltaOutput = arena_alloc_matrix(&arena, microBatch, numOutputs);
+    pipeline.sampleLoss = arena_alloc_vector(&arena, microBatch);
+    pipeline.sampleCorrect = arena_alloc(&arena, microBatch * sizeof(int));
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(numHiddenNodes) * sizeof(uint64_t)),
+                                arena_alloc(&arena, numHiddenNodes * sizeof(int)), 0, 1.0};
+
+    spsc_init(&pipeline.forward);
+    spsc_init(&pipeline.backward);
+    create_thread(&stage2, stage2_main, &pipeline);
+
+    int numMicroBatches = (numTrainingSets + microBatch - 1) / microBatch;
+    for (int epoch = 0; epoch < epochs; epoch++)
+    {
+        double epochStart = now_seconds();
+        pipeline.loss = 0.0;
+        pipeline.correct = 0;
+        pipeline.busy[0] = pipeline.busy[1] = 0.0;
+
+        // Fixed schedule: micro-batch m is handed to stage 2 before the backward pass of m - 1 is applied,
+        // independent of how fast the stages are
+        for (int m = 0; m < numMicroBatches + PIPELINE_DEPTH - 1; m++)
+        {
+            if (m < numMicroBatches)
+            {
+                struct pipeline_slot *slot = &pipeline.slots[m % PIPELINE_DEPTH];
+                double start = now_seconds();
+                slot->first = m * microBatch;
+                slot->count = numTrainingSets - slot->first < microBatch ? numTrainingSets - slot->first : microBatch;
+                stage1_forward(&pipeline, slot, dropoutRate, &mask);
+                pipeline.busy[0] += now_seconds() - start;
+                wait_push(&pipeline.forward, m % PIPELINE_DEPTH);
+            }
+            if (m >= PIPELINE_DEPTH - 1)
+            {
+                int s = wait_pop(&pipeline.backward);
+                double start = now_seconds();
+                stage1_backward(&pipeline, &pipeline.slots[s]);
+                pipeline.busy[0] += now_seconds() - start;
+            }
+        }
+
+        double seconds = now_seconds() - epochStart;
+        printf("Epoch %d/%d - Loss: %.6f - Accuracy: %.2f%% (%ld/%d) - %.0f samples/s - Stage 1: busy %.3fs (%.1f%%), Stage 2: busy %.3fs (%.1f%%)\n",
+               epoch + 1, epochs, pipeline.loss / numTrainingSets, 100.0 * pipeline.correct / numTrainingSets, pipeline.correct, numTrainingSets,
+               numTrainingSets / seconds, pipeline.busy[0], 100.0 * pipeline.busy[0] / seconds, pipeline.busy[1], 100.0 * pipeline.busy[1] / seconds);
+    }
+
+    wait_push(&pipeline.forward, PIPELINE_STOP);
+    pthread_join(stage2, NULL);
+    arena_destroy(&arena);
+    return 0;
+}
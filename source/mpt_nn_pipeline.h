@@ -0,0 +1,115 @@
+/**
+ * @file mpt_nn_pipeline.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the layer-pipelined training.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The layers of the network are assigned to pipeline stages, every stage runs on its own group of cores:
+ * stage 1 owns the hidden layer (the input weights), stage 2 owns the output layer. The training data is split
+ * into micro-batches that stream through the stages: stage 1 computes the hidden activations of a micro-batch and
+ * hands it to stage 2 through a bounded lock-free queue, stage 2 computes the outputs, the errors and the update of
+ * the output weights and hands the errors of the hidden layer back. Meanwhile stage 1 already computes the next
+ * micro-batch. Every thread of stage 1 owns the same columns of the input weights in the forward and the backward
+ * pass, so each core keeps its slice of one layer in its cache instead of cycling the whole model per sample.
+ */
+#ifndef MPT_NN_PIPELINE_H
+#define MPT_NN_PIPELINE_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "mpt_nn_utility.h"
+#include "mpt_nn_arena.h"
+
+/**
+ * @brief Default number of samples per micro-batch.
+ */
+#define PIPELINE_DEFAULT_MICRO_BATCH 16
+
+/**
+ * @brief Micro-batches in flight between the stages (one per stage).
+ *
+ * Stage 1 computes micro-batch m + 1 while stage 2 works on m, so the forward pass of m + 1 does not see
+ * the update of the input weights by m yet (the update is one micro-batch stale, like PipeDream without weight stashing).
+ */
+#define PIPELINE_DEPTH 2
+
+/**
+ * @brief Capacity of a queue between two stages (a power of two larger than PIPELINE_DEPTH).
+ */
+#define SPSC_QUEUE_CAPACITY 4
+
+/**
+ * @brief Bounded lock-free queue with one producer and one consumer thread.
+ *
+ * The two counters are on their own cache lines, so the producer and the consumer only share a line
+ * when an item is handed over.
+ */
+struct spsc_queue
+{
+    atomic_uint head; /**< Next item to pop, only written by the consumer. */
+    char padding1[ARENA_ALIGNMENT - sizeof(atomic_uint)];
+    atomic_uint tail; /**< Next free entry, only written by the producer. */
+    char padding2[ARENA_ALIGNMENT - sizeof(atomic_uint)];
+    int items[SPSC_QUEUE_CAPACITY]; /**< Ring buffer of the items. */
+};
+
+/**
+ * @brief Initializes an empty queue.
+ *
+ * @param queue Queue.
+ */
+void spsc_init(struct spsc_queue *queue);
+
+/**
+ * @brief Appends an item, called by the producer only.
+ *
+ * @param queue Queue.
+ * @param item Item.
+ * @return true on success, false if the queue is full.
+ */
+bool spsc_push(struct spsc_queue *queue, int item);
+
+/**
+ * @brief Takes the oldest item, called by the consumer only.
+ *
+ * @param queue Queue.
+ * @param item Receives the item.
+ * @return true on success, false if the queue is empty.
+ */
+bool spsc_pop(struct spsc_queue *queue, int *item);
+
+/**
+ * @brief Configuration of the pipelined training.
+ */
+struct pipeline_config
+{
+    int microBatch; /**< Samples per micro-batch, 0 disables the pipeline. */
+    int numThreads; /**< Threads of both stages together, split in proportion to the weights of the stages. */
+};
+
+/**
+ * @brief Trains a model with the layer pipeline.
+ *
+ * The weights are updated after every micro-batch with learningRate times the summed gradient of its samples.
+ * The order of all operations is fixed, so the result does not depend on the timing of the stages
+ * (and is reproducible in the deterministic mode). Prints the loss, accuracy, throughput and the busy time
+ * of both stages for every epoch.
+ *
+ * @param config Configuration of the pipeline.
+ * @param model Initialized weights and biases, trained in place.
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param epochs Number of epochs.
+ * @param learningRate Learning rate per sample.
+ * @param dropoutRate Dropout rate of the hidden layer.
+ * @return 0 on success, -1 if the configuration is invalid.
+ */
+int train_pipeline(const struct pipeline_config *config, struct model *model,
+                   double **trainingInputs, double **trainingOutputs, int numTrainingSets,
+                   int epochs, double learningRate, double dropoutRate);
+
+#endif // MPT_NN_PIPELINE_H
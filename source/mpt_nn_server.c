@@ -0,0 +1,672 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "mpt_nn_server.h"
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Maximum number of concurrent client connections.
+ */
+#define SERVER_MAX_CONNECTIONS 1024
+
+/**
+ * @brief Size of the receive buffer of the I/O thread in bytes.
+ */
+#define SERVER_READ_BUFFER 65536
+
+/**
+ * @brief Number of latency samples kept per statistics interval.
+ */
+#define SERVER_LATENCY_SAMPLES 65536
+
+/**
+ * @brief A client connection.
+ */
+struct connection
+{
+    int fd;                     /**< Socket of the connection. */
+    uint32_t nextId;            /**< Id of the next image received on the connection. */
+    int filled;                 /**< Bytes of the current image received so far. */
+    unsigned char *partial;     /**< Buffer of the current image. */
+    int pending;                /**< Images queued or in flight (guarded by the queue lock). */
+    int closing;                /**< Set when the client closed the connection. */
+    pthread_mutex_t writeLock;  /**< Serializes the replies of concurrent workers. */
+};
+
+/**
+ * @brief An image waiting for classification.
+ */
+struct request
+{
+    struct connection *conn; /**< Connection the image was received on. */
+    uint32_t id;             /**< Id of the image on its connection. */
+    struct timespec arrival; /**< Time the image was completely received. */
+};
+
+/**
+ * @brief State shared by the I/O thread and the workers.
+ */
+struct server
+{
+    const struct server_config *config;
+    const struct model *model;
+
+    pthread_mutex_t lock;           /**< Guards the queue, the connections' pending counters and the statistics. */
+    pthread_cond_t notEmpty;        /**< Signaled when requests are queued or the server stops. */
+    struct request *queue;          /**< Ring buffer of waiting requests. */
+    unsigned char *pixels;          /**< Pixels of the requests, numInputs bytes per queue slot. */
+    int head;                       /**< Index of the oldest request. */
+    int count;                      /**< Number of waiting requests. */
+    int stop;                       /**< Set when the server shuts down. */
+
+    long totalRequests;             /**< Requests answered since the start. */
+    long totalBatches;              /**< Micro-batches computed since the start. */
+    long *batchHistogram;           /**< Number of micro-batches per batch size (maxBatch + 1 entries). */
+    int maxQueueDepth;              /**< Largest queue depth seen when a batch was taken. */
+    long queueDepthSum;             /**< Sum of the queue depths seen when a batch was taken. */
+    double *latencies;              /**< Latency samples of the current interval in microseconds. */
+    int numLatencies;               /**< Number of latency samples of the current interval. */
+    long intervalRequests;          /**< Requests answered in the current interval. */
+    long forwardedRequests;         /**< Requests forwarded by the cascade to the served model since the start. */
+
+    struct arena arena;             /**< Arena owning the queue and the buffers of the workers. */
+};
+
+/**
+ * @brief Buffers of one worker thread.
+ */
+struct worker
+{
+    struct server *server;
+    double **inputs;
+    double **hiddenLayer;
+    double **outputLayer;
+    struct request *batch;
+    struct cascade cascade;         /**< Cascade of the worker, only used with config->cascade. */
+    int *labels;                    /**< Labels of the batch predicted by the cascade. */
+};
+
+static volatile sig_atomic_t stopRequested = 0;
+
+/**
+ * @brief Signal handler for SIGINT and SIGTERM.
+ *
+ * @param sig Received signal.
+ */
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stopRequested = 1;
+}
+
+/**
+ * @brief Returns the difference of two points in time in microseconds.
+ *
+ * @param start Earlier point in time.
+ * @param end Later point in time.
+ * @return double Difference in microseconds.
+ */
+static double elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/**
+ * @brief Compares two doubles for qsort.
+ */
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int server_address(const char *address, struct sockaddr_storage *addr, socklen_t *len)
+{
+    memset(addr, 0, sizeof(*addr));
+
+    if (strncmp(address, "unix:", 5) == 0 || address[0] == '/')
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        const char *path = address[0] == '/' ? address : address + 5;
+
+        if (strlen(path) == 0 || strlen(path) >= sizeof(un->sun_path))
+        {
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path);
+        *len = sizeof(*un);
+        return 0;
+    }
+
+    const char *port = strncmp(address, "tcp:", 4) == 0 ? address + 4 : address;
+    char *end;
+    long value = strtol(port, &end, 10);
+    if (end == port || *end != '\0' || value <= 0 || value > 65535)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)value);
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *len = sizeof(*in);
+    return 0;
+}
+
+/**
+ * @brief Prints the statistics of the current interval and starts a new one.
+ *
+ * Has to be called with the queue lock held.
+ *
+ * @param server Server state.
+ * @param seconds Length of the interval in seconds.
+ */
+static void print_stats(struct server *server, double seconds)
+{
+    double p50 = 0.0, p99 = 0.0, max = 0.0;
+
+    if (server->numLatencies > 0)
+    {
+        qsort(server->latencies, server->numLatencies, sizeof(double), compare_double);
+        p50 = server->latencies[(int)(0.50 * (server->numLatencies - 1))];
+        p99 = server->latencies[(int)(0.99 * (server->numLatencies - 1))];
+        max = server->latencies[server->numLatencies - 1];
+    }
+
+    printf("Requests: %ld (%.1f/s) - Queue depth: %d (max %d, avg %.1f) - Latency p50: %.0fus p99: %.0fus max: %.0fus\n",
+           server->totalRequests, seconds > 0.0 ? server->intervalRequests / seconds : 0.0,
+           server->count, server->maxQueueDepth,
+           server->totalBatches > 0 ? (double)server->queueDepthSum / server->totalBatches : 0.0,
+           p50, p99, max);
+    if (server->config->cascade != NULL)
+    {
+        printf("Cascade: %.2f%% answered by the %d-%d-%d model\n",
+               server->totalRequests > 0 ? 100.0 * (server->totalRequests - server->forwardedRequests) / server->totalRequests : 0.0,
+               server->config->cascade->numInputs, server->config->cascade->numHiddenNodes, server->config->cascade->numOutputs);
+    }
+    printf("Batch sizes:");
+    for (int size = 1; size <= server->config->maxBatch; size++)
+    {
+        if (server->batchHistogram[size] > 0)
+        {
+            printf(" %d:%ld", size, server->batchHistogram[size]);
+        }
+    }
+    printf("\n");
+    fflush(stdout);
+
+    server->numLatencies = 0;
+    server->intervalRequests = 0;
+}
+
+/**
+ * @brief Sends a reply to a client.
+ *
+ * @param conn Connection of the request.
+ * @param id Id of the image.
+ * @param label Predicted label.
+ */
+static void send_reply(struct connection *conn, uint32_t id, int label)
+{
+    struct server_reply reply = {id, (uint8_t)label, {0, 0, 0}};
+    const char *data = (const char *)&reply;
+    size_t sent = 0;
+
+    pthread_mutex_lock(&conn->writeLock);
+    while (sent < sizeof(reply))
+    {
+        ssize_t n = send(conn->fd, data + sent, sizeof(reply) - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        sent += n;
+    }
+    pthread_mutex_unlock(&conn->writeLock);
+}
+
+/**
+ * @brief Worker thread: takes micro-batches from the queue and classifies them.
+ *
+ * A batch is taken as soon as it is full or the oldest request has waited for the latency budget.
+ *
+ * @param arg Worker state.
+ * @return void* Always NULL.
+ */
+static void *worker_main(void *arg)
+{
+    struct worker *worker = arg;
+    struct server *server = worker->server;
+    const struct model *model = server->model;
+    int numInputs = model->numInputs;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&server->lock);
+        while (!server->stop && server->count == 0)
+        {
+            pthread_cond_wait(&server->notEmpty, &server->lock);
+        }
+        if (server->count == 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            break;
+        }
+
+        struct timespec deadline = server->queue[server->head].arrival;
+        deadline.tv_nsec += (long)server->config->latencyBudgetUs * 1000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        while (!server->stop && server->count > 0 && server->count < server->config->maxBatch)
+        {
+            if (pthread_cond_timedwait(&server->notEmpty, &server->lock, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+        if (server->count == 0)
+        {
+            pthread_mutex_unlock(&server->lock);
+            continue;
+        }
+
+        int batchSize = server->count < server->config->maxBatch ? server->count : server->config->maxBatch;
+        server->queueDepthSum += server->count;
+        if (server->count > server->maxQueueDepth)
+        {
+            server->maxQueueDepth = server->count;
+        }
+        for (int b = 0; b < batchSize; b++)
+        {
+            int slot = (server->head + b) % SERVER_QUEUE_CAPACITY;
+            const unsigned char *pixels = server->pixels + (size_t)slot * numInputs;
+
+            worker->batch[b] = server->queue[slot];
+            for (int j = 0; j < numInputs; j++)
+            {
+                worker->inputs[b][j] = pixels[j] / 255.0;
+            }
+        }
+        server->head = (server->head + batchSize) % SERVER_QUEUE_CAPACITY;
+        server->count -= batchSize;
+        pthread_mutex_unlock(&server->lock);
+
+        int numForwarded = 0;
+        if (server->config->cascade != NULL)
+        {
+            numForwarded = cascade_classify(&worker->cascade, worker->inputs, batchSize, worker->labels);
+        }
+        else if (server->config->workStealing)
+        {
+            forward_pass_batch_ws(worker->inputs, batchSize, worker->hiddenLayer, worker->outputLayer,
+                                  model->hiddenLayerBias, model->outputLayerBias, model->hiddenWeights, model->outputWeights,
+                                  model->numInputs, model->numHiddenNodes, model->numOutputs);
+        }
+        else
+        {
+            forward_pass_batch(worker->inputs, batchSize, worker->hiddenLayer, worker->outputLayer,
+                               model->hiddenLayerBias, model->outputLayerBias, model->hiddenWeights, model->outputWeights,
+                               model->numInputs, model->numHiddenNodes, model->numOutputs);
+        }
+
+        for (int b = 0; b < batchSize; b++)
+        {
+            int label = server->config->cascade != NULL ? worker->labels[b] : predict_label(worker->outputLayer[b], model->numOutputs);
+            send_reply(worker->batch[b].conn, worker->batch[b].id, label);
+        }
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        pthread_mutex_lock(&server->lock);
+        for (int b = 0; b < batchSize; b++)
+        {
+            worker->batch[b].conn->pending--;
+            if (server->numLatencies < SERVER_LATENCY_SAMPLES)
+            {
+                server->latencies[server->numLatencies++] = elapsed_us(&worker->batch[b].arrival, &now);
+            }
+        }
+        server->batchHistogram[batchSize]++;
+        server->totalBatches++;
+        server->totalRequests += batchSize;
+        server->intervalRequests += batchSize;
+        server->forwardedRequests += numForwarded;
+        pthread_mutex_unlock(&server->lock);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Opens the listening socket.
+ *
+ * @param address Server address.
+ * @return int Socket, -1 on error.
+ */
+static int open_listener(const char *address)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int one = 1;
+
+    if (server_address(address, &addr, &len) != 0)
+    {
+        fprintf(stderr, "Invalid server address %s\n", address);
+        return -1;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("Error creating server socket");
+        return -1;
+    }
+    if (addr.ss_family == AF_UNIX)
+    {
+        unlink(((struct sockaddr_un *)&addr)->sun_path);
+    }
+    else
+    {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(fd, (struct sockaddr *)&addr, len) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        perror("Error binding server socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Reads the available bytes of a connection and queues every complete image.
+ *
+ * Reads at most as many bytes as the free slots of the queue can take, the rest stays in the socket
+ * until the workers have taken requests out of the queue.
+ *
+ * @param server Server state.
+ * @param conn Connection to read from.
+ */
+static void read_connection(struct server *server, struct connection *conn)
+{
+    int numInputs = server->model->numInputs;
+    unsigned char buffer[SERVER_READ_BUFFER];
+
+    // Only this thread adds requests, the free slots can only grow until the images are queued
+    pthread_mutex_lock(&server->lock);
+    int freeSlots = SERVER_QUEUE_CAPACITY - server->count;
+    pthread_mutex_unlock(&server->lock);
+    if (freeSlots == 0)
+    {
+        return;
+    }
+
+    size_t capacity = (size_t)freeSlots * numInputs - conn->filled;
+    ssize_t n = recv(conn->fd, buffer, capacity < sizeof(buffer) ? capacity : sizeof(buffer), 0);
+
+    if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    {
+        return;
+    }
+    if (n <= 0)
+    {
+        conn->closing = 1;
+        return;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    pthread_mutex_lock(&server->lock);
+    for (ssize_t offset = 0; offset < n && server->count < SERVER_QUEUE_CAPACITY;)
+    {
+        int take = numInputs - conn->filled;
+        if (take > n - offset)
+        {
+            take = n - offset;
+        }
+        memcpy(conn->partial + conn->filled, buffer + offset, take);
+        conn->filled += take;
+        offset += take;
+
+        if (conn->filled == numInputs)
+        {
+            int slot = (server->head + server->count) % SERVER_QUEUE_CAPACITY;
+            server->queue[slot] = (struct request){conn, conn->nextId++, now};
+            memcpy(server->pixels + (size_t)slot * numInputs, conn->partial, numInputs);
+            server->count++;
+            conn->pending++;
+            conn->filled = 0;
+        }
+    }
+    pthread_cond_broadcast(&server->notEmpty);
+    pthread_mutex_unlock(&server->lock);
+}
+
+int run_server(const struct server_config *config, const struct model *model)
+{
+    struct server server;
+    struct connection *conns[SERVER_MAX_CONNECTIONS];
+    struct connection *polled[SERVER_MAX_CONNECTIONS];
+    struct pollfd fds[SERVER_MAX_CONNECTIONS + 1];
+    int numConns = 0;
+    int numInputs = model->numInputs;
+    int maxImagesPerRead = SERVER_READ_BUFFER / numInputs + 1;
+
+    // A read never takes more images than the queue has free slots, so the reads resume once the queue is not full
+    if (maxImagesPerRead > SERVER_QUEUE_CAPACITY)
+    {
+        maxImagesPerRead = SERVER_QUEUE_CAPACITY;
+    }
+
+    memset(&server, 0, sizeof(server));
+    server.config = config;
+    server.model = model;
+
+    if (config->cascade != NULL && (config->cascade->numInputs != model->numInputs || config->cascade->numOutputs != model->numOutputs))
+    {
+        fprintf(stderr, "The cascade model does not have the inputs and outputs of the served model\n");
+        return -1;
+    }
+
+    int listener = open_listener(config->address);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    size_t workerBytes = arena_vector_bytes(config->maxBatch, sizeof(struct request)) +
+                         arena_matrix_bytes(config->maxBatch, model->numInputs) +
+                         arena_matrix_bytes(config->maxBatch, model->numHiddenNodes) +
+                         arena_matrix_bytes(config->maxBatch, model->numOutputs) +
+                         arena_vector_bytes(config->maxBatch, sizeof(int));
+    arena_create(&server.arena, arena_vector_bytes(SERVER_QUEUE_CAPACITY, sizeof(struct request)) +
+                                    arena_vector_bytes((size_t)SERVER_QUEUE_CAPACITY * numInputs, 1) +
+                                    arena_vector_bytes(config->maxBatch + 1, sizeof(long)) +
+                                    arena_vector_bytes(SERVER_LATENCY_SAMPLES, sizeof(double)) +
+                                    arena_vector_bytes(config->numWorkers, sizeof(struct worker)) +
+                                    arena_vector_bytes(config->numWorkers, sizeof(pthread_t)) +
+                                    config->numWorkers * workerBytes);
+    server.queue = arena_alloc(&server.arena, SERVER_QUEUE_CAPACITY * sizeof(struct request));
+    server.pixels = arena_alloc(&server.arena, (size_t)SERVER_QUEUE_CAPACITY * numInputs);
+    server.batchHistogram = arena_alloc(&server.arena, (config->maxBatch + 1) * sizeof(long));
+    server.latencies = arena_alloc(&server.arena, SERVER_LATENCY_SAMPLES * sizeof(double));
+    memset(server.batchHistogram, 0, (config->maxBatch + 1) * sizeof(long));
+
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&server.notEmpty, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    pthread_mutex_init(&server.lock, NULL);
+
+    struct worker *workers = arena_alloc(&server.arena, config->numWorkers * sizeof(struct worker));
+    pthread_t *threads = arena_alloc(&server.arena, config->numWorkers * sizeof(pthread_t));
+    for (int w = 0; w < config->numWorkers; w++)
+    {
+        workers[w].server = &server;
+        workers[w].batch = arena_alloc(&server.arena, config->maxBatch * sizeof(struct request));
+        workers[w].inputs = arena_alloc_matrix(&server.arena, config->maxBatch, model->numInputs);
+        workers[w].hiddenLayer = arena_alloc_matrix(&server.arena, config->maxBatch, model->numHiddenNodes);
+        workers[w].outputLayer = arena_alloc_matrix(&server.arena, config->maxBatch, model->numOutputs);
+        workers[w].labels = arena_alloc(&server.arena, config->maxBatch * sizeof(int));
+        if (config->cascade != NULL)
+        {
+            cascade_create(&workers[w].cascade, config->cascade, model, config->margin, config->maxBatch);
+        }
+        create_thread(&threads[w], worker_main, &workers[w]);
+    }
+
+    struct sigaction action, oldInt, oldTerm;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    stopRequested = 0;
+    sigaction(SIGINT, &action, &oldInt);
+    sigaction(SIGTERM, &action, &oldTerm);
+
+    printf("Serving %d-%d-%d model on %s (max batch %d, latency budget %dus, %d workers)\n",
+           model->numInputs, model->numHiddenNodes, model->numOutputs, config->address,
+           config->maxBatch, config->latencyBudgetUs, config->numWorkers);
+    if (config->cascade != NULL)
+    {
+        printf("Cascade: the %d-%d-%d model answers images with a top-1 margin of at least %.2f\n", config->cascade->numInputs,
+               config->cascade->numHiddenNodes, config->cascade->numOutputs, config->margin);
+    }
+    fflush(stdout);
+
+    struct timespec lastReport, now;
+    clock_gettime(CLOCK_MONOTONIC, &lastReport);
+
+    while (!stopRequested)
+    {
+        pthread_mutex_lock(&server.lock);
+        int room = SERVER_QUEUE_CAPACITY - server.count >= maxImagesPerRead;
+
+        // Connections closed by their clients are released once all their replies are sent
+        for (int c = 0; c < numConns;)
+        {
+            if (conns[c]->closing && conns[c]->pending == 0)
+            {
+                close(conns[c]->fd);
+                pthread_mutex_destroy(&conns[c]->writeLock);
+                free(conns[c]);
+                conns[c] = conns[--numConns];
+                continue;
+            }
+            c++;
+        }
+        pthread_mutex_unlock(&server.lock);
+
+        // Closed connections and, while the queue is full, all connections are left out, POLLHUP would wake poll at once
+        int numPolled = 0;
+        fds[0].fd = listener;
+        fds[0].events = numConns < SERVER_MAX_CONNECTIONS ? POLLIN : 0;
+        for (int c = 0; c < numConns && room; c++)
+        {
+            if (!conns[c]->closing)
+            {
+                fds[numPolled + 1].fd = conns[c]->fd;
+                fds[numPolled + 1].events = POLLIN;
+                polled[numPolled++] = conns[c];
+            }
+        }
+
+        int ready = poll(fds, numPolled + 1, room ? 100 : 1);
+        if (ready > 0)
+        {
+            for (int c = 0; c < numPolled; c++)
+            {
+                if (fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR))
+                {
+                    read_connection(&server, polled[c]);
+                    pthread_mutex_lock(&server.lock);
+                    room = SERVER_QUEUE_CAPACITY - server.count >= maxImagesPerRead;
+                    pthread_mutex_unlock(&server.lock);
+                    if (!room)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                int fd = accept(listener, NULL, NULL);
+                struct connection *conn = fd >= 0 ? calloc(1, sizeof(struct connection) + numInputs) : NULL;
+                if (conn != NULL)
+                {
+                    conn->fd = fd;
+                    conn->partial = (unsigned char *)(conn + 1);
+                    pthread_mutex_init(&conn->writeLock, NULL);
+                    conns[numConns++] = conn;
+                }
+                else if (fd >= 0)
+                {
+                    close(fd);
+                }
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double seconds = elapsed_us(&lastReport, &now) / 1e6;
+        if (config->statsInterval > 0 && seconds >= config->statsInterval)
+        {
+            pthread_mutex_lock(&server.lock);
+            print_stats(&server, seconds);
+            pthread_mutex_unlock(&server.lock);
+            lastReport = now;
+        }
+    }
+
+    pthread_mutex_lock(&server.lock);
+    server.stop = 1;
+    pthread_cond_broadcast(&server.notEmpty);
+    pthread_mutex_unlock(&server.lock);
+    for (int w = 0; w < config->numWorkers; w++)
+    {
+        pthread_join(threads[w], NULL);
+        if (config->cascade != NULL)
+        {
+            cascade_destroy(&workers[w].cascade);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("Server stopped after %ld requests in %ld micro-batches\n", server.totalRequests, server.totalBatches);
+    print_stats(&server, elapsed_us(&lastReport, &now) / 1e6);
+
+    for (int c = 0; c < numConns; c++)
+    {
+        close(conns[c]->fd);
+        pthread_mutex_destroy(&conns[c]->writeLock);
+        free(conns[c]);
+    }
+    close(listener);
+    if (strncmp(config->address, "unix:", 5) == 0 || config->address[0] == '/')
+    {
+        unlink(config->address[0] == '/' ? config->address : config->address + 5);
+    }
+    sigaction(SIGINT, &oldInt, NULL);
+    sigaction(SIGTERM, &oldTerm, NULL);
+    pthread_cond_destroy(&server.notEmpty);
+    pthread_mutex_destroy(&server.lock);
+    arena_destroy(&server.arena);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file mpt_nn_server.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the mpt_nn inference server.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for serving a trained mpt_nn model on a Unix domain socket
+ * or a loopback TCP port. Clients send raw images (numInputs bytes, one byte per pixel).
+ * Concurrent requests are collected into micro-batches within a latency budget and classified
+ * by a pool of worker threads with one batched forward pass per micro-batch. With a cascade, a small model classifies
+ * the micro-batch first and only the images with a small top-1 margin are classified by the served model.
+ *
+ * Protocol: every image sent on a connection gets the next id of that connection (starting at 0).
+ * For every image the server answers with one struct server_reply. Replies of different micro-batches
+ * may arrive out of order, the id identifies the image.
+ */
+#ifndef MPT_NN_SERVER_H
+#define MPT_NN_SERVER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "mpt_nn_cascade.h"
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Default maximum number of images in one micro-batch.
+ */
+#define SERVER_DEFAULT_MAX_BATCH 32
+
+/**
+ * @brief Default time in microseconds the oldest request may wait for its micro-batch to fill up.
+ */
+#define SERVER_DEFAULT_LATENCY_US 2000
+
+/**
+ * @brief Default number of worker threads.
+ */
+#define SERVER_DEFAULT_WORKERS 4
+
+/**
+ * @brief Number of requests that can wait in the queue before the server stops reading from the sockets.
+ */
+#define SERVER_QUEUE_CAPACITY 4096
+
+/**
+ * @brief Reply sent for every classified image.
+ */
+struct server_reply
+{
+    uint32_t id;         /**< Id of the image on its connection. */
+    uint8_t label;       /**< Predicted label. */
+    uint8_t reserved[3]; /**< Padding, always 0. */
+};
+
+/**
+ * @brief Configuration of the inference server.
+ */
+struct server_config
+{
+    const char *address;         /**< Unix socket path ("unix:/path" or "/path") or loopback TCP port ("tcp:5000" or "5000"). */
+    int maxBatch;                /**< Maximum number of images in one micro-batch. */
+    int latencyBudgetUs;         /**< Time in microseconds the oldest request may wait for its micro-batch to fill up. */
+    int numWorkers;              /**< Number of worker threads computing micro-batches. */
+    int statsInterval;           /**< Seconds between two statistics reports. */
+    bool workStealing;           /**< Computes the micro-batches with forward_pass_batch_ws on the scheduler pool. */
+    const struct model *cascade; /**< Small model classifying every image first, NULL to serve without a cascade. */
+    double margin;               /**< Images with a smaller top-1 margin of the cascade model are forwarded to the served model. */
+};
+
+/**
+ * @brief Resolves a server address.
+ *
+ * @param address Unix socket path ("unix:/path" or "/path") or loopback TCP port ("tcp:5000" or "5000").
+ * @param addr Socket address that is filled.
+ * @param len Length of the filled socket address.
+ * @return 0 on success, -1 if the address is invalid.
+ */
+int server_address(const char *address, struct sockaddr_storage *addr, socklen_t *len);
+
+/**
+ * @brief Serves a model until SIGINT or SIGTERM is received.
+ *
+ * Prints the queue depth, the batch size histogram and the latency percentiles
+ * (from arrival of an image until its reply is sent) every statsInterval seconds and on shutdown, with a cascade also
+ * the share of the images answered by the small model.
+ *
+ * @param config Configuration of the server.
+ * @param model Model used to classify the images.
+ * @return 0 after a clean shutdown, -1 if the server could not be started or the cascade model does not fit the model.
+ */
+int run_server(const struct server_config *config, const struct model *model);
+
+#endif // MPT_NN_SERVER_H
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_sparse.h"
+
+/**
+ * @brief Compares two doubles for qsort.
+ */
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Returns the value below which count of the given values lie (the count-th smallest value).
+ *
+ * @param values Values, sorted in place.
+ * @param size Number of values.
+ * @param count Number of values that are pruned.
+ * @return double Largest pruned value, -1.0 if nothing is pruned.
+ */
+static double pruning_threshold(double *values, size_t size, size_t count)
+{
+    if (count == 0)
+    {
+        return -1.0;
+    }
+    qsort(values, size, sizeof(double), compare_double);
+    return values[count - 1];
+}
+
+double prune_weights(double **weights, int rows, int cols, double sparsity)
+{
+    size_t size = (size_t)rows * cols;
+    size_t count = (size_t)(sparsity * size + 0.5);
+    double *magnitudes = malloc(size * sizeof(double));
+
+    if (magnitudes == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for pruning\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            magnitudes[(size_t)i * cols + j] = fabs(weights[i][j]);
+        }
+    }
+    double threshold = pruning_threshold(magnitudes, size, count);
+    free(magnitudes);
+
+    // Ties at the threshold are pruned until exactly count weights are zero
+    size_t pruned = 0;
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            if (fabs(weights[i][j]) < threshold)
+            {
+                weights[i][j] = 0.0;
+                pruned++;
+            }
+        }
+    }
+    for (int i = 0; i < rows && pruned < count; i++)
+    {
+        for (int j = 0; j < cols && pruned < count; j++)
+        {
+            if (fabs(weights[i][j]) == threshold)
+            {
+                weights[i][j] = 0.0;
+                pruned++;
+            }
+        }
+    }
+    return threshold;
+}
+
+double prune_weight_blocks(double **weights, int rows, int cols, double sparsity)
+{
+    int blockRows = (rows + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+    int blockCols = (cols + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+    size_t numBlocks = (size_t)blockRows * blockCols;
+    size_t count = (size_t)(sparsity * numBlocks + 0.5);
+    double *norms = malloc(2 * numBlocks * sizeof(double));
+
+    if (norms == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for pruning\n");
+        exit(EXIT_FAILURE);
+    }
+
+    double *sorted = norms + numBlocks;
+    for (int br = 0; br < blockRows; br++)
+    {
+        for (int bc = 0; bc < blockCols; bc++)
+        {
+            double sum = 0.0;
+            for (int i = br * SPARSE_BLOCK_SIZE; i < rows && i < (br + 1) * SPARSE_BLOCK_SIZE; i++)
+            {
+                for (int j = bc * SPARSE_BLOCK_SIZE; j < cols && j < (bc + 1) * SPARSE_BLOCK_SIZE; j++)
+                {
+                    sum += weights[i][j] * weights[i][j];
+                }
+            }
+            norms[(size_t)br * blockCols + bc] = sorted[(size_t)br * blockCols + bc] = sqrt(sum);
+        }
+    }
+    double threshold = pruning_threshold(sorted, numBlocks, count);
+
+    size_t pruned = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t b = 0; b < numBlocks && pruned < count; b++)
+        {
+            // First all blocks below the threshold, then ties until exactly count blocks are zero
+            if (norms[b] < 0.0 || (pass == 0 ? norms[b] >= threshold : norms[b] != threshold))
+            {
+                continue;
+            }
+            int br = b / blockCols, bc = b % blockCols;
+            for (int i = br * SPARSE_BLOCK_SIZE; i < rows && i < (br + 1) * SPARSE_BLOCK_SIZE; i++)
+            {
+                for (int j = bc * SPARSE_BLOCK_SIZE; j < cols && j < (bc + 1) * SPARSE_BLOCK_SIZE; j++)
+                {
+                    weights[i][j] = 0.0;
+                }
+            }
+            norms[b] = -1.0;
+            pruned++;
+        }
+    }
+    free(norms);
+    return threshold;
+}
+
+double pruning_schedule(double target, int epoch, int epochs)
+{
+    double remaining = 1.0 - (double)epoch / epochs;
+    return target * (1.0 - remaining * remaining * remaining);
+}
+
+double weight_sparsity(double **weights, int rows, int cols)
+{
+    size_t zeros = 0;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            zeros += weights[i][j] == 0.0;
+        }
+    }
+    return (double)zeros / ((size_t)rows * cols);
+}
+
+void sparse_from_dense(struct sparse_matrix *matrix, double **dense, int rows, int cols, enum sparse_format format)
+{
+    int B = SPARSE_BLOCK_SIZE;
+    int blockRows = (rows + B - 1) / B, blockCols = (cols + B - 1) / B;
+    int numRows = format == SPARSE_CSR ? rows : blockRows;
+    int numStored = 0;
+
+    // Count the stored weights or blocks first, so the arena can be sized exactly
+    for (int r = 0; r < numRows; r++)
+    {
+        for (int c = 0; c < (format == SPARSE_CSR ? cols : blockCols); c++)
+        {
+            bool nonzero = false;
+            for (int i = format == SPARSE_CSR ? r : r * B; i < rows && i < (format == SPARSE_CSR ? r + 1 : (r + 1) * B); i++)
+            {
+                for (int j = format == SPARSE_CSR ? c : c * B; j < cols && j < (format == SPARSE_CSR ? c + 1 : (c + 1) * B); j++)
+                {
+                    nonzero |= dense[i][j] != 0.0;
+                }
+            }
+            numStored += nonzero;
+        }
+    }
+
+    int valuesPerEntry = format == SPARSE_CSR ? 1 : B * B;
+    matrix->format = format;
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->numStored = numStored;
+    arena_create(&matrix->arena, arena_vector_bytes(numRows + 1, sizeof(int)) + arena_vector_bytes(numStored, sizeof(int)) +
+                                     arena_vector_bytes((size_t)numStored * valuesPerEntry, sizeof(double)) +
+                                     arena_vector_bytes((size_t)blockCols * B, sizeof(double)));
+    matrix->rowPtr = arena_alloc(&matrix->arena, (numRows + 1) * sizeof(int));
+    matrix->colIndex = arena_alloc(&matrix->arena, numStored * sizeof(int));
+    matrix->values = arena_alloc_vector(&matrix->arena, (size_t)numStored * valuesPerEntry);
+    matrix->accumulator = format == SPARSE_BLOCK ? arena_alloc_vector(&matrix->arena, (size_t)blockCols * B) : NULL;
+
+    int k = 0;
+    for (int r = 0; r < numRows; r++)
+    {
+        matrix->rowPtr[r] = k;
+        if (format == SPARSE_CSR)
+        {
+            for (int c = 0; c < cols; c++)
+            {
+                if (dense[r][c] != 0.0)
+                {
+                    matrix->colIndex[k] = c;
+                    matrix->values[k++] = dense[r][c];
+                }
+            }
+            continue;
+        }
+        for (int bc = 0; bc < blockCols; bc++)
+        {
+            double *block = matrix->values + (size_t)k * B * B;
+            bool nonzero = false;
+            for (int i = 0; i < B; i++)
+            {
+                for (int j = 0; j < B; j++)
+                {
+                    int row = r * B + i, col = bc * B + j;
+                    block[i * B + j] = row < rows && col < cols ? dense[row][col] : 0.0;
+                    nonzero |= block[i * B + j] != 0.0;
+                }
+            }
+            if (nonzero)
+            {
+                matrix->colIndex[k++] = bc;
+            }
+        }
+    }
+    matrix->rowPtr[numRows] = k;
+}
+
+void free_sparse(struct sparse_matrix *matrix)
+{
+    arena_destroy(&matrix->arena);
+    memset(matrix, 0, sizeof(*matrix));
+}
+
+size_t sparse_bytes(const struct sparse_matrix *matrix)
+{
+    int numRows = matrix->format == SPARSE_CSR ? matrix->rows : (matrix->rows + SPARSE_BLOCK_SIZE - 1) / SPARSE_BLOCK_SIZE;
+    int valuesPerEntry = matrix->format == SPARSE_CSR ? 1 : SPARSE_BLOCK_SIZE * SPARSE_BLOCK_SIZE;
+    return (numRows + 1) * sizeof(int) + matrix->numStored * (sizeof(int) + valuesPerEntry * sizeof(double));
+}
+
+void sparse_multiply(const struct sparse_matrix *matrix, const double inputs[], const int inputIndex[], int numActiveInputs, double outputs[])
+{
+    if (matrix->format == SPARSE_CSR)
+    {
+        for (int a = 0; a < numActiveInputs; a++)
+        {
+            int r = inputIndex[a];
+            double x = inputs[r];
+            const int *col = matrix->colIndex;
+            const double *value = matrix->values;
+            // The columns of a row are distinct, so the scattered updates never conflict
+#pragma omp simd
+            for (int k = matrix->rowPtr[r]; k < matrix->rowPtr[r + 1]; k++)
+            {
+                outputs[col[k]] += x * value[k];
+            }
+        }
+        return;
+    }
+
+    int B = SPARSE_BLOCK_SIZE;
+    int blockRows = (matrix->rows + B - 1) / B, blockCols = (matrix->cols + B - 1) / B;
+    double *acc = matrix->accumulator;
+
+    memset(acc, 0, (size_t)blockCols * B * sizeof(double));
+    for (int br = 0; br < blockRows; br++)
+    {
+        double x[SPARSE_BLOCK_SIZE];
+        bool active = false;
+        for (int i = 0; i < B; i++)
+        {
+            x[i] = br * B + i < matrix->rows ? inputs[br * B + i] : 0.0;
+            active |= x[i] != 0.0;
+        }
+        if (!active)
+        {
+            continue;
+        }
+        for (int k = matrix->rowPtr[br]; k < matrix->rowPtr[br + 1]; k++)
+        {
+            const double *block = matrix->values + (size_t)k * B * B;
+            double *out = acc + matrix->colIndex[k] * B;
+#pragma omp simd
+            for (int j = 0; j < SPARSE_BLOCK_SIZE; j++)
+            {
+                out[j] += x[0] * block[j] + x[1] * block[B + j] + x[2] * block[2 * B + j] + x[3] * block[3 * B + j];
+            }
+        }
+    }
+    for (int j = 0; j < matrix->cols; j++)
+    {
+        outputs[j] += acc[j];
+    }
+}
+
+void forward_pass_sparse(const struct sparse_matrix *hiddenWeights, const double inputs[], const int inputIndex[], int numActiveInputs,
+                         double hiddenLayer[], double outputLayer[], const double hiddenLayerBias[], const double outputLayerBias[],
+                         double **outputWeights, int numHiddenNodes, int numOutputs)
+{
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        hiddenLayer[i] = hiddenLayerBias[i];
+    }
+    sparse_multiply(hiddenWeights, inputs, inputIndex, numActiveInputs, hiddenLayer);
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        hiddenLayer[i] = sigmoid(hiddenLayer[i]);
+    }
+
+    for (int i = 0; i < numOutputs; i++)
+    {
+        double activation = outputLayerBias[i];
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            activation += hiddenLayer[j] * outputWeights[j][i];
+        }
+        outputLayer[i] = sigmoid(activation);
+    }
+}
+
+/**
+ * @brief Evaluates a model with dense or sparse hidden weights.
+ *
+ * @param sparse Sparse hidden weights, NULL for the dense forward pass with hiddenWeights.
+ * @param seconds Receives the time of the forward passes.
+ * @return int Number of correct predictions.
+ */
+static int evaluate(const struct model *model, double **hiddenWeights, const struct sparse_matrix *sparse,
+                    double **inputs, double **outputs, int numSets, int *inputIndex, double *hiddenLayer, double *outputLayer,
+                    struct dropout_mask *mask, double *seconds)
+{
+    int correct = 0;
+    double start = omp_get_wtime();
+
+    for (int s = 0; s < numSets; s++)
+    {
+        int numActiveInputs = build_input_index(inputs[s], model->numInputs, inputIndex);
+        if (sparse == NULL)
+        {
+            forward_pass_simd(inputs[s], inputIndex, numActiveInputs, hiddenLayer, outputLayer, model->hiddenLayerBias, model->outputLayerBias,
+                              hiddenWeights, model->outputWeights, model->numInputs, model->numHiddenNodes, model->numOutputs, 0.0, false, mask);
+        }
+        else
+        {
+            forward_pass_sparse(sparse, inputs[s], inputIndex, numActiveInputs, hiddenLayer, outputLayer, model->hiddenLayerBias,
+                                model->outputLayerBias, model->outputWeights, model->numHiddenNodes, model->numOutputs);
+        }
+        correct += predict_label(outputLayer, model->numOutputs) == predict_label(outputs[s], model->numOutputs);
+    }
+    *seconds = omp_get_wtime() - start;
+    return correct;
+}
+
+void pruning_report(const struct model *model, double **inputs, double **outputs, int numSets, const char *path)
+{
+    const double levels[] = {0.0, 0.5, 0.7, 0.8, 0.9, 0.95, 0.98};
+    int numLevels = sizeof(levels) / sizeof(levels[0]);
+    int I = model->numInputs, H = model->numHiddenNodes, O = model->numOutputs;
+    double denseSeconds, csrSeconds, blockSeconds;
+    struct sparse_matrix csr, block;
+    struct arena arena;
+
+    arena_create(&arena, arena_matrix_bytes(I, H) + arena_vector_bytes(I, sizeof(int)) + arena_vector_bytes(H, sizeof(double)) +
+                             arena_vector_bytes(O, sizeof(double)) + arena_vector_bytes(H, sizeof(int)) +
+                             arena_vector_bytes(DROPOUT_MASK_WORDS(H), sizeof(uint64_t)));
+    double **pruned = arena_alloc_matrix(&arena, I, H);
+    int *inputIndex = arena_alloc(&arena, I * sizeof(int));
+    double *hiddenLayer = arena_alloc_vector(&arena, H);
+    double *outputLayer = arena_alloc_vector(&arena, O);
+    struct dropout_mask mask = {arena_alloc(&arena, DROPOUT_MASK_WORDS(H) * sizeof(uint64_t)), arena_alloc(&arena, H * sizeof(int)), 0, 1.0};
+
+    FILE *file = path != NULL ? fopen(path, "w") : NULL;
+    if (path != NULL && file == NULL)
+    {
+        printf("Error opening file %s\n", path);
+    }
+
+    // The sparse kernels run on one thread, so the dense SIMD pass does as well: the speedup is that of the sparsity alone,
+    // not of the threads or of the fork and join of a parallel region per sample
+    int maxThreads = omp_get_max_threads();
+    omp_set_num_threads(1);
+
+    // Warm-up, so the dense timing does not include the first touch of the weights and inputs
+    evaluate(model, model->hiddenWeights, NULL, inputs, outputs, numSets, inputIndex, hiddenLayer, outputLayer, &mask, &denseSeconds);
+    int denseCorrect = evaluate(model, model->hiddenWeights, NULL, inputs, outputs, numSets, inputIndex, hiddenLayer, outputLayer, &mask, &denseSeconds);
+    printf("Pruning report on %d samples (one thread), dense: %.2f%% in %.1fms (%zu KiB hidden weights)\n", numSets, 100.0 * denseCorrect / numSets,
+           denseSeconds * 1e3, (size_t)I * H * sizeof(double) / 1024);
+
+    const char *header = "| Sparsity | Accuracy CSR | CSR [ms] | CSR speedup | CSR [KiB] | Accuracy 4x4 | 4x4 [ms] | 4x4 speedup | 4x4 [KiB] |\n"
+                         "|---------:|-------------:|---------:|------------:|----------:|-------------:|---------:|------------:|----------:|\n";
+    printf("%s", header);
+    if (file != NULL)
+    {
+        fprintf(file, "Dense: %.2f%% in %.1fms (%zu KiB hidden weights), %d samples, one thread\n\n%s", 100.0 * denseCorrect / numSets,
+                denseSeconds * 1e3, (size_t)I * H * sizeof(double) / 1024, numSets, header);
+    }
+
+    for (int l = 0; l < numLevels; l++)
+    {
+        for (int i = 0; i < I; i++)
+        {
+            memcpy(pruned[i], model->hiddenWeights[i], H * sizeof(double));
+        }
+        prune_weights(pruned, I, H, levels[l]);
+        sparse_from_dense(&csr, pruned, I, H, SPARSE_CSR);
+        int csrCorrect = evaluate(model, NULL, &csr, inputs, outputs, numSets, inputIndex, hiddenLayer, outputLayer, &mask, &csrSeconds);
+
+        for (int i = 0; i < I; i++)
+        {
+            memcpy(pruned[i], model->hiddenWeights[i], H * sizeof(double));
+        }
+        prune_weight_blocks(pruned, I, H, levels[l]);
+        sparse_from_dense(&block, pruned, I, H, SPARSE_BLOCK);
+        int blockCorrect = evaluate(model, NULL, &block, inputs, outputs, numSets, inputIndex, hiddenLayer, outputLayer, &mask, &blockSeconds);
+
+        char line[256];
+        snprintf(line, sizeof(line), "| %7.0f%% | %11.2f%% | %8.1f | %10.2fx | %9zu | %11.2f%% | %8.1f | %10.2fx | %9zu |\n",
+                 100.0 * levels[l], 100.0 * csrCorrect / numSets, csrSeconds * 1e3, denseSeconds / csrSeconds, sparse_bytes(&csr) / 1024,
+                 100.0 * blockCorrect / numSets, blockSeconds * 1e3, denseSeconds / blockSeconds, sparse_bytes(&block) / 1024);
+        printf("%s", line);
+        if (file != NULL)
+        {
+            fprintf(file, "%s", line);
+        }
+        free_sparse(&csr);
+        free_sparse(&block);
+    }
+    omp_set_num_threads(maxThreads);
+
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    arena_destroy(&arena);
+}
@@ -0,0 +1,167 @@
+/**
+ * @file mpt_nn_sparse.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for magnitude pruning and sparse inference kernels.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for pruning the weights of the mpt_nn and for running the
+ * inference with pruned weights. The hidden weights are converted into a compressed sparse row (CSR)
+ * or a 4x4 block-sparse format. The sparse kernels only touch stored weights, the CSR kernel
+ * additionally skips zero inputs like the dense forward pass.
+ */
+#ifndef MPT_NN_SPARSE_H
+#define MPT_NN_SPARSE_H
+
+#include <stdbool.h>
+#include "mpt_nn_arena.h"
+#include "mpt_nn_utility.h"
+
+/**
+ * @brief Rows and columns of a block of the block-sparse format.
+ */
+#define SPARSE_BLOCK_SIZE 4
+
+/**
+ * @brief Storage format of a sparse matrix.
+ */
+enum sparse_format
+{
+    SPARSE_CSR,  /**< Every nonzero weight is stored with its column index. */
+    SPARSE_BLOCK /**< Every 4x4 block with a nonzero weight is stored densely with its block column index. */
+};
+
+/**
+ * @brief A sparse rows x cols matrix (rows are the inputs, cols the outputs of a layer, like hiddenWeights).
+ */
+struct sparse_matrix
+{
+    enum sparse_format format;
+    int rows;            /**< Rows of the dense matrix. */
+    int cols;            /**< Columns of the dense matrix. */
+    int numStored;       /**< Stored weights (CSR) or stored blocks (block format). */
+    int *rowPtr;         /**< Start of every row (CSR) or block row in colIndex, one entry more than rows. */
+    int *colIndex;       /**< Column (CSR) or block column of every stored weight or block. */
+    double *values;      /**< Stored weights, blocks are stored row-major with SPARSE_BLOCK_SIZE^2 values each. */
+    double *accumulator; /**< Outputs padded to whole blocks (block format only). */
+    struct arena arena;  /**< Arena owning all buffers. */
+};
+
+/**
+ * @brief Zeroes the weights with the smallest magnitude (unstructured magnitude pruning).
+ *
+ * @param weights 2D array of weights.
+ * @param rows Rows of the array.
+ * @param cols Columns of the array.
+ * @param sparsity Fraction of the weights that is zero afterwards (between 0.0 and 1.0).
+ * @return double Largest magnitude that was pruned.
+ */
+double prune_weights(double **weights, int rows, int cols, double sparsity);
+
+/**
+ * @brief Zeroes the 4x4 blocks with the smallest L2 norm (structured block pruning).
+ *
+ * Blocks at the edges that are cut by the array border only count their weights inside the array.
+ *
+ * @param weights 2D array of weights.
+ * @param rows Rows of the array.
+ * @param cols Columns of the array.
+ * @param sparsity Fraction of the blocks that is zero afterwards (between 0.0 and 1.0).
+ * @return double Largest block norm that was pruned.
+ */
+double prune_weight_blocks(double **weights, int rows, int cols, double sparsity);
+
+/**
+ * @brief Sparsity of the gradual pruning after an epoch.
+ *
+ * Cubic schedule: the sparsity grows quickly at the beginning, when the network can still recover,
+ * and reaches the target after the last epoch.
+ *
+ * @param target Final sparsity.
+ * @param epoch Number of completed epochs (1 to epochs).
+ * @param epochs Total number of epochs.
+ * @return double Sparsity the weights are pruned to after this epoch.
+ */
+double pruning_schedule(double target, int epoch, int epochs);
+
+/**
+ * @brief Returns the fraction of zero weights.
+ */
+double weight_sparsity(double **weights, int rows, int cols);
+
+/**
+ * @brief Converts a (pruned) dense matrix into a sparse format.
+ *
+ * @param matrix Sparse matrix to fill. Has to be released with free_sparse.
+ * @param dense 2D array with the weights.
+ * @param rows Rows of the array.
+ * @param cols Columns of the array.
+ * @param format Storage format.
+ */
+void sparse_from_dense(struct sparse_matrix *matrix, double **dense, int rows, int cols, enum sparse_format format);
+
+/**
+ * @brief Releases the buffers of a sparse matrix.
+ */
+void free_sparse(struct sparse_matrix *matrix);
+
+/**
+ * @brief Returns the bytes of the stored weights and indices of a sparse matrix.
+ */
+size_t sparse_bytes(const struct sparse_matrix *matrix);
+
+/**
+ * @brief Sparse-dense product: outputs[c] += sum over r of inputs[r] * W[r][c].
+ *
+ * The CSR kernel only visits the rows of the nonzero inputs (inputIndex) and scatters their stored weights
+ * with SIMD. The block kernel skips block rows whose inputs are all zero and updates SPARSE_BLOCK_SIZE outputs
+ * at once. The block kernel uses the accumulator of the matrix, so one matrix may only be used by one thread at a time.
+ *
+ * @param matrix Sparse matrix.
+ * @param inputs Input vector (rows entries).
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
+ * @param outputs Output vector (cols entries) the product is added to.
+ */
+void sparse_multiply(const struct sparse_matrix *matrix, const double inputs[], const int inputIndex[], int numActiveInputs, double outputs[]);
+
+/**
+ * @brief Inference forward pass with sparse hidden weights.
+ *
+ * Same result as forward_pass_sequential in inference mode with the pruned dense weights.
+ *
+ * @param hiddenWeights Sparse hidden weights (numInputs x numHiddenNodes).
+ * @param inputs Input data for the neural network.
+ * @param inputIndex Indices of the nonzero inputs (see build_input_index).
+ * @param numActiveInputs Number of entries in inputIndex.
+ * @param hiddenLayer Array storing the activations of the hidden layer.
+ * @param outputLayer Array storing the activations of the output layer.
+ * @param hiddenLayerBias Array containing the biases for the hidden layer.
+ * @param outputLayerBias Array containing the biases for the output layer.
+ * @param outputWeights 2D array containing the weights between hidden and output layers.
+ * @param numHiddenNodes Number of hidden layer nodes.
+ * @param numOutputs Number of output nodes.
+ */
+void forward_pass_sparse(const struct sparse_matrix *hiddenWeights, const double inputs[], const int inputIndex[], int numActiveInputs,
+                         double hiddenLayer[], double outputLayer[], const double hiddenLayerBias[], const double outputLayerBias[],
+                         double **outputWeights, int numHiddenNodes, int numOutputs);
+
+/**
+ * @brief Measures accuracy and inference time of a trained model across sparsity levels.
+ *
+ * For every sparsity level the hidden weights are pruned unstructured (inference with the CSR kernel) and in 4x4 blocks
+ * (inference with the block kernel). Both are compared with the dense SIMD forward pass of the unpruned model.
+ * Like the sparse kernels the dense pass runs on one thread, so the speedup only reflects the sparsity.
+ * The table is printed and written to the given markdown file.
+ *
+ * @param model Trained model, its weights are not modified.
+ * @param inputs 2D array of evaluation inputs.
+ * @param outputs 2D array of one-hot evaluation outputs.
+ * @param numSets Number of evaluation samples.
+ * @param path Markdown file the table is written to, NULL to only print it.
+ */
+void pruning_report(const struct model *model, double **inputs, double **outputs, int numSets, const char *path);
+
+#endif // MPT_NN_SPARSE_H
@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include "mpt_nn_specialized.h"
+
+/**
+ * @brief Checks that the rows of a matrix are contiguous with the stride of arena_alloc_matrix.
+ */
+static bool has_arena_layout(double **matrix, int rows, int cols)
+{
+    for (int r = 1; r < rows; r++)
+    {
+        if (matrix[r] != matrix[0] + (size_t)r * ARENA_ROW_STRIDE(cols))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const struct specialized_kernels *find_specialized_kernels(int numInputs, int numHiddenNodes, int numOutputs,
+                                                           double **hiddenWeights, double **outputWeights)
+{
+    if (is_deterministic())
+    {
+        return NULL;
+    }
+    for (const struct specialized_kernels *kernels = specializedKernels; kernels->forward != NULL; kernels++)
+    {
+        if (kernels->numInputs == numInputs && kernels->numHiddenNodes == numHiddenNodes && kernels->numOutputs == numOutputs)
+        {
+            bool fits = has_arena_layout(hiddenWeights, numInputs, numHiddenNodes) && has_arena_layout(outputWeights, numHiddenNodes, numOutputs);
+            return fits ? kernels : NULL;
+        }
+    }
+    return NULL;
+}
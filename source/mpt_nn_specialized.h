@@ -0,0 +1,81 @@
+/**
+ * @file mpt_nn_specialized.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the forward and backward kernels specialized for fixed network shapes.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * The generic kernels take the number of inputs, hidden nodes and outputs at runtime. For the shapes listed
+ * in SPECIALIZED_SHAPES of the Makefile (e.g. 784-128-10) the Makefile generates out/mpt_nn_shapes.c, which
+ * includes mpt_nn_specialized_template.h once per shape with the sizes as compile-time constants.
+ * All loop bounds and row strides of these kernels are constants, so the compiler can unroll the loops,
+ * vectorize them without remainder and address the weights with constant strides.
+ * At runtime find_specialized_kernels selects the kernels of the current shape, other shapes use the generic kernels.
+ */
+#ifndef MPT_NN_SPECIALIZED_H
+#define MPT_NN_SPECIALIZED_H
+
+#include "mpt_nn.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_tile.h"
+
+/**
+ * @brief Hidden nodes that are accumulated in registers at once, the hidden size of a specialized shape has to be a multiple.
+ */
+#define SPECIALIZED_CHUNK 8
+
+/**
+ * @brief Name of a kernel specialized for a shape, e.g. forward_pass_784_128_10.
+ */
+#define SPECIALIZED_PASTE(name, inputs, hidden, outputs) name##_##inputs##_##hidden##_##outputs
+#define SPECIALIZED_EXPAND(name, inputs, hidden, outputs) SPECIALIZED_PASTE(name, inputs, hidden, outputs)
+#define SPECIALIZED_NAME(name) SPECIALIZED_EXPAND(name, SHAPE_INPUTS, SHAPE_HIDDEN, SHAPE_OUTPUTS)
+
+/**
+ * @brief Entry of the table of specialized kernels for a shape.
+ */
+#define SPECIALIZED_KERNELS(inputs, hidden, outputs)                                       \
+    {                                                                                      \
+        inputs, hidden, outputs, SPECIALIZED_EXPAND(forward_pass, inputs, hidden, outputs), \
+            SPECIALIZED_EXPAND(backpropagation, inputs, hidden, outputs)                   \
+    }
+
+/**
+ * @brief Forward and backward kernel specialized for one shape.
+ *
+ * The kernels have the signatures of the generic kernels, their size parameters are ignored.
+ * They are parallelized like the SIMD kernels and compute the same sums in the same order.
+ */
+struct specialized_kernels
+{
+    int numInputs;                   /**< Number of input nodes. */
+    int numHiddenNodes;              /**< Number of hidden layer nodes. */
+    int numOutputs;                  /**< Number of output nodes. */
+    forward_pass_kernel forward;     /**< Replaces forward_pass_simd. */
+    backpropagation_kernel backward; /**< Replaces backpropagation_simd. */
+};
+
+/**
+ * @brief Kernels of all shapes in SPECIALIZED_SHAPES (generated), terminated by an entry with forward == NULL.
+ */
+extern const struct specialized_kernels specializedKernels[];
+
+/**
+ * @brief Returns the specialized kernels for a network.
+ *
+ * The weights have to be arena matrices (contiguous rows with the stride ARENA_ROW_STRIDE), because the
+ * specialized kernels address them with constant strides. The deterministic mode always uses the generic kernels.
+ *
+ * @param numInputs Number of input nodes.
+ * @param numHiddenNodes Number of hidden layer nodes.
+ * @param numOutputs Number of output nodes.
+ * @param hiddenWeights Weights between input and hidden layer.
+ * @param outputWeights Weights between hidden and output layer.
+ * @return const struct specialized_kernels* Kernels for the shape, NULL if there are none or the weights do not fit.
+ */
+const struct specialized_kernels *find_specialized_kernels(int numInputs, int numHiddenNodes, int numOutputs,
+                                                           double **hiddenWeights, double **outputWeights);
+
+#endif // MPT_NN_SPECIALIZED_H
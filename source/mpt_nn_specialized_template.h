@@ -0,0 +1,189 @@
+/**
+ * @file mpt_nn_specialized_template.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Template of the shape-specialized kernels.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Included by the generated out/mpt_nn_shapes.c once per shape, with SHAPE_INPUTS, SHAPE_HIDDEN and SHAPE_OUTPUTS
+ * defined as integer literals. Defines the static kernels forward_pass_<I>_<H>_<O> and backpropagation_<I>_<H>_<O>
+ * and undefines the shape afterwards. There is deliberately no include guard.
+ *
+ * The kernels follow forward_pass_simd and backpropagation_simd: every thread owns whole chunks of SPECIALIZED_CHUNK
+ * hidden nodes, so all loops over the layers have constant bounds and constant row strides. Like those, the barriers
+ * are annotated for helgrind (mpt_nn_tile.h).
+ */
+#if !defined(SHAPE_INPUTS) || !defined(SHAPE_HIDDEN) || !defined(SHAPE_OUTPUTS)
+#error "Define SHAPE_INPUTS, SHAPE_HIDDEN and SHAPE_OUTPUTS before including mpt_nn_specialized_template.h"
+#endif
+
+_Static_assert(SHAPE_HIDDEN % SPECIALIZED_CHUNK == 0, "The hidden size of a specialized shape has to be a multiple of SPECIALIZED_CHUNK");
+
+static void SPECIALIZED_NAME(forward_pass)(double inputs[], const int inputIndex[], int numActiveInputs, double hiddenLayer[], double outputLayer[],
+                                           double hiddenLayerBias[], double outputLayerBias[],
+                                           double **hiddenWeights, double **outputWeights,
+                                           int numInputs, int numHiddenNodes, int numOutputs,
+                                           double dropout_rate, bool training, struct dropout_mask *mask)
+{
+    const double *W1 = hiddenWeights[0];
+    const double *W2 = outputWeights[0];
+
+    if (training)
+    {
+        draw_dropout_mask(mask, SHAPE_HIDDEN, dropout_rate);
+    }
+    else
+    {
+        keep_all_neurons(mask, SHAPE_HIDDEN);
+    }
+
+    TILE_RELEASE();
+#pragma omp parallel
+    {
+        TILE_ACQUIRE();
+
+        // Every thread owns whole chunks of the hidden layer and streams the weight rows of the nonzero inputs
+        // through them, a single thread owns the whole layer and the inner loop has a constant length
+        int numThreads = omp_get_num_threads();
+        int numChunks = SHAPE_HIDDEN / SPECIALIZED_CHUNK;
+        int begin = (int)((long)numChunks * omp_get_thread_num() / numThreads) * SPECIALIZED_CHUNK;
+        int end = (int)((long)numChunks * (omp_get_thread_num() + 1) / numThreads) * SPECIALIZED_CHUNK;
+
+#pragma omp simd
+        for (int i = begin; i < end; i++)
+        {
+            hiddenLayer[i] = hiddenLayerBias[i];
+        }
+        for (int k = 0; k < numActiveInputs; k++)
+        {
+            int j = inputIndex[k];
+            double x = inputs[j];
+            const double *row = W1 + (size_t)j * ARENA_ROW_STRIDE(SHAPE_HIDDEN);
+            if (numThreads == 1)
+            {
+#pragma omp simd
+                for (int i = 0; i < SHAPE_HIDDEN; i++)
+                {
+                    hiddenLayer[i] += x * row[i];
+                }
+            }
+            else
+            {
+                for (int c = begin; c < end; c += SPECIALIZED_CHUNK)
+                {
+#pragma omp simd
+                    for (int l = 0; l < SPECIALIZED_CHUNK; l++)
+                    {
+                        hiddenLayer[c + l] += x * row[c + l];
+                    }
+                }
+            }
+        }
+        for (int i = begin; i < end; i++)
+        {
+            hiddenLayer[i] = dropout_mask_keeps(mask, i) ? sigmoid(hiddenLayer[i]) * mask->scale : 0.0;
+        }
+        TILE_BARRIER();
+
+#pragma omp single nowait
+        {
+            double sum[SHAPE_OUTPUTS];
+            for (int i = 0; i < SHAPE_OUTPUTS; i++)
+            {
+                sum[i] = outputLayerBias[i];
+            }
+            for (int a = 0; a < mask->numActive; a++)
+            {
+                int j = mask->active[a];
+                double x = hiddenLayer[j];
+                const double *row = W2 + (size_t)j * ARENA_ROW_STRIDE(SHAPE_OUTPUTS);
+#pragma omp simd
+                for (int i = 0; i < SHAPE_OUTPUTS; i++)
+                {
+                    sum[i] += x * row[i];
+                }
+            }
+            for (int i = 0; i < SHAPE_OUTPUTS; i++)
+            {
+                outputLayer[i] = sigmoid(sum[i]);
+            }
+        }
+        TILE_RELEASE();
+    }
+    TILE_ACQUIRE();
+}
+
+static void SPECIALIZED_NAME(backpropagation)(double inputs[], const int inputIndex[], int numActiveInputs, double target[], double hiddenLayer[], double outputLayer[],
+                                              double hiddenLayerBias[], double outputLayerBias[],
+                                              double **hiddenWeights, double **outputWeights,
+                                              double deltaOutput[], double deltaHidden[], double lr, int numInputs, int numHiddenNodes, int numOutputs,
+                                              const struct dropout_mask *mask)
+{
+    double *W1 = hiddenWeights[0];
+    double *W2 = outputWeights[0];
+
+    TILE_RELEASE();
+#pragma omp parallel
+    {
+        TILE_ACQUIRE();
+#pragma omp single nowait
+        {
+            for (int i = 0; i < SHAPE_OUTPUTS; i++)
+            {
+                double error = target[i] - outputLayer[i];
+                deltaOutput[i] = error * dSigmoid(outputLayer[i]);
+                outputLayerBias[i] += deltaOutput[i] * lr;
+            }
+        }
+        TILE_BARRIER();
+
+        // The errors of dropped neurons are set to zero, so the rows of hiddenWeights are updated contiguously below
+#pragma omp for schedule(static) nowait
+        for (int c = 0; c < SHAPE_HIDDEN / SPECIALIZED_CHUNK; c++)
+        {
+            for (int l = 0; l < SPECIALIZED_CHUNK; l++)
+            {
+                int i = c * SPECIALIZED_CHUNK + l;
+                double *row = W2 + (size_t)i * ARENA_ROW_STRIDE(SHAPE_OUTPUTS);
+                double error = 0.0;
+                if (!dropout_mask_keeps(mask, i))
+                {
+                    deltaHidden[i] = 0.0;
+                    continue;
+                }
+                // Every weight is loaded once for the error and the update
+#pragma omp simd reduction(+ : error)
+                for (int j = 0; j < SHAPE_OUTPUTS; j++)
+                {
+                    double weight = row[j];
+                    error += deltaOutput[j] * weight;
+                    row[j] = weight + hiddenLayer[i] * deltaOutput[j] * lr;
+                }
+                deltaHidden[i] = error * mask->scale * dSigmoid(hiddenLayer[i] / mask->scale);
+                hiddenLayerBias[i] += deltaHidden[i] * lr;
+            }
+        }
+        TILE_BARRIER();
+
+#pragma omp for schedule(static) nowait
+        for (int k = 0; k < numActiveInputs; k++)
+        {
+            int j = inputIndex[k];
+            double x = inputs[j];
+            double *row = W1 + (size_t)j * ARENA_ROW_STRIDE(SHAPE_HIDDEN);
+#pragma omp simd
+            for (int i = 0; i < SHAPE_HIDDEN; i++)
+            {
+                row[i] += x * deltaHidden[i] * lr;
+            }
+        }
+        TILE_RELEASE();
+    }
+    TILE_ACQUIRE();
+}
+
+#undef SHAPE_INPUTS
+#undef SHAPE_HIDDEN
+#undef SHAPE_OUTPUTS
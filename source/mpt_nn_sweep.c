@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include "mpt_nn.h"
+#include "mpt_nn_utility.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_sweep.h"
+
+/**
+ * @brief A model of a sweep with its buffers and statistics.
+ */
+struct sweep_model
+{
+    struct sweep_config config;
+    struct model model;       /**< Parameters, the arena also holds the buffers below. */
+    double *hiddenLayer;      /**< Activations of the hidden layer. */
+    double *outputLayer;      /**< Activations of the output layer. */
+    double *deltaHidden;      /**< Errors of the hidden layer. */
+    double *deltaOutput;      /**< Errors of the output layer. */
+    struct dropout_mask mask; /**< Dropout mask of the current sample. */
+    unsigned seed;            /**< State of the random numbers of the dropout masks of this model. */
+    double loss;              /**< Summed loss of the current epoch. */
+    int correct;              /**< Correct predictions of the current epoch. */
+    double seconds;           /**< Training time of the model. */
+    double *accuracy;         /**< Accuracy after every epoch in percent. */
+};
+
+int parse_sweep(const char *spec, const struct sweep_config *defaults, struct sweep_config configs[], int maxConfigs)
+{
+    int numConfigs = 0;
+    const char *p = spec;
+
+    while (*p != '\0')
+    {
+        int numKeys = 0;
+        if (numConfigs == maxConfigs)
+        {
+            return -1;
+        }
+        struct sweep_config *config = &configs[numConfigs++];
+        *config = *defaults;
+
+        // Parameters of one configuration up to the next ';'
+        while (*p != '\0' && *p != ';')
+        {
+            char key = *p;
+            char *end;
+            if (p[1] != '=')
+            {
+                return -1;
+            }
+            if (key == 'h')
+            {
+                long value = strtol(p + 2, &end, 10);
+                config->numHiddenNodes = (int)value;
+            }
+            else if (key == 'l' || key == 'd')
+            {
+                double value = strtod(p + 2, &end);
+                *(key == 'l' ? &config->learningRate : &config->dropoutRate) = value;
+            }
+            else
+            {
+                return -1;
+            }
+            if (end == p + 2 || (*end != ',' && *end != ';' && *end != '\0'))
+            {
+                return -1;
+            }
+            p = *end == ',' ? end + 1 : end;
+            numKeys++;
+        }
+        if (numKeys == 0 || config->numHiddenNodes <= 0 || config->learningRate <= 0.0 || config->dropoutRate < 0.0 || config->dropoutRate >= 1.0)
+        {
+            return -1;
+        }
+        p += *p == ';';
+    }
+    return numConfigs;
+}
+
+int train_sweep(const struct sweep_config configs[], int numConfigs, int mode, double **trainingInputs, double **trainingOutputs,
+                int numTrainingSets, int numInputs, int numOutputs, int epochs, int batchSize, const char *path)
+{
+    forward_pass_kernel forward[] = {forward_pass_sequential, forward_pass_parallel, forward_pass_simd};
+    backpropagation_kernel backward[] = {backpropagation_sequential, backpropagation_parallel, backpropagation_simd};
+
+    if (numConfigs <= 0 || mode < 1 || mode > 3 || batchSize <= 0)
+    {
+        return -1;
+    }
+
+    int numThreads = omp_get_max_threads();
+    int numGroups = numConfigs < numThreads ? numConfigs : numThreads;
+    int threadsPerGroup = numThreads / numConfigs > 1 ? numThreads / numConfigs : 1;
+
+    // The inputs of a mini-batch and their nonzero indices are shared by all models
+    struct arena arena;
+    arena_create(&arena, arena_vector_bytes(numConfigs, sizeof(struct sweep_model)) +
+                             arena_matrix_bytes(batchSize, numInputs) + arena_vector_bytes(batchSize, sizeof(int)));
+    struct sweep_model *models = arena_alloc(&arena, numConfigs * sizeof(struct sweep_model));
+    int **batchIndex = (int **)arena_alloc(&arena, batchSize * sizeof(int *));
+    int *numActiveInputs = arena_alloc(&arena, batchSize * sizeof(int));
+    for (int b = 0; b < batchSize; b++)
+    {
+        batchIndex[b] = arena_alloc(&arena, numInputs * sizeof(int));
+    }
+
+    // initialize_weights seeds the generator, so the models are initialized one after another
+    for (int m = 0; m < numConfigs; m++)
+    {
+        struct sweep_model *s = &models[m];
+        int H = configs[m].numHiddenNodes;
+
+        memset(s, 0, sizeof(*s));
+        s->config = configs[m];
+        s->model.numInputs = numInputs;
+        s->model.numHiddenNodes = H;
+        s->model.numOutputs = numOutputs;
+        arena_create(&s->model.arena, arena_matrix_bytes(numInputs, H) + arena_matrix_bytes(H, numOutputs) +
+                                          3 * arena_vector_bytes(H, sizeof(double)) + 3 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                                          arena_vector_bytes(H, sizeof(int)) + arena_vector_bytes(DROPOUT_MASK_WORDS(H), sizeof(uint64_t)) +
+                                          arena_vector_bytes(epochs, sizeof(double)));
+        s->model.hiddenWeights = arena_alloc_matrix(&s->model.arena, numInputs, H);
+        s->model.outputWeights = arena_alloc_matrix(&s->model.arena, H, numOutputs);
+        s->model.hiddenLayerBias = arena_alloc_vector(&s->model.arena, H);
+        s->model.outputLayerBias = arena_alloc_vector(&s->model.arena, numOutputs);
+        s->hiddenLayer = arena_alloc_vector(&s->model.arena, H);
+        s->outputLayer = arena_alloc_vector(&s->model.arena, numOutputs);
+        s->deltaHidden = arena_alloc_vector(&s->model.arena, H);
+        s->deltaOutput = arena_alloc_vector(&s->model.arena, numOutputs);
+        s->mask = (struct dropout_mask){arena_alloc(&s->model.arena, DROPOUT_MASK_WORDS(H) * sizeof(uint64_t)),
+                                        arena_alloc(&s->model.arena, H * sizeof(int)), 0, 1.0, &s->seed};
+        s->accuracy = arena_alloc_vector(&s->model.arena, epochs);
+
+        initialize_weights(s->model.hiddenWeights, numInputs, H);
+        initialize_weights(s->model.outputWeights, H, numOutputs);
+        initialize_bias(s->model.hiddenLayerBias, H);
+        initialize_bias(s->model.outputLayerBias, numOutputs);
+
+        // The groups draw their masks concurrently, every model draws from its own sequence
+        s->seed = (unsigned)rand() + m;
+    }
+
+    printf("Sweep: %d models, %d thread group(s) of %d thread(s), mini-batch %d\n", numConfigs, numGroups, threadsPerGroup, batchSize);
+
+    int maxActiveLevels = omp_get_max_active_levels();
+    omp_set_max_active_levels(threadsPerGroup > 1 ? 2 : 1);
+    double start = omp_get_wtime();
+
+#pragma omp parallel num_threads(numGroups)
+    {
+        // Team size of the parallel regions inside the kernels of this group
+        omp_set_num_threads(threadsPerGroup);
+
+        for (int epoch = 0; epoch < epochs; epoch++)
+        {
+            for (int first = 0; first < numTrainingSets; first += batchSize)
+            {
+                int size = numTrainingSets - first < batchSize ? numTrainingSets - first : batchSize;
+
+#pragma omp for schedule(static)
+                for (int b = 0; b < size; b++)
+                {
+                    numActiveInputs[b] = build_input_index(trainingInputs[first + b], numInputs, batchIndex[b]);
+                }
+
+                // Every model trains on the whole mini-batch while its inputs are in the cache
+#pragma omp for schedule(static)
+                for (int m = 0; m < numConfigs; m++)
+                {
+                    struct sweep_model *s = &models[m];
+                    struct model *p = &s->model;
+                    double begin = omp_get_wtime();
+
+                    for (int b = 0; b < size; b++)
+                    {
+                        double *inputs = trainingInputs[first + b];
+                        double *target = trainingOutputs[first + b];
+
+                        forward[mode - 1](inputs, batchIndex[b], numActiveInputs[b], s->hiddenLayer, s->outputLayer, p->hiddenLayerBias,
+                                          p->outputLayerBias, p->hiddenWeights, p->outputWeights, numInputs, p->numHiddenNodes, numOutputs,
+                                          s->config.dropoutRate, true, &s->mask);
+                        for (int j = 0; j < numOutputs; j++)
+                        {
+                            s->loss += pow(target[j] - s->outputLayer[j], 2);
+                        }
+                        s->correct += predict_label(s->outputLayer, numOutputs) == predict_label(target, numOutputs);
+                        backward[mode - 1](inputs, batchIndex[b], numActiveInputs[b], target, s->hiddenLayer, s->outputLayer, p->hiddenLayerBias,
+                                           p->outputLayerBias, p->hiddenWeights, p->outputWeights, s->deltaOutput, s->deltaHidden,
+                                           s->config.learningRate, numInputs, p->numHiddenNodes, numOutputs, &s->mask);
+                    }
+                    s->seconds += omp_get_wtime() - begin;
+                }
+            }
+
+#pragma omp single
+            {
+                printf("Epoch %d/%d - %.2fs\n", epoch + 1, epochs, omp_get_wtime() - start);
+                for (int m = 0; m < numConfigs; m++)
+                {
+                    struct sweep_model *s = &models[m];
+                    s->accuracy[epoch] = (double)s->correct / numTrainingSets * 100.0;
+                    printf("  [%d] h=%-4d l=%-8g d=%-5g Loss: %.6f - Accuracy: %.2f%% (%d/%d)\n", m, s->config.numHiddenNodes,
+                           s->config.learningRate, s->config.dropoutRate, s->loss / numTrainingSets, s->accuracy[epoch],
+                           s->correct, numTrainingSets);
+                    s->loss = 0.0;
+                    s->correct = 0;
+                }
+            }
+        }
+    }
+
+    omp_set_max_active_levels(maxActiveLevels);
+
+    printf("Sweep finished in %.2fs\n", omp_get_wtime() - start);
+
+    // Accuracy curves in percent: one row per model, one column per epoch, printed and written to the file
+    FILE *streams[2] = {stdout, path != NULL ? fopen(path, "w") : NULL};
+    if (path != NULL && streams[1] == NULL)
+    {
+        printf("Error opening file %s\n", path);
+    }
+    for (int f = 0; f < 2 && streams[f] != NULL; f++)
+    {
+        fprintf(streams[f], "| Model | Hidden | Learning rate | Dropout | Time [s] |");
+        for (int epoch = 0; epoch < epochs; epoch++)
+        {
+            fprintf(streams[f], " Epoch %d |", epoch + 1);
+        }
+        fprintf(streams[f], "\n|------:|-------:|--------------:|--------:|---------:|");
+        for (int epoch = 0; epoch < epochs; epoch++)
+        {
+            fprintf(streams[f], "--------:|");
+        }
+        fprintf(streams[f], "\n");
+        for (int m = 0; m < numConfigs; m++)
+        {
+            struct sweep_model *s = &models[m];
+            fprintf(streams[f], "| %5d | %6d | %13g | %7g | %8.2f |", m, s->config.numHiddenNodes, s->config.learningRate,
+                    s->config.dropoutRate, s->seconds);
+            for (int epoch = 0; epoch < epochs; epoch++)
+            {
+                fprintf(streams[f], " %6.2f%% |", s->accuracy[epoch]);
+            }
+            fprintf(streams[f], "\n");
+        }
+    }
+    if (streams[1] != NULL)
+    {
+        fclose(streams[1]);
+    }
+
+    for (int m = 0; m < numConfigs; m++)
+    {
+        arena_destroy(&models[m].model.arena);
+    }
+    arena_destroy(&arena);
+    return 0;
+}
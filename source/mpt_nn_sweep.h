@@ -0,0 +1,74 @@
+/**
+ * @file mpt_nn_sweep.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for training several model configurations in one process (hyperparameter sweeps).
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * This file contains the declarations for a sweep: K models with different numbers of hidden nodes,
+ * learning rates and dropout rates are trained on the same training data, which is only loaded once.
+ * The models are interleaved over every mini-batch, so the inputs of the mini-batch are read from the
+ * cache by all models. Every model is trained by its own group of OpenMP threads.
+ */
+#ifndef MPT_NN_SWEEP_H
+#define MPT_NN_SWEEP_H
+
+/**
+ * @brief Maximum number of configurations of a sweep.
+ */
+#define SWEEP_MAX_CONFIGS 64
+
+/**
+ * @brief Hyperparameters of one model of a sweep.
+ */
+struct sweep_config
+{
+    int numHiddenNodes;  /**< Number of hidden layer nodes. */
+    double learningRate; /**< Learning rate. */
+    double dropoutRate;  /**< Dropout rate of the hidden layer. */
+};
+
+/**
+ * @brief Parses the configurations of a sweep.
+ *
+ * The configurations are separated by ';', every configuration is a ',' separated list of
+ * h=<hidden nodes>, l=<learning rate> and d=<dropout rate>, e.g. "h=64,l=0.01;h=128,l=0.05,d=0.1".
+ * Values that are not given are taken from the defaults. A configuration without any parameter (";;" or a leading ';') is rejected.
+ *
+ * @param spec Configurations as described above.
+ * @param defaults Values of the parameters that are not given.
+ * @param configs Receives the configurations.
+ * @param maxConfigs Capacity of configs.
+ * @return int Number of configurations, -1 if the specification is invalid.
+ */
+int parse_sweep(const char *spec, const struct sweep_config *defaults, struct sweep_config configs[], int maxConfigs);
+
+/**
+ * @brief Trains all configurations of a sweep on the same training data.
+ *
+ * Every mini-batch is trained by all models before the next one is read. The indices of the nonzero
+ * inputs of the mini-batch are built once and shared by all models. The OpenMP threads are split into
+ * one group per model (nested parallelism), a model with more than one thread uses the parallel or SIMD kernels
+ * inside its group. Every model is trained sample by sample like the normal training. The dropout masks of every
+ * model are drawn from its own rand_r sequence, so a sweep does not depend on the interleaving of the groups.
+ * Prints the loss and accuracy of every model after every epoch and the accuracy curves of all models at the end.
+ *
+ * @param configs Configurations of the models.
+ * @param numConfigs Number of configurations.
+ * @param mode Kernels used [1: sequential][2: parallel][3: SIMD].
+ * @param trainingInputs 2D array of training inputs.
+ * @param trainingOutputs 2D array of one-hot training outputs.
+ * @param numTrainingSets Number of training samples.
+ * @param numInputs Number of input nodes.
+ * @param numOutputs Number of output nodes.
+ * @param epochs Number of epochs.
+ * @param batchSize Samples that are read by all models before the next ones.
+ * @param path Markdown file the accuracy curves are written to, NULL to only print them.
+ * @return 0 on success, -1 if a configuration is invalid.
+ */
+int train_sweep(const struct sweep_config configs[], int numConfigs, int mode, double **trainingInputs, double **trainingOutputs,
+                int numTrainingSets, int numInputs, int numOutputs, int epochs, int batchSize, const char *path);
+
+#endif // MPT_NN_SWEEP_H
@@ -12,64 +12,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include <omp.h>
 #include <immintrin.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
 #include "mpt_nn.h"
 #include "mpt_nn_utility.h"
+#include "mpt_nn_arena.h"
+#include "mpt_nn_distributed.h"
+#include "mpt_nn_conv.h"
+#include "mpt_nn_sparse.h"
+#include "mpt_nn_sweep.h"
+#include "mpt_nn_specialized.h"
+#include "mpt_nn_dataset.h"
+#include "mpt_nn_augment.h"
+#include "mpt_nn_ws.h"
+#include "mpt_nn_pipeline.h"
+#include "mpt_nn_dashboard.h"
+#include "mpt_nn_mixed.h"
+#include "mpt_nn_norm.h"
+#include "mpt_nn_cascade.h"
+#include "mpt_nn_distill.h"
+#include "mpt_nn_export.h"
+#include "mpt_nn_server.h"
 #include "math.h"
 
-/**
- * @brief Allocates memory for a 2D array (weights matrix).
- *
- * @param rows Number of rows.
- * @param cols Number of columns.
- * @return double** Pointer to the allocated 2D array.
- *
- * Allocates memory for a 2D array that will hold the weights of a neural network layer.
- */
-static double **allocate_weights(int rows, int cols)
-{
-    double **weights = malloc(rows * sizeof(double *));
-    if (!weights)
-    {
-        fprintf(stderr, "Failed to allocate memory for weights\n");
-        exit(EXIT_FAILURE);
-    }
-
-    for (int i = 0; i < rows; i++)
-    {
-        weights[i] = malloc(cols * sizeof(double));
-        if (!weights[i])
-        {
-            fprintf(stderr, "Failed to allocate memory for weights[%d]\n", i);
-            for (int j = 0; j < i; j++)
-            {
-                free(weights[j]);
-            }
-            free(weights);
-            exit(EXIT_FAILURE);
-        }
-    }
-    return weights;
-}
-
-/**
- * @brief Frees the memory allocated for a 2D array (weights matrix).
- *
- * Deallocates the memory that was previously allocated for a 2D array used to store weights.
- *
- * @param weights Pointer to the 2D array to be freed.
- * @param rows Number of rows.
- */
-static void free_weights(double **weights, int rows)
-{
-    for (int i = 0; i < rows; i++)
-    {
-        free(weights[i]);
-    }
-    free(weights);
-}
-
 /**
  * @brief Tests the sigmoid function.
  *
@@ -95,7 +65,9 @@ static void test_sigmoid()
 static void test_initialize_weights()
 {
     int rows = 2, cols = 3;
-    double **weights = allocate_weights(rows, cols);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(rows, cols));
+    double **weights = arena_alloc_matrix(&arena, rows, cols);
 
     initialize_weights(weights, rows, cols);
 
@@ -106,7 +78,7 @@ static void test_initialize_weights()
             assert(weights[i][j] >= -0.5 && weights[i][j] <= 0.5);
         }
     }
-    free_weights(weights, rows);
+    arena_destroy(&arena);
 
     printf("test_initialize_weights passed.\n");
 }
@@ -130,8 +102,10 @@ static void test_forward_pass()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -140,13 +114,18 @@ static void test_forward_pass()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0; // No dropout for this test
 
-    forward_pass_sequential(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
 
     assert(outputLayer[0] > 0 && outputLayer[0] < 1);
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_forward_pass (sequential) passed.\n");
 }
@@ -170,8 +149,10 @@ static void test_forward_pass_parallel()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -180,14 +161,19 @@ static void test_forward_pass_parallel()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0;
 
-    forward_pass_parallel(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_parallel(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
 
     assert(outputLayer[0] > 0 && outputLayer[0] < 1);
 
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_forward_pass (parallel) passed.\n");
 }
@@ -211,8 +197,10 @@ static void test_forward_pass_simd()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -221,14 +209,19 @@ static void test_forward_pass_simd()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0;
 
-    forward_pass_simd(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_simd(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
 
     assert(outputLayer[0] > 0 && outputLayer[0] < 1);
 
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_forward_pass (SIMD) passed.\n");
 }
@@ -253,8 +246,13 @@ static void test_backpropagation()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numOutputs, sizeof(double)) + arena_vector_bytes(numHiddenNodes, sizeof(double)));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -263,16 +261,21 @@ static void test_backpropagation()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0;
 
-    forward_pass_sequential(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
-    backpropagation_sequential(inputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, 0.1, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
+    backpropagation_sequential(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
 
     assert(hiddenWeights[0][0] != 0.1);
     assert(outputWeights[0][0] != 0.5);
 
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_backpropagation (sequential) passed.\n");
 }
@@ -297,8 +300,13 @@ static void test_backpropagation_parallel()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numOutputs, sizeof(double)) + arena_vector_bytes(numHiddenNodes, sizeof(double)));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -307,16 +315,21 @@ static void test_backpropagation_parallel()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0;
 
-    forward_pass_parallel(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
-    backpropagation_parallel(inputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, 0.1, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_parallel(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
+    backpropagation_parallel(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
 
     assert(hiddenWeights[0][0] != 0.1);
     assert(outputWeights[0][0] != 0.5);
 
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_backpropagation (parallel) passed.\n");
 }
@@ -341,8 +354,13 @@ static void test_backpropagation_simd()
     double hiddenLayerBias[2] = {0.1, 0.2};
     double outputLayerBias[1] = {0.3};
 
-    double **hiddenWeights = allocate_weights(numInputs, numHiddenNodes);
-    double **outputWeights = allocate_weights(numHiddenNodes, numOutputs);
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numOutputs, sizeof(double)) + arena_vector_bytes(numHiddenNodes, sizeof(double)));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
 
     hiddenWeights[0][0] = 0.1;
     hiddenWeights[0][1] = 0.2;
@@ -351,20 +369,76 @@ static void test_backpropagation_simd()
     outputWeights[0][0] = 0.5;
     outputWeights[1][0] = 0.6;
 
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
     double dropout_rate = 0.0;
 
-    forward_pass_simd(inputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate);
-    backpropagation_simd(inputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, 0.1, numInputs, numHiddenNodes, numOutputs, dropout_rate);
+    forward_pass_simd(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
+    backpropagation_simd(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
 
     assert(hiddenWeights[0][0] != 0.1);
     assert(outputWeights[0][0] != 0.5);
 
-    free_weights(hiddenWeights, numInputs);
-    free_weights(outputWeights, numHiddenNodes);
+    arena_destroy(&arena);
 
     printf("test_backpropagation (SIMD) passed.\n");
 }
 
+/**
+ * @brief Tests the build_input_index function and the sparse first layer.
+ *
+ * Verifies that only the nonzero inputs are listed and that the backpropagation
+ * leaves the weight rows of the zero inputs untouched.
+ */
+static void test_sparse_inputs()
+{
+    int numInputs = 4, numHiddenNodes = 2, numOutputs = 1;
+    double inputs[] = {0.0, 0.5, 0.0, 1.0};
+    double target[] = {1.0};
+    double hiddenLayer[2];
+    double outputLayer[1];
+    double hiddenLayerBias[2] = {0.1, 0.2};
+    double outputLayerBias[1] = {0.3};
+    int inputIndex[4];
+
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+    assert(numActiveInputs == 2 && inputIndex[0] == 1 && inputIndex[1] == 3);
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numOutputs, sizeof(double)) + arena_vector_bytes(numHiddenNodes, sizeof(double)));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double *deltaOutput = arena_alloc_vector(&arena, numOutputs);
+    double *deltaHidden = arena_alloc_vector(&arena, numHiddenNodes);
+
+    for (int i = 0; i < numInputs; i++)
+    {
+        hiddenWeights[i][0] = 0.1 * (i + 1);
+        hiddenWeights[i][1] = -0.1 * (i + 1);
+    }
+    outputWeights[0][0] = 0.5;
+    outputWeights[1][0] = 0.6;
+
+    forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.0, true, &mask);
+    assert(fabs(hiddenLayer[0] - sigmoid(0.1 + 0.5 * 0.2 + 1.0 * 0.4)) < 1e-12);
+
+    backpropagation_sequential(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+    assert(hiddenWeights[0][0] == 0.1 * 1 && hiddenWeights[2][1] == -0.1 * 3);
+    assert(hiddenWeights[1][0] != 0.1 * 2 && hiddenWeights[3][1] != -0.1 * 4);
+
+    arena_destroy(&arena);
+
+    printf("test_sparse_inputs passed.\n");
+}
+
 /**
  * @brief Tests the apply_dropout function.
  *
@@ -410,6 +484,2038 @@ static void test_apply_dropout()
     printf("test_apply_dropout passed.\n");
 }
 
+/**
+ * @brief Tests the arena allocator.
+ *
+ * Verifies that vectors and matrices allocated from the arena are zero-initialized,
+ * aligned to a cache line and that the rows of a matrix are stored in one block.
+ */
+static void test_arena()
+{
+    int rows = 5, cols = 3;
+    struct arena arena;
+    arena_create(&arena, arena_vector_bytes(cols, sizeof(double)) + arena_matrix_bytes(rows, cols));
+
+    double *vector = arena_alloc_vector(&arena, cols);
+    double **matrix = arena_alloc_matrix(&arena, rows, cols);
+
+    assert((size_t)vector % ARENA_ALIGNMENT == 0);
+    for (int j = 0; j < cols; j++)
+    {
+        assert(vector[j] == 0.0);
+    }
+    for (int i = 0; i < rows; i++)
+    {
+        assert((size_t)matrix[i] % ARENA_ALIGNMENT == 0);
+        assert(matrix[i] == matrix[0] + i * (ARENA_ALIGNMENT / sizeof(double)));
+        for (int j = 0; j < cols; j++)
+        {
+            assert(matrix[i][j] == 0.0);
+        }
+    }
+    assert(arena.used <= arena.size);
+    arena_destroy(&arena);
+
+    printf("test_arena passed.\n");
+}
+
+/**
+ * @brief Tests the draw_dropout_mask function.
+ *
+ * Draws a mask with the same seed as apply_dropout and checks that exactly the neurons
+ * kept by apply_dropout are listed. Verifies that a forward pass with this mask produces zeros for the dropped neurons
+ * and that a mask with its own seed does not depend on rand().
+ */
+static void test_draw_dropout_mask()
+{
+    int size = 10;
+    double layer[10];
+    uint64_t bits[1];
+    int active[10];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+    double dropout_rate = 0.3;
+
+    for (int i = 0; i < size; i++)
+    {
+        layer[i] = 1.0;
+    }
+
+    srand(42);
+    apply_dropout(layer, size, dropout_rate);
+    srand(42);
+    draw_dropout_mask(&mask, size, dropout_rate);
+
+    int a = 0;
+    for (int i = 0; i < size; i++)
+    {
+        if (layer[i] != 0.0)
+        {
+            assert(a < mask.numActive && mask.active[a] == i);
+            a++;
+        }
+        assert(dropout_mask_keeps(&mask, i) == (layer[i] != 0.0));
+    }
+    assert(a == mask.numActive);
+    assert(fabs(mask.scale - 1.0 / (1.0 - dropout_rate)) < 1e-12);
+
+    // A mask with its own seed repeats its draws no matter what else draws from rand()
+    uint64_t seededBits[2][1];
+    int seededActive[2][10];
+    unsigned seeds[2] = {9, 9};
+    struct dropout_mask seeded[2] = {{seededBits[0], seededActive[0], 0, 1.0, &seeds[0]}, {seededBits[1], seededActive[1], 0, 1.0, &seeds[1]}};
+    srand(1);
+    draw_dropout_mask(&seeded[0], size, 0.5);
+    srand(2);
+    rand();
+    draw_dropout_mask(&seeded[1], size, 0.5);
+    assert(seededBits[0][0] == seededBits[1][0] && seeded[0].numActive == seeded[1].numActive && seeds[0] == seeds[1]);
+
+    int numInputs = 2, numHiddenNodes = 10, numOutputs = 1;
+    double inputs[] = {0.5, 0.5};
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    double hiddenLayer[10];
+    double outputLayer[1];
+    double hiddenLayerBias[10] = {0};
+    double outputLayerBias[1] = {0};
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+
+    srand(42);
+    forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, dropout_rate, true, &mask);
+    for (int i = 0; i < size; i++)
+    {
+        assert(layer[i] == 0.0 ? hiddenLayer[i] == 0.0 : fabs(hiddenLayer[i] - 0.5 * mask.scale) < 1e-12);
+    }
+    arena_destroy(&arena);
+
+    printf("test_draw_dropout_mask passed.\n");
+}
+
+/**
+ * @brief Tests the forward pass in inference mode.
+ *
+ * Verifies that a forward pass with training set to false draws no random numbers,
+ * keeps every neuron and leaves the hidden activations unscaled even with a dropout rate.
+ */
+static void test_forward_pass_inference()
+{
+    int numInputs = 2, numHiddenNodes = 2, numOutputs = 1;
+    double inputs[] = {0.5, 0.5};
+    double hiddenLayer[2];
+    double outputLayer[1];
+    double hiddenLayerBias[2] = {0.1, 0.2};
+    double outputLayerBias[1] = {0.3};
+    int inputIndex[2];
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    uint64_t bits[1];
+    int active[2];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+
+    hiddenWeights[0][0] = 0.1;
+    hiddenWeights[0][1] = 0.2;
+    hiddenWeights[1][0] = 0.3;
+    hiddenWeights[1][1] = 0.4;
+    outputWeights[0][0] = 0.5;
+    outputWeights[1][0] = 0.6;
+
+    srand(7);
+    int expected = rand();
+    srand(7);
+    forward_pass_parallel(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.5, false, &mask);
+    assert(rand() == expected);
+
+    assert(mask.numActive == numHiddenNodes && mask.scale == 1.0);
+    assert(dropout_mask_keeps(&mask, 0) && dropout_mask_keeps(&mask, 1));
+    assert(fabs(hiddenLayer[0] - sigmoid(0.1 + 0.5 * 0.1 + 0.5 * 0.3)) < 1e-12);
+    assert(fabs(hiddenLayer[1] - sigmoid(0.2 + 0.5 * 0.2 + 0.5 * 0.4)) < 1e-12);
+
+    arena_destroy(&arena);
+
+    printf("test_forward_pass_inference passed.\n");
+}
+
+/**
+ * @brief Tests save_model, load_model and the batched forward pass.
+ *
+ * Saves a small model, loads it back and verifies that the parameters survive the round trip.
+ * The batched forward pass of the loaded model has to match a forward pass per sample in inference mode.
+ */
+static void test_save_model()
+{
+    int numInputs = 3, numHiddenNodes = 4, numOutputs = 2, batchSize = 3;
+    const char *path = "out/test_model.bin";
+    double hiddenLayerBias[4] = {0.1, -0.2, 0.3, -0.4};
+    double outputLayerBias[2] = {0.05, -0.05};
+    double inputs[3][3] = {{0.0, 0.5, 1.0}, {0.2, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+    double hiddenLayer[4];
+    double outputLayer[2];
+    int inputIndex[3];
+    uint64_t bits[1];
+    int active[4];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_matrix_bytes(batchSize, numInputs) + arena_matrix_bytes(batchSize, numHiddenNodes) +
+                             arena_matrix_bytes(batchSize, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double **batchInputs = arena_alloc_matrix(&arena, batchSize, numInputs);
+    double **batchHidden = arena_alloc_matrix(&arena, batchSize, numHiddenNodes);
+    double **batchOutputs = arena_alloc_matrix(&arena, batchSize, numOutputs);
+
+    srand(3);
+    initialize_weights(hiddenWeights, numInputs, numHiddenNodes);
+    initialize_weights(outputWeights, numHiddenNodes, numOutputs);
+
+    struct model saved = {numInputs, numHiddenNodes, numOutputs, hiddenWeights, outputWeights, hiddenLayerBias, outputLayerBias};
+    struct model loaded;
+    assert(save_model(path, &saved) == 0);
+    assert(load_model(path, &loaded) == 0);
+    remove(path);
+
+    assert(loaded.numInputs == numInputs && loaded.numHiddenNodes == numHiddenNodes && loaded.numOutputs == numOutputs);
+    for (int i = 0; i < numInputs; i++)
+    {
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            assert(loaded.hiddenWeights[i][j] == hiddenWeights[i][j]);
+        }
+    }
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        assert(loaded.hiddenLayerBias[i] == hiddenLayerBias[i]);
+        for (int j = 0; j < numOutputs; j++)
+        {
+            assert(loaded.outputWeights[i][j] == outputWeights[i][j]);
+        }
+    }
+    assert(loaded.outputLayerBias[0] == outputLayerBias[0] && loaded.outputLayerBias[1] == outputLayerBias[1]);
+
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            batchInputs[b][j] = inputs[b][j];
+        }
+    }
+    forward_pass_batch(batchInputs, batchSize, batchHidden, batchOutputs, loaded.hiddenLayerBias, loaded.outputLayerBias,
+                       loaded.hiddenWeights, loaded.outputWeights, numInputs, numHiddenNodes, numOutputs);
+
+    for (int b = 0; b < batchSize; b++)
+    {
+        int numActiveInputs = build_input_index(inputs[b], numInputs, inputIndex);
+        forward_pass_sequential(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.0, false, &mask);
+        for (int j = 0; j < numOutputs; j++)
+        {
+            assert(fabs(batchOutputs[b][j] - outputLayer[j]) < 1e-12);
+        }
+        assert(predict_label(batchOutputs[b], numOutputs) == predict_label(outputLayer, numOutputs));
+    }
+
+    free_model(&loaded);
+    arena_destroy(&arena);
+
+    printf("test_save_model passed.\n");
+}
+
+/**
+ * @brief Tests accumulate_gradients and apply_gradients.
+ *
+ * Applying the accumulated gradient of one sample with the learning rate has to give the same
+ * weights and biases as backpropagation_sequential.
+ */
+static void test_accumulate_gradients()
+{
+    int numInputs = 3, numHiddenNodes = 4, numOutputs = 2;
+    double inputs[] = {0.5, 0.0, 1.0};
+    double target[] = {1.0, 0.0};
+    double hiddenLayer[4], outputLayer[2], deltaHidden[4], deltaOutput[2];
+    double hiddenLayerBias[4] = {0.1, -0.2, 0.3, -0.4}, outputLayerBias[2] = {0.05, -0.05};
+    double hiddenBiasCopy[4] = {0.1, -0.2, 0.3, -0.4}, outputBiasCopy[2] = {0.05, -0.05};
+    double gradients[GRADIENT_SIZE(3, 4, 2)] = {0};
+    double lr = 0.5;
+    int inputIndex[3];
+    uint64_t bits[1];
+    int active[4];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
+    struct arena arena;
+    arena_create(&arena, 2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    double **hiddenWeightsCopy = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeightsCopy = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+
+    srand(5);
+    initialize_weights(hiddenWeights, numInputs, numHiddenNodes);
+    initialize_weights(outputWeights, numHiddenNodes, numOutputs);
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            hiddenWeightsCopy[j][i] = hiddenWeights[j][i];
+        }
+        for (int j = 0; j < numOutputs; j++)
+        {
+            outputWeightsCopy[i][j] = outputWeights[i][j];
+        }
+    }
+
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+    forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.0, false, &mask);
+    accumulate_gradients(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, outputWeightsCopy, deltaOutput, deltaHidden, gradients, numInputs, numHiddenNodes, numOutputs, &mask);
+    apply_gradients(gradients, lr, hiddenBiasCopy, outputBiasCopy, hiddenWeightsCopy, outputWeightsCopy, numInputs, numHiddenNodes, numOutputs);
+    backpropagation_sequential(inputs, inputIndex, numActiveInputs, target, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, deltaOutput, deltaHidden, lr, numInputs, numHiddenNodes, numOutputs, &mask);
+
+    for (int i = 0; i < numHiddenNodes; i++)
+    {
+        assert(fabs(hiddenBiasCopy[i] - hiddenLayerBias[i]) < 1e-12);
+        for (int j = 0; j < numInputs; j++)
+        {
+            assert(fabs(hiddenWeightsCopy[j][i] - hiddenWeights[j][i]) < 1e-12);
+        }
+        for (int j = 0; j < numOutputs; j++)
+        {
+            assert(fabs(outputWeightsCopy[i][j] - outputWeights[i][j]) < 1e-12);
+        }
+    }
+    assert(fabs(outputBiasCopy[0] - outputLayerBias[0]) < 1e-12 && fabs(outputBiasCopy[1] - outputLayerBias[1]) < 1e-12);
+    arena_destroy(&arena);
+
+    printf("test_accumulate_gradients passed.\n");
+}
+
+/**
+ * @brief Tests the shared-memory ring all-reduce.
+ *
+ * Three processes reduce vectors whose length is not divisible by the number of processes twice in a row.
+ * Every process has to end up with the element-wise sum.
+ */
+static void test_ring_allreduce()
+{
+    int numProcesses = 3;
+    size_t count = 10;
+    double data[10];
+    struct ring ring;
+
+    assert(ring_create(&ring, numProcesses, count) == 0);
+    int rank = ring_fork(&ring);
+    assert(rank >= 0);
+
+    int ok = 1;
+    for (int round = 1; round <= 2; round++)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            data[i] = round * (rank + 1) * 100.0 + i;
+        }
+        ok &= ring_allreduce(&ring, data, count) == 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            // sum over ranks of round * (rank + 1) * 100 + i
+            ok &= data[i] == round * 600.0 + numProcesses * i;
+        }
+    }
+    assert(ring_join(&ring, ok ? 0 : -1) == 0);
+
+    printf("test_ring_allreduce passed.\n");
+}
+
+/**
+ * @brief Tests the im2col and the direct convolution.
+ *
+ * Both forward passes have to match a naive convolution with ReLU on an input with two channels
+ * and an output width that is not a multiple of CONV_BLOCK_WIDTH. Both backward passes have to
+ * produce the same filter, bias and input gradients.
+ */
+static void test_conv2d()
+{
+    int batchSize = 2, inChannels = 2, height = 7, width = 13, outChannels = 3, kernelSize = 3;
+    int outHeight = CONV_OUTPUT_SIZE(height, kernelSize), outWidth = CONV_OUTPUT_SIZE(width, kernelSize);
+    size_t inSize = (size_t)inChannels * height * width, outSize = (size_t)outChannels * outHeight * outWidth;
+    struct conv_layer im2col, direct;
+    struct arena arena;
+
+    arena_create(&arena, 2 * conv_layer_bytes(inChannels, outChannels, kernelSize) +
+                             arena_vector_bytes(batchSize * inSize, sizeof(double)) * 3 +
+                             arena_vector_bytes(batchSize * outSize, sizeof(double)) * 4 +
+                             arena_vector_bytes(inChannels * kernelSize * kernelSize * outHeight * outWidth * (omp_get_max_threads() + 2), sizeof(double)));
+    srand(11);
+    conv_layer_init(&im2col, &arena, inChannels, height, width, outChannels, kernelSize);
+    conv_layer_init(&direct, &arena, inChannels, height, width, outChannels, kernelSize);
+    memcpy(direct.weights, im2col.weights, outChannels * inChannels * kernelSize * kernelSize * sizeof(double));
+    for (int co = 0; co < outChannels; co++)
+    {
+        im2col.bias[co] = direct.bias[co] = 0.1 * co - 0.1;
+    }
+
+    double *input = arena_alloc_vector(&arena, batchSize * inSize);
+    double *inputs[2] = {input, input + inSize};
+    double *outIm2col = arena_alloc_vector(&arena, batchSize * outSize);
+    double *outDirect = arena_alloc_vector(&arena, batchSize * outSize);
+    double *errIm2col = arena_alloc_vector(&arena, batchSize * outSize);
+    double *errDirect = arena_alloc_vector(&arena, batchSize * outSize);
+    double *inErrIm2col = arena_alloc_vector(&arena, batchSize * inSize);
+    double *inErrDirect = arena_alloc_vector(&arena, batchSize * inSize);
+    double *workspace = arena_alloc_vector(&arena, conv2d_workspace_size(&im2col, omp_get_max_threads()));
+
+    for (size_t i = 0; i < batchSize * inSize; i++)
+    {
+        input[i] = (double)rand() / RAND_MAX - 0.3;
+    }
+
+    conv2d_forward_im2col(&im2col, inputs, batchSize, outIm2col, workspace);
+    conv2d_forward_direct(&direct, inputs, batchSize, outDirect);
+
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int co = 0; co < outChannels; co++)
+        {
+            for (int oy = 0; oy < outHeight; oy++)
+            {
+                for (int ox = 0; ox < outWidth; ox++)
+                {
+                    double expected = im2col.bias[co];
+                    for (int c = 0; c < inChannels; c++)
+                    {
+                        for (int ky = 0; ky < kernelSize; ky++)
+                        {
+                            for (int kx = 0; kx < kernelSize; kx++)
+                            {
+                                expected += im2col.weights[((co * inChannels + c) * kernelSize + ky) * kernelSize + kx] *
+                                            inputs[b][(c * height + oy + ky) * width + ox + kx];
+                            }
+                        }
+                    }
+                    expected = expected > 0.0 ? expected : 0.0;
+                    size_t index = b * outSize + (co * outHeight + oy) * outWidth + ox;
+                    assert(fabs(outIm2col[index] - expected) < 1e-12);
+                    assert(fabs(outDirect[index] - expected) < 1e-12);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < batchSize * outSize; i++)
+    {
+        errIm2col[i] = errDirect[i] = (double)rand() / RAND_MAX - 0.5;
+    }
+    conv2d_backward_im2col(&im2col, inputs, batchSize, outIm2col, errIm2col, inErrIm2col, workspace);
+    conv2d_backward_direct(&direct, inputs, batchSize, outDirect, errDirect, inErrDirect);
+
+    for (int i = 0; i < outChannels * inChannels * kernelSize * kernelSize; i++)
+    {
+        assert(fabs(im2col.gradWeights[i] - direct.gradWeights[i]) < 1e-9);
+    }
+    for (int co = 0; co < outChannels; co++)
+    {
+        assert(fabs(im2col.gradBias[co] - direct.gradBias[co]) < 1e-9);
+    }
+    for (size_t i = 0; i < batchSize * inSize; i++)
+    {
+        assert(fabs(inErrIm2col[i] - inErrDirect[i]) < 1e-9);
+    }
+
+    // The first filter weight only sees the top left input of every window
+    double expected = 0.0;
+    for (int b = 0; b < batchSize; b++)
+    {
+        for (int oy = 0; oy < outHeight; oy++)
+        {
+            for (int ox = 0; ox < outWidth; ox++)
+            {
+                expected += errDirect[b * outSize + oy * outWidth + ox] * inputs[b][oy * width + ox];
+            }
+        }
+    }
+    assert(fabs(direct.gradWeights[0] - expected) < 1e-9);
+
+    conv_apply_gradients(&direct, 0.5);
+    assert(direct.gradWeights[0] == 0.0 && direct.gradBias[0] == 0.0);
+    assert(fabs(direct.weights[0] - (im2col.weights[0] + 0.5 * expected)) < 1e-9);
+    arena_destroy(&arena);
+
+    printf("test_conv2d passed.\n");
+}
+
+/**
+ * @brief Tests the max pooling.
+ *
+ * Verifies the maxima of the windows, that incomplete windows are dropped and that the backward pass
+ * routes every error to the maximum of its window.
+ */
+static void test_maxpool()
+{
+    struct pool_layer pool;
+    double input[2 * 5 * 4];
+    double output[2 * 2 * 2];
+    double outputError[2 * 2 * 2] = {1, 2, 3, 4, 5, 6, 7, 8};
+    double inputError[2 * 5 * 4];
+    int argmax[2 * 2 * 2];
+
+    pool_layer_init(&pool, 2, 5, 4, 2);
+    assert(pool.outHeight == 2 && pool.outWidth == 2);
+    for (int i = 0; i < 2 * 5 * 4; i++)
+    {
+        input[i] = (i * 7) % 11;
+    }
+
+    maxpool_forward(&pool, input, 1, output, argmax);
+    for (int c = 0; c < 2; c++)
+    {
+        for (int py = 0; py < 2; py++)
+        {
+            for (int px = 0; px < 2; px++)
+            {
+                int o = (c * 2 + py) * 2 + px;
+                double best = -1.0;
+                for (int dy = 0; dy < 2; dy++)
+                {
+                    for (int dx = 0; dx < 2; dx++)
+                    {
+                        double v = input[(c * 5 + py * 2 + dy) * 4 + px * 2 + dx];
+                        best = v > best ? v : best;
+                    }
+                }
+                assert(output[o] == best && input[argmax[o]] == best);
+                assert(argmax[o] / 20 == c);
+            }
+        }
+    }
+
+    maxpool_backward(&pool, outputError, argmax, 1, inputError);
+    double sum = 0.0;
+    for (int i = 0; i < 2 * 5 * 4; i++)
+    {
+        sum += inputError[i];
+    }
+    assert(sum == 36.0);
+    for (int o = 0; o < 8; o++)
+    {
+        assert(inputError[argmax[o]] == outputError[o]);
+    }
+
+    printf("test_maxpool passed.\n");
+}
+
+/**
+ * @brief Tests the unstructured and the block pruning.
+ *
+ * Verifies that exactly the requested fraction of weights or 4x4 blocks is zero, that the smallest
+ * magnitudes are removed first and the cubic pruning schedule.
+ */
+static void test_prune_weights()
+{
+    int rows = 10, cols = 7;
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(rows, cols));
+    double **weights = arena_alloc_matrix(&arena, rows, cols);
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            weights[i][j] = ((i * cols + j) % 2 ? -1.0 : 1.0) * (i * cols + j + 1);
+        }
+    }
+    double threshold = prune_weights(weights, rows, cols, 0.5);
+    assert(threshold == 35.0);
+    assert(fabs(weight_sparsity(weights, rows, cols) - 0.5) < 1e-12);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            assert((weights[i][j] == 0.0) == (i * cols + j < 35));
+        }
+    }
+
+    // 3 x 2 blocks, the blocks of the last block row only have 2 rows and the last block column 3 columns
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            weights[i][j] = 1.0 + (i / 4) * 2 + j / 4;
+        }
+    }
+    prune_weight_blocks(weights, rows, cols, 0.5);
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = 0; j < cols; j++)
+        {
+            // Norms: 4, 2*sqrt(12), 3*4, 4*sqrt(12), 5*sqrt(8), 6*sqrt(6)
+            assert((weights[i][j] == 0.0) == (i < 4 || (i < 8 && j < 4)));
+        }
+    }
+
+    assert(pruning_schedule(0.8, 0, 10) == 0.0);
+    assert(fabs(pruning_schedule(0.8, 10, 10) - 0.8) < 1e-12);
+    assert(fabs(pruning_schedule(0.8, 5, 10) - 0.7) < 1e-12);
+
+    arena_destroy(&arena);
+
+    printf("test_prune_weights passed.\n");
+}
+
+/**
+ * @brief Tests the CSR and the block-sparse forward pass.
+ *
+ * Both sparse formats of pruned hidden weights have to produce the same activations as the dense
+ * forward pass in inference mode, also with zero inputs and sizes that are no multiple of the block size.
+ */
+static void test_forward_pass_sparse()
+{
+    int numInputs = 11, numHiddenNodes = 6, numOutputs = 3;
+    double inputs[11] = {0.0, 0.5, 1.0, 0.0, 0.0, 0.0, 0.0, 0.25, 0.0, 0.75, 1.0};
+    double hiddenLayerBias[6] = {0.1, -0.2, 0.3, -0.4, 0.5, -0.6};
+    double outputLayerBias[3] = {0.05, -0.05, 0.1};
+    double hiddenLayer[6], outputLayer[3];
+    double sparseHidden[6], sparseOutput[3];
+    int inputIndex[11];
+    uint64_t bits[1];
+    int active[6];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+    struct sparse_matrix sparse;
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs));
+    double **hiddenWeights = arena_alloc_matrix(&arena, numInputs, numHiddenNodes);
+    double **outputWeights = arena_alloc_matrix(&arena, numHiddenNodes, numOutputs);
+    int numActiveInputs = build_input_index(inputs, numInputs, inputIndex);
+
+    for (enum sparse_format format = SPARSE_CSR; format <= SPARSE_BLOCK; format++)
+    {
+        for (int i = 0; i < numInputs; i++)
+        {
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                hiddenWeights[i][j] = sin(i * numHiddenNodes + j + 1);
+            }
+        }
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            for (int j = 0; j < numOutputs; j++)
+            {
+                outputWeights[i][j] = cos(i * numOutputs + j);
+            }
+        }
+        if (format == SPARSE_CSR)
+        {
+            prune_weights(hiddenWeights, numInputs, numHiddenNodes, 0.6);
+        }
+        else
+        {
+            prune_weight_blocks(hiddenWeights, numInputs, numHiddenNodes, 0.5);
+        }
+
+        sparse_from_dense(&sparse, hiddenWeights, numInputs, numHiddenNodes, format);
+        assert(sparse.numStored == (format == SPARSE_CSR ? numInputs * numHiddenNodes - 40 : 3));
+        forward_pass_sequential(inputs, inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias, outputLayerBias, hiddenWeights, outputWeights, numInputs, numHiddenNodes, numOutputs, 0.0, false, &mask);
+        forward_pass_sparse(&sparse, inputs, inputIndex, numActiveInputs, sparseHidden, sparseOutput, hiddenLayerBias, outputLayerBias, outputWeights, numHiddenNodes, numOutputs);
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            assert(fabs(sparseHidden[i] - hiddenLayer[i]) < 1e-12);
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            assert(fabs(sparseOutput[i] - outputLayer[i]) < 1e-12);
+        }
+        free_sparse(&sparse);
+    }
+
+    arena_destroy(&arena);
+
+    printf("test_forward_pass_sparse passed.\n");
+}
+
+/**
+ * @brief Tests parsing the configurations of a sweep.
+ *
+ * Missing parameters have to be taken from the defaults, invalid keys, values, empty and too many configurations are rejected.
+ */
+static void test_parse_sweep()
+{
+    struct sweep_config defaults = {32, 0.01, 0.0};
+    struct sweep_config configs[3];
+
+    assert(parse_sweep("h=64;l=0.5,d=0.25;h=8,l=0.1,d=0.1", &defaults, configs, 3) == 3);
+    assert(configs[0].numHiddenNodes == 64 && configs[0].learningRate == 0.01 && configs[0].dropoutRate == 0.0);
+    assert(configs[1].numHiddenNodes == 32 && configs[1].learningRate == 0.5 && configs[1].dropoutRate == 0.25);
+    assert(configs[2].numHiddenNodes == 8 && configs[2].learningRate == 0.1 && configs[2].dropoutRate == 0.1);
+
+    assert(parse_sweep("h=16;", &defaults, configs, 3) == 1);
+    assert(parse_sweep("h=32;;", &defaults, configs, 3) == -1);
+    assert(parse_sweep(";h=32", &defaults, configs, 3) == -1);
+    assert(parse_sweep("h=32;;h=16", &defaults, configs, 3) == -1);
+    assert(parse_sweep("h=1;h=2;h=3;h=4", &defaults, configs, 3) == -1);
+    assert(parse_sweep("x=3", &defaults, configs, 3) == -1);
+    assert(parse_sweep("h=abc", &defaults, configs, 3) == -1);
+    assert(parse_sweep("h=0", &defaults, configs, 3) == -1);
+    assert(parse_sweep("d=1.0", &defaults, configs, 3) == -1);
+
+    printf("test_parse_sweep passed.\n");
+}
+
+/**
+ * @brief Tests the deterministic mode.
+ *
+ * Trains a few samples with the sequential, parallel (several thread counts) and SIMD kernels in the
+ * deterministic mode. Activations and weights have to be bitwise identical to the sequential kernels.
+ */
+static void test_deterministic()
+{
+    int numInputs = 53, numHiddenNodes = 21, numOutputs = 10, numSamples = 4;
+    int numRuns = 4;
+    double inputs[4][53], target[4][10];
+    double hiddenLayer[21], outputLayer[10], deltaHidden[21], deltaOutput[10];
+    double referenceOutput[4][10];
+    int inputIndex[53];
+    uint64_t bits[1];
+    int active[21];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
+    struct arena arena;
+    arena_create(&arena, 2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             4 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 4 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **hiddenWeights[2] = {arena_alloc_matrix(&arena, numInputs, numHiddenNodes), arena_alloc_matrix(&arena, numInputs, numHiddenNodes)};
+    double **outputWeights[2] = {arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_matrix(&arena, numHiddenNodes, numOutputs)};
+    double *hiddenLayerBias[2] = {arena_alloc_vector(&arena, numHiddenNodes), arena_alloc_vector(&arena, numHiddenNodes)};
+    double *outputLayerBias[2] = {arena_alloc_vector(&arena, numOutputs), arena_alloc_vector(&arena, numOutputs)};
+
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j * 7 + b) % 3 == 0 ? 0.0 : sin(j + b * numInputs);
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            target[b][i] = i == b ? 1.0 : 0.0;
+        }
+    }
+
+    int numThreads = omp_get_max_threads();
+    set_deterministic(true);
+    // Run 0: sequential, 1: parallel with 1 thread, 2: parallel with 3 threads, 3: SIMD with 4 threads
+    for (int run = 0; run < numRuns; run++)
+    {
+        int r = run == 0 ? 0 : 1;
+        omp_set_num_threads(run < 2 ? 1 : run + 1);
+        for (int j = 0; j < numInputs; j++)
+        {
+            for (int i = 0; i < numHiddenNodes; i++)
+            {
+                hiddenWeights[r][j][i] = cos(j * numHiddenNodes + i) / 4.0;
+            }
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            hiddenLayerBias[r][j] = sin(j) / 10.0;
+            for (int i = 0; i < numOutputs; i++)
+            {
+                outputWeights[r][j][i] = sin(j * numOutputs + i) / 2.0;
+            }
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            outputLayerBias[r][i] = cos(i) / 10.0;
+        }
+
+        srand(DETERMINISTIC_SEED);
+        for (int b = 0; b < numSamples; b++)
+        {
+            int numActiveInputs = build_input_index(inputs[b], numInputs, inputIndex);
+            if (run == 0)
+            {
+                forward_pass_sequential(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], numInputs, numHiddenNodes, numOutputs, 0.3, true, &mask);
+                memcpy(referenceOutput[b], outputLayer, sizeof(outputLayer));
+                backpropagation_sequential(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+            }
+            else if (run < 3)
+            {
+                forward_pass_parallel(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], numInputs, numHiddenNodes, numOutputs, 0.3, true, &mask);
+                assert(memcmp(referenceOutput[b], outputLayer, sizeof(outputLayer)) == 0);
+                backpropagation_parallel(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+            }
+            else
+            {
+                forward_pass_simd(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], numInputs, numHiddenNodes, numOutputs, 0.3, true, &mask);
+                assert(memcmp(referenceOutput[b], outputLayer, sizeof(outputLayer)) == 0);
+                backpropagation_simd(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[r], outputLayerBias[r], hiddenWeights[r], outputWeights[r], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+            }
+        }
+
+        if (run > 0)
+        {
+            for (int j = 0; j < numInputs; j++)
+            {
+                assert(memcmp(hiddenWeights[0][j], hiddenWeights[1][j], numHiddenNodes * sizeof(double)) == 0);
+            }
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                assert(memcmp(outputWeights[0][j], outputWeights[1][j], numOutputs * sizeof(double)) == 0);
+            }
+            assert(memcmp(hiddenLayerBias[0], hiddenLayerBias[1], numHiddenNodes * sizeof(double)) == 0);
+            assert(memcmp(outputLayerBias[0], outputLayerBias[1], numOutputs * sizeof(double)) == 0);
+        }
+    }
+    set_deterministic(false);
+    omp_set_num_threads(numThreads);
+
+    arena_destroy(&arena);
+
+    printf("test_deterministic passed.\n");
+}
+
+/**
+ * @brief Test the kernels specialized for a shape against the generic SIMD kernels.
+ *
+ * Trains two copies of a 784-64-10 network on the same samples with dropout, one with the generic and one
+ * with the specialized kernels, and compares the outputs and parameters. Shapes without specialized kernels and
+ * the deterministic mode have to fall back to the generic kernels.
+ */
+static void test_specialized_kernels()
+{
+    int numInputs = 784, numHiddenNodes = 64, numOutputs = 10, numSamples = 3;
+    double inputs[3][784], target[3][10];
+    double hiddenLayer[64], outputLayer[10], referenceOutput[10], deltaHidden[64], deltaOutput[10];
+    int inputIndex[784];
+    uint64_t bits[1];
+    int active[64];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+
+    struct arena arena;
+    arena_create(&arena, 2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 2 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **hiddenWeights[2] = {arena_alloc_matrix(&arena, numInputs, numHiddenNodes), arena_alloc_matrix(&arena, numInputs, numHiddenNodes)};
+    double **outputWeights[2] = {arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_matrix(&arena, numHiddenNodes, numOutputs)};
+    double *hiddenLayerBias[2] = {arena_alloc_vector(&arena, numHiddenNodes), arena_alloc_vector(&arena, numHiddenNodes)};
+    double *outputLayerBias[2] = {arena_alloc_vector(&arena, numOutputs), arena_alloc_vector(&arena, numOutputs)};
+
+    const struct specialized_kernels *kernels = find_specialized_kernels(numInputs, numHiddenNodes, numOutputs, hiddenWeights[1], outputWeights[1]);
+    if (kernels == NULL)
+    {
+        // 784-64-10 was removed from SPECIALIZED_SHAPES
+        arena_destroy(&arena);
+        printf("test_specialized_kernels skipped.\n");
+        return;
+    }
+    assert(find_specialized_kernels(numInputs, numHiddenNodes + 1, numOutputs, hiddenWeights[1], outputWeights[1]) == NULL);
+    set_deterministic(true);
+    assert(find_specialized_kernels(numInputs, numHiddenNodes, numOutputs, hiddenWeights[1], outputWeights[1]) == NULL);
+    set_deterministic(false);
+
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j * 5 + b) % 4 == 0 ? sin(j + b * numInputs) : 0.0;
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            target[b][i] = i == b ? 1.0 : 0.0;
+        }
+    }
+    for (int r = 0; r < 2; r++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            for (int i = 0; i < numHiddenNodes; i++)
+            {
+                hiddenWeights[r][j][i] = cos(j * numHiddenNodes + i) / 8.0;
+            }
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            hiddenLayerBias[r][j] = sin(j) / 10.0;
+            for (int i = 0; i < numOutputs; i++)
+            {
+                outputWeights[r][j][i] = sin(j * numOutputs + i) / 2.0;
+            }
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            outputLayerBias[r][i] = cos(i) / 10.0;
+        }
+    }
+
+    for (int b = 0; b < numSamples; b++)
+    {
+        int numActiveInputs = build_input_index(inputs[b], numInputs, inputIndex);
+
+        srand(b);
+        forward_pass_simd(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[0], outputLayerBias[0], hiddenWeights[0], outputWeights[0], numInputs, numHiddenNodes, numOutputs, 0.25, true, &mask);
+        memcpy(referenceOutput, outputLayer, sizeof(outputLayer));
+        backpropagation_simd(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[0], outputLayerBias[0], hiddenWeights[0], outputWeights[0], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+
+        srand(b);
+        kernels->forward(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[1], outputLayerBias[1], hiddenWeights[1], outputWeights[1], numInputs, numHiddenNodes, numOutputs, 0.25, true, &mask);
+        for (int i = 0; i < numOutputs; i++)
+        {
+            assert(fabs(outputLayer[i] - referenceOutput[i]) < 1e-12);
+        }
+        kernels->backward(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[1], outputLayerBias[1], hiddenWeights[1], outputWeights[1], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+    }
+
+    for (int j = 0; j < numInputs; j++)
+    {
+        for (int i = 0; i < numHiddenNodes; i++)
+        {
+            assert(fabs(hiddenWeights[0][j][i] - hiddenWeights[1][j][i]) < 1e-12);
+        }
+    }
+    for (int j = 0; j < numHiddenNodes; j++)
+    {
+        assert(fabs(hiddenLayerBias[0][j] - hiddenLayerBias[1][j]) < 1e-12);
+        for (int i = 0; i < numOutputs; i++)
+        {
+            assert(fabs(outputWeights[0][j][i] - outputWeights[1][j][i]) < 1e-12);
+        }
+    }
+    for (int i = 0; i < numOutputs; i++)
+    {
+        assert(fabs(outputLayerBias[0][i] - outputLayerBias[1][i]) < 1e-12);
+    }
+
+    arena_destroy(&arena);
+
+    printf("test_specialized_kernels passed.\n");
+}
+
+/**
+ * @brief Test writing and mapping the cache of the training data.
+ *
+ * The mapped rows have to match the written ones. A cache with too few samples
+ * or with changed source files must not be mapped.
+ */
+static void test_dataset_cache()
+{
+    const char *imagePath = "out/test_images.idx", *labelPath = "out/test_labels.idx", *path = "out/test_dataset.cache";
+    int numSets = 5, numInputs = 13, numOutputs = 3;
+    struct dataset_cache cache = {NULL, 0, NULL, NULL};
+
+    FILE *file = fopen(imagePath, "wb");
+    fputs("images", file);
+    fclose(file);
+    file = fopen(labelPath, "wb");
+    fputs("labels", file);
+    fclose(file);
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSets, numInputs) + arena_matrix_bytes(numSets, numOutputs) +
+                             2 * arena_vector_bytes(numSets, sizeof(double *)));
+    double **inputs = arena_alloc_matrix(&arena, numSets, numInputs);
+    double **outputs = arena_alloc_matrix(&arena, numSets, numOutputs);
+    for (int i = 0; i < numSets; i++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[i][j] = (i * numInputs + j) / 255.0;
+        }
+        outputs[i][i % numOutputs] = 1.0;
+    }
+
+    remove(path);
+    assert(write_dataset_cache(path, imagePath, labelPath, inputs, outputs, numSets, numInputs, numOutputs) == 0);
+    assert(map_dataset_cache(path, imagePath, labelPath, numSets + 1, numInputs, numOutputs, &cache) == -1);
+    assert(map_dataset_cache(path, imagePath, labelPath, numSets, numInputs + 1, numOutputs, &cache) == -1);
+
+    assert(map_dataset_cache(path, imagePath, labelPath, numSets - 1, numInputs, numOutputs, &cache) == 0);
+    double **mappedInputs = arena_alloc_rows(&arena, cache.inputs, numSets, numInputs);
+    double **mappedOutputs = arena_alloc_rows(&arena, cache.outputs, numSets, numOutputs);
+    for (int i = 0; i < numSets; i++)
+    {
+        assert(((uintptr_t)mappedInputs[i] & (ARENA_ALIGNMENT - 1)) == 0);
+        assert(memcmp(mappedInputs[i], inputs[i], numInputs * sizeof(double)) == 0);
+        assert(memcmp(mappedOutputs[i], outputs[i], numOutputs * sizeof(double)) == 0);
+    }
+    unmap_dataset_cache(&cache);
+
+    // A changed source file invalidates the cache
+    file = fopen(labelPath, "ab");
+    fputs("changed", file);
+    fclose(file);
+    assert(map_dataset_cache(path, imagePath, labelPath, numSets, numInputs, numOutputs, &cache) == -1);
+
+    remove(path);
+    remove(imagePath);
+    remove(labelPath);
+    arena_destroy(&arena);
+
+    printf("test_dataset_cache passed.\n");
+}
+
+/**
+ * @brief Test the augmentation of the training images.
+ *
+ * Without transformations an image is copied exactly. The augmented batches do not depend on the number
+ * of threads and the batches prepared in the background match the ones augmented directly.
+ */
+static void test_augment()
+{
+    int side = 12, numInputs = 144, numSets = AUGMENT_BATCH + 40;
+    struct augment_config config = {0.0, 0.0, 0.0, 0.0, side, side};
+    double image[144];
+
+    assert(parse_augment("s=2,r=10,a=0.1,e=1.5", &config) == 0);
+    assert(config.shift == 2.0 && config.rotate == 10.0 && config.affine == 0.1 && config.elastic == 1.5 && config.width == side);
+    assert(parse_augment("s=2,x=1", &config) == -1);
+    assert(parse_augment("r=-1", &config) == -1);
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSets, numInputs) + 2 * arena_matrix_bytes(AUGMENT_BATCH, numInputs));
+    double **inputs = arena_alloc_matrix(&arena, numSets, numInputs);
+    double **batch[2] = {arena_alloc_matrix(&arena, AUGMENT_BATCH, numInputs), arena_alloc_matrix(&arena, AUGMENT_BATCH, numInputs)};
+    for (int i = 0; i < numSets; i++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[i][j] = fabs(sin(i * numInputs + j));
+        }
+    }
+
+    struct augment_config identity = {0.0, 0.0, 0.0, 0.0, side, side};
+    augment_image(&identity, inputs[0], image, 42);
+    for (int j = 0; j < numInputs; j++)
+    {
+        assert(fabs(image[j] - inputs[0][j]) < 1e-12);
+    }
+
+    // A transformed image stays inside [0, 1] and changes
+    augment_image(&config, inputs[0], image, 42);
+    double change = 0.0;
+    for (int j = 0; j < numInputs; j++)
+    {
+        assert(image[j] >= -1e-12 && image[j] <= 1.0 + 1e-12);
+        change += fabs(image[j] - inputs[0][j]);
+    }
+    assert(change > 0.0);
+
+    augment_batch(&config, inputs, 0, AUGMENT_BATCH, batch[0], 7, 1, 1);
+    augment_batch(&config, inputs, 0, AUGMENT_BATCH, batch[1], 7, 1, 3);
+    for (int b = 0; b < AUGMENT_BATCH; b++)
+    {
+        assert(memcmp(batch[0][b], batch[1][b], numInputs * sizeof(double)) == 0);
+    }
+
+    // Epoch 0 is augmented directly, the following batches are prepared in the background
+    struct augmenter augmenter;
+    augmenter_create(&augmenter, &config, inputs, numSets, 2, 7, 2);
+    for (int epoch = 0; epoch < 2; epoch++)
+    {
+        for (int first = 0; first < numSets; first += AUGMENT_BATCH)
+        {
+            int count = numSets - first < AUGMENT_BATCH ? numSets - first : AUGMENT_BATCH;
+            double **next = augmenter_next(&augmenter, epoch, first);
+            augment_batch(&config, inputs, first, count, batch[0], 7, epoch, 1);
+            for (int b = 0; b < count; b++)
+            {
+                assert(memcmp(next[b], batch[0][b], numInputs * sizeof(double)) == 0);
+            }
+        }
+    }
+    augmenter_destroy(&augmenter);
+    arena_destroy(&arena);
+
+    printf("test_augment passed.\n");
+}
+
+/**
+ * @brief Nested loop of test_ws_scheduler.
+ */
+struct nested_count
+{
+    struct ws_pool *pool;
+    atomic_int *counts;
+};
+
+/**
+ * @brief Loop body of test_ws_scheduler: counts the iterations of the inner loop.
+ */
+static void count_inner(void *context, int begin, int end)
+{
+    atomic_int *counts = context;
+    for (int i = begin; i < end; i++)
+    {
+        atomic_fetch_add(&counts[i], 1);
+    }
+}
+
+/**
+ * @brief Loop body of test_ws_scheduler: every outer iteration runs an inner loop on the same pool.
+ */
+static void count_outer(void *context, int begin, int end)
+{
+    struct nested_count *nested = context;
+    for (int o = begin; o < end; o++)
+    {
+        ws_parallel_for(nested->pool, 100, 3, count_inner, nested->counts + o * 100);
+    }
+}
+
+/**
+ * @brief Second outside thread of test_ws_scheduler: runs a loop while the first one is blocked in its loop.
+ */
+static void *outside_loop_main(void *arg)
+{
+    struct nested_count *nested = arg;
+    ws_parallel_for(nested->pool, 100, 3, count_inner, nested->counts);
+    atomic_store(&nested->counts[100], 1);
+    return NULL;
+}
+
+/**
+ * @brief Loop body of test_ws_scheduler: blocks until the loop of the second outside thread is done.
+ */
+static void wait_for_outside_loop(void *context, int begin, int end)
+{
+    atomic_int *done = context;
+    (void)begin;
+    (void)end;
+    while (atomic_load(done) == 0)
+    {
+        sched_yield();
+    }
+}
+
+/**
+ * @brief Test the work-stealing scheduler and its kernels.
+ *
+ * A nested parallel loop has to run every iteration exactly once. Loops of two outside threads have to run
+ * concurrently: the loop of the first thread waits for the loop of the second one. On an uneven 50-37-10 network the
+ * work-stealing kernels have to compute bitwise the same outputs and parameters as the OpenMP kernels
+ * (the summation order of a neuron does not depend on the scheduler), the batch kernel the same as forward_pass_batch.
+ */
+static void test_ws_scheduler()
+{
+    int numInputs = 50, numHiddenNodes = 37, numOutputs = 10, numSamples = 5;
+    double inputs[5][50], target[5][10];
+    double hiddenLayer[37], outputLayer[10], referenceOutput[10], deltaHidden[37], deltaOutput[10];
+    int inputIndex[50];
+    uint64_t bits[1];
+    int active[37];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+    static atomic_int counts[16 * 100];
+    struct ws_pool pool;
+
+    ws_pool_create(&pool, 3);
+    struct nested_count nested = {&pool, counts};
+    ws_parallel_for(&pool, 16, 1, count_outer, &nested);
+    for (int i = 0; i < 16 * 100; i++)
+    {
+        assert(atomic_load(&counts[i]) == 1);
+    }
+
+    static atomic_int outsideCounts[101];
+    struct nested_count outsideLoop = {&pool, outsideCounts};
+    pthread_t outsideThread;
+    assert(pthread_create(&outsideThread, NULL, outside_loop_main, &outsideLoop) == 0);
+    ws_parallel_for(&pool, 1, 1, wait_for_outside_loop, &outsideCounts[100]);
+    pthread_join(outsideThread, NULL);
+    for (int i = 0; i < 100; i++)
+    {
+        assert(atomic_load(&outsideCounts[i]) == 1);
+    }
+
+    struct arena arena;
+    arena_create(&arena, 2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 2 * arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_matrix_bytes(numSamples, numInputs) + 2 * arena_matrix_bytes(numSamples, numHiddenNodes) +
+                             2 * arena_matrix_bytes(numSamples, numOutputs));
+    double **hiddenWeights[2] = {arena_alloc_matrix(&arena, numInputs, numHiddenNodes), arena_alloc_matrix(&arena, numInputs, numHiddenNodes)};
+    double **outputWeights[2] = {arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_matrix(&arena, numHiddenNodes, numOutputs)};
+    double *hiddenLayerBias[2] = {arena_alloc_vector(&arena, numHiddenNodes), arena_alloc_vector(&arena, numHiddenNodes)};
+    double *outputLayerBias[2] = {arena_alloc_vector(&arena, numOutputs), arena_alloc_vector(&arena, numOutputs)};
+    double **batchInputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    double **batchHidden[2] = {arena_alloc_matrix(&arena, numSamples, numHiddenNodes), arena_alloc_matrix(&arena, numSamples, numHiddenNodes)};
+    double **batchOutput[2] = {arena_alloc_matrix(&arena, numSamples, numOutputs), arena_alloc_matrix(&arena, numSamples, numOutputs)};
+
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = batchInputs[b][j] = (j * 3 + b) % 4 == 0 ? sin(j + b * numInputs) : 0.0;
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            target[b][i] = i == b ? 1.0 : 0.0;
+        }
+    }
+    for (int r = 0; r < 2; r++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            for (int i = 0; i < numHiddenNodes; i++)
+            {
+                hiddenWeights[r][j][i] = cos(j * numHiddenNodes + i) / 4.0;
+            }
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            hiddenLayerBias[r][j] = sin(j) / 10.0;
+            for (int i = 0; i < numOutputs; i++)
+            {
+                outputWeights[r][j][i] = sin(j * numOutputs + i) / 2.0;
+            }
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            outputLayerBias[r][i] = cos(i) / 10.0;
+        }
+    }
+
+    forward_pass_batch(batchInputs, numSamples, batchHidden[0], batchOutput[0], hiddenLayerBias[0], outputLayerBias[0],
+                       hiddenWeights[0], outputWeights[0], numInputs, numHiddenNodes, numOutputs);
+    set_scheduler_pool(&pool);
+    forward_pass_batch_ws(batchInputs, numSamples, batchHidden[1], batchOutput[1], hiddenLayerBias[0], outputLayerBias[0],
+                          hiddenWeights[0], outputWeights[0], numInputs, numHiddenNodes, numOutputs);
+    for (int b = 0; b < numSamples; b++)
+    {
+        assert(memcmp(batchOutput[0][b], batchOutput[1][b], numOutputs * sizeof(double)) == 0);
+    }
+
+    for (int b = 0; b < numSamples; b++)
+    {
+        int numActiveInputs = build_input_index(inputs[b], numInputs, inputIndex);
+
+        srand(b);
+        forward_pass_parallel(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[0], outputLayerBias[0], hiddenWeights[0], outputWeights[0], numInputs, numHiddenNodes, numOutputs, 0.25, true, &mask);
+        memcpy(referenceOutput, outputLayer, sizeof(outputLayer));
+        backpropagation_parallel(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[0], outputLayerBias[0], hiddenWeights[0], outputWeights[0], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+
+        srand(b);
+        forward_pass_ws(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, hiddenLayerBias[1], outputLayerBias[1], hiddenWeights[1], outputWeights[1], numInputs, numHiddenNodes, numOutputs, 0.25, true, &mask);
+        assert(memcmp(outputLayer, referenceOutput, sizeof(outputLayer)) == 0);
+        backpropagation_ws(inputs[b], inputIndex, numActiveInputs, target[b], hiddenLayer, outputLayer, hiddenLayerBias[1], outputLayerBias[1], hiddenWeights[1], outputWeights[1], deltaOutput, deltaHidden, 0.1, numInputs, numHiddenNodes, numOutputs, &mask);
+    }
+    set_scheduler_pool(NULL);
+
+    for (int j = 0; j < numInputs; j++)
+    {
+        assert(memcmp(hiddenWeights[0][j], hiddenWeights[1][j], numHiddenNodes * sizeof(double)) == 0);
+    }
+    for (int j = 0; j < numHiddenNodes; j++)
+    {
+        assert(memcmp(outputWeights[0][j], outputWeights[1][j], numOutputs * sizeof(double)) == 0);
+    }
+    assert(memcmp(hiddenLayerBias[0], hiddenLayerBias[1], numHiddenNodes * sizeof(double)) == 0);
+    assert(memcmp(outputLayerBias[0], outputLayerBias[1], numOutputs * sizeof(double)) == 0);
+
+    arena_destroy(&arena);
+    ws_pool_destroy(&pool);
+    printf("test_ws_scheduler passed.\n");
+}
+
+/**
+ * @brief Producer of test_pipeline: pushes 0 .. 9999 into a queue.
+ */
+static void *push_numbers(void *arg)
+{
+    struct spsc_queue *queue = arg;
+    for (int i = 0; i < 10000; i++)
+    {
+        while (!spsc_push(queue, i))
+        {
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Test the lock-free queue and the layer-pipelined training.
+ *
+ * The queue has to deliver the items of another thread in order and reject pushes when it is full.
+ * The pipeline has a fixed schedule, so training a small network with 1 and with 3 threads has to give
+ * bitwise identical weights.
+ */
+static void test_pipeline()
+{
+    struct spsc_queue queue;
+    pthread_t producer;
+    int item;
+
+    spsc_init(&queue);
+    assert(!spsc_pop(&queue, &item));
+    for (int i = 0; i < SPSC_QUEUE_CAPACITY; i++)
+    {
+        assert(spsc_push(&queue, i));
+    }
+    assert(!spsc_push(&queue, SPSC_QUEUE_CAPACITY));
+    for (int i = 0; i < SPSC_QUEUE_CAPACITY; i++)
+    {
+        assert(spsc_pop(&queue, &item) && item == i);
+    }
+    pthread_create(&producer, NULL, push_numbers, &queue);
+    for (int i = 0; i < 10000; i++)
+    {
+        while (!spsc_pop(&queue, &item))
+        {
+        }
+        assert(item == i);
+    }
+    pthread_join(producer, NULL);
+
+    int numInputs = 20, numHiddenNodes = 12, numOutputs = 3, numSamples = 50;
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSamples, numInputs) + arena_matrix_bytes(numSamples, numOutputs) +
+                             2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 2 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **inputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    double **outputs = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    struct model models[2];
+    for (int r = 0; r < 2; r++)
+    {
+        models[r] = (struct model){numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                                   arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                                   arena_alloc_vector(&arena, numOutputs)};
+        for (int j = 0; j < numInputs; j++)
+        {
+            for (int i = 0; i < numHiddenNodes; i++)
+            {
+                models[r].hiddenWeights[j][i] = cos(j * numHiddenNodes + i) / 4.0;
+            }
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            for (int i = 0; i < numOutputs; i++)
+            {
+                models[r].outputWeights[j][i] = sin(j * numOutputs + i) / 2.0;
+            }
+        }
+    }
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j + b) % 3 == 0 ? fabs(sin(j + b * numInputs)) : 0.0;
+        }
+        outputs[b][b % numOutputs] = 1.0;
+    }
+
+    for (int r = 0; r < 2; r++)
+    {
+        struct pipeline_config config = {8, r == 0 ? 1 : 3};
+        srand(7);
+        assert(train_pipeline(&config, &models[r], inputs, outputs, numSamples, 3, 0.1, 0.2) == 0);
+    }
+    for (int j = 0; j < numInputs; j++)
+    {
+        assert(memcmp(models[0].hiddenWeights[j], models[1].hiddenWeights[j], numHiddenNodes * sizeof(double)) == 0);
+    }
+    for (int j = 0; j < numHiddenNodes; j++)
+    {
+        assert(memcmp(models[0].outputWeights[j], models[1].outputWeights[j], numOutputs * sizeof(double)) == 0);
+    }
+    assert(memcmp(models[0].hiddenLayerBias, models[1].hiddenLayerBias, numHiddenNodes * sizeof(double)) == 0);
+    assert(memcmp(models[0].outputLayerBias, models[1].outputLayerBias, numOutputs * sizeof(double)) == 0);
+
+    struct pipeline_config invalid = {0, 1};
+    assert(train_pipeline(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+
+    arena_destroy(&arena);
+    printf("test_pipeline passed.\n");
+}
+
+/**
+ * @brief Test the ring buffer between the training loop and the dashboard (without the observer thread).
+ *
+ * Publishing has to clear the request, write complete entries with even sequence numbers and wrap around the ring.
+ */
+static void test_dashboard()
+{
+    static struct dashboard dashboard;
+    double image[4] = {0.0, 0.25, 0.5, 1.0};
+    double outputs[3] = {0.1, 0.7, 0.2};
+
+    for (int e = 0; e < DASHBOARD_RING_SIZE; e++)
+    {
+        atomic_init(&dashboard.ring[e].sequence, 0);
+    }
+    atomic_init(&dashboard.published, 0);
+    atomic_init(&dashboard.requested, true);
+    dashboard.numInputs = 4;
+    dashboard.numTrainingSets = 100;
+    dashboard.epochs = 2;
+
+    assert(dashboard_wants_sample(&dashboard));
+    dashboard_publish(&dashboard, 0, 41, image, 1, outputs, 3, 0.5, 30);
+    assert(!dashboard_wants_sample(&dashboard));
+    assert(atomic_load(&dashboard.published) == 1);
+    assert(atomic_load(&dashboard.ring[0].sequence) == 2);
+
+    struct dashboard_sample *sample = &dashboard.ring[0].sample;
+    assert(sample->epoch == 0 && sample->index == 41 && sample->expected == 1);
+    assert(sample->predicted == 1 && sample->confidence == 0.7);
+    assert(sample->loss == 0.5 && sample->correct == 30 && !sample->epochDone);
+    assert(memcmp(sample->pixels, image, sizeof(image)) == 0);
+
+    dashboard_publish_epoch(&dashboard, 0, 0.25, 90);
+    sample = &dashboard.ring[1].sample;
+    assert(sample->epochDone && sample->index == 99 && sample->correct == 90 && sample->loss == 0.25);
+
+    // The ring overwrites the oldest entries
+    for (int p = 2; p <= DASHBOARD_RING_SIZE; p++)
+    {
+        dashboard_publish(&dashboard, 1, p, image, 2, outputs, 3, 0.1, p);
+    }
+    assert(atomic_load(&dashboard.published) == DASHBOARD_RING_SIZE + 1);
+    assert(atomic_load(&dashboard.ring[0].sequence) == 2 * DASHBOARD_RING_SIZE + 2);
+    assert(dashboard.ring[0].sample.index == DASHBOARD_RING_SIZE);
+
+    printf("test_dashboard passed.\n");
+}
+
+/**
+ * @brief Test the 16 bit conversions and the mixed-precision training.
+ *
+ * The conversions have to round to nearest even, keep NaN and overflow fp16 to infinity. The training has a fixed
+ * order of all sums and updates, so training with 1 and with 3 threads has to give bitwise identical weights.
+ */
+static void test_mixed_precision()
+{
+    enum precision precision;
+
+    assert(float_to_bf16(1.0f) == 0x3f80 && bf16_to_float(0x3f80) == 1.0f);
+    assert(float_to_bf16(1.0f + 1.0f / 256.0f) == 0x3f80);
+    assert(float_to_bf16(1.0f + 3.0f / 256.0f) == 0x3f82);
+    assert(float_to_bf16(-2.0f) == 0xc000);
+    assert(isnan(bf16_to_float(float_to_bf16(NAN))));
+    assert(float_to_fp16(1.0f) == 0x3c00 && fp16_to_float(0x3c00) == 1.0f);
+    assert(float_to_fp16(65504.0f) == 0x7bff);
+    assert(isinf(fp16_to_float(float_to_fp16(70000.0f))));
+    assert(fp16_to_float(0x0001) == ldexpf(1.0f, -24));
+    assert(parse_precision("bf16", &precision) == 0 && precision == PRECISION_BF16);
+    assert(parse_precision("fp16", &precision) == 0 && precision == PRECISION_FP16);
+    assert(parse_precision("fp64", &precision) == 0 && precision == PRECISION_FP64);
+    assert(parse_precision("fp8", &precision) == -1);
+
+    int numInputs = 21, numHiddenNodes = 12, numOutputs = 3, numSamples = 50;
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSamples, numInputs) + arena_matrix_bytes(numSamples, numOutputs) +
+                             2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 2 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **inputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    double **outputs = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    struct model models[2];
+    for (int r = 0; r < 2; r++)
+    {
+        models[r] = (struct model){numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                                   arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                                   arena_alloc_vector(&arena, numOutputs)};
+    }
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j + b) % 3 == 0 ? fabs(sin(j + b * numInputs)) : 0.0;
+        }
+        outputs[b][b % numOutputs] = 1.0;
+    }
+
+    for (int f = 0; f < 2; f++)
+    {
+        for (int r = 0; r < 2; r++)
+        {
+            struct mixed_config config = {f == 0 ? PRECISION_BF16 : PRECISION_FP16, 8, r == 0 ? 1 : 3};
+            for (int j = 0; j < numInputs; j++)
+            {
+                for (int i = 0; i < numHiddenNodes; i++)
+                {
+                    models[r].hiddenWeights[j][i] = cos(j * numHiddenNodes + i) / 4.0;
+                }
+            }
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                models[r].hiddenLayerBias[j] = 0.0;
+                for (int i = 0; i < numOutputs; i++)
+                {
+                    models[r].outputWeights[j][i] = sin(j * numOutputs + i) / 2.0;
+                }
+            }
+            for (int i = 0; i < numOutputs; i++)
+            {
+                models[r].outputLayerBias[i] = 0.0;
+            }
+            srand(7);
+            assert(train_mixed(&config, &models[r], inputs, outputs, numSamples, 3, 0.1, 0.2) == 0);
+        }
+        for (int j = 0; j < numInputs; j++)
+        {
+            assert(memcmp(models[0].hiddenWeights[j], models[1].hiddenWeights[j], numHiddenNodes * sizeof(double)) == 0);
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            assert(memcmp(models[0].outputWeights[j], models[1].outputWeights[j], numOutputs * sizeof(double)) == 0);
+        }
+        assert(memcmp(models[0].hiddenLayerBias, models[1].hiddenLayerBias, numHiddenNodes * sizeof(double)) == 0);
+        assert(memcmp(models[0].outputLayerBias, models[1].outputLayerBias, numOutputs * sizeof(double)) == 0);
+        assert(models[0].hiddenWeights[0][0] != cos(0.0) / 4.0);
+    }
+
+    struct mixed_config invalid = {PRECISION_FP64, 8, 1};
+    assert(train_mixed(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+    invalid = (struct mixed_config){PRECISION_BF16, 0, 1};
+    assert(train_mixed(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+
+    arena_destroy(&arena);
+    printf("test_mixed_precision passed.\n");
+}
+
+/**
+ * @brief Test the training with layer norm and batch norm.
+ *
+ * Both normalizations sum and update in a fixed order, so training with 1 and with 3 threads has to give bitwise
+ * identical weights (20 hidden nodes: the last block of NORM_LANES nodes is partial). The inputs of the samples
+ * depend on their label, after the training the model with the folded batch norm has to classify all of them.
+ */
+static void test_normalization()
+{
+    enum normalization normalization;
+
+    assert(parse_normalization("layer", &normalization) == 0 && normalization == NORM_LAYER);
+    assert(parse_normalization("batch", &normalization) == 0 && normalization == NORM_BATCH);
+    assert(parse_normalization("none", &normalization) == 0 && normalization == NORM_NONE);
+    assert(parse_normalization("group", &normalization) == -1);
+    assert(strcmp(normalization_name(NORM_BATCH), "batch") == 0);
+
+    int numInputs = 21, numHiddenNodes = 20, numOutputs = 3, numSamples = 50;
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSamples, numInputs) + arena_matrix_bytes(numSamples, numOutputs) +
+                             2 * arena_matrix_bytes(numInputs, numHiddenNodes) + 2 * arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             2 * arena_vector_bytes(numHiddenNodes, sizeof(double)) + 2 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **inputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    double **outputs = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    struct model models[2];
+    for (int r = 0; r < 2; r++)
+    {
+        models[r] = (struct model){numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                                   arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                                   arena_alloc_vector(&arena, numOutputs)};
+    }
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j + b) % 3 == 0 ? fabs(sin(j + b * numInputs)) : 0.0;
+        }
+        outputs[b][b % numOutputs] = 1.0;
+    }
+
+    for (int n = 0; n < 2; n++)
+    {
+        for (int r = 0; r < 2; r++)
+        {
+            struct norm_config config = {n == 0 ? NORM_LAYER : NORM_BATCH, 8, r == 0 ? 1 : 3};
+            for (int j = 0; j < numInputs; j++)
+            {
+                for (int i = 0; i < numHiddenNodes; i++)
+                {
+                    models[r].hiddenWeights[j][i] = cos(j * numHiddenNodes + i) / 4.0;
+                }
+            }
+            for (int j = 0; j < numHiddenNodes; j++)
+            {
+                models[r].hiddenLayerBias[j] = 0.0;
+                for (int i = 0; i < numOutputs; i++)
+                {
+                    models[r].outputWeights[j][i] = sin(j * numOutputs + i) / 2.0;
+                }
+            }
+            for (int i = 0; i < numOutputs; i++)
+            {
+                models[r].outputLayerBias[i] = 0.0;
+            }
+            srand(7);
+            assert(train_normalized(&config, &models[r], inputs, outputs, numSamples, 30, 0.1, 0.1) == 0);
+        }
+        for (int j = 0; j < numInputs; j++)
+        {
+            assert(memcmp(models[0].hiddenWeights[j], models[1].hiddenWeights[j], numHiddenNodes * sizeof(double)) == 0);
+        }
+        for (int j = 0; j < numHiddenNodes; j++)
+        {
+            assert(memcmp(models[0].outputWeights[j], models[1].outputWeights[j], numOutputs * sizeof(double)) == 0);
+        }
+        assert(memcmp(models[0].hiddenLayerBias, models[1].hiddenLayerBias, numHiddenNodes * sizeof(double)) == 0);
+        assert(memcmp(models[0].outputLayerBias, models[1].outputLayerBias, numOutputs * sizeof(double)) == 0);
+        assert(models[0].hiddenWeights[0][0] != cos(0.0) / 4.0);
+    }
+
+    // The folded batch norm is evaluated by the plain forward pass
+    int correct = 0;
+    double hiddenLayer[numHiddenNodes], outputLayer[numOutputs];
+    int inputIndex[numInputs], active[numHiddenNodes];
+    uint64_t bits[DROPOUT_MASK_WORDS(numHiddenNodes)];
+    struct dropout_mask mask = {bits, active, 0, 1.0};
+    for (int b = 0; b < numSamples; b++)
+    {
+        int numActiveInputs = build_input_index(inputs[b], numInputs, inputIndex);
+        forward_pass_sequential(inputs[b], inputIndex, numActiveInputs, hiddenLayer, outputLayer, models[0].hiddenLayerBias,
+                                models[0].outputLayerBias, models[0].hiddenWeights, models[0].outputWeights, numInputs,
+                                numHiddenNodes, numOutputs, 0.0, false, &mask);
+        correct += predict_label(outputLayer, numOutputs) == b % numOutputs;
+    }
+    assert(correct == numSamples);
+
+    struct norm_config invalid = {NORM_NONE, 8, 1};
+    assert(train_normalized(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+    invalid = (struct norm_config){NORM_BATCH, 1, 1};
+    assert(train_normalized(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+    invalid = (struct norm_config){NORM_LAYER, 8, 0};
+    assert(train_normalized(&invalid, &models[0], inputs, outputs, numSamples, 1, 0.1, 0.0) == -1);
+
+    arena_destroy(&arena);
+    printf("test_normalization passed.\n");
+}
+
+/**
+ * @brief Test the confidence-gated cascade of a small and a full model.
+ *
+ * Every image has to get the label of the small model if its top-1 margin reaches the threshold and the label of the
+ * full model otherwise, with a threshold of 0 no image and with a threshold above 1 every image is forwarded.
+ */
+static void test_cascade()
+{
+    const double outputs[] = {0.1, 0.7, 0.4, 0.65};
+    assert(fabs(top1_margin(outputs, 4) - 0.05) < 1e-12);
+    assert(fabs(top1_margin(outputs + 1, 2) - 0.3) < 1e-12);
+
+    int numInputs = 12, numOutputs = 4, numSamples = 20, hidden[2] = {3, 9};
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numSamples, numInputs) + 2 * arena_matrix_bytes(numSamples, numOutputs) +
+                             arena_matrix_bytes(numSamples, hidden[0]) + arena_matrix_bytes(numSamples, hidden[1]) +
+                             arena_matrix_bytes(numInputs, hidden[0]) + arena_matrix_bytes(numInputs, hidden[1]) +
+                             arena_matrix_bytes(hidden[0], numOutputs) + arena_matrix_bytes(hidden[1], numOutputs) +
+                             arena_vector_bytes(hidden[0], sizeof(double)) + arena_vector_bytes(hidden[1], sizeof(double)) +
+                             2 * arena_vector_bytes(numOutputs, sizeof(double)));
+    double **inputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    struct model models[2];
+    double **outputLayers[2];
+    for (int m = 0; m < 2; m++)
+    {
+        int H = hidden[m];
+        models[m] = (struct model){numInputs, H, numOutputs, arena_alloc_matrix(&arena, numInputs, H), arena_alloc_matrix(&arena, H, numOutputs),
+                                   arena_alloc_vector(&arena, H), arena_alloc_vector(&arena, numOutputs)};
+        for (int j = 0; j < numInputs; j++)
+        {
+            for (int i = 0; i < H; i++)
+            {
+                models[m].hiddenWeights[j][i] = sin(j * H + i + m);
+            }
+        }
+        for (int j = 0; j < H; j++)
+        {
+            models[m].hiddenLayerBias[j] = cos(j + m) / 4.0;
+            for (int i = 0; i < numOutputs; i++)
+            {
+                models[m].outputWeights[j][i] = 2.0 * cos(j * numOutputs + i + 3 * m);
+            }
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            models[m].outputLayerBias[i] = sin(i + m) / 4.0;
+        }
+    }
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j + b) % 3 == 0 ? fabs(sin(j + b * numInputs)) : 0.0;
+        }
+    }
+
+    // Reference: both models classify every image
+    for (int m = 0; m < 2; m++)
+    {
+        double **hiddenLayer = arena_alloc_matrix(&arena, numSamples, hidden[m]);
+        outputLayers[m] = arena_alloc_matrix(&arena, numSamples, numOutputs);
+        forward_pass_batch(inputs, numSamples, hiddenLayer, outputLayers[m], models[m].hiddenLayerBias, models[m].outputLayerBias,
+                           models[m].hiddenWeights, models[m].outputWeights, numInputs, hidden[m], numOutputs);
+    }
+
+    // The margin of one image as threshold forwards the images with smaller margins only
+    const double margins[] = {0.0, top1_margin(outputLayers[0][numSamples / 2], numOutputs), 1.5};
+    for (int t = 0; t < 3; t++)
+    {
+        struct cascade cascade;
+        int labels[numSamples];
+        int expectedForwarded = 0;
+        assert(cascade_create(&cascade, &models[0], &models[1], margins[t], numSamples) == 0);
+        int numForwarded = cascade_classify(&cascade, inputs, numSamples, labels);
+        for (int b = 0; b < numSamples; b++)
+        {
+            bool forwarded = top1_margin(outputLayers[0][b], numOutputs) < margins[t];
+            expectedForwarded += forwarded;
+            assert(labels[b] == predict_label(outputLayers[forwarded ? 1 : 0][b], numOutputs));
+        }
+        assert(numForwarded == expectedForwarded);
+        assert(t != 0 || numForwarded == 0);
+        assert(t != 1 || (numForwarded > 0 && numForwarded < numSamples));
+        assert(t != 2 || numForwarded == numSamples);
+        cascade_destroy(&cascade);
+    }
+
+    struct cascade invalid;
+    models[0].numOutputs = numOutputs - 1;
+    assert(cascade_create(&invalid, &models[0], &models[1], 0.5, numSamples) == -1);
+
+    arena_destroy(&arena);
+    printf("test_cascade passed.\n");
+}
+
+/**
+ * @brief Test the teacher logits and the targets of the distillation.
+ *
+ * The sigmoid of the logits computed by the threads in batches (the last batch is partial) has to give the outputs
+ * of the batched forward pass. The targets have to blend the softened teacher outputs and the labels.
+ */
+static void test_distill()
+{
+    int numInputs = 10, numHiddenNodes = 7, numOutputs = 3, numSamples = 2 * DISTILL_BATCH + 5;
+    const char *path = "out/test_teacher.bin";
+    struct arena arena;
+    arena_create(&arena, 2 * arena_matrix_bytes(numSamples, numInputs) + 3 * arena_matrix_bytes(numSamples, numOutputs) +
+                             arena_matrix_bytes(numSamples, numHiddenNodes) + arena_matrix_bytes(numInputs, numHiddenNodes) +
+                             arena_matrix_bytes(numHiddenNodes, numOutputs) + arena_vector_bytes(numHiddenNodes, sizeof(double)) +
+                             arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_vector_bytes((size_t)numSamples * numOutputs, sizeof(float)));
+    double **inputs = arena_alloc_matrix(&arena, numSamples, numInputs);
+    double **outputs = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    double **hiddenLayer = arena_alloc_matrix(&arena, numSamples, numHiddenNodes);
+    double **outputLayer = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    double **targets = arena_alloc_matrix(&arena, numSamples, numOutputs);
+    float *logits = arena_alloc(&arena, (size_t)numSamples * numOutputs * sizeof(float));
+    struct model teacher = {numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                            arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                            arena_alloc_vector(&arena, numOutputs)};
+
+    srand(11);
+    initialize_weights(teacher.hiddenWeights, numInputs, numHiddenNodes);
+    initialize_weights(teacher.outputWeights, numHiddenNodes, numOutputs);
+    initialize_bias(teacher.hiddenLayerBias, numHiddenNodes);
+    initialize_bias(teacher.outputLayerBias, numOutputs);
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            inputs[b][j] = (j + b) % 2 == 0 ? fabs(sin(j + b * numInputs)) : 0.0;
+        }
+        outputs[b][b % numOutputs] = 1.0;
+    }
+
+    int maxThreads = omp_get_max_threads();
+    omp_set_num_threads(3);
+    compute_logits(&teacher, inputs, numSamples, logits);
+    omp_set_num_threads(maxThreads);
+    forward_pass_batch(inputs, numSamples, hiddenLayer, outputLayer, teacher.hiddenLayerBias, teacher.outputLayerBias,
+                       teacher.hiddenWeights, teacher.outputWeights, numInputs, numHiddenNodes, numOutputs);
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int i = 0; i < numOutputs; i++)
+        {
+            assert(fabs(sigmoid(logits[b * numOutputs + i]) - outputLayer[b][i]) < 1e-6);
+        }
+    }
+
+    // Without the cache the teacher is loaded from its file and run again
+    assert(save_model(path, &teacher) == 0);
+    struct distill_config config = {path, 2.0, 0.25, false};
+    assert(distill_targets(&config, inputs, outputs, numSamples, numInputs, numOutputs, targets) == 0);
+    for (int b = 0; b < numSamples; b++)
+    {
+        for (int i = 0; i < numOutputs; i++)
+        {
+            double expected = 0.25 * sigmoid(logits[b * numOutputs + i] / 2.0) + 0.75 * outputs[b][i];
+            assert(fabs(targets[b][i] - expected) < 1e-12);
+        }
+    }
+
+    config.weight = 0.0;
+    assert(distill_targets(&config, inputs, outputs, numSamples, numInputs, numOutputs, targets) == 0);
+    for (int b = 0; b < numSamples; b++)
+    {
+        assert(memcmp(targets[b], outputs[b], numOutputs * sizeof(double)) == 0);
+    }
+
+    assert(distill_targets(&config, inputs, outputs, numSamples, numInputs + 1, numOutputs, targets) == -1);
+    config.temperature = 0.0;
+    assert(distill_targets(&config, inputs, outputs, numSamples, numInputs, numOutputs, targets) == -1);
+    remove(path);
+
+    arena_destroy(&arena);
+    printf("test_distill passed.\n");
+}
+
+/**
+ * @brief Test the export of a model as a C source file.
+ *
+ * The arrays of the generated file are read back with strtod: every weight and bias has to be reproduced exactly and
+ * the rows have to be padded to ARENA_ROW_STRIDE with zeros (5 hidden nodes and 3 outputs are padded to 8).
+ * The file is then compiled with the AOT_FLAGS of the Makefile (AOT_COMMAND) into the stdin classifier, whose labels
+ * of raw images with many zero pixels have to match predict_label of forward_pass_batch.
+ */
+static void test_export()
+{
+    int numInputs = 4, numHiddenNodes = 5, numOutputs = 3;
+    const char *path = "out/test_export.c";
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(double)) + arena_vector_bytes(numOutputs, sizeof(double)));
+    struct model model = {numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                          arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                          arena_alloc_vector(&arena, numOutputs)};
+    // Weights in [-4, 4] from a fixed seed, so that the labels of the compiled classifier depend on the pixels
+    srand(5);
+    for (int j = 0; j < numHiddenNodes; j++)
+    {
+        for (int i = 0; i < numInputs; i++)
+        {
+            model.hiddenWeights[i][j] = (rand() / (double)RAND_MAX - 0.5) * 8.0;
+        }
+        for (int i = 0; i < numOutputs; i++)
+        {
+            model.outputWeights[j][i] = (rand() / (double)RAND_MAX - 0.5) * 8.0;
+        }
+        model.hiddenLayerBias[j] = rand() / (double)RAND_MAX - 0.5;
+    }
+    for (int i = 0; i < numOutputs; i++)
+    {
+        model.outputLayerBias[i] = rand() / (double)RAND_MAX - 0.5;
+    }
+
+    assert(export_model_c(&model, path, EXPORT_DEFAULT_PREFIX) == 0);
+    FILE *file = fopen(path, "r");
+    assert(file != NULL);
+    static char source[65536];
+    size_t length = fread(source, 1, sizeof(source) - 1, file);
+    source[length] = '\0';
+    fclose(file);
+
+    assert(strstr(source, "void mpt_nn_aot_forward(const double input[MPT_NN_AOT_INPUTS], double output[MPT_NN_AOT_OUTPUTS])") != NULL);
+    assert(strstr(source, "int mpt_nn_aot_classify(const unsigned char pixels[MPT_NN_AOT_INPUTS])") != NULL);
+    assert(strstr(source, "#define MPT_NN_AOT_HIDDEN_STRIDE 8") != NULL);
+
+    const char *names[4] = {"hiddenWeights[4][8]", "hiddenLayerBias[8]", "outputWeights[5][8]", "outputLayerBias[8]"};
+    int rows[4] = {numInputs, 1, numHiddenNodes, 1};
+    int cols[4] = {numHiddenNodes, numHiddenNodes, numOutputs, numOutputs};
+    for (int a = 0; a < 4; a++)
+    {
+        char *p = strstr(source, names[a]);
+        assert(p != NULL);
+        p = strchr(p, '{');
+        for (int r = 0; r < rows[a]; r++)
+        {
+            for (int c = 0; c < 8; c++)
+            {
+                while (*p == '{' || *p == ',' || *p == ' ' || *p == '}' || *p == '\n')
+                {
+                    p++;
+                }
+                char *end;
+                double value = strtod(p, &end);
+                assert(end != p);
+                p = end;
+
+                double expected = 0.0;
+                if (c < cols[a])
+                {
+                    const double *row = a == 0 ? model.hiddenWeights[r] : a == 1 ? model.hiddenLayerBias
+                                                                      : a == 2 ? model.outputWeights[r]
+                                                                               : model.outputLayerBias;
+                    expected = row[c];
+                }
+                assert(value == expected);
+            }
+        }
+    }
+
+    // The generated classifier reads the images from a file and prints one label per line
+    const char *binary = "out/test_export";
+    const char *images = "out/test_export.in";
+    int numImages = 64;
+    char command[512];
+    snprintf(command, sizeof(command), "%s -DMPT_NN_AOT_MAIN %s -o %s -lm", AOT_COMMAND, path, binary);
+    assert(system(command) == 0);
+
+    unsigned char pixels[numImages][numInputs];
+    for (int image = 0; image < numImages; image++)
+    {
+        for (int j = 0; j < numInputs; j++)
+        {
+            pixels[image][j] = rand() % 3 == 0 ? 0 : (unsigned char)(rand() % 256);
+        }
+    }
+    file = fopen(images, "wb");
+    assert(file != NULL);
+    assert(fwrite(pixels, numInputs, numImages, file) == (size_t)numImages);
+    fclose(file);
+
+    snprintf(command, sizeof(command), "%s < %s", binary, images);
+    FILE *labels = popen(command, "r");
+    assert(labels != NULL);
+    double input[numInputs], hidden[numHiddenNodes], output[numOutputs];
+    double *inputs[1] = {input}, *hiddenLayer[1] = {hidden}, *outputLayer[1] = {output};
+    int seen[3] = {0};
+    for (int image = 0; image < numImages; image++)
+    {
+        int label;
+        assert(fscanf(labels, "%d", &label) == 1);
+        for (int j = 0; j < numInputs; j++)
+        {
+            input[j] = pixels[image][j] / 255.0;
+        }
+        forward_pass_batch(inputs, 1, hiddenLayer, outputLayer, model.hiddenLayerBias, model.outputLayerBias,
+                           model.hiddenWeights, model.outputWeights, numInputs, numHiddenNodes, numOutputs);
+        assert(label == predict_label(output, numOutputs));
+        seen[label] = 1;
+    }
+    assert(pclose(labels) == 0);
+    assert(seen[0] + seen[1] + seen[2] >= 2);
+    remove(path);
+    remove(binary);
+    remove(images);
+
+    arena_destroy(&arena);
+    printf("test_export passed.\n");
+}
+
+/**
+ * @brief Arguments of the threads of test_server.
+ */
+struct test_server_args
+{
+    const struct server_config *config;
+    const struct model *model;
+    int fd;                      /**< Client socket the images are written to. */
+    const unsigned char *pixels; /**< Images sent by the client. */
+    size_t bytes;                /**< Size of all images in bytes. */
+    int result;                  /**< Result of run_server. */
+};
+
+/**
+ * @brief Runs the server of test_server.
+ */
+static void *test_server_main(void *arg)
+{
+    struct test_server_args *args = arg;
+    args->result = run_server(args->config, args->model);
+    return NULL;
+}
+
+/**
+ * @brief Writes all images of test_server in one stream, while the test thread reads the replies.
+ */
+static void *test_server_writer(void *arg)
+{
+    struct test_server_args *args = arg;
+    for (size_t sent = 0; sent < args->bytes;)
+    {
+        ssize_t n = send(args->fd, args->pixels + sent, args->bytes - sent, MSG_NOSIGNAL);
+        assert(n > 0);
+        sent += n;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Test the inference server with a flood of images on one connection.
+ *
+ * The client sends more than three times SERVER_QUEUE_CAPACITY images of 16 pixels without waiting for replies, so
+ * every read of the server could fill the queue many times over. With one worker the replies have to arrive in order,
+ * one per image, with the label of the batched forward pass.
+ */
+static void test_server()
+{
+    int numInputs = 16, numHiddenNodes = 24, numOutputs = 10, numImages = 3 * SERVER_QUEUE_CAPACITY + 77;
+    char address[64];
+    snprintf(address, sizeof(address), "unix:/tmp/mpt_nn_test_%d.sock", (int)getpid());
+
+    struct arena arena;
+    arena_create(&arena, arena_matrix_bytes(numInputs, numHiddenNodes) + arena_matrix_bytes(numHiddenNodes, numOutputs) +
+                             arena_vector_bytes(numHiddenNodes, sizeof(double)) + arena_vector_bytes(numOutputs, sizeof(double)) +
+                             arena_matrix_bytes(1, numInputs) + arena_matrix_bytes(1, numHiddenNodes) + arena_matrix_bytes(1, numOutputs) +
+                             arena_vector_bytes((size_t)numImages * numInputs, 1));
+    struct model model = {numInputs, numHiddenNodes, numOutputs, arena_alloc_matrix(&arena, numInputs, numHiddenNodes),
+                          arena_alloc_matrix(&arena, numHiddenNodes, numOutputs), arena_alloc_vector(&arena, numHiddenNodes),
+                          arena_alloc_vector(&arena, numOutputs)};
+    double **input = arena_alloc_matrix(&arena, 1, numInputs);
+    double **hiddenLayer = arena_alloc_matrix(&arena, 1, numHiddenNodes);
+    double **outputLayer = arena_alloc_matrix(&arena, 1, numOutputs);
+    unsigned char *pixels = arena_alloc(&arena, (size_t)numImages * numInputs);
+
+    srand(17);
+    initialize_weights(model.hiddenWeights, numInputs, numHiddenNodes);
+    initialize_weights(model.outputWeights, numHiddenNodes, numOutputs);
+    initialize_bias(model.hiddenLayerBias, numHiddenNodes);
+    initialize_bias(model.outputLayerBias, numOutputs);
+    for (size_t k = 0; k < (size_t)numImages * numInputs; k++)
+    {
+        pixels[k] = (unsigned char)(rand() % 256);
+    }
+
+    struct server_config config = {address, 32, 100, 1, 0, false, NULL, 0.0};
+    struct test_server_args args = {&config, &model, -1, pixels, (size_t)numImages * numInputs, -1};
+    pthread_t server, writer;
+    assert(pthread_create(&server, NULL, test_server_main, &args) == 0);
+
+    struct sockaddr_storage addr;
+    socklen_t len;
+    assert(server_address(address, &addr, &len) == 0);
+    for (int attempt = 0; attempt < 1000 && args.fd < 0; attempt++)
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(fd >= 0);
+        if (connect(fd, (struct sockaddr *)&addr, len) == 0)
+        {
+            args.fd = fd;
+        }
+        else
+        {
+            close(fd);
+            usleep(10000);
+        }
+    }
+    assert(args.fd >= 0);
+    assert(pthread_create(&writer, NULL, test_server_writer, &args) == 0);
+
+    for (int image = 0; image < numImages; image++)
+    {
+        struct server_reply reply;
+        for (size_t got = 0; got < sizeof(reply);)
+        {
+            ssize_t n = recv(args.fd, (char *)&reply + got, sizeof(reply) - got, 0);
+            assert(n > 0);
+            got += n;
+        }
+        for (int j = 0; j < numInputs; j++)
+        {
+            input[0][j] = pixels[(size_t)image * numInputs + j] / 255.0;
+        }
+        forward_pass_batch(input, 1, hiddenLayer, outputLayer, model.hiddenLayerBias, model.outputLayerBias,
+                           model.hiddenWeights, model.outputWeights, numInputs, numHiddenNodes, numOutputs);
+        assert(reply.id == (uint32_t)image);
+        assert(reply.label == predict_label(outputLayer[0], numOutputs));
+    }
+
+    pthread_join(writer, NULL);
+    close(args.fd);
+    kill(getpid(), SIGTERM);
+    pthread_join(server, NULL);
+    assert(args.result == 0);
+
+    arena_destroy(&arena);
+    printf("test_server passed.\n");
+}
+
 /**
  * @brief Main function for running all unit tests.
  *
@@ -427,7 +2533,32 @@ int main()
     test_backpropagation();
     test_backpropagation_parallel();
     test_backpropagation_simd();
+    test_sparse_inputs();
     test_apply_dropout();
+    test_draw_dropout_mask();
+    test_forward_pass_inference();
+    test_arena();
+    test_save_model();
+    test_accumulate_gradients();
+    test_ring_allreduce();
+    test_conv2d();
+    test_maxpool();
+    test_prune_weights();
+    test_forward_pass_sparse();
+    test_parse_sweep();
+    test_deterministic();
+    test_specialized_kernels();
+    test_dataset_cache();
+    test_augment();
+    test_ws_scheduler();
+    test_pipeline();
+    test_dashboard();
+    test_mixed_precision();
+    test_normalization();
+    test_cascade();
+    test_distill();
+    test_export();
+    test_server();
     printf("All tests passed.\n");
     return 0;
 }
@@ -0,0 +1,53 @@
+/**
+ * @file mpt_nn_tile.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the helgrind annotations of the tiled OpenMP kernels.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * Helgrind does not see the futex-based barriers of libgomp, these annotations make the ordering of the
+ * tiles visible to it. They are no-ops without the Valgrind headers and cost a few instructions otherwise.
+ * Used by the kernels of mpt_nn.c and by the shape-specialized kernels of mpt_nn_specialized_template.h.
+ */
+#ifndef MPT_NN_TILE_H
+#define MPT_NN_TILE_H
+
+#if defined(__has_include)
+#if __has_include(<valgrind/helgrind.h>)
+#include <valgrind/helgrind.h>
+#endif
+#endif
+#ifndef ANNOTATE_HAPPENS_BEFORE
+#define ANNOTATE_HAPPENS_BEFORE(obj) ((void)(obj))
+#define ANNOTATE_HAPPENS_AFTER(obj) ((void)(obj))
+#endif
+
+/**
+ * @brief Object the annotations of a translation unit synchronize on.
+ */
+static char tileSync __attribute__((unused));
+
+/**
+ * @brief Publishes the writes of the calling thread before a barrier or the end of a parallel region.
+ */
+#define TILE_RELEASE() ANNOTATE_HAPPENS_BEFORE(&tileSync)
+
+/**
+ * @brief Orders the following reads after the writes published by TILE_RELEASE.
+ */
+#define TILE_ACQUIRE() ANNOTATE_HAPPENS_AFTER(&tileSync)
+
+/**
+ * @brief Barrier of the OpenMP team that helgrind sees as well.
+ */
+#define TILE_BARRIER()             \
+    do                             \
+    {                              \
+        TILE_RELEASE();            \
+        _Pragma("omp barrier")     \
+        TILE_ACQUIRE();            \
+    } while (0)
+
+#endif // MPT_NN_TILE_H
@@ -1,12 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include "mpt_nn_utility.h"
+#include "mpt_nn_server.h"
+#include "mpt_nn_distributed.h"
+#include "mpt_nn_dataset.h"
+#include "mpt_nn_dashboard.h"
+#include "mpt_nn_distill.h"
 
 void load_mnist(double **training_inputs, double **training_outputs, int numTrainingSets, int numInputs, int numOutputs)
 {
-    FILE *imageFile = fopen("data/train-images.idx3-ubyte", "rb");
-    FILE *labelFile = fopen("data/train-labels.idx1-ubyte", "rb");
+    FILE *imageFile = fopen(MNIST_IMAGE_PATH, "rb");
+    FILE *labelFile = fopen(MNIST_LABEL_PATH, "rb");
 
     if (imageFile == NULL || labelFile == NULL)
     {
@@ -49,7 +55,7 @@ void load_mnist(double **training_inputs, double **training_outputs, int numTrai
 
 void initialize_weights(double **weights, int rows, int cols)
 {
-    srand((unsigned int)time(NULL));
+    srand(is_deterministic() ? DETERMINISTIC_SEED : (unsigned int)time(NULL));
     for (int i = 0; i < rows; i++)
     {
         for (int j = 0; j < cols; j++)
@@ -61,7 +67,7 @@ void initialize_weights(double **weights, int rows, int cols)
 
 void initialize_bias(double bias[], int size)
 {
-    srand((unsigned int)time(NULL));
+    srand(is_deterministic() ? DETERMINISTIC_SEED : (unsigned int)time(NULL));
     for (int i = 0; i < size; i++)
     {
         bias[i] = (rand() / (double)RAND_MAX) - 0.5;
@@ -97,17 +103,49 @@ void print_options(void)
     printf("\033[1;33mINFO:"
            " If default parameters are not set with -D, options -m, -t, -i, -h, -o, -e and -l are mandatory and require an argument\033[0m\n");
     printf("Available options:\n");
+    printf("  -b, --bind        <policy>             Pin the threads to places [close][spread][master][none]\n");
+    printf("  -c, --conv        <numFilters>         Train a convolutional network: conv (ReLU) -> max pool -> hidden layer -> outputs\n");
     printf("  -d, --dropOut     <dropOutRate>        Set the droput rate[Float between 0.0 - 1.0]\n");
     printf("  -D, --defaultParams                    Set default paramaters for training\n");
     printf("  -e, --epochs      <numEpochs>          Set the number of epochs for training\n");
     printf("  -h, --hidden      <numHiddenNodes>     Set the number of hidden nodes\n");
     printf("  -i, --inputs      <numInputs>          Set the number of input nodes[784 for MNIST]\n");
     printf("  -l, --learning    <learningRate>       Set the learning rate [Float between 0.0 - 1.0]\n");
+    printf("  -M, --model       <file>               Model file served with --serve or the full model of --cascade\n");
     printf("  -m, --mode        <mode>               Set the mode [1: sequential][2: parallel][3: simd]\n");
     printf("  -n, --numThreads  <numThreads>         Set the number of threads to be used while executing a parallel region\n");
     printf("  -o, --outputs     <numOutput>          Set the number of output nodes[10 for MNIST]\n");
+    printf("  -P, --processes   <numProcesses>       Train data-parallel with several processes on shards of the training data\n");
+    printf("  -p, --places      <places>             Set the places used by --bind [threads][cores][sockets][numa][cpu list e.g. 0,2,4-7]\n");
+    printf("  -s, --save        <file>               Save the trained model to a file\n");
+    printf("  -S, --serve       <address>            Serve the model (-M) on a Unix socket or loopback TCP port [unix:/path][tcp:port]\n");
     printf("  -t, --trainsets   <numTrainingSets>    Set the number of training sets[max. 60000 for MNIST]\n");
-    printf("  -v, --visualize                        Enable visualization\n");
+    printf("  -v, --visualize                        Live training dashboard, redrawn by an observer thread every %d ms\n", DASHBOARD_REFRESH_MS);
+    printf("      --max-batch   <size>               Maximum micro-batch size of the server (default %d)\n", SERVER_DEFAULT_MAX_BATCH);
+    printf("      --latency-budget <us>              Time the oldest request may wait for its micro-batch (default %d)\n", SERVER_DEFAULT_LATENCY_US);
+    printf("      --workers     <numWorkers>         Number of server worker threads (default %d)\n", SERVER_DEFAULT_WORKERS);
+    printf("      --batch       <size>               Samples per mini-batch (per process when data-parallel, also for --conv) (default %d)\n", DATA_PARALLEL_DEFAULT_BATCH);
+    printf("      --no-overlap                       Wait for the all-reduce of every mini-batch instead of overlapping it with the next one\n");
+    printf("      --kernel      <size>               Filter size of the convolution (default 5)\n");
+    printf("      --pool        <size>               Window of the max pooling (default 2)\n");
+    printf("      --conv-algorithm <algorithm>       Implementation of the convolution [im2col][direct] (default direct)\n");
+    printf("      --prune       <sparsity>           Prune the hidden weights gradually to this sparsity (0.0 - 1.0)\n");
+    printf("      --prune-blocks                     Prune whole 4x4 blocks instead of single weights\n");
+    printf("      --prune-report                     Report accuracy and sparse inference speedup across sparsity levels\n");
+    printf("      --sweep       <configs>            Train several models on the same data, e.g. \"h=64,l=0.01;h=128,l=0.05,d=0.1\"\n");
+    printf("      --deterministic                    Fixed-order reductions and a fixed seed, all modes and thread counts give identical results\n");
+    printf("      --no-cache                         Parse the IDX files instead of mapping the preprocessed cache (%s)\n", MNIST_CACHE_PATH);
+    printf("      --augment     <transforms>         Train on random variants of the images, e.g. \"s=2,r=10,a=0.1,e=1.5\" (shift, rotation, affine, elastic)\n");
+    printf("      --scheduler   <scheduler>          Scheduler of mode 2 and of the server batches [omp][ws] (default omp), ws steals neuron and sample tasks\n");
+    printf("      --pipeline    <microBatch>         Train the hidden and the output layer as two pipeline stages on micro-batches of this size\n");
+    printf("      --precision   <precision>          Train with 16 bit weights and activations and a fp32 master copy [fp64][bf16][fp16] (default fp64)\n");
+    printf("      --norm        <normalization>      Normalize the hidden layer before the sigmoid, uses --batch [none][layer][batch] (default none)\n");
+    printf("      --cascade     <file>               Small model that classifies first, forwards images with a small margin to -M (report or --serve)\n");
+    printf("      --margin      <margin>             Top-1 margin below which --cascade forwards an image to -M (default %.2f)\n", CASCADE_DEFAULT_MARGIN);
+    printf("      --teacher     <file>               Distill: train against the outputs of this model, the logits are cached in <file>%s\n", DISTILL_CACHE_SUFFIX);
+    printf("      --temperature <temperature>        Temperature of the teacher outputs, sigmoid(logit / temperature) (default %.1f)\n", DISTILL_DEFAULT_TEMPERATURE);
+    printf("      --distill-weight <weight>          Weight of the teacher outputs in the targets, the labels get the rest (default %.1f)\n", DISTILL_DEFAULT_WEIGHT);
+    printf("      --export      <file.c>             Export the trained model (or -M without training) as a standalone C source file\n");
     printf("  -?, --help                             Display this help and exit\n");
 }
 
@@ -126,3 +164,156 @@ void apply_dropout(double *layer, int size, double dropout_rate)
         }
     }
 }
+
+void draw_dropout_mask(struct dropout_mask *mask, int size, double dropout_rate)
+{
+    mask->numActive = 0;
+    mask->scale = 1.0 / (1.0 - dropout_rate);
+    for (int w = 0; w < DROPOUT_MASK_WORDS(size); w++)
+    {
+        mask->bits[w] = 0;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        double random_val = (double)(mask->seed != NULL ? rand_r(mask->seed) : rand()) / RAND_MAX;
+        if (random_val >= dropout_rate)
+        {
+            mask->bits[i / 64] |= (uint64_t)1 << (i % 64);
+            mask->active[mask->numActive++] = i;
+        }
+    }
+}
+
+void keep_all_neurons(struct dropout_mask *mask, int size)
+{
+    mask->numActive = size;
+    mask->scale = 1.0;
+    for (int w = 0; w < DROPOUT_MASK_WORDS(size); w++)
+    {
+        mask->bits[w] = ~(uint64_t)0;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        mask->active[i] = i;
+    }
+}
+
+/**
+ * @brief Magic number at the start of every model file.
+ */
+static const char MODEL_MAGIC[4] = {'M', 'P', 'T', 'N'};
+
+/**
+ * @brief Version of the model file format.
+ */
+#define MODEL_VERSION 1
+
+int save_model(const char *path, const struct model *model)
+{
+    FILE *file = fopen(path, "wb");
+    int32_t header[4] = {MODEL_VERSION, model->numInputs, model->numHiddenNodes, model->numOutputs};
+    int ok;
+
+    if (file == NULL)
+    {
+        perror("Error opening model file");
+        return -1;
+    }
+
+    ok = fwrite(MODEL_MAGIC, sizeof(MODEL_MAGIC), 1, file) == 1 && fwrite(header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < model->numInputs; i++)
+    {
+        ok = fwrite(model->hiddenWeights[i], sizeof(double), model->numHiddenNodes, file) == (size_t)model->numHiddenNodes;
+    }
+    for (int i = 0; ok && i < model->numHiddenNodes; i++)
+    {
+        ok = fwrite(model->outputWeights[i], sizeof(double), model->numOutputs, file) == (size_t)model->numOutputs;
+    }
+    ok = ok && fwrite(model->hiddenLayerBias, sizeof(double), model->numHiddenNodes, file) == (size_t)model->numHiddenNodes;
+    ok = ok && fwrite(model->outputLayerBias, sizeof(double), model->numOutputs, file) == (size_t)model->numOutputs;
+
+    if (fclose(file) != 0 || !ok)
+    {
+        perror("Error writing model file");
+        return -1;
+    }
+    return 0;
+}
+
+int load_model(const char *path, struct model *model)
+{
+    FILE *file = fopen(path, "rb");
+    char magic[4];
+    int32_t header[4];
+    int ok;
+
+    memset(model, 0, sizeof(*model));
+    if (file == NULL)
+    {
+        perror("Error opening model file");
+        return -1;
+    }
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, MODEL_MAGIC, sizeof(magic)) != 0 ||
+        fread(header, sizeof(header), 1, file) != 1 || header[0] != MODEL_VERSION ||
+        header[1] <= 0 || header[2] <= 0 || header[3] <= 0)
+    {
+        fprintf(stderr, "Error reading model file %s: not an mpt_nn model\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    model->numInputs = header[1];
+    model->numHiddenNodes = header[2];
+    model->numOutputs = header[3];
+
+    arena_create(&model->arena, arena_matrix_bytes(model->numInputs, model->numHiddenNodes) +
+                                    arena_matrix_bytes(model->numHiddenNodes, model->numOutputs) +
+                                    arena_vector_bytes(model->numHiddenNodes, sizeof(double)) +
+                                    arena_vector_bytes(model->numOutputs, sizeof(double)));
+    model->hiddenWeights = arena_alloc_matrix(&model->arena, model->numInputs, model->numHiddenNodes);
+    model->outputWeights = arena_alloc_matrix(&model->arena, model->numHiddenNodes, model->numOutputs);
+    model->hiddenLayerBias = arena_alloc_vector(&model->arena, model->numHiddenNodes);
+    model->outputLayerBias = arena_alloc_vector(&model->arena, model->numOutputs);
+
+    ok = 1;
+    for (int i = 0; ok && i < model->numInputs; i++)
+    {
+        ok = fread(model->hiddenWeights[i], sizeof(double), model->numHiddenNodes, file) == (size_t)model->numHiddenNodes;
+    }
+    for (int i = 0; ok && i < model->numHiddenNodes; i++)
+    {
+        ok = fread(model->outputWeights[i], sizeof(double), model->numOutputs, file) == (size_t)model->numOutputs;
+    }
+    ok = ok && fread(model->hiddenLayerBias, sizeof(double), model->numHiddenNodes, file) == (size_t)model->numHiddenNodes;
+    ok = ok && fread(model->outputLayerBias, sizeof(double), model->numOutputs, file) == (size_t)model->numOutputs;
+    fclose(file);
+
+    if (!ok)
+    {
+        fprintf(stderr, "Error reading model file %s: file is truncated\n", path);
+        free_model(model);
+        return -1;
+    }
+    return 0;
+}
+
+void free_model(struct model *model)
+{
+    arena_destroy(&model->arena);
+    memset(model, 0, sizeof(*model));
+}
+
+int predict_label(const double outputLayer[], int numOutputs)
+{
+    int label = 0;
+
+    for (int j = 1; j < numOutputs; j++)
+    {
+        if (outputLayer[j] > outputLayer[label])
+        {
+            label = j;
+        }
+    }
+    return label;
+}
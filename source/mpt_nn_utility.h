@@ -15,7 +15,9 @@
 #ifndef MPT_NN_UTILITY_H
 #define MPT_NN_UTILITY_H
 
+#include <stdint.h>
 #include "mpt_nn.h"
+#include "mpt_nn_arena.h"
 
 /**
  * @brief Loads the MNIST dataset into the mpt_nn input and output arrays.
@@ -92,4 +94,119 @@ void print_options(void);
  */
 void apply_dropout(double *layer, int size, double dropout_rate);
 
+/**
+ * @brief Parameters of a trained mpt_nn.
+ *
+ * Models loaded with load_model own their buffers through the arena, models that only point to
+ * buffers of a training run leave the arena empty.
+ */
+struct model
+{
+    int numInputs;            /**< Number of input nodes. */
+    int numHiddenNodes;       /**< Number of hidden layer nodes. */
+    int numOutputs;           /**< Number of output nodes. */
+    double **hiddenWeights;   /**< Weights between input and hidden layer (numInputs x numHiddenNodes). */
+    double **outputWeights;   /**< Weights between hidden and output layer (numHiddenNodes x numOutputs). */
+    double *hiddenLayerBias;  /**< Biases of the hidden layer. */
+    double *outputLayerBias;  /**< Biases of the output layer. */
+    struct arena arena;       /**< Arena owning the buffers of a loaded model. */
+};
+
+/**
+ * @brief Saves the parameters of a model to a file.
+ *
+ * The file starts with the magic "MPTN", a format version and the layer sizes,
+ * followed by the weights and biases as doubles in host byte order.
+ *
+ * @param path Path of the model file.
+ * @param model Model to save.
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int save_model(const char *path, const struct model *model);
+
+/**
+ * @brief Loads a model saved with save_model.
+ *
+ * All parameters are allocated from one arena owned by the model.
+ *
+ * @param path Path of the model file.
+ * @param model Model to fill. Has to be released with free_model.
+ * @return 0 on success, -1 if the file could not be read or is no model file.
+ */
+int load_model(const char *path, struct model *model);
+
+/**
+ * @brief Releases the buffers of a model loaded with load_model.
+ *
+ * @param model Model to release.
+ */
+void free_model(struct model *model);
+
+/**
+ * @brief Returns the index of the largest output (the predicted label).
+ *
+ * @param outputLayer Activations of the output layer.
+ * @param numOutputs Number of output nodes.
+ * @return int Index of the largest activation.
+ */
+int predict_label(const double outputLayer[], int numOutputs);
+
+/**
+ * @brief Returns the number of 64-bit words needed to store a dropout mask.
+ *
+ * @param size Number of neurons in the layer.
+ */
+#define DROPOUT_MASK_WORDS(size) (((size) + 63) / 64)
+
+/**
+ * @brief Dropout mask of a layer.
+ *
+ * The mask is stored bit-packed (bit i set if neuron i is kept), so it can be kept per sample cheaply
+ * and the backpropagation uses exactly the mask the forward pass was computed with.
+ * Next to the bits the kept neurons are listed compactly, so the forward pass and the backpropagation
+ * only iterate over the kept neurons and skip the dot products, errors and weight updates of the dropped ones.
+ */
+struct dropout_mask
+{
+    uint64_t *bits; /**< Bit-packed mask (capacity: DROPOUT_MASK_WORDS(layer size) words). */
+    int *active;    /**< Indices of the kept neurons in ascending order (capacity: layer size). */
+    int numActive;  /**< Number of kept neurons. */
+    double scale;   /**< Factor applied to the kept neurons: 1 / (1 - dropout_rate). */
+    unsigned *seed; /**< State of rand_r for the draws of this mask, NULL draws with rand(). */
+};
+
+/**
+ * @brief Draws a dropout mask for a layer.
+ *
+ * Uses the same random numbers as apply_dropout: neuron i is dropped if the i-th draw is below the dropout rate.
+ * A mask with its own seed draws with rand_r instead, so masks of concurrently trained models do not share rand().
+ *
+ * @param mask Mask to fill.
+ * @param size Number of neurons in the layer.
+ * @param dropout_rate Probability of dropping a neuron (value between 0.0 and 1.0).
+ */
+void draw_dropout_mask(struct dropout_mask *mask, int size, double dropout_rate);
+
+/**
+ * @brief Sets a mask that keeps every neuron without scaling them.
+ *
+ * Used for inference: no random numbers are drawn and the activations are left unchanged.
+ *
+ * @param mask Mask to fill.
+ * @param size Number of neurons in the layer.
+ */
+void keep_all_neurons(struct dropout_mask *mask, int size);
+
+/**
+ * @brief Checks whether a neuron is kept by a dropout mask.
+ *
+ * @param mask Dropout mask.
+ * @param i Index of the neuron.
+ * @return int 1 if the neuron is kept, 0 if it is dropped.
+ */
+static inline int dropout_mask_keeps(const struct dropout_mask *mask, int i)
+{
+    return (mask->bits[i / 64] >> (i % 64)) & 1;
+}
+
 #endif // MPT_NN_UTILITY_H
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+#include "mpt_nn_ws.h"
+#include "mpt_nn_numa.h"
+
+/**
+ * @brief Failed steal attempts of an idle worker before it goes to sleep.
+ */
+#define WS_IDLE_ROUNDS 64
+
+/**
+ * @brief Worker of the calling thread, NULL outside of the pool.
+ */
+static __thread struct ws_worker *currentWorker;
+
+/**
+ * @brief Pushes a task to the bottom of the own deque.
+ *
+ * @return true if it was pushed, false if the deque is full.
+ */
+static bool push_task(struct ws_worker *worker, const struct ws_task *task)
+{
+    long b = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&worker->top, memory_order_acquire);
+
+    if (b - t >= WS_DEQUE_CAPACITY - 1)
+    {
+        return false;
+    }
+    worker->tasks[b & (WS_DEQUE_CAPACITY - 1)] = *task;
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&worker->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Pops the newest task from the bottom of the own deque.
+ *
+ * @return true if a task was popped.
+ */
+static bool pop_task(struct ws_worker *worker, struct ws_task *task)
+{
+    long b = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&worker->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&worker->top, memory_order_relaxed);
+
+    if (t > b)
+    {
+        atomic_store_explicit(&worker->bottom, b + 1, memory_order_relaxed);
+        return false;
+    }
+    *task = worker->tasks[b & (WS_DEQUE_CAPACITY - 1)];
+    if (t == b)
+    {
+        // Last task: race against the thieves for it
+        bool won = atomic_compare_exchange_strong_explicit(&worker->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+        atomic_store_explicit(&worker->bottom, b + 1, memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+/**
+ * @brief Steals the oldest task from the top of another deque.
+ *
+ * @return true if a task was stolen.
+ */
+static bool steal_task(struct ws_worker *victim, struct ws_task *task)
+{
+    long t = atomic_load_explicit(&victim->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+
+    if (t >= b)
+    {
+        return false;
+    }
+    *task = victim->tasks[t & (WS_DEQUE_CAPACITY - 1)];
+    return atomic_compare_exchange_strong_explicit(&victim->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed);
+}
+
+/**
+ * @brief Wakes the sleeping workers after a task has been pushed.
+ */
+static void wake_workers(struct ws_pool *pool)
+{
+    if (atomic_load_explicit(&pool->sleeping, memory_order_relaxed) > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * @brief Runs a range: the right halves are pushed for thieves until the rest is at most one grain.
+ */
+static void run_task(struct ws_worker *worker, struct ws_task task)
+{
+    bool pushed = false;
+
+    while (task.end - task.begin > task.grain)
+    {
+        struct ws_task right = task;
+        right.begin = task.begin + (task.end - task.begin) / 2;
+        atomic_fetch_add_explicit(task.pending, 1, memory_order_relaxed);
+        if (!push_task(worker, &right))
+        {
+            // Full deque: the right half runs directly after the left one
+            atomic_fetch_sub_explicit(task.pending, 1, memory_order_relaxed);
+            break;
+        }
+        pushed = true;
+        task.end = right.begin;
+    }
+    if (pushed)
+    {
+        wake_workers(worker->pool);
+    }
+    task.body(task.context, task.begin, task.end);
+    atomic_fetch_sub_explicit(task.pending, 1, memory_order_release);
+}
+
+/**
+ * @brief Submits a loop of an outside thread to the injection queue.
+ *
+ * @return true if it was queued, false if the queue is full.
+ */
+static bool inject_task(struct ws_pool *pool, const struct ws_task *task)
+{
+    bool queued = false;
+
+    pthread_mutex_lock(&pool->inject);
+    int count = atomic_load_explicit(&pool->numInjected, memory_order_relaxed);
+    if (count < WS_INJECT_CAPACITY)
+    {
+        pool->injected[(pool->injectHead + count) % WS_INJECT_CAPACITY] = *task;
+        atomic_store_explicit(&pool->numInjected, count + 1, memory_order_release);
+        queued = true;
+    }
+    pthread_mutex_unlock(&pool->inject);
+    return queued;
+}
+
+/**
+ * @brief Takes the oldest loop from the injection queue.
+ *
+ * @return true if a loop was taken.
+ */
+static bool take_injected(struct ws_pool *pool, struct ws_task *task)
+{
+    bool taken = false;
+
+    if (atomic_load_explicit(&pool->numInjected, memory_order_acquire) == 0)
+    {
+        return false;
+    }
+    pthread_mutex_lock(&pool->inject);
+    int count = atomic_load_explicit(&pool->numInjected, memory_order_relaxed);
+    if (count > 0)
+    {
+        *task = pool->injected[pool->injectHead];
+        pool->injectHead = (pool->injectHead + 1) % WS_INJECT_CAPACITY;
+        atomic_store_explicit(&pool->numInjected, count - 1, memory_order_relaxed);
+        taken = true;
+    }
+    pthread_mutex_unlock(&pool->inject);
+    return taken;
+}
+
+/**
+ * @brief Takes a task from the own deque, the injection queue or steals one from a random victim.
+ *
+ * @return true if a task was found.
+ */
+static bool find_task(struct ws_worker *worker, struct ws_task *task)
+{
+    struct ws_pool *pool = worker->pool;
+
+    if (pop_task(worker, task) || take_injected(pool, task))
+    {
+        return true;
+    }
+    int first = pool->numWorkers > 1 ? rand_r(&worker->seed) % pool->numWorkers : 0;
+    for (int v = 0; v < pool->numWorkers; v++)
+    {
+        struct ws_worker *victim = &pool->workers[(first + v) % pool->numWorkers];
+        if (victim != worker && steal_task(victim, task))
+        {
+            worker->steals++;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Checks whether any deque of the pool holds a task.
+ */
+static bool has_tasks(struct ws_pool *pool)
+{
+    if (atomic_load(&pool->numInjected) > 0)
+    {
+        return true;
+    }
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        if (atomic_load(&pool->workers[w].top) < atomic_load(&pool->workers[w].bottom))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Main function of the threads of the pool.
+ *
+ * @param arg The ws_worker.
+ * @return void* Always NULL.
+ */
+static void *worker_main(void *arg)
+{
+    struct ws_worker *worker = arg;
+    struct ws_pool *pool = worker->pool;
+    struct ws_task task;
+    int idle = 0;
+
+    currentWorker = worker;
+    while (!atomic_load(&pool->stop))
+    {
+        if (find_task(worker, &task))
+        {
+            run_task(worker, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < WS_IDLE_ROUNDS)
+        {
+            sched_yield();
+            continue;
+        }
+
+        // Sleep until tasks are pushed, the timeout covers a push between the check and the wait
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        if (!has_tasks(pool) && !atomic_load(&pool->stop))
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 1000000;
+            if (deadline.tv_nsec >= 1000000000)
+            {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_cond_timedwait(&pool->wake, &pool->lock, &deadline);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        pthread_mutex_unlock(&pool->lock);
+        idle = 0;
+    }
+    return NULL;
+}
+
+void ws_pool_create(struct ws_pool *pool, int numWorkers)
+{
+    pool->numWorkers = numWorkers > 0 ? numWorkers : 1;
+    pool->workers = aligned_alloc(64, ((pool->numWorkers * sizeof(struct ws_worker) + 63) / 64) * 64);
+    if (pool->workers == NULL)
+    {
+        perror("Error allocating the work-stealing pool");
+        exit(EXIT_FAILURE);
+    }
+    atomic_init(&pool->stop, false);
+    atomic_init(&pool->sleeping, 0);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_mutex_init(&pool->outside, NULL);
+    pthread_mutex_init(&pool->inject, NULL);
+    atomic_init(&pool->numInjected, 0);
+    pool->injectHead = 0;
+
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        struct ws_worker *worker = &pool->workers[w];
+        atomic_init(&worker->top, 0);
+        atomic_init(&worker->bottom, 0);
+        worker->pool = pool;
+        worker->seed = 2024u + w;
+        worker->steals = 0;
+    }
+    for (int w = 1; w < pool->numWorkers; w++)
+    {
+        create_thread(&pool->workers[w].thread, worker_main, &pool->workers[w]);
+    }
+}
+
+void ws_pool_destroy(struct ws_pool *pool)
+{
+    atomic_store(&pool->stop, true);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    for (int w = 1; w < pool->numWorkers; w++)
+    {
+        pthread_join(pool->workers[w].thread, NULL);
+    }
+    pthread_mutex_destroy(&pool->inject);
+    pthread_mutex_destroy(&pool->outside);
+    pthread_cond_destroy(&pool->wake);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    pool->workers = NULL;
+}
+
+void ws_parallel_for(struct ws_pool *pool, int n, int grain, ws_loop_body body, void *context)
+{
+    struct ws_worker *worker = currentWorker;
+    bool outside = worker == NULL || worker->pool != pool;
+    bool injected = false;
+    atomic_int pending;
+    struct ws_task task = {body, context, 0, n, grain > 0 ? grain : 1, &pending};
+
+    if (n <= 0)
+    {
+        return;
+    }
+    atomic_init(&pending, 1);
+
+    if (outside)
+    {
+        // While another outside thread is worker 0 the loop is handed to the workers through the injection queue.
+        // The thread takes over worker 0 as soon as it is free, so the loop also finishes in a pool without threads
+        bool owner = pthread_mutex_trylock(&pool->outside) == 0;
+        if (!owner && inject_task(pool, &task))
+        {
+            injected = true;
+            wake_workers(pool);
+            while (!owner && atomic_load_explicit(&pending, memory_order_acquire) > 0)
+            {
+                owner = pthread_mutex_trylock(&pool->outside) == 0;
+                if (!owner)
+                {
+                    sched_yield();
+                }
+            }
+            if (!owner)
+            {
+                return;
+            }
+        }
+        else if (!owner)
+        {
+            pthread_mutex_lock(&pool->outside);
+        }
+        worker = &pool->workers[0];
+        currentWorker = worker;
+    }
+
+    if (!injected)
+    {
+        run_task(worker, task);
+    }
+
+    // Help with other tasks (also of other loops) until all ranges of this loop are done
+    while (atomic_load_explicit(&pending, memory_order_acquire) > 0)
+    {
+        if (find_task(worker, &task))
+        {
+            run_task(worker, task);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+
+    if (outside)
+    {
+        currentWorker = NULL;
+        pthread_mutex_unlock(&pool->outside);
+    }
+}
+
+long ws_pool_steals(const struct ws_pool *pool)
+{
+    long steals = 0;
+    for (int w = 0; w < pool->numWorkers; w++)
+    {
+        steals += pool->workers[w].steals;
+    }
+    return steals;
+}
@@ -0,0 +1,127 @@
+/**
+ * @file mpt_nn_ws.h
+ * @authors Marcus Worrmann, Luca Schulz
+ * @brief Header file for the work-stealing task runtime.
+ * @version 1.0
+ * @date 2024-08-30
+ *
+ * @copyright Copyright (c) 2024
+ *
+ * A persistent pool of worker threads, every worker owns a double-ended queue of tasks (Chase-Lev deque).
+ * A parallel loop is split recursively: the owner keeps working on the left half and pushes the right half,
+ * idle workers steal the oldest (largest) tasks from the top of the deques of other workers.
+ * A thread waiting for its loop executes and steals other tasks in the meantime, so loops can be nested:
+ * the tasks of the samples of a batch and the tasks of the neurons of their layers are stolen across each other.
+ * Unlike the static OpenMP schedules, no thread idles while another one still has a large chunk of work.
+ * Threads outside of the pool (e.g. the workers of the inference server) run their loops concurrently: one of them acts
+ * as worker 0, the others hand their loop to the pool through a shared queue and wait for it.
+ */
+#ifndef MPT_NN_WS_H
+#define MPT_NN_WS_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/**
+ * @brief Capacity of the deque of a worker (power of two), a full deque executes new tasks directly.
+ */
+#define WS_DEQUE_CAPACITY 1024
+
+/**
+ * @brief Capacity of the queue of loops submitted by outside threads, a full queue makes them wait for worker 0.
+ */
+#define WS_INJECT_CAPACITY 64
+
+/**
+ * @brief Body of a parallel loop, called for the iterations [begin, end).
+ */
+typedef void (*ws_loop_body)(void *context, int begin, int end);
+
+/**
+ * @brief A range of iterations of a parallel loop.
+ */
+struct ws_task
+{
+    ws_loop_body body;   /**< Body of the loop. */
+    void *context;       /**< Argument of the body. */
+    int begin;           /**< First iteration. */
+    int end;             /**< One past the last iteration. */
+    int grain;           /**< Ranges up to this size are not split. */
+    atomic_int *pending; /**< Unfinished ranges of the loop. */
+};
+
+/**
+ * @brief A worker with its deque, the owner pushes and pops at the bottom, thieves steal at the top.
+ */
+struct ws_worker
+{
+    atomic_long top;                        /**< Next task to steal. */
+    atomic_long bottom;                     /**< Next free slot. */
+    struct ws_task tasks[WS_DEQUE_CAPACITY]; /**< Ring buffer of the deque. */
+    struct ws_pool *pool;                   /**< Pool of the worker. */
+    pthread_t thread;                       /**< Thread of the worker (not used for worker 0). */
+    unsigned int seed;                      /**< State of the random choice of victims. */
+    long steals;                            /**< Tasks stolen by this worker. */
+};
+
+/**
+ * @brief A persistent pool of workers.
+ *
+ * Worker 0 is the thread that calls ws_parallel_for from outside of the pool, the other workers are threads
+ * of the pool. While an outside thread is worker 0, other outside threads push their loops to the injection queue,
+ * from which every worker takes tasks when its own deque is empty.
+ */
+struct ws_pool
+{
+    int numWorkers;             /**< Number of workers including worker 0. */
+    struct ws_worker *workers;  /**< The workers. */
+    atomic_bool stop;           /**< Ends the threads of the pool. */
+    atomic_int sleeping;        /**< Workers waiting for work. */
+    pthread_mutex_t lock;       /**< Protects the sleeping workers. */
+    pthread_cond_t wake;        /**< Wakes sleeping workers when tasks are pushed. */
+    pthread_mutex_t outside;    /**< Held by the outside thread acting as worker 0. */
+    pthread_mutex_t inject;     /**< Protects the injection queue. */
+    atomic_int numInjected;     /**< Loops in the injection queue. */
+    int injectHead;             /**< Oldest loop in the injection queue. */
+    struct ws_task injected[WS_INJECT_CAPACITY]; /**< Ring buffer of the loops submitted by outside threads. */
+};
+
+/**
+ * @brief Creates a pool and starts its threads.
+ *
+ * @param pool Pool to initialize.
+ * @param numWorkers Number of workers including the calling thread (at least 1).
+ */
+void ws_pool_create(struct ws_pool *pool, int numWorkers);
+
+/**
+ * @brief Stops the threads of a pool and releases it.
+ *
+ * @param pool Pool to destroy.
+ */
+void ws_pool_destroy(struct ws_pool *pool);
+
+/**
+ * @brief Runs a parallel loop on the pool and returns when all iterations are done.
+ *
+ * The iterations are split into ranges of at most grain iterations, which may run on any worker.
+ * Can be called from outside of the pool and from inside a body (nested loops).
+ *
+ * @param pool Pool.
+ * @param n Number of iterations.
+ * @param grain Largest range that is not split (at least 1).
+ * @param body Body of the loop.
+ * @param context Argument of the body.
+ */
+void ws_parallel_for(struct ws_pool *pool, int n, int grain, ws_loop_body body, void *context);
+
+/**
+ * @brief Returns the number of tasks stolen in a pool so far.
+ *
+ * @param pool Pool.
+ * @return long Number of stolen tasks.
+ */
+long ws_pool_steals(const struct ws_pool *pool);
+
+#endif // MPT_NN_WS_H